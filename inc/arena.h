@@ -0,0 +1,57 @@
+// arena.h
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator for per-document data. Objects are never freed individually;
+// reset() rewinds the whole arena at once and keeps its chunks for reuse.
+class Arena
+{
+  public:
+    explicit Arena(size_t chunkSize = 64 * 1024);
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    Arena(Arena &&) = default;
+    Arena &operator=(Arena &&) = default;
+
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    // Construct a trivially destructible object inside the arena
+    template <typename T, typename... Args> T *make(Args &&...args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>,
+                      "arena objects are released without running destructors");
+        return new (allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+    }
+
+    // Copy text into the arena and return a view of the copy
+    std::string_view copy(std::string_view text);
+
+    // Release every allocation at once
+    void reset();
+
+    size_t bytesUsed() const;
+
+  private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current{0};
+    size_t offset{0};
+    size_t used{0};
+    size_t chunkSize;
+};
+
+#endif // ARENA_H
@@ -0,0 +1,57 @@
+// batch_converter.h
+#ifndef BATCH_CONVERTER_H
+#define BATCH_CONVERTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "md_converter.h"
+
+struct BatchJob
+{
+    std::string input;
+    std::string output;
+    std::uintmax_t size{0};
+};
+
+struct BatchSummary
+{
+    size_t files{0};
+    size_t failed{0};
+    std::uintmax_t inputBytes{0};
+    std::uintmax_t outputBytes{0};
+    double seconds{0.0};
+    size_t threads{0};
+    // Sum over all files when ConverterOptions::collectStats is set
+    ConversionStats stats;
+};
+
+// Converts many Markdown files on a work-stealing ThreadPool. One shared
+// MarkdownConverter serves every worker, and each worker reuses a
+// ConversionContext of its own.
+class BatchConverter
+{
+  public:
+    // threads == 0 uses one worker per hardware thread
+    explicit BatchConverter(size_t threads = 0, ConverterOptions options = {});
+
+    // Jobs for every .md file below a directory, or for each path listed (one
+    // per line) in a file list. Outputs go next to the inputs, or below
+    // outputDir when it is not empty, at the input's path relative to the
+    // directory or, for a listed path, without its root. The BibTeX of a document with references
+    // is written next to its output, e.g. notes.bib beside notes.tex, unless
+    // ConverterOptions::bibliographyPath is empty.
+    static std::vector<BatchJob> collectJobs(const std::string &source,
+                                             const std::string &outputDir = "");
+
+    // A job whose output another job already writes fails without running
+    BatchSummary run(std::vector<BatchJob> jobs);
+
+  private:
+    size_t threads;
+    ConverterOptions options;
+};
+
+#endif // BATCH_CONVERTER_H
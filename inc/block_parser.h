@@ -0,0 +1,73 @@
+// block_parser.h
+#ifndef BLOCK_PARSER_H
+#define BLOCK_PARSER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "mapped_file.h"
+#include "md_ast.h"
+
+// Line-oriented block parser. Recognises headers, list items, blockquotes,
+// fenced code blocks, paragraphs and blank lines, and stops at the first
+// citation reference line ([^n]: ...), which starts the citation section.
+class BlockParser
+{
+  public:
+    explicit BlockParser(Arena &arena);
+
+    // Parse one line, given without its trailing '\n'
+    void parseLine(std::string_view line);
+
+    // Blocks parsed so far
+    const BlockList &blocks() const;
+
+    // Hand over the blocks parsed so far and start a new list. Parsing state
+    // such as an open code block carries over.
+    BlockList takeBlocks();
+
+    // Forget all parsed blocks and state, e.g. after the arena was reset
+    void reset();
+
+  private:
+    void appendBlock(BlockType type, int level, std::string_view text,
+                     std::string_view info = {});
+
+    Arena &arena;
+    BlockList list;
+
+    bool inCodeBlock{false};
+    bool inCitationSection{false};
+    std::string codeBlockContent;
+    std::string codeBlockLanguage;
+};
+
+// Finds safe split points (see findSafeSplitPoints) one line at a time, so a
+// scan can start at any earlier split point and stop as soon as it has seen
+// enough.
+class SplitScanner
+{
+  public:
+    // Feed the next line; returns true if the document may be cut before it
+    bool feed(std::string_view line);
+
+    // The citation section has started; no further split points follow
+    bool done() const;
+
+  private:
+    bool inCodeBlock{false};
+    bool inList{false};
+    bool inQuote{false};
+    bool inCitationSection{false};
+};
+
+// Indices of the lines at which a document can be cut into pieces that convert
+// independently: blank or header lines outside code blocks, lists and
+// blockquotes, before the citation section. Every environment is closed at
+// such a line, so converting the pieces separately and concatenating the
+// results gives the same output as converting the whole document.
+std::vector<size_t> findSafeSplitPoints(const LineIndex &lines);
+
+#endif // BLOCK_PARSER_H
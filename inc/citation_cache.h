@@ -0,0 +1,404 @@
+#ifndef CITATION_CACHE_H
+#define CITATION_CACHE_H
+
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "paper_cition_api.h"
+
+namespace citation
+{
+
+// Cache configuration
+struct CacheOptions
+{
+    // Cache file; an empty path disables the cache
+    std::string path{".md2latex-citations.msgpack"};
+    // Entries older than this are looked up again; zero keeps them forever
+    std::chrono::seconds ttl{std::chrono::hours(24 * 30)};
+    // Ignore stored entries (but still write fresh ones)
+    bool refresh{false};
+};
+
+inline nlohmann::json paperToJson(const PaperInfo &paper)
+{
+    return {{"title", paper.title},         {"authors", paper.authors},
+            {"journal", paper.journal},     {"volume", paper.volume},
+            {"issue", paper.issue},         {"pages", paper.pages},
+            {"year", paper.year},           {"doi", paper.doi},
+            {"url", paper.url},             {"publisher", paper.publisher},
+            {"abstract", paper.abstract},   {"citation_key", paper.citation_key},
+            {"book_title", paper.book_title}, {"edition", paper.edition},
+            {"isbn", paper.isbn},           {"type", paper.type}};
+}
+
+inline PaperInfo paperFromJson(const nlohmann::json &json)
+{
+    PaperInfo paper;
+    paper.title = json.value("title", "");
+    paper.authors = json.value("authors", std::vector<std::string>());
+    paper.journal = json.value("journal", "");
+    paper.volume = json.value("volume", "");
+    paper.issue = json.value("issue", "");
+    paper.pages = json.value("pages", "");
+    paper.year = json.value("year", "");
+    paper.doi = json.value("doi", "");
+    paper.url = json.value("url", "");
+    paper.publisher = json.value("publisher", "");
+    paper.abstract = json.value("abstract", "");
+    paper.citation_key = json.value("citation_key", "");
+    paper.book_title = json.value("book_title", "");
+    paper.edition = json.value("edition", "");
+    paper.isbn = json.value("isbn", "");
+    paper.type = json.value("type", "article");
+    return paper;
+}
+
+// Persistent cache of citation lookups, keyed by source name and normalized
+// query text, plus the candidate the user picked for each reference. Stored
+// as MessagePack and written back atomically by save(). Safe to use from
+// several threads at once.
+class CitationCache
+{
+  public:
+    explicit CitationCache(CacheOptions options = {}) : options(std::move(options)) { load(); }
+
+    ~CitationCache() { save(); }
+
+    CitationCache(const CitationCache &) = delete;
+    CitationCache &operator=(const CitationCache &) = delete;
+
+    // The cache of options.path, shared by everyone in the process who opens
+    // the same file so that they do not overwrite each other's entries. The
+    // options of the first to open it apply. A disabled cache is not shared.
+    static std::shared_ptr<CitationCache> shared(const CacheOptions &options)
+    {
+        if (options.path.empty())
+        {
+            return std::make_shared<CitationCache>(options);
+        }
+
+        static std::mutex openMutex;
+        static std::map<std::string, std::weak_ptr<CitationCache>> open;
+        std::lock_guard<std::mutex> lock(openMutex);
+        std::weak_ptr<CitationCache> &entry = open[options.path];
+        std::shared_ptr<CitationCache> cache = entry.lock();
+        if (!cache)
+        {
+            cache = std::make_shared<CitationCache>(options);
+            entry = cache;
+        }
+        return cache;
+    }
+
+    // Lowercase, keep letters and digits, collapse everything else to single spaces
+    static std::string normalize(const std::string &text)
+    {
+        std::string normalized;
+        normalized.reserve(text.size());
+        bool pendingSpace = false;
+        for (unsigned char c : text)
+        {
+            if (std::isalnum(c) || c >= 0x80)
+            {
+                if (pendingSpace && !normalized.empty())
+                {
+                    normalized.push_back(' ');
+                }
+                pendingSpace = false;
+                normalized.push_back(static_cast<char>(std::tolower(c)));
+            }
+            else
+            {
+                pendingSpace = true;
+            }
+        }
+        return normalized;
+    }
+
+    bool enabled() const { return !options.path.empty(); }
+
+    // Cached results of source for query, if present and fresh
+    bool lookup(const std::string &source, const std::string &query,
+                std::vector<PaperInfo> &papers) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = results.find(resultKey(source, query));
+        if (it == results.end() || !fresh(it->second.fetched))
+        {
+            return false;
+        }
+        papers = it->second.papers;
+        return true;
+    }
+
+    void store(const std::string &source, const std::string &query,
+               const std::vector<PaperInfo> &papers)
+    {
+        if (!enabled())
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        results[resultKey(source, query)] = {now(), papers};
+        dirty = true;
+    }
+
+    // The candidate previously chosen for a reference text
+    bool lookupSelection(const std::string &reference, PaperInfo &paper) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = selections.find(normalize(reference));
+        if (it == selections.end() || !fresh(it->second.fetched) || it->second.papers.empty())
+        {
+            return false;
+        }
+        paper = it->second.papers.front();
+        return true;
+    }
+
+    void storeSelection(const std::string &reference, const PaperInfo &paper)
+    {
+        if (!enabled())
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        selections[normalize(reference)] = {now(), {paper}};
+        dirty = true;
+    }
+
+    // Drop every entry
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        results.clear();
+        selections.clear();
+        dirty = true;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return results.size() + selections.size();
+    }
+
+    // Write the cache if it changed; returns false on I/O errors
+    bool save()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!enabled() || !dirty)
+        {
+            return true;
+        }
+
+        nlohmann::json json;
+        json["version"] = kFormatVersion;
+        json["results"] = entriesToJson(results);
+        json["selections"] = entriesToJson(selections);
+        std::vector<std::uint8_t> bytes = nlohmann::json::to_msgpack(json);
+
+        try
+        {
+            std::filesystem::path path(options.path);
+            if (path.has_parent_path())
+            {
+                std::filesystem::create_directories(path.parent_path());
+            }
+
+            // Write a temporary file and rename it so readers never see a partial cache
+            std::filesystem::path temp = path;
+            temp += ".tmp";
+            {
+                std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+                file.write(reinterpret_cast<const char *>(bytes.data()),
+                           static_cast<std::streamsize>(bytes.size()));
+                if (!file)
+                {
+                    std::cerr << "Failed to write citation cache: " << temp.string() << "\n";
+                    return false;
+                }
+            }
+            std::filesystem::rename(temp, path);
+            dirty = false;
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error saving citation cache: " << e.what() << "\n";
+            return false;
+        }
+    }
+
+  private:
+    static constexpr int kFormatVersion = 1;
+
+    struct Entry
+    {
+        std::int64_t fetched{0};
+        std::vector<PaperInfo> papers;
+    };
+
+    static std::int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static std::string resultKey(const std::string &source, const std::string &query)
+    {
+        return source + '\x1f' + normalize(query);
+    }
+
+    bool fresh(std::int64_t fetched) const
+    {
+        if (options.refresh)
+        {
+            return false;
+        }
+        return options.ttl.count() == 0 || now() - fetched <= options.ttl.count();
+    }
+
+    static nlohmann::json entriesToJson(const std::map<std::string, Entry> &entries)
+    {
+        nlohmann::json json = nlohmann::json::object();
+        for (const auto &[key, entry] : entries)
+        {
+            nlohmann::json papers = nlohmann::json::array();
+            for (const auto &paper : entry.papers)
+            {
+                papers.push_back(paperToJson(paper));
+            }
+            json[key] = {{"fetched", entry.fetched}, {"papers", std::move(papers)}};
+        }
+        return json;
+    }
+
+    static void entriesFromJson(const nlohmann::json &json, std::map<std::string, Entry> &entries)
+    {
+        for (const auto &[key, value] : json.items())
+        {
+            Entry entry;
+            entry.fetched = value.value("fetched", std::int64_t{0});
+            for (const auto &paper : value.at("papers"))
+            {
+                entry.papers.push_back(paperFromJson(paper));
+            }
+            entries[key] = std::move(entry);
+        }
+    }
+
+    void load()
+    {
+        if (!enabled())
+        {
+            return;
+        }
+
+        std::ifstream file(options.path, std::ios::binary);
+        if (!file)
+        {
+            return;
+        }
+
+        try
+        {
+            // Reading throws when the path is not a file, e.g. a directory
+            std::vector<std::uint8_t> bytes((std::istreambuf_iterator<char>(file)),
+                                            std::istreambuf_iterator<char>());
+            auto json = nlohmann::json::from_msgpack(bytes);
+            if (json.value("version", 0) != kFormatVersion)
+            {
+                return;
+            }
+            entriesFromJson(json.at("results"), results);
+            entriesFromJson(json.at("selections"), selections);
+        }
+        catch (const std::exception &e)
+        {
+            // A damaged cache is discarded and rebuilt
+            std::cerr << "Ignoring unreadable citation cache " << options.path << ": " << e.what()
+                      << "\n";
+            results.clear();
+            selections.clear();
+        }
+    }
+
+    CacheOptions options;
+    // Guards the entries and the file
+    mutable std::mutex mutex;
+    std::map<std::string, Entry> results;
+    std::map<std::string, Entry> selections;
+    bool dirty{false};
+};
+
+// Decorator that answers queries from a CitationCache and records fresh results
+class CachedSource : public CitationSource
+{
+  public:
+    CachedSource(std::unique_ptr<CitationSource> inner, CitationCache &cache)
+        : inner(std::move(inner)), cache(cache)
+    {
+    }
+
+    HttpRequest request(const std::string &query_string) const override
+    {
+        return inner->request(query_string);
+    }
+
+    QueryResult parse(const std::string &response) const override
+    {
+        return inner->parse(response);
+    }
+
+    bool cached(const std::string &query_string, QueryResult &result) override
+    {
+        if (cache.lookup(inner->name(), query_string, result.papers))
+        {
+            result.success = true;
+            return true;
+        }
+        return inner->cached(query_string, result);
+    }
+
+    void store(const std::string &query_string, const QueryResult &result) override
+    {
+        if (!result.success)
+        {
+            return;
+        }
+        cache.store(inner->name(), query_string, result.papers);
+        inner->store(query_string, result);
+    }
+
+    std::string name() const override { return inner->name(); }
+
+    void useSession(CurlSession *curl_session) override
+    {
+        CitationSource::useSession(curl_session);
+        inner->useSession(curl_session);
+    }
+
+    // Results answered from the cache have no raw response
+    void keepRawResponse(bool keep) override { inner->keepRawResponse(keep); }
+
+  private:
+    std::unique_ptr<CitationSource> inner;
+    CitationCache &cache;
+};
+
+} // namespace citation
+
+#endif // CITATION_CACHE_H
@@ -0,0 +1,56 @@
+// citation_ingester.h
+#ifndef CITATION_INGESTER_H
+#define CITATION_INGESTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct IngestSummary
+{
+    size_t files{0};
+    std::uintmax_t inputBytes{0};
+    // Works indexed, and non-empty lines that were not a usable work
+    // (malformed JSON, or neither title nor authors)
+    size_t records{0};
+    size_t skipped{0};
+    std::uintmax_t storeBytes{0};
+    // The whole run, and the part of it spent writing the store
+    double seconds{0.0};
+    double writeSeconds{0.0};
+    size_t threads{0};
+};
+
+// Builds a citation store, the index a citation::LibrarySource searches, from
+// JSONL metadata dumps holding one CrossRef work per line (an item of a
+// /works response). Each dump is mapped and cut at line ends into chunks that
+// are parsed and indexed on a ThreadPool; the chunks are then merged, in
+// input order, into the store.
+class CitationIngester
+{
+  public:
+    // Dumps are cut into chunks of about this size, ending at a line end.
+    // Each chunk becomes one batch of the index: large enough that merging
+    // the word tables of the batches stays cheap, small enough to keep every
+    // worker busy.
+    static constexpr size_t kChunkBytes = 8 << 20;
+
+    // threads == 0 uses one worker per hardware thread
+    explicit CitationIngester(size_t threads = 0, size_t chunkBytes = kChunkBytes);
+
+    // Index dumps into the store at storePath; on failure returns false and
+    // sets error()
+    bool run(const std::vector<std::string> &dumps, const std::string &storePath);
+
+    const IngestSummary &summary() const;
+    const std::string &error() const;
+
+  private:
+    size_t threads;
+    size_t chunkBytes;
+    IngestSummary result;
+    std::string errorMessage;
+};
+
+#endif // CITATION_INGESTER_H
@@ -0,0 +1,346 @@
+#ifndef CITATION_LIBRARY_H
+#define CITATION_LIBRARY_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+#include "paper_cition_api.h"
+
+namespace citation
+{
+
+// Reads the entries of a BibTeX file. @string macros, month names and '#'
+// concatenation are expanded; values keep their LaTeX, braces included, with
+// whitespace collapsed, so they can be written back out unchanged. Malformed
+// fields are skipped rather than failing the file.
+class BibParser
+{
+  public:
+    explicit BibParser(std::string_view text);
+
+    std::vector<PaperInfo> parse();
+
+  private:
+    using Fields = std::vector<std::pair<std::string, std::string>>;
+
+    static bool isNameChar(char c);
+    static std::string lower(std::string_view name);
+
+    // Collapse runs of whitespace to single spaces and trim
+    static std::string collapse(std::string_view value);
+
+    // Names joined by "and" outside braces, so {Barnes and Noble} is one name
+    static std::vector<std::string> splitAuthors(std::string_view value);
+
+    static PaperInfo toPaper(const std::string &type, std::string key, const Fields &fields);
+
+    // Start of the first line after from that begins with '@'
+    size_t nextEntry(size_t from) const;
+
+    void parseEntry(const std::string &type, char close, std::vector<PaperInfo> &papers);
+    void skipSpace();
+    std::string_view readName();
+
+    // Move past the next stop character outside braces, or to the end
+    void skipPast(char stop);
+
+    // Move to the next ',' or close outside braces, after a field that does
+    // not parse
+    void recover(char close);
+
+    // name = value pairs up to and including close
+    Fields readFields(char close);
+
+    // A {braced} or "quoted" string, a number or a macro, or several joined by '#'
+    std::string readValue();
+
+    std::string_view text;
+    size_t pos{0};
+    std::map<std::string, std::string> macros;
+};
+
+// When an index was built from a source file of this size and modification
+// time, it is still up to date
+struct IndexStamp
+{
+    std::int64_t size{-1};
+    std::int64_t modified{0};
+
+    bool operator==(const IndexStamp &other) const
+    {
+        return size == other.size && modified == other.modified;
+    }
+};
+
+// Inverted index over the title, author and year words of a set of papers,
+// stored in a binary format that is used in place once mapped, so opening an
+// index costs the same however many papers it holds. The file is a header,
+// a table of entries, a table of words sorted by text with the range of
+// their postings (entry numbers, ascending), the postings, and a string area
+// holding the words and each paper's fields as length-prefixed strings. All
+// numbers are in the byte order of the machine that built it; an index from
+// a machine of the other order is rejected and rebuilt.
+class LibraryIndex
+{
+  public:
+    // Words of text the index is searched by: lowercase letters and digits
+    // (bytes of UTF-8 sequences included), without LaTeX command names,
+    // stopwords or single characters
+    static std::vector<std::string> tokenize(std::string_view text);
+
+    // Papers to be indexed; see below
+    class Batch;
+
+    // Write an index of the papers of finished batches, the entries of each
+    // batch numbered after those of the batches before it
+    static void write(const std::vector<Batch> &batches, IndexStamp stamp, std::ostream &out);
+
+    // The index as bytes, to be saved or loaded
+    static std::string build(const std::vector<Batch> &batches, IndexStamp stamp = {});
+
+    // Write an index to path atomically, from build() or straight from the
+    // batches of an index too large to hold in memory twice; returns false
+    // on I/O errors
+    static bool save(const std::string &bytes, const std::string &path);
+    static bool save(const std::vector<Batch> &batches, IndexStamp stamp, const std::string &path);
+
+    // Map an index file; on failure returns false and sets error()
+    bool open(const std::string &path);
+
+    // Use an index held in memory, e.g. when it cannot be saved
+    bool load(std::string bytes);
+
+    const std::string &error() const { return errorMessage; }
+
+    IndexStamp stamp() const { return {header.sourceSize, header.sourceModified}; }
+
+    size_t size() const { return header.entries; }
+
+    // An entry and the summed weight of the query words it contains
+    struct Match
+    {
+        std::uint32_t entry;
+        double score;
+    };
+
+    // The at most limit entries sharing the most weight with tokens, best
+    // first; rare words weigh more. Words are taken from the rarest on, each
+    // posting list merged into the matches so far, which are kept sorted by
+    // entry. Only entries containing one of the few rarest words become
+    // matches: a reference that an entry matches well shares most of its
+    // distinctive words. Later lists, and all lists once the words left weigh
+    // too little to lift a new entry into the best limit, only add to
+    // existing matches, and matches that can no longer make it are dropped.
+    std::vector<Match> search(const std::vector<std::string> &tokens, size_t limit) const;
+
+    // Entry i as a paper; empty if the index is damaged there
+    PaperInfo entry(std::uint32_t i) const;
+
+  private:
+    static constexpr char kMagic[8] = {'M', 'D', '2', 'L', 'B', 'I', 'B', 'X'};
+    static constexpr std::uint32_t kFormatVersion = 1;
+    static constexpr std::uint32_t kByteOrder = 0x01020304;
+    // Rarest words of a query whose entries are candidates
+    static constexpr size_t kCandidateWords = 4;
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::int64_t sourceSize;
+        std::int64_t sourceModified;
+        std::uint64_t entries;
+        std::uint64_t tokens;
+        // Offsets of the tables from the start of the file
+        std::uint64_t entryTable;
+        std::uint64_t tokenTable;
+        std::uint64_t postingTable;
+        std::uint64_t stringTable;
+        std::uint64_t fileSize;
+    };
+
+    // A paper's fields, relative to the string area
+    struct EntryRecord
+    {
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    // A word, relative to the string area, and its postings by posting number
+    struct TokenRecord
+    {
+        std::uint64_t text;
+        std::uint32_t length;
+        std::uint32_t count;
+        std::uint64_t postings;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Header> &&
+                      std::is_trivially_copyable_v<EntryRecord> &&
+                      std::is_trivially_copyable_v<TokenRecord>,
+                  "index records are copied as bytes");
+
+    // Fields of a record after the title and the authors, in file order
+    static constexpr std::string PaperInfo::*kRecordFields[] = {
+        &PaperInfo::journal,      &PaperInfo::volume,  &PaperInfo::issue,
+        &PaperInfo::pages,        &PaperInfo::year,    &PaperInfo::doi,
+        &PaperInfo::url,          &PaperInfo::publisher, &PaperInfo::abstract,
+        &PaperInfo::citation_key, &PaperInfo::book_title, &PaperInfo::edition,
+        &PaperInfo::isbn,         &PaperInfo::type};
+
+    static bool isStopword(const std::string &word);
+
+    // Call visit(token) for each word tokenize() would return
+    template <typename Visit> static void forEachToken(std::string_view text, Visit visit);
+
+    // A word of one batch, among the words of all batches being merged
+    struct Part
+    {
+        size_t batch;
+        const TokenRecord *word;
+    };
+
+    // Call visit(text, parts) for each word of the batches in text order,
+    // with its part in every batch containing it, in batch order
+    template <typename Visit>
+    static void forEachWord(const std::vector<Batch> &batches, Visit visit);
+
+    static bool saveWith(const std::string &path,
+                         const std::function<void(std::ostream &)> &write);
+
+    static void writeRaw(std::ostream &out, const void *data, size_t size);
+    static void appendRaw(std::string &bytes, const void *data, size_t size);
+    static void appendString(std::string &bytes, std::string_view text);
+
+    // Authors are joined by the unit separator
+    static void appendRecord(std::string &bytes, const PaperInfo &paper);
+
+    static bool readString(std::string_view &record, std::string &text);
+    static void readRecord(std::string_view record, PaperInfo &paper);
+
+    std::string_view bytes() const
+    {
+        return owned.empty() ? mapped.data() : std::string_view(owned);
+    }
+
+    template <typename Record> Record read(std::uint64_t offset) const
+    {
+        Record record;
+        std::memcpy(&record, bytes().data() + offset, sizeof(Record));
+        return record;
+    }
+
+    std::uint64_t postingCount() const
+    {
+        return (header.stringTable - header.postingTable) / sizeof(std::uint32_t);
+    }
+
+    // Binary search of the word table
+    bool find(std::string_view token, TokenRecord &record) const;
+
+    // Check that the tables lie inside the file, so lookups only need to
+    // check the offsets stored in them
+    bool validate();
+
+    MappedFile mapped;
+    std::string owned;
+    Header header{};
+    std::string errorMessage;
+};
+
+// Papers prepared for a LibraryIndex: their records, and their words with
+// the entries containing them, numbered from 0 within the batch. A large
+// input is split into batches that are filled on different threads and then
+// written as one index.
+class LibraryIndex::Batch
+{
+  public:
+    void add(const PaperInfo &paper);
+
+    // Sort the words into the tables write() reads; called once, after the
+    // last add()
+    void finish();
+
+    size_t size() const { return recordEnds.size(); }
+
+    // Room for records totalling about bytes, e.g. the size of their source
+    void reserve(size_t bytes) { records.reserve(bytes); }
+
+  private:
+    friend class LibraryIndex;
+
+    // Entry containing word, by number of the word in order of first use
+    struct Occurrence
+    {
+        std::uint32_t word;
+        std::uint32_t entry;
+    };
+
+    std::string_view word(const TokenRecord &record) const
+    {
+        return std::string_view(words).substr(record.text, record.length);
+    }
+
+    std::unordered_map<std::string, std::uint32_t> ids;
+    std::vector<std::uint32_t> lastEntry;
+    std::vector<Occurrence> occurrences;
+    std::string records;
+    std::vector<std::uint64_t> recordEnds;
+    std::string words;
+    std::vector<TokenRecord> table;
+    std::vector<std::uint32_t> postings;
+};
+
+// First citation source to consult: BibTeX files the user keeps locally, and
+// stores built from metadata dumps by CitationIngester. Each BibTeX file is
+// indexed on first use into <file>.idx next to it, which later runs map
+// instead of parsing the file again for as long as the file keeps its size
+// and modification time. It never makes a request: every query is answered
+// from the indexes, possibly with no papers.
+class LibrarySource : public CitationSource
+{
+  public:
+    explicit LibrarySource(std::vector<std::string> bibFiles,
+                           std::vector<std::string> stores = {})
+        : bibFiles(std::move(bibFiles)), stores(std::move(stores))
+    {
+    }
+
+    HttpRequest request(const std::string & /*query_string*/) const override { return {}; }
+
+    QueryResult parse(const std::string & /*response*/) const override;
+
+    std::string name() const override { return "Local library"; }
+
+    bool cached(const std::string &query_string, QueryResult &result) override;
+
+    // The entries sharing the most distinctive words with query_string, best first
+    QueryResult search(const std::string &query_string, size_t max_results = 5) const;
+
+  private:
+    void load() const;
+
+    // The index of a .bib file, rebuilt when missing or out of date
+    static bool openBib(const std::string &path, LibraryIndex &index);
+
+    std::vector<std::string> bibFiles;
+    std::vector<std::string> stores;
+    mutable std::once_flag loaded;
+    mutable std::vector<LibraryIndex> indexes;
+};
+
+} // namespace citation
+
+#endif // CITATION_LIBRARY_H
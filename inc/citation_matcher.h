@@ -0,0 +1,255 @@
+#ifndef CITATION_MATCHER_H
+#define CITATION_MATCHER_H
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "paper_cition_api.h"
+
+namespace citation
+{
+
+// A candidate paper and how well it matches a reference, from 0 to 1
+struct RankedCandidate
+{
+    size_t index{0};
+    double score{0.0};
+};
+
+// Ranks PaperInfo candidates against free-form reference text such as
+// "LeCun et al. Deep learning, Nature 2015". The score combines how closely
+// the title matches the reference (by word and by character trigram), whether
+// the authors' surnames appear, and whether the year agrees. Only evidence
+// counts: a candidate without authors or year gets no credit for them, so
+// its title alone has to carry it past the threshold.
+class CitationMatcher
+{
+  public:
+    explicit CitationMatcher(double threshold = 0.7) : threshold(threshold) {}
+
+    // Minimum score at which the best candidate is accepted without asking
+    double getThreshold() const { return threshold; }
+
+    double score(const std::string &reference, const PaperInfo &paper) const
+    {
+        return score(Reference(reference), paper);
+    }
+
+    // Candidates from best to worst; equal scores keep their original order
+    std::vector<RankedCandidate> rank(const std::string &reference,
+                                      const std::vector<PaperInfo> &papers) const
+    {
+        Reference parsed(reference);
+        std::vector<RankedCandidate> ranked;
+        ranked.reserve(papers.size());
+        for (size_t i = 0; i < papers.size(); ++i)
+        {
+            ranked.push_back({i, score(parsed, papers[i])});
+        }
+        std::stable_sort(ranked.begin(), ranked.end(),
+                         [](const RankedCandidate &a, const RankedCandidate &b)
+                         { return a.score > b.score; });
+        return ranked;
+    }
+
+  private:
+    static constexpr double kTitleWeight = 0.6;
+    static constexpr double kAuthorWeight = 0.25;
+    static constexpr double kYearWeight = 0.15;
+
+    // Lowercase alphanumeric words of text; BibTeX case braces as in
+    // "Deep {L}earning" do not split words
+    static std::vector<std::string> tokenize(const std::string &text)
+    {
+        std::vector<std::string> tokens;
+        std::string token;
+        for (unsigned char c : text)
+        {
+            if (c == '{' || c == '}')
+            {
+                continue;
+            }
+            if (std::isalnum(c) || c >= 0x80)
+            {
+                token.push_back(static_cast<char>(std::tolower(c)));
+            }
+            else if (!token.empty())
+            {
+                tokens.push_back(std::move(token));
+                token.clear();
+            }
+        }
+        if (!token.empty())
+        {
+            tokens.push_back(std::move(token));
+        }
+        return tokens;
+    }
+
+    // Character trigrams of the words joined by single spaces
+    static std::unordered_set<std::string> trigrams(const std::vector<std::string> &tokens)
+    {
+        std::string joined;
+        for (const auto &token : tokens)
+        {
+            joined += ' ' + token;
+        }
+        joined += ' ';
+
+        std::unordered_set<std::string> grams;
+        for (size_t i = 0; i + 3 <= joined.size(); ++i)
+        {
+            grams.insert(joined.substr(i, 3));
+        }
+        return grams;
+    }
+
+    static bool isYear(const std::string &token)
+    {
+        if (token.size() != 4 || (token.compare(0, 2, "19") != 0 && token.compare(0, 2, "20") != 0))
+        {
+            return false;
+        }
+        return std::all_of(token.begin(), token.end(),
+                           [](unsigned char c) { return std::isdigit(c); });
+    }
+
+    // Words of a reference that are never part of what it cites
+    static bool isFiller(const std::string &token) { return token == "et" || token == "al"; }
+
+    // Dice coefficient of two sets of the given sizes with shared elements in common
+    static double dice(size_t shared, size_t first, size_t second)
+    {
+        return first + second == 0 ? 0.0 : 2.0 * shared / static_cast<double>(first + second);
+    }
+
+    // Reference text prepared once for scoring many candidates
+    struct Reference
+    {
+        explicit Reference(const std::string &text) : tokens(tokenize(text))
+        {
+            words.insert(tokens.begin(), tokens.end());
+            for (const auto &token : tokens)
+            {
+                if (isYear(token))
+                {
+                    years.insert(token);
+                }
+            }
+        }
+
+        std::vector<std::string> tokens;
+        std::unordered_set<std::string> words;
+        std::unordered_set<std::string> years;
+    };
+
+    // Similarity of the title to the part of the reference that may be its
+    // title: every word except those the candidate's other fields (authors,
+    // venue, year) or "et al." account for. Symmetric, so a short title found
+    // inside a long reference, e.g. "Learning", scores low.
+    static double titleScore(const Reference &reference, const PaperInfo &paper)
+    {
+        std::vector<std::string> tokens = tokenize(paper.title);
+        if (tokens.empty())
+        {
+            return 0.0;
+        }
+        std::unordered_set<std::string> titleWords(tokens.begin(), tokens.end());
+
+        std::unordered_set<std::string> otherWords;
+        for (const std::string *field :
+             {&paper.journal, &paper.book_title, &paper.publisher, &paper.year})
+        {
+            std::vector<std::string> fieldTokens = tokenize(*field);
+            otherWords.insert(fieldTokens.begin(), fieldTokens.end());
+        }
+        for (const auto &author : paper.authors)
+        {
+            std::vector<std::string> authorTokens = tokenize(author);
+            otherWords.insert(authorTokens.begin(), authorTokens.end());
+        }
+
+        std::vector<std::string> rest;
+        for (const auto &token : reference.tokens)
+        {
+            if (titleWords.count(token) ||
+                (!otherWords.count(token) && !isFiller(token) && !isYear(token)))
+            {
+                rest.push_back(token);
+            }
+        }
+        std::unordered_set<std::string> restWords(rest.begin(), rest.end());
+
+        size_t found = 0;
+        for (const auto &word : titleWords)
+        {
+            found += restWords.count(word);
+        }
+        double wordScore = dice(found, titleWords.size(), restWords.size());
+
+        // Trigrams tolerate spelling differences and split or joined words
+        std::unordered_set<std::string> grams = trigrams(tokens);
+        std::unordered_set<std::string> restGrams = trigrams(rest);
+        size_t shared = 0;
+        for (const auto &gram : grams)
+        {
+            shared += restGrams.count(gram);
+        }
+        double gramScore = dice(shared, grams.size(), restGrams.size());
+
+        return std::max(wordScore, gramScore);
+    }
+
+    // "Family, Given" or "Given Family"
+    static std::string surname(const std::string &author)
+    {
+        size_t comma = author.find(',');
+        std::vector<std::string> tokens =
+            tokenize(comma != std::string::npos ? author.substr(0, comma) : author);
+        return tokens.empty() ? std::string() : tokens.back();
+    }
+
+    // 1 if the first author is named, 0.5 if only a later one is; references
+    // often list just the first author followed by "et al."
+    static double authorScore(const Reference &reference, const std::vector<std::string> &authors)
+    {
+        if (authors.empty())
+        {
+            return 0.0;
+        }
+        if (reference.words.count(surname(authors.front())))
+        {
+            return 1.0;
+        }
+        for (size_t i = 1; i < authors.size(); ++i)
+        {
+            if (reference.words.count(surname(authors[i])))
+            {
+                return 0.5;
+            }
+        }
+        return 0.0;
+    }
+
+    // No credit unless both sides have the same year
+    static double yearScore(const Reference &reference, const std::string &year)
+    {
+        return reference.years.count(year) ? 1.0 : 0.0;
+    }
+
+    double score(const Reference &reference, const PaperInfo &paper) const
+    {
+        return kTitleWeight * titleScore(reference, paper) +
+               kAuthorWeight * authorScore(reference, paper.authors) +
+               kYearWeight * yearScore(reference, paper.year);
+    }
+
+    double threshold;
+};
+
+} // namespace citation
+
+#endif // CITATION_MATCHER_H
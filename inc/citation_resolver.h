@@ -0,0 +1,305 @@
+#ifndef CITATION_RESOLVER_H
+#define CITATION_RESOLVER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <curl/curl.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "paper_cition_api.h"
+#include "trace.h"
+
+namespace citation
+{
+
+// Resolves many queries against a set of sources at once with the curl multi
+// interface. At most max_in_flight requests are open at a time; results are
+// returned in query order whatever order the responses arrive in.
+class ConcurrentResolver
+{
+  public:
+    explicit ConcurrentResolver(size_t max_in_flight = 8)
+        : max_in_flight(std::max<size_t>(max_in_flight, 1))
+    {
+    }
+
+    // Give up on the lookups still open once deadline has passed or
+    // *cancelled becomes true, which another thread may set; they fail with
+    // "deadline exceeded" or "cancelled". The limits stay in place until set
+    // again.
+    void setLimits(std::chrono::steady_clock::time_point deadline,
+                   const std::atomic<bool> *cancelled = nullptr)
+    {
+        this->deadline = deadline;
+        cancel_flag = cancelled;
+    }
+
+    // results[q][s] is the result of queries[q] on sources[s]. Handles come
+    // from session when one is given, so DNS results and TLS sessions are
+    // reused across queries and across calls.
+    std::vector<std::vector<QueryResult>> resolve(const std::vector<CitationSource *> &sources,
+                                                  const std::vector<std::string> &queries,
+                                                  CurlSession *session = nullptr)
+    {
+        TraceSpan span("resolve", "citation");
+        span.arg("queries", queries.size());
+        std::vector<std::vector<QueryResult>> results(queries.size(),
+                                                      std::vector<QueryResult>(sources.size()));
+
+        // Everything a source can answer without a request is done up front
+        std::vector<Lookup> pending;
+        for (size_t q = 0; q < queries.size(); ++q)
+        {
+            for (size_t s = 0; s < sources.size(); ++s)
+            {
+                if (!sources[s]->cached(queries[q], results[q][s]))
+                {
+                    pending.push_back({q, s});
+                }
+            }
+        }
+        span.arg("requests", pending.size());
+        if (pending.empty())
+        {
+            return results;
+        }
+
+        initCurl();
+        CURLM *multi = curl_multi_init();
+        if (!multi)
+        {
+            for (const Lookup &lookup : pending)
+            {
+                results[lookup.query][lookup.source].error_message = "Failed to initialize CURL";
+            }
+            return results;
+        }
+
+        std::map<CURL *, std::unique_ptr<Transfer>> active;
+        size_t next = 0;
+
+        // Top the set of open requests up to the cap
+        auto startTransfers = [&]()
+        {
+            while (active.size() < max_in_flight && next < pending.size())
+            {
+                const Lookup &lookup = pending[next++];
+                CURL *curl = session ? session->acquire() : curl_easy_init();
+                if (!curl)
+                {
+                    results[lookup.query][lookup.source].error_message =
+                        "Failed to initialize CURL";
+                    continue;
+                }
+
+                auto transfer = std::make_unique<Transfer>();
+                transfer->lookup = lookup;
+                transfer->start = Tracer::Clock::now();
+                prepareHandle(curl, sources[lookup.source]->request(queries[lookup.query]),
+                              &transfer->response);
+                curl_multi_add_handle(multi, curl);
+                active.emplace(curl, std::move(transfer));
+            }
+        };
+
+        auto closeHandle = [&](CURL *curl)
+        {
+            curl_multi_remove_handle(multi, curl);
+            if (session)
+            {
+                session->release(curl);
+            }
+            else
+            {
+                curl_easy_cleanup(curl);
+            }
+        };
+
+        auto finishTransfer = [&](CURL *curl, CURLcode code)
+        {
+            auto it = active.find(curl);
+            const Lookup &lookup = it->second->lookup;
+            CitationSource *source = sources[lookup.source];
+            QueryResult &result = results[lookup.query][lookup.source];
+            if (Tracer::enabled())
+            {
+                traceTransfer(curl, code, *it->second, source->name(), queries[lookup.query]);
+            }
+
+            result.error_message = transferError(curl, code);
+            if (result.error_message.empty())
+            {
+                result = source->parse(it->second->response);
+                if (result.success)
+                {
+                    source->store(queries[lookup.query], result);
+                }
+            }
+
+            closeHandle(curl);
+            active.erase(it);
+        };
+
+        auto failRemaining = [&](const std::string &error)
+        {
+            for (auto &[curl, transfer] : active)
+            {
+                results[transfer->lookup.query][transfer->lookup.source].error_message = error;
+                closeHandle(curl);
+            }
+            active.clear();
+            for (; next < pending.size(); ++next)
+            {
+                results[pending[next].query][pending[next].source].error_message = error;
+            }
+        };
+
+        startTransfers();
+        while (!active.empty())
+        {
+            int running = 0;
+            CURLMcode status = curl_multi_perform(multi, &running);
+
+            CURLMsg *message = nullptr;
+            int queued = 0;
+            while ((message = curl_multi_info_read(multi, &queued)))
+            {
+                if (message->msg == CURLMSG_DONE)
+                {
+                    finishTransfer(message->easy_handle, message->data.result);
+                }
+            }
+            startTransfers();
+
+            if (status == CURLM_OK && !active.empty())
+            {
+                status = curl_multi_poll(multi, nullptr, 0, pollTimeout(), nullptr);
+            }
+            if (status != CURLM_OK)
+            {
+                // The multi handle is unusable; fail whatever is left
+                failRemaining("CURL multi failed: " + std::string(curl_multi_strerror(status)));
+            }
+            else if (!active.empty())
+            {
+                std::string stop = stopReason();
+                if (!stop.empty())
+                {
+                    failRemaining(stop);
+                }
+            }
+        }
+
+        curl_multi_cleanup(multi);
+        return results;
+    }
+
+    // Papers found for each query by every source of api, in source order like
+    // PaperCitationAPI::search. Nothing is printed, since a server or batch
+    // resolves the references of many documents; the lookups that failed are
+    // counted into *failed when it is given.
+    std::vector<std::vector<PaperInfo>> search(const PaperCitationAPI &api,
+                                               const std::vector<std::string> &queries,
+                                               size_t *failed = nullptr)
+    {
+        std::vector<CitationSource *> sources = api.getSources();
+        auto results = resolve(sources, queries, &api.getSession());
+
+        std::vector<std::vector<PaperInfo>> papers(queries.size());
+        for (size_t q = 0; q < queries.size(); ++q)
+        {
+            for (size_t s = 0; s < sources.size(); ++s)
+            {
+                QueryResult &result = results[q][s];
+                if (result.success)
+                {
+                    papers[q].insert(papers[q].end(), result.papers.begin(), result.papers.end());
+                }
+                else if (failed != nullptr)
+                {
+                    ++*failed;
+                }
+            }
+        }
+        return papers;
+    }
+
+  private:
+    // Longest wait for network activity, in milliseconds; a cancel flag is
+    // looked at every 100 ms
+    static constexpr int kPollMilliseconds = 1000;
+    static constexpr int kCancelPollMilliseconds = 100;
+
+    // Why the open lookups must be given up, or empty
+    std::string stopReason() const
+    {
+        if (cancel_flag != nullptr && cancel_flag->load(std::memory_order_relaxed))
+        {
+            return "cancelled";
+        }
+        if (deadline != std::chrono::steady_clock::time_point::max() &&
+            std::chrono::steady_clock::now() >= deadline)
+        {
+            return "deadline exceeded";
+        }
+        return {};
+    }
+
+    // How long to wait for network activity before looking at the limits again
+    int pollTimeout() const
+    {
+        int timeout = cancel_flag != nullptr ? kCancelPollMilliseconds : kPollMilliseconds;
+        if (deadline != std::chrono::steady_clock::time_point::max())
+        {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            timeout = static_cast<int>(std::clamp<long long>(left.count(), 0, timeout));
+        }
+        return timeout;
+    }
+
+    // One query on one source
+    struct Lookup
+    {
+        size_t query;
+        size_t source;
+    };
+
+    struct Transfer
+    {
+        Lookup lookup;
+        std::string response;
+        Tracer::Clock::time_point start;
+    };
+
+    // Record a finished request as a span of its own, since requests overlap
+    static void traceTransfer(CURL *curl, CURLcode code, const Transfer &transfer,
+                              const std::string &source_name, const std::string &query)
+    {
+        long status = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        std::string args;
+        Tracer::appendArg(args, "source", source_name);
+        Tracer::appendArg(args, "query", query);
+        Tracer::appendArg(args, "status", static_cast<long long>(status));
+        Tracer::appendArg(args, "bytes", static_cast<long long>(transfer.response.size()));
+        if (code != CURLE_OK)
+        {
+            Tracer::appendArg(args, "error", curl_easy_strerror(code));
+        }
+        Tracer::async("query", "citation", reinterpret_cast<std::uintptr_t>(&transfer),
+                      transfer.start, Tracer::Clock::now(), std::move(args));
+    }
+
+    size_t max_in_flight;
+    std::chrono::steady_clock::time_point deadline{std::chrono::steady_clock::time_point::max()};
+    const std::atomic<bool> *cancel_flag{nullptr};
+};
+
+} // namespace citation
+
+#endif // CITATION_RESOLVER_H
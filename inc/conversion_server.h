@@ -0,0 +1,152 @@
+// conversion_server.h
+#ifndef CONVERSION_SERVER_H
+#define CONVERSION_SERVER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "md_converter.h"
+#include "thread_pool.h"
+
+struct ServerOptions
+{
+    // Unix domain socket to listen on; a stale socket file is replaced
+    std::string socketPath;
+    // Also serve HTTP on 127.0.0.1 at this port when not 0
+    int httpPort{0};
+    // Conversion workers; 0 uses one per hardware thread
+    size_t threads{0};
+    // Seconds a request may take from its arrival unless it asks otherwise
+    double timeoutSeconds{30.0};
+    // Requests with a larger document are refused
+    size_t maxRequestBytes{64 * 1024 * 1024};
+};
+
+// Long-running conversion service, so that callers converting many small
+// documents pay for process startup, library loading and cache warm-up once.
+//
+// One thread multiplexes the connections with poll() and hands complete
+// requests to a fixed pool of workers, each with its own ConversionContext,
+// and writes their results back. A connection speaks one of two protocols,
+// told apart by its first byte:
+//
+//   framed: a JSON header line, then that many bytes of Markdown
+//     {"length": 1234, "template": "minimal", "timeout_ms": 500}\n<markdown>
+//   answered by a header line and the LaTeX:
+//     {"status": "ok", "length": 5678}\n<latex>
+//     {"status": "error", "error": "deadline exceeded", "length": 0}\n
+//   with the BibTeX of the references, if the document has any, in the
+//   header's "bibliography" string.
+//
+//   HTTP/1.1: POST /convert with the Markdown as body and the same options as
+//   query parameters, e.g. /convert?template=minimal&timeout_ms=500; answered
+//   with the LaTeX as application/x-tex, or with output=bibliography, the
+//   BibTeX as application/x-bibtex. GET /health answers "ok".
+//
+// No bibliography file is written, since requests do not share one.
+// Both keep the connection open for further requests. "template" is default
+// (the server's converter options) or minimal. A request that is still
+// queued or converting when its deadline passes, or whose client hangs up,
+// is abandoned.
+class ConversionServer
+{
+  public:
+    ConversionServer(ConverterOptions converter, ServerOptions server);
+    ~ConversionServer();
+
+    ConversionServer(const ConversionServer &) = delete;
+    ConversionServer &operator=(const ConversionServer &) = delete;
+
+    // Create the listening sockets; on failure returns false and sets error()
+    bool open();
+
+    // Serve until stopFd becomes readable; a negative stopFd serves until an
+    // error. Returns false if serving failed, with error() set.
+    bool run(int stopFd = -1);
+
+    // Requests answered so far, and how many of them with an error
+    size_t requests() const;
+    size_t failures() const;
+
+    const std::string &error() const;
+
+  private:
+    struct Connection;
+    struct Request;
+
+    // Answer to a request, from a worker or straight from the parser
+    struct Completion
+    {
+        std::uint64_t connection;
+        int status; // HTTP status code, 200 when converted
+        std::string message;
+        std::string body;
+        const char *contentType;
+        // BibTeX of the document's references, for the framed header
+        std::string bibliography{};
+    };
+
+    enum class Parsed
+    {
+        Incomplete, // more input is needed
+        Request,    // a conversion is ready to start
+        Answered,   // a response has been queued without converting
+    };
+
+    void close();
+    void accept(int listener);
+
+    // Read what is available, noting whether the peer has gone
+    void readFrom(Connection &connection, bool hangup);
+
+    // Write pending output, start the next request, and close the
+    // connection once it is done, as far as possible without blocking
+    void service(Connection &connection);
+
+    // Write pending output; false while it would block or after an error
+    bool flushOutput(Connection &connection);
+    void closeConnection(Connection &connection);
+
+    Parsed parseFramed(Connection &connection, Request &request);
+    Parsed parseHttp(Connection &connection, Request &request);
+
+    // Converter for a template name, nullptr for an unknown name
+    std::shared_ptr<const MarkdownConverter> converterFor(const std::string &name) const;
+
+    // Queue a response; connection is closed after it when close is set
+    void respond(Connection &connection, Completion completion, bool close);
+
+    void convert(const std::shared_ptr<Request> &request, size_t worker);
+    void finish(Completion completion);
+    void collectCompletions();
+
+    ConverterOptions converterOptions;
+    ServerOptions options;
+    std::shared_ptr<const MarkdownConverter> defaultConverter;
+    std::shared_ptr<const MarkdownConverter> minimalConverter;
+
+    ThreadPool pool;
+    std::vector<std::unique_ptr<ConversionContext>> contexts;
+
+    int socketFd{-1};
+    int httpFd{-1};
+    int wakeFds[2]{-1, -1};
+    std::map<std::uint64_t, std::unique_ptr<Connection>> connections;
+    std::uint64_t nextConnection{0};
+
+    std::mutex completionMutex;
+    std::deque<Completion> completions;
+
+    size_t answered{0};
+    size_t failed{0};
+    std::string errorMessage;
+};
+
+#endif // CONVERSION_SERVER_H
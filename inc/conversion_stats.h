@@ -0,0 +1,101 @@
+// conversion_stats.h
+#ifndef CONVERSION_STATS_H
+#define CONVERSION_STATS_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+#include "md_ast.h"
+
+constexpr size_t kBlockTypeCount = static_cast<size_t>(BlockType::Blank) + 1;
+
+// Inline passes in the order InlineScanner runs them
+enum class InlinePass
+{
+    Links,
+    Images,
+    Emphasis,
+    Code,
+    Citations,
+    Escape,
+};
+
+constexpr size_t kInlinePassCount = static_cast<size_t>(InlinePass::Escape) + 1;
+
+// Work done by one kind of block or one inline pass
+struct StageStats
+{
+    size_t count{0};   // blocks emitted, or lines the pass ran on
+    size_t changed{0}; // lines the pass rewrote (inline passes only)
+    size_t bytes{0};   // text bytes handled
+    double seconds{0.0};
+
+    void add(const StageStats &other);
+};
+
+// Counters and cumulative times of a conversion, collected when
+// ConverterOptions::collectStats is set. Times are summed over threads, so in
+// a parallel conversion they are CPU time rather than wall time.
+struct ConversionStats
+{
+    size_t documents{0};
+    size_t lines{0};
+    size_t inputBytes{0};
+
+    // Block parsing, including recognising citation reference lines
+    double parseSeconds{0.0};
+    // LaTeX emission per block type; the time includes the inline passes
+    std::array<StageStats, kBlockTypeCount> blocks;
+    std::array<StageStats, kInlinePassCount> inlinePasses;
+
+    // Citation references ([^n]: ...) found, matched in the local library,
+    // looked up online rather than taken from stored selections or the
+    // library, and turned into BibTeX entries; those skipped because no
+    // candidate found online was a confident match or picked at the prompt;
+    // and lookups of one reference on one source that failed, e.g. because
+    // the service could not be reached
+    size_t citationReferences{0};
+    size_t citationLibraryMatches{0};
+    size_t citationLookups{0};
+    size_t citationsResolved{0};
+    size_t citationsUnmatched{0};
+    size_t citationLookupsFailed{0};
+    // Waiting for the citation services, and the whole citation phase
+    // (cache, lookups, matching, prompts, writing references.bib)
+    double citationNetworkSeconds{0.0};
+    double citationSeconds{0.0};
+
+    StageStats &block(BlockType type) { return blocks[static_cast<size_t>(type)]; }
+    const StageStats &block(BlockType type) const { return blocks[static_cast<size_t>(type)]; }
+    StageStats &pass(InlinePass which) { return inlinePasses[static_cast<size_t>(which)]; }
+    const StageStats &pass(InlinePass which) const
+    {
+        return inlinePasses[static_cast<size_t>(which)];
+    }
+
+    // Parsing and emitting, i.e. everything except the citation phase
+    double conversionSeconds() const;
+
+    // Add the counters of another conversion, e.g. of one chunk or one file
+    void add(const ConversionStats &other);
+
+    // Aligned table for people
+    void writeText(std::ostream &out) const;
+
+    // One JSON object, for scripts
+    std::string toJson() const;
+};
+
+const char *blockTypeName(BlockType type);
+const char *inlinePassName(InlinePass which);
+
+// Seconds elapsed since start
+inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif // CONVERSION_STATS_H
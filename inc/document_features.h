@@ -0,0 +1,17 @@
+// document_features.h
+#ifndef DOCUMENT_FEATURES_H
+#define DOCUMENT_FEATURES_H
+
+// Constructs a converted document uses that need LaTeX packages or closing
+// text, as bits of a mask. The emitter records them so that a LatexTemplate
+// can load only the packages the document needs.
+enum DocumentFeature : unsigned
+{
+    kFeatureLinks = 1U << 0,        // \href
+    kFeatureImages = 1U << 1,       // figures with \includegraphics
+    kFeatureCode = 1U << 2,         // lstlisting environments
+    kFeatureCitations = 1U << 3,    // \cite
+    kFeatureBibliography = 1U << 4, // reference definitions, hence references.bib
+};
+
+#endif // DOCUMENT_FEATURES_H
@@ -0,0 +1,37 @@
+// file_watcher.h
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+
+// Waits for a file to be saved. On Linux this uses inotify on the file's
+// directory, so editors that save by writing a new file and renaming it over
+// the old one are noticed as well; elsewhere the modification time is polled.
+class FileWatcher
+{
+  public:
+    FileWatcher() = default;
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    // Start watching path; on failure returns false and sets error()
+    bool open(const std::string &path);
+
+    // Block until the file has been written (true), or until stopFd becomes
+    // readable or watching fails (false). A negative stopFd is ignored.
+    bool waitForChange(int stopFd = -1);
+
+    const std::string &error() const;
+
+  private:
+    void close();
+
+    std::string path;
+    std::string fileName;
+    int notifyFd{-1};
+    std::string errorMessage;
+};
+
+#endif // FILE_WATCHER_H
@@ -0,0 +1,71 @@
+// inline_scanner.h
+#ifndef INLINE_SCANNER_H
+#define INLINE_SCANNER_H
+
+#include <string>
+#include <string_view>
+
+#include "conversion_stats.h"
+#include "document_features.h"
+
+// Regex-free implementation of the inline Markdown passes (links, images,
+// emphasis, inline code, citations and LaTeX escaping).
+//
+// A line is classified once by a single scan that records which trigger
+// characters it contains; only the passes that can match are then run, each
+// as a linear scan that writes into one of two reusable scratch buffers.
+// Plain prose therefore costs one classification scan plus the escaping scan.
+// The passes reproduce the previous std::regex based output byte for byte.
+//
+// Every conversion takes a view and returns a view of either its input or a
+// scratch buffer, valid until the next call on this scanner. The buffers keep
+// their capacity, so once they have grown to the longest line a conversion
+// allocates nothing. The input must not be a view returned by this scanner.
+class InlineScanner
+{
+  public:
+    // Paragraph text: links, images, emphasis, inline code, citations, escaping
+    std::string_view convertParagraph(std::string_view line);
+
+    // List item and blockquote text: same as paragraphs but without images
+    std::string_view convertInline(std::string_view text);
+
+    // Convert links [text](url) -> \href{url}{text}
+    std::string_view convertLinks(std::string_view line);
+
+    // Convert images ![alt](url) -> \includegraphics{url}
+    std::string_view convertImages(std::string_view line);
+
+    // Convert bold and italic text
+    std::string_view convertEmphasis(std::string_view line);
+
+    // Convert inline code `code` -> \texttt{code}
+    std::string_view convertCodeBlocks(std::string_view line);
+
+    // Convert citations [^1] -> \cite{ref1}
+    std::string_view convertCitations(std::string_view line);
+
+    // Escape LaTeX special characters
+    std::string_view escapeLatexChars(std::string_view text);
+
+    // DocumentFeature bits of the links, images and citations that
+    // convertParagraph and convertInline have produced so far
+    unsigned features() const;
+    void clearFeatures();
+
+    // Count and time the passes of convertParagraph and convertInline into
+    // target; nullptr stops collecting
+    void setStats(ConversionStats *target);
+
+  private:
+    std::string_view run(std::string_view text, bool withImages);
+
+    ConversionStats *stats{nullptr};
+    unsigned usedFeatures{0};
+
+    // Ping-pong buffers shared by the passes of one line
+    std::string front;
+    std::string back;
+};
+
+#endif // INLINE_SCANNER_H
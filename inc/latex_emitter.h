@@ -0,0 +1,71 @@
+// latex_emitter.h
+#ifndef LATEX_EMITTER_H
+#define LATEX_EMITTER_H
+
+#include <ostream>
+#include <string>
+
+#include "conversion_stats.h"
+#include "inline_scanner.h"
+#include "md_ast.h"
+
+// Walks a block list and writes LaTeX. Keeps the itemize/quotation
+// environment state across calls, so a document may be emitted in pieces.
+class LatexEmitter
+{
+  public:
+    // Write the document preamble up to \begin{document}
+    void emitPreamble(std::ostream &out);
+
+    // Write the given blocks
+    void emitBlocks(const BlockList &blocks, std::ostream &out);
+
+    // Close any environment still open at the end of the document
+    void closeEnvironments(std::ostream &out);
+
+    // Write the bibliography commands, naming the BibTeX file bibliography
+    // (without .bib), and \end{document}
+    void emitEpilogue(bool hasCitations, const std::string &bibliography, std::ostream &out);
+
+    // Start over for the next document, keeping scratch buffers
+    void reset();
+
+    // DocumentFeature bits of everything emitted so far
+    unsigned features() const;
+
+    // Count and time the emitted blocks and inline passes into target;
+    // nullptr stops collecting
+    void setStats(ConversionStats *target);
+
+  private:
+    void emitBlock(const BlockNode &node, std::ostream &out);
+
+    // Convert headers (# Header -> \section{Header}, ## Header ->
+    // \subsection{Header}, etc.)
+    void emitHeading(const BlockNode &node, std::ostream &out);
+
+    // Convert lists
+    void emitListItem(const BlockNode &node, std::ostream &out);
+
+    // Convert blockquotes
+    void emitQuote(const BlockNode &node, std::ostream &out);
+
+    // Convert fenced code blocks into lstlisting environments
+    void emitCodeBlock(const BlockNode &node, std::ostream &out);
+
+    // Regular text
+    void emitParagraph(const BlockNode &node, std::ostream &out);
+
+    // End open list and quote environments before a header or paragraph
+    void closeForParagraph(std::ostream &out);
+
+    InlineScanner inlineScanner;
+    ConversionStats *stats{nullptr};
+    bool hasCode{false};
+
+    bool inList{false};
+    int listDepth{0};
+    bool inQuote{false};
+};
+
+#endif // LATEX_EMITTER_H
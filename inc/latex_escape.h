@@ -0,0 +1,38 @@
+// latex_escape.h
+#ifndef LATEX_ESCAPE_H
+#define LATEX_ESCAPE_H
+
+#include <string>
+#include <string_view>
+
+// Escaping of LaTeX special characters (#$%&_~^\). Every special character
+// is prefixed with a backslash, except a backslash that starts one of the
+// commands the converter generates (\textbf, \href, \cite, ...), which is
+// copied unchanged. Generated commands therefore survive without being
+// escaped and un-escaped again.
+//
+// Special characters are located 16 or 32 bytes at a time with SSE4.2 or
+// AVX2 when the CPU supports them (checked once at runtime), and with a
+// table-driven scalar loop otherwise. Runs without specials are copied whole.
+
+enum class EscapeKernel
+{
+    Scalar,
+    Sse42,
+    Avx2,
+};
+
+// Escape in into out. Returns false, leaving out untouched, when in has no
+// special characters.
+bool escapeLatex(std::string_view in, std::string &out);
+
+// Kernel picked for this CPU
+EscapeKernel activeEscapeKernel();
+
+// Override the kernel, e.g. to compare them in benchmarks. Falls back to the
+// best supported kernel when the requested one is not available.
+void setEscapeKernel(EscapeKernel kernel);
+
+const char *escapeKernelName(EscapeKernel kernel);
+
+#endif // LATEX_ESCAPE_H
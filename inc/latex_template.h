@@ -0,0 +1,65 @@
+// latex_template.h
+#ifndef LATEX_TEMPLATE_H
+#define LATEX_TEMPLATE_H
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document_features.h"
+
+// Document text written around the converted Markdown, compiled once into a
+// list of segments and then rendered for each document from the features it
+// uses. A compiled template is immutable and may be shared between
+// converters, e.g. by the workers of a batch.
+//
+// The template is LaTeX with these tags:
+//   {{body}}        where the converted document goes; required, once
+//   {{packages}}    \usepackage lines for the features the document uses
+//   {{#feature}}    text up to the matching {{/feature}} is kept only if the
+//   {{^feature}}    document uses (#) or does not use (^) the feature
+// where feature is one of links, images, code, citations or bibliography.
+// A tag alone on its line takes the whole line with it. Any other {{...}} is
+// LaTeX and copied as it is, so \def\x{{\bfseries y}} or {{#1}} need no
+// escaping.
+class LatexTemplate
+{
+  public:
+    // Compile template text; on failure returns false and sets error()
+    bool compile(std::string_view text);
+
+    // Read and compile a template file; on failure returns false and sets error()
+    bool load(const std::string &path);
+
+    // Built-in template with the default document class and only the packages
+    // a document needs
+    static std::shared_ptr<const LatexTemplate> minimal();
+
+    // Write everything before or after {{body}}
+    void writeHead(unsigned features, std::ostream &out) const;
+    void writeTail(unsigned features, std::ostream &out) const;
+
+    const std::string &error() const;
+
+  private:
+    struct Segment
+    {
+        // {{packages}} when set, otherwise text
+        bool packages;
+        std::string text;
+        // Written only if all of required and none of excluded are used
+        unsigned required;
+        unsigned excluded;
+    };
+
+    static void write(const std::vector<Segment> &segments, unsigned features,
+                      std::ostream &out);
+
+    std::vector<Segment> head;
+    std::vector<Segment> tail;
+    std::string errorMessage;
+};
+
+#endif // LATEX_TEMPLATE_H
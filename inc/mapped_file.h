@@ -0,0 +1,57 @@
+// mapped_file.h
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only view of a whole file. Uses mmap where available and falls back
+// to reading the file into memory otherwise (or when mapping fails, e.g. for
+// pipes).
+class MappedFile
+{
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    // Open and map the file; on failure returns false and sets error()
+    bool open(const std::string &path);
+
+    std::string_view data() const;
+    const std::string &error() const;
+
+  private:
+    void close();
+
+    void *mapping{nullptr};
+    size_t mappedSize{0};
+    std::string fallback;
+    std::string_view view;
+    std::string errorMessage;
+};
+
+// Offsets of the lines of a text, split at '\n' with std::getline semantics:
+// a trailing newline does not start an extra empty line.
+class LineIndex
+{
+  public:
+    explicit LineIndex(std::string_view text);
+
+    size_t size() const;
+
+    // Line i without its '\n'
+    std::string_view line(size_t i) const;
+
+  private:
+    std::string_view text;
+    std::vector<size_t> starts;
+};
+
+#endif // MAPPED_FILE_H
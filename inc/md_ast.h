@@ -0,0 +1,53 @@
+// md_ast.h
+#ifndef MD_AST_H
+#define MD_AST_H
+
+#include <cstddef>
+#include <string_view>
+
+// Block-level Markdown syntax tree. Nodes and their text live in an Arena and
+// are released together with it, so every member must stay trivially
+// destructible.
+
+enum class BlockType
+{
+    Heading,   // level, text
+    ListItem,  // level (nesting depth), text
+    Quote,     // text
+    Paragraph, // text
+    CodeBlock, // info (language), text (body, one '\n' per line)
+    Blank,
+};
+
+struct BlockNode
+{
+    BlockType type;
+    int level;
+    std::string_view text;
+    std::string_view info;
+    BlockNode *next;
+};
+
+// Singly linked list of the top-level blocks of a document, in source order
+struct BlockList
+{
+    BlockNode *first{nullptr};
+    BlockNode *last{nullptr};
+    size_t count{0};
+
+    void append(BlockNode *node)
+    {
+        if (last)
+        {
+            last->next = node;
+        }
+        else
+        {
+            first = node;
+        }
+        last = node;
+        count++;
+    }
+};
+
+#endif // MD_AST_H
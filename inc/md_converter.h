@@ -2,52 +2,256 @@
 #ifndef MD_CONVERTER_H
 #define MD_CONVERTER_H
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <istream>
 #include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "arena.h"
+#include "conversion_stats.h"
+#include "latex_emitter.h"
+
+class LatexTemplate;
+class ThreadPool;
+
+namespace citation
+{
+class LibrarySource;
+}
+
+struct ConverterOptions
+{
+    // Persistent citation cache file; empty disables caching
+    std::string citationCachePath{".md2latex-citations.msgpack"};
+    // Age in seconds after which cached lookups are repeated; 0 never expires
+    long long citationCacheTtl{30LL * 24 * 60 * 60};
+    // Ignore cached lookups and selections and query every reference again
+    bool refreshCitationCache{false};
+    // Citation lookups kept in flight at once
+    size_t citationConcurrency{8};
+    // Replaces the address of the citation services when not empty, e.g. to
+    // point them at a local test server
+    std::string citationBaseUrl;
+    // Candidates scoring at least this (0..1) against the reference text are
+    // picked automatically
+    double citationMatchThreshold{0.7};
+    // BibTeX files searched before the citation services; references with a
+    // confident match in them are never looked up online. Each is indexed on
+    // first use into <file>.idx next to it.
+    std::vector<std::string> bibLibraries;
+    // Stores built from metadata dumps by CitationIngester, searched along
+    // with bibLibraries
+    std::vector<std::string> citationStores;
+    // File the BibTeX of each document's references is written to; the
+    // \bibliography of the built-in epilogue names it by its stem. Empty
+    // writes no file; see ConversionContext::bibliography.
+    std::string bibliographyPath{"references.bib"};
+    // Ask on stdin when no candidate reaches the threshold; otherwise the
+    // reference is skipped
+    bool promptCitations{true};
+    // Count and time the work of each conversion; see MarkdownConverter::stats
+    bool collectStats{false};
+    // Text written around the converted document, loading only the packages
+    // it needs; nullptr keeps the built-in preamble. With a template, the
+    // LaTeX of a document is held in memory until its features are known.
+    std::shared_ptr<const LatexTemplate> documentTemplate;
+};
+
+// Work done by one incremental conversion
+struct IncrementalUpdate
+{
+    size_t segments{0};
+    size_t reconverted{0};
+    // Size of the LaTeX, and how many leading bytes of it are the same as
+    // after the previous conversion
+    size_t outputBytes{0};
+    size_t unchangedBytes{0};
+};
+
+// Everything that changes while a document is converted: the block arena,
+// the emitter and its scratch buffers, the references found, statistics and
+// the state of incremental conversion. A MarkdownConverter itself only holds
+// its options and the citation library and services they name, so one
+// converter may convert on many threads at once as long as each call gets its
+// own context. Reusing a context for the next document keeps its arena chunks
+// and buffers, so a context per thread is enough.
+class ConversionContext
+{
+  public:
+    // Reference texts of the last document by citation key, e.g. "ref1"
+    const std::map<std::string, std::string> &citationReferences() const;
+
+    // BibTeX of the references of the last document, whether or not it was
+    // written to a file
+    const std::string &bibliography() const;
+
+    // Write the BibTeX of documents converted with this context to path
+    // instead of ConverterOptions::bibliographyPath, e.g. next to each output
+    // file of a batch
+    void setBibliographyPath(std::string path);
+
+    // Statistics of the last conversion when ConverterOptions::collectStats is
+    // set. After an incremental update they cover only the segments converted
+    // again.
+    const ConversionStats &stats() const;
+
+    // Make conversions with this context stop early once deadline has passed
+    // or *cancelled becomes true, which another thread may set. The limits are
+    // checked between batches of blocks (or chunks, in parallel) and while
+    // citations are resolved; a conversion that stops leaves its output
+    // incomplete. An incremental update checks them only while citations are
+    // resolved, since its segments are kept for the next update. The limits
+    // stay in place until set again.
+    void setLimits(std::chrono::steady_clock::time_point deadline,
+                   const std::atomic<bool> *cancelled = nullptr);
+
+    // Whether the last conversion or incremental update stopped early because
+    // of its limits
+    bool interrupted() const;
+
+  private:
+    friend class MarkdownConverter;
+
+    // Record whether a limit has been reached
+    bool checkLimits();
+    // Whether a limit has been reached, without recording it; safe to call
+    // from pool workers
+    bool limitReached() const;
+
+    // A run of lines between two safe split points and its LaTeX
+    struct Segment
+    {
+        size_t begin; // byte offset of the first line
+        std::string latex;
+        unsigned features; // DocumentFeature bits of the LaTeX
+    };
+
+    // Storage for the block tree of the document being converted
+    Arena arena;
+    LatexEmitter emitter;
+    // The LaTeX of the blocks while a template waits for their features
+    std::string body;
+
+    // Arena and emitter of each pool worker in parallel conversion
+    struct Worker
+    {
+        Arena arena;
+        LatexEmitter emitter;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::chrono::steady_clock::time_point deadline{std::chrono::steady_clock::time_point::max()};
+    const std::atomic<bool> *cancelFlag{nullptr};
+    bool stopped{false};
+
+    std::map<std::string, std::string> citationRefs;
+    std::string bibtex;
+    std::optional<std::string> bibliographyFile;
+    ConversionStats conversionStats;
+
+    // The document of the previous incremental conversion, its segments and
+    // its references
+    bool hasPrevious{false};
+    std::string previousMarkdown;
+    std::vector<Segment> segments;
+    std::map<std::string, std::string> previousCitationRefs;
+    // Preamble and epilogue around the segments' LaTeX
+    std::string latexHead;
+    std::string latexTail;
+};
+
+// Converts Markdown to LaTeX. The methods taking a ConversionContext are
+// const and reentrant; the others keep their state in a context owned by the
+// converter and so must not be called concurrently.
 class MarkdownConverter
 {
   public:
-    MarkdownConverter();
+    explicit MarkdownConverter(ConverterOptions options = {});
     std::string convertToLatex(const std::string &markdown);
 
-  private:
-    // Convert headers (# Header -> \section{Header}, ## Header ->
-    // \subsection{Header}, etc.)
-    std::string convertHeaders(const std::string &line);
+    // Convert markdown read from in, writing LaTeX to out as blocks complete.
+    // Memory use is bounded by the largest block rather than the document.
+    void convertToLatex(std::istream &in, std::ostream &out);
+    void convertToLatex(std::istream &in, std::ostream &out, ConversionContext &context) const;
 
-    // Convert bold and italic text
-    std::string convertEmphasis(const std::string &line);
+    // Convert an in-memory document, e.g. a MappedFile, without copying its lines
+    void convertToLatex(std::string_view markdown, std::ostream &out);
+    void convertToLatex(std::string_view markdown, std::ostream &out,
+                        ConversionContext &context) const;
 
-    // Convert code blocks and inline code
-    std::string convertCodeBlocks(const std::string &line);
+    // Same output as convertToLatex, but the document is cut at safe block
+    // boundaries and the pieces are converted on pool. Must not be called from
+    // a task running on the same pool.
+    void convertToLatexParallel(std::string_view markdown, std::ostream &out, ThreadPool &pool);
+    void convertToLatexParallel(std::string_view markdown, std::ostream &out, ThreadPool &pool,
+                                ConversionContext &context) const;
 
-    // Convert lists
-    std::string convertLists(const std::string &line, bool &inList, int &listDepth);
+    // Convert a new version of the document given to the previous call on this
+    // converter. Only the segments (lines between two safe split points) around
+    // the part that differs from the previous version are scanned and
+    // converted again; the LaTeX of the others is reused. BibTeX is only
+    // regenerated when the references change.
+    IncrementalUpdate convertToLatexIncremental(std::string_view markdown, std::ostream &out);
 
-    // Convert links [text](url) -> \href{url}{text}
-    std::string convertLinks(const std::string &line);
+    // The two halves of convertToLatexIncremental: bring the converter up to
+    // date with a new version, then write its LaTeX starting at byte from, e.g.
+    // to rewrite only the part of an output file after unchangedBytes. With a
+    // context, the previous version is the one last given with that context.
+    IncrementalUpdate updateIncremental(std::string_view markdown);
+    IncrementalUpdate updateIncremental(std::string_view markdown,
+                                        ConversionContext &context) const;
+    void writeIncremental(std::ostream &out, size_t from = 0) const;
+    void writeIncremental(std::ostream &out, const ConversionContext &context,
+                          size_t from = 0) const;
 
-    // Convert images ![alt](url) -> \includegraphics{url}
-    std::string convertImages(const std::string &line);
+    // Statistics of the last conversion through the converter's own context
+    const ConversionStats &stats() const;
 
-    // Convert blockquotes
-    std::string convertBlockquotes(const std::string &line, bool &inQuote);
+  private:
+    // Parse, emit and resolve citations for one document, pulling lines from
+    // nextLine(std::string_view &) until it returns false
+    template <typename LineSource>
+    void convertLines(LineSource &nextLine, std::ostream &out, ConversionContext &context) const;
 
-    // Convert citations [^1] -> \cite{ref1}
-    std::string convertCitations(const std::string &line);
+    // Record a citation reference line [^1]: reference text
+    static void processCitationReference(std::string_view line, ConversionContext &context);
 
-    // Process citation references at the end of the document [^1]: reference text
-    void processCitationReferences(const std::string &markdown);
+    // Generate BibTeX entries from the references collected in context, keep
+    // them in the context and write them to its bibliography file
+    void generateBibTeX(ConversionContext &context) const;
 
-    // Generate BibTeX entries from collected references
-    std::string generateBibTeX();
+    // Where the BibTeX of documents converted with context goes; empty for
+    // nowhere
+    const std::string &bibliographyPath(const ConversionContext &context) const;
 
-    // Escape LaTeX special characters
-    std::string escapeLatexChars(const std::string &text);
+    // Write what goes before and after the converted blocks of a document
+    // with the given DocumentFeature bits
+    void writeHead(unsigned features, std::ostream &out) const;
+    void writeTail(unsigned features, const ConversionContext &context, std::ostream &out) const;
 
-    // Map to store citation references
-    std::map<std::string, std::string> citationRefs;
+    // Clear the statistics for a new conversion; nullptr unless collecting
+    ConversionStats *startStats(ConversionContext &context) const;
+
+    ConverterOptions options;
+
+    // Searched before the citation services; nullptr without bibLibraries
+    // and citationStores
+    std::shared_ptr<const citation::LibrarySource> library;
+
+    // The citation cache and services, opened by the first document with
+    // references and used by every conversion after it
+    struct CitationServices;
+    std::shared_ptr<CitationServices> citationServices;
+
+    // State of the calls that take no context
+    ConversionContext ownContext;
 };
 
 #endif // MD_CONVERTER_H
\ No newline at end of file
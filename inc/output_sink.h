@@ -0,0 +1,104 @@
+// output_sink.h
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <cstddef>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Stream buffer for writing a file through a file descriptor. Output is
+// collected in fixed-size chunks, and once kChunksPerWrite of them are full
+// they are handed to the kernel in one writev call and reused, so memory
+// stays at a few chunks whatever the size of the output. Unlike
+// std::ofstream there is no locale conversion or intermediate copy.
+//
+// A write error is remembered; later output is discarded and close() reports
+// the error.
+class ChunkedOutput : public std::streambuf
+{
+  public:
+    static constexpr size_t kChunkSize = 64 * 1024;
+    static constexpr size_t kChunksPerWrite = 16;
+
+    // Call open() before writing
+    ChunkedOutput() = default;
+
+    // Write to an already open descriptor, e.g. standard output. It is not
+    // closed by close().
+    explicit ChunkedOutput(int fd);
+
+    // Flushes and closes, ignoring errors; call close() to see them
+    ~ChunkedOutput() override;
+
+    ChunkedOutput(const ChunkedOutput &) = delete;
+    ChunkedOutput &operator=(const ChunkedOutput &) = delete;
+
+    // Create or truncate path; on failure returns false and sets error()
+    bool open(const std::string &path);
+
+    // Write out everything collected so far
+    bool flush();
+
+    // Flush, and close the file if open() opened it; false if any write failed
+    bool close();
+
+    // Bytes written to the stream so far, whether flushed or not
+    size_t size() const;
+
+    const std::string &error() const;
+
+  protected:
+    int_type overflow(int_type chr) override;
+    std::streamsize xsputn(const char *data, std::streamsize count) override;
+    int sync() override;
+
+  private:
+    // Make room after the current chunk is full, writing out full chunks
+    // when enough have piled up
+    bool nextChunk();
+
+    // Write the filled chunks, lastBytes of the current one and then extra,
+    // and start over in the first chunk
+    bool writeChunks(size_t lastBytes, const char *extra = nullptr, size_t extraBytes = 0);
+
+    int fd{-1};
+    bool ownsFd{false};
+    bool failed{false};
+    std::vector<std::unique_ptr<char[]>> chunks;
+    // Chunks already filled; chunks[filled] is the one being written
+    size_t filled{0};
+    size_t flushedBytes{0};
+    std::string errorMessage;
+};
+
+// Stream buffer that writes straight into a std::string, growing it
+// geometrically. std::ostringstream::str() copies the whole output once more
+// at the end; here the string already holds the result.
+class StringOutput : public std::streambuf
+{
+  public:
+    // Output is appended to target
+    explicit StringOutput(std::string &target);
+    ~StringOutput() override;
+
+    StringOutput(const StringOutput &) = delete;
+    StringOutput &operator=(const StringOutput &) = delete;
+
+    // Trim target to the bytes written; called by the destructor. Writing
+    // after finish() appends again.
+    void finish();
+
+  protected:
+    int_type overflow(int_type chr) override;
+    std::streamsize xsputn(const char *data, std::streamsize count) override;
+
+  private:
+    // Grow target so that at least count more bytes fit
+    void reserve(size_t count);
+
+    std::string &target;
+};
+
+#endif // OUTPUT_SINK_H
@@ -1,17 +1,25 @@
 #ifndef PAPER_CITATION_API_H
 #define PAPER_CITATION_API_H
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
 #include <curl/curl.h>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
-#include <regex>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "trace.h"
+
 namespace citation
 {
 
@@ -61,383 +69,1171 @@ static size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::stri
     }
 }
 
-// Abstract base class
-class CitationSource
+// Percent-encode text for a URL query; unreserved characters are kept
+inline std::string urlEncode(const std::string &text)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string encoded;
+    encoded.reserve(text.size() * 3);
+    for (unsigned char c : text)
+    {
+        if (std::isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~')
+        {
+            encoded.push_back(static_cast<char>(c));
+        }
+        else
+        {
+            encoded.push_back('%');
+            encoded.push_back(hex[c >> 4]);
+            encoded.push_back(hex[c & 0x0F]);
+        }
+    }
+    return encoded;
+}
+
+// HTTP request for one query, built by a source and performed by the caller
+struct HttpRequest
+{
+    std::string url;
+    std::string user_agent;
+    bool use_cookies{false};
+};
+
+// Initialize libcurl once, before the first handle of any kind. Left to the
+// first curl_easy_init(), it would happen implicitly, which is not safe while
+// other threads create handles, e.g. the workers of a batch.
+inline void initCurl()
+{
+    static std::once_flag once;
+    std::call_once(once, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+}
+
+// Set up an easy handle for request, appending the response body to response
+inline void prepareHandle(CURL *curl, const HttpRequest &request, std::string *response)
+{
+    curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, request.user_agent.c_str());
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    if (request.use_cookies)
+    {
+        // Enable the cookie engine without reading a cookie file
+        curl_easy_setopt(curl, CURLOPT_COOKIEFILE, "");
+    }
+}
+
+// Why a finished transfer has no response worth parsing, e.g. "HTTP 429";
+// empty for a 2xx answer. Error pages such as a rate limit or a CAPTCHA would
+// otherwise be parsed into an empty result and cached as if nothing matched.
+inline std::string transferError(CURL *curl, CURLcode code)
+{
+    if (code != CURLE_OK)
+    {
+        return "CURL request failed: " + std::string(curl_easy_strerror(code));
+    }
+    // 0 when the protocol has no status, e.g. file://
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    if (status != 0 && (status < 200 || status > 299))
+    {
+        return "HTTP " + std::to_string(status);
+    }
+    return {};
+}
+
+// Easy handles and a CURLSH share object reused by every request of a run, so
+// DNS results and TLS sessions carry over between queries. The connection cache
+// is not shared: the workers of a converter resolve at the same time, and libcurl
+// does not support sharing connections between concurrent threads.
+// Nothing is created before the first request, so a session that makes none
+// costs nothing (and, with MD2LATEX_LAZY_CURL, does not load libcurl).
+class CurlSession
 {
   public:
-    virtual ~CitationSource() = default;
-    virtual QueryResult query(const std::string &query_string) = 0;
-    virtual std::string name() const = 0;
+    CurlSession() = default;
+
+    ~CurlSession()
+    {
+        // Handles must let go of the share before it can be cleaned up
+        for (CURL *curl : idle)
+        {
+            curl_easy_cleanup(curl);
+        }
+        if (share)
+        {
+            curl_share_cleanup(share);
+        }
+    }
+
+    CurlSession(const CurlSession &) = delete;
+    CurlSession &operator=(const CurlSession &) = delete;
+
+    // A handle with default options attached to the share; nullptr on failure
+    CURL *acquire()
+    {
+        CURL *curl = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (!idle.empty())
+            {
+                curl = idle.back();
+                idle.pop_back();
+            }
+            else if (!share_created)
+            {
+                createShare();
+            }
+        }
+
+        if (curl)
+        {
+            curl_easy_reset(curl);
+        }
+        else
+        {
+            curl = curl_easy_init();
+        }
+        if (curl && share)
+        {
+            curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        }
+        return curl;
+    }
+
+    // Return a handle from acquire() to the pool
+    void release(CURL *curl)
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        idle.push_back(curl);
+    }
+
+  private:
+    void createShare()
+    {
+        initCurl();
+        share_created = true;
+        share = curl_share_init();
+        if (share)
+        {
+            curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+            curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+            curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+            curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        }
+    }
+
+    static void lockShare(CURL *, curl_lock_data data, curl_lock_access, void *session)
+    {
+        static_cast<CurlSession *>(session)->share_locks[data].lock();
+    }
+
+    static void unlockShare(CURL *, curl_lock_data data, void *session)
+    {
+        static_cast<CurlSession *>(session)->share_locks[data].unlock();
+    }
+
+    // Set under pool_mutex by the first acquire()
+    CURLSH *share{nullptr};
+    bool share_created{false};
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> share_locks;
+    std::mutex pool_mutex;
+    std::vector<CURL *> idle;
 };
 
-// CrossRef API implementation
-class CrossRefAPI : public CitationSource
+// Abstract base class. A source builds the request for a query and parses the
+// response, so lookups can either block in query() or be performed
+// concurrently by a ConcurrentResolver.
+class CitationSource
 {
   public:
-    QueryResult query(const std::string &query_string) override
+    virtual ~CitationSource() = default;
+
+    // Request that answers query_string
+    virtual HttpRequest request(const std::string &query_string) const = 0;
+
+    // Papers found in a response body
+    virtual QueryResult parse(const std::string &response) const = 0;
+
+    virtual std::string name() const = 0;
+
+    // Answer query_string without a request, e.g. from a cache
+    virtual bool cached(const std::string & /*query_string*/, QueryResult & /*result*/)
     {
+        return false;
+    }
+
+    // Called with the successful result of a request that got a 2xx answer
+    virtual void store(const std::string & /*query_string*/, const QueryResult & /*result*/) {}
+
+    // Blocking lookup
+    virtual QueryResult query(const std::string &query_string)
+    {
+        TraceSpan span("query", "citation");
+        if (span.recording())
+        {
+            span.arg("source", name());
+            span.arg("query", query_string);
+        }
+
         QueryResult result;
+        if (cached(query_string, result))
+        {
+            span.arg("cached", 1);
+            return result;
+        }
 
         // Initialize CURL
-        CURL *curl = curl_easy_init();
+        initCurl();
+        CURL *curl = session ? session->acquire() : curl_easy_init();
         if (!curl)
         {
             result.error_message = "Failed to initialize CURL";
             return result;
         }
 
-        // Construct URL and encode the query string
-        char *encoded_query = curl_easy_escape(curl, query_string.c_str(), query_string.length());
-        if (!encoded_query)
+        // Perform the request
+        std::string response_string;
+        prepareHandle(curl, request(query_string), &response_string);
+        CURLcode res = curl_easy_perform(curl);
+        if (span.recording())
+        {
+            long status = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+            span.arg("status", status);
+            span.arg("bytes", response_string.size());
+        }
+        result.error_message = transferError(curl, res);
+        if (session)
+        {
+            session->release(curl);
+        }
+        else
         {
             curl_easy_cleanup(curl);
-            result.error_message = "Failed to encode query string";
+        }
+
+        if (!result.error_message.empty())
+        {
             return result;
         }
 
-        std::string url = "https://api.crossref.org/works?query=" + std::string(encoded_query) +
-                          "&rows=5&sort=relevance";
-        curl_free(encoded_query);
+        result = parse(response_string);
+        if (result.success)
+        {
+            store(query_string, result);
+        }
+        return result;
+    }
 
-        // Set request parameters
-        std::string response_string;
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_string);
+    // Perform blocking requests with handles from session instead of a fresh
+    // handle per query
+    virtual void useSession(CurlSession *curl_session) { session = curl_session; }
 
-        // Add user agent and email as recommended by the CrossRef API
-        curl_easy_setopt(curl, CURLOPT_USERAGENT,
-                         "PaperCitationTool/1.0 (mailto:user@example.com)");
+    // Keep the response body in QueryResult::raw_response (off by default)
+    virtual void keepRawResponse(bool keep) { keep_raw_response = keep; }
 
-        // Perform the request
-        CURLcode res = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
+  protected:
+    CurlSession *session{nullptr};
+    bool keep_raw_response{false};
+};
 
-        if (res != CURLE_OK)
+// Citation key from the first author's surname and the year, falling back to
+// the DOI, the start of the title, or the position in the result list
+inline void assignCitationKey(PaperInfo &paper, size_t ordinal)
+{
+    if (!paper.authors.empty() && !paper.year.empty())
+    {
+        // Extract the last name of the first author
+        size_t comma_pos = paper.authors[0].find(",");
+        std::string first_author = (comma_pos != std::string::npos)
+                                       ? paper.authors[0].substr(0, comma_pos)
+                                       : paper.authors[0];
+
+        // Remove non-alphanumeric characters
+        first_author.erase(std::remove_if(first_author.begin(), first_author.end(),
+                                          [](unsigned char c) { return !std::isalnum(c); }),
+                           first_author.end());
+
+        paper.citation_key = first_author + paper.year;
+    }
+    else
+    {
+        // If there is no author or year, use DOI or a part of the title
+        if (!paper.doi.empty())
         {
-            result.error_message = "CURL request failed: " + std::string(curl_easy_strerror(res));
-            return result;
+            paper.citation_key = "doi" + paper.doi.substr(paper.doi.find_last_of("/") + 1);
+        }
+        else if (!paper.title.empty())
+        {
+            std::string short_title = paper.title.substr(0, 20);
+            short_title.erase(std::remove_if(short_title.begin(), short_title.end(),
+                                             [](unsigned char c) { return !std::isalnum(c); }),
+                              short_title.end());
+            paper.citation_key = "title" + short_title;
+        }
+        else
+        {
+            paper.citation_key = "unknown" + std::to_string(ordinal);
         }
+    }
+}
+
+// Builds PaperInfo records straight from the events of a CrossRef /works
+// response, without a JSON DOM. Only message.items[] is looked at, and within
+// each item only the fields a BibTeX entry needs; everything else (reference
+// lists, licenses, funders, ...) is skipped as it streams past. With
+// single_work, the document is one item on its own, as in the lines of a
+// JSONL metadata dump.
+class CrossRefSaxHandler : public nlohmann::json_sax<nlohmann::json>
+{
+  public:
+    explicit CrossRefSaxHandler(std::vector<PaperInfo> &papers, bool single_work = false)
+        : papers(papers), single_work(single_work)
+    {
+    }
 
-        result.raw_response = response_string;
+    bool null() override { return value(nullptr, nullptr); }
+    bool boolean(bool) override { return value(nullptr, nullptr); }
+    bool number_integer(number_integer_t number) override { return value(nullptr, &number); }
+    bool number_unsigned(number_unsigned_t number) override
+    {
+        auto integer = static_cast<number_integer_t>(number);
+        return value(nullptr, &integer);
+    }
+    bool number_float(number_float_t, const string_t &) override { return value(nullptr, nullptr); }
+    bool string(string_t &text) override { return value(&text, nullptr); }
+    bool binary(binary_t &) override { return value(nullptr, nullptr); }
 
-        try
+    bool start_object(std::size_t) override { return open(false); }
+    bool start_array(std::size_t) override { return open(true); }
+    bool end_object() override { return close(); }
+    bool end_array() override { return close(); }
+
+    bool key(string_t &name) override
+    {
+        if (skip_depth == 0)
         {
-            // Parse JSON response
-            auto json = nlohmann::json::parse(response_string);
-            auto items = json["message"]["items"];
+            stack.back().key = std::move(name);
+        }
+        return true;
+    }
 
-            for (const auto &item : items)
+    bool parse_error(std::size_t, const std::string &, const nlohmann::json::exception &e) override
+    {
+        error = e.what();
+        return false;
+    }
+
+    // Message of the parse error, if parsing failed
+    const std::string &getError() const { return error; }
+
+  private:
+    enum class Context
+    {
+        Root,
+        Message,
+        Items,
+        Item,
+        Title,
+        ContainerTitle,
+        Authors,
+        Author,
+        Published,
+        DateParts,
+        DatePart,
+    };
+
+    struct Frame
+    {
+        Context context;
+        std::string key;   // last key read, for objects
+        size_t element{0}; // elements seen so far, for arrays
+    };
+
+    // Context of a container opened at the current position, or false if its
+    // contents are not needed
+    bool childContext(bool array, Context &context) const
+    {
+        if (stack.empty())
+        {
+            context = single_work ? Context::Item : Context::Root;
+            return !array;
+        }
+
+        const Frame &parent = stack.back();
+        switch (parent.context)
+        {
+        case Context::Root:
+            context = Context::Message;
+            return !array && parent.key == "message";
+        case Context::Message:
+            context = Context::Items;
+            return array && parent.key == "items";
+        case Context::Items:
+            context = Context::Item;
+            return !array;
+        case Context::Item:
+            if (array && parent.key == "title")
+            {
+                context = Context::Title;
+                return true;
+            }
+            if (array && parent.key == "container-title")
+            {
+                context = Context::ContainerTitle;
+                return true;
+            }
+            if (array && parent.key == "author")
             {
-                PaperInfo paper;
+                context = Context::Authors;
+                return true;
+            }
+            context = Context::Published;
+            return !array && parent.key == "published";
+        case Context::Authors:
+            context = Context::Author;
+            return !array;
+        case Context::Published:
+            context = Context::DateParts;
+            return array && parent.key == "date-parts";
+        case Context::DateParts:
+            // Only the first date matters
+            context = Context::DatePart;
+            return array && parent.element == 0;
+        default:
+            return false;
+        }
+    }
 
-                // Extract title
-                if (item.contains("title") && !item["title"].empty())
-                {
-                    paper.title = item["title"][0];
-                }
+    bool open(bool array)
+    {
+        if (skip_depth > 0)
+        {
+            ++skip_depth;
+            return true;
+        }
 
-                // Extract authors
-                if (item.contains("author"))
-                {
-                    for (const auto &author : item["author"])
-                    {
-                        std::string author_name;
-                        if (author.contains("family"))
-                        {
-                            author_name = author["family"].get<std::string>();
-                        }
-                        if (author.contains("given"))
-                        {
-                            if (!author_name.empty())
-                                author_name += ", ";
-                            author_name += author["given"].get<std::string>();
-                        }
-                        if (!author_name.empty())
-                        {
-                            paper.authors.push_back(author_name);
-                        }
-                    }
-                }
+        Context context;
+        bool wanted = childContext(array, context);
+        if (!stack.empty())
+        {
+            ++stack.back().element;
+        }
+        if (!wanted)
+        {
+            skip_depth = 1;
+            return true;
+        }
 
-                // Extract journal information
-                if (item.contains("container-title") && !item["container-title"].empty())
-                {
-                    paper.journal = item["container-title"][0];
-                }
+        if (context == Context::Item)
+        {
+            current = PaperInfo();
+        }
+        else if (context == Context::Author)
+        {
+            family.clear();
+            given.clear();
+        }
+        stack.push_back({context, {}, 0});
+        return true;
+    }
 
-                // Extract volume number
-                if (item.contains("volume"))
-                {
-                    paper.volume = item["volume"];
-                }
+    bool close()
+    {
+        if (skip_depth > 0)
+        {
+            --skip_depth;
+            return true;
+        }
 
-                // Extract issue number
-                if (item.contains("issue"))
-                {
-                    paper.issue = item["issue"];
-                }
+        Context context = stack.back().context;
+        stack.pop_back();
+        if (context == Context::Item)
+        {
+            assignCitationKey(current, papers.size() + 1);
+            papers.push_back(std::move(current));
+        }
+        else if (context == Context::Author)
+        {
+            std::string author_name = family;
+            if (given_seen)
+            {
+                if (!author_name.empty())
+                    author_name += ", ";
+                author_name += given;
+            }
+            if (!author_name.empty())
+            {
+                current.authors.push_back(std::move(author_name));
+            }
+            given_seen = false;
+        }
+        return true;
+    }
 
-                // Extract page numbers
-                if (item.contains("page"))
-                {
-                    paper.pages = item["page"];
-                }
+    // A scalar value; text is set for strings and number for integers
+    bool value(string_t *text, number_integer_t *number)
+    {
+        if (skip_depth > 0 || stack.empty())
+        {
+            return true;
+        }
 
-                // Extract year
-                if (item.contains("published") && item["published"].contains("date-parts") &&
-                    !item["published"]["date-parts"].empty() &&
-                    !item["published"]["date-parts"][0].empty())
-                {
-                    paper.year = std::to_string(item["published"]["date-parts"][0][0].get<int>());
-                }
+        Frame &frame = stack.back();
+        size_t element = frame.element++;
+        switch (frame.context)
+        {
+        case Context::Item:
+            if (text)
+            {
+                storeField(frame.key, *text);
+            }
+            break;
+        case Context::Title:
+            if (text && element == 0)
+            {
+                current.title = std::move(*text);
+            }
+            break;
+        case Context::ContainerTitle:
+            if (text && element == 0)
+            {
+                current.journal = std::move(*text);
+            }
+            break;
+        case Context::Author:
+            if (text && frame.key == "family")
+            {
+                family = std::move(*text);
+            }
+            else if (text && frame.key == "given")
+            {
+                given = std::move(*text);
+                given_seen = true;
+            }
+            break;
+        case Context::DatePart:
+            if (number && element == 0)
+            {
+                current.year = std::to_string(*number);
+            }
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
 
-                // Extract DOI
-                if (item.contains("DOI"))
-                {
-                    paper.doi = item["DOI"];
-                }
+    void storeField(const std::string &field, string_t &text)
+    {
+        if (field == "volume")
+        {
+            current.volume = std::move(text);
+        }
+        else if (field == "issue")
+        {
+            current.issue = std::move(text);
+        }
+        else if (field == "page")
+        {
+            current.pages = std::move(text);
+        }
+        else if (field == "DOI")
+        {
+            current.doi = std::move(text);
+        }
+        else if (field == "URL")
+        {
+            current.url = std::move(text);
+        }
+        else if (field == "publisher")
+        {
+            current.publisher = std::move(text);
+        }
+    }
 
-                // Extract URL
-                if (item.contains("URL"))
-                {
-                    paper.url = item["URL"];
-                }
+    std::vector<PaperInfo> &papers;
+    bool single_work;
+    std::vector<Frame> stack;
+    // Nesting depth inside a container whose contents are ignored
+    size_t skip_depth{0};
+    PaperInfo current;
+    std::string family;
+    std::string given;
+    bool given_seen{false};
+    std::string error;
+};
 
-                // Extract publisher information
-                if (item.contains("publisher"))
-                {
-                    paper.publisher = item["publisher"];
-                }
+// CrossRef API implementation
+class CrossRefAPI : public CitationSource
+{
+  public:
+    explicit CrossRefAPI(std::string base_url = "https://api.crossref.org")
+        : base_url(std::move(base_url))
+    {
+    }
 
-                // Generate citation key
-                if (!paper.authors.empty() && !paper.year.empty())
-                {
-                    // Extract the last name of the first author
-                    size_t comma_pos = paper.authors[0].find(",");
-                    std::string first_author = (comma_pos != std::string::npos)
-                                                   ? paper.authors[0].substr(0, comma_pos)
-                                                   : paper.authors[0];
-
-                    // Remove non-alphanumeric characters
-                    first_author.erase(std::remove_if(first_author.begin(), first_author.end(),
-                                                      [](unsigned char c)
-                                                      { return !std::isalnum(c); }),
-                                       first_author.end());
-
-                    paper.citation_key = first_author + paper.year;
-                }
-                else
-                {
-                    // If there is no author or year, use DOI or a part of the title
-                    if (!paper.doi.empty())
-                    {
-                        paper.citation_key =
-                            "doi" + paper.doi.substr(paper.doi.find_last_of("/") + 1);
-                    }
-                    else if (!paper.title.empty())
-                    {
-                        std::string short_title = paper.title.substr(0, 20);
-                        short_title.erase(std::remove_if(short_title.begin(), short_title.end(),
-                                                         [](unsigned char c)
-                                                         { return !std::isalnum(c); }),
-                                          short_title.end());
-                        paper.citation_key = "title" + short_title;
-                    }
-                    else
-                    {
-                        paper.citation_key = "unknown" + std::to_string(result.papers.size() + 1);
-                    }
-                }
+    HttpRequest request(const std::string &query_string) const override
+    {
+        HttpRequest request;
+        request.url =
+            base_url + "/works?query=" + urlEncode(query_string) + "&rows=5&sort=relevance";
+        // Add user agent and email as recommended by the CrossRef API
+        request.user_agent = "PaperCitationTool/1.0 (mailto:user@example.com)";
+        return request;
+    }
 
-                result.papers.push_back(paper);
-            }
+    QueryResult parse(const std::string &response) const override
+    {
+        QueryResult result;
+        if (keep_raw_response)
+        {
+            result.raw_response = response;
+        }
 
+        // Stream the response into PaperInfo records without building a DOM
+        CrossRefSaxHandler handler(result.papers);
+        if (nlohmann::json::sax_parse(response, &handler))
+        {
             result.success = true;
         }
-        catch (const std::exception &e)
+        else
         {
-            result.error_message = "Failed to parse response: " + std::string(e.what());
+            result.papers.clear();
+            result.error_message = "Failed to parse response: " + handler.getError();
         }
 
         return result;
     }
 
     std::string name() const override { return "CrossRef"; }
+
+  private:
+    std::string base_url;
 };
 
-// Google Scholar API implementation
-class GoogleScholarAPI : public CitationSource
+// Single pass over a Google Scholar results page. The scan jumps from tag to
+// tag; text is collected only inside the title (h3.gs_rt) and byline
+// (div.gs_a) of each result block (div.gs_ri), which ends at its matching
+// </div>. Scripts, styles and comments are skipped whole.
+class ScholarHtmlParser
 {
   public:
-    QueryResult query(const std::string &query_string) override
+    static std::vector<PaperInfo> parse(std::string_view html)
     {
-        QueryResult result;
+        ScholarHtmlParser parser(html);
+        parser.run();
+        return std::move(parser.papers);
+    }
 
-        // Initialize CURL
-        CURL *curl = curl_easy_init();
-        if (!curl)
+  private:
+    enum class Field
+    {
+        None,
+        Title,
+        Byline,
+    };
+
+    struct Tag
+    {
+        std::string_view name;
+        std::string_view cls;
+        bool closing{false};
+    };
+
+    explicit ScholarHtmlParser(std::string_view html) : html(html) {}
+
+    static bool hasClass(std::string_view classes, std::string_view name)
+    {
+        size_t pos = 0;
+        while (pos < classes.size())
         {
-            result.error_message = "Failed to initialize CURL";
-            return result;
+            size_t end = classes.find(' ', pos);
+            if (end == std::string_view::npos)
+            {
+                end = classes.size();
+            }
+            if (classes.substr(pos, end - pos) == name)
+            {
+                return true;
+            }
+            pos = end + 1;
         }
+        return false;
+    }
+
+    static bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+    }
 
-        // Construct URL and encode the query string
-        char *encoded_query = curl_easy_escape(curl, query_string.c_str(), query_string.length());
-        if (!encoded_query)
+    // Read the tag at html[pos] == '<' and return the position after its '>'
+    size_t readTag(size_t pos, Tag &tag) const
+    {
+        size_t i = pos + 1;
+        tag.closing = i < html.size() && html[i] == '/';
+        if (tag.closing)
         {
-            curl_easy_cleanup(curl);
-            result.error_message = "Failed to encode query string";
-            return result;
+            ++i;
         }
+        size_t name_start = i;
+        while (i < html.size() && !isSpace(html[i]) && html[i] != '>' && html[i] != '/')
+        {
+            ++i;
+        }
+        tag.name = html.substr(name_start, i - name_start);
+        tag.cls = {};
 
-        std::string url = "https://scholar.google.com/scholar?q=" + std::string(encoded_query) +
-                          "&hl=en&as_sdt=0,5";
-        curl_free(encoded_query);
-
-        // Set request parameters
-        std::string response_string;
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_string);
+        // Attributes; quoted values may contain '>'
+        while (i < html.size() && html[i] != '>')
+        {
+            if (isSpace(html[i]) || html[i] == '/')
+            {
+                ++i;
+                continue;
+            }
+            size_t attr_start = i;
+            while (i < html.size() && !isSpace(html[i]) && html[i] != '=' && html[i] != '>')
+            {
+                ++i;
+            }
+            std::string_view attr = html.substr(attr_start, i - attr_start);
+            if (i >= html.size() || html[i] != '=')
+            {
+                continue;
+            }
 
-        // Add user agent
-        curl_easy_setopt(curl, CURLOPT_USERAGENT,
-                         "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+            ++i;
+            size_t value_start = i;
+            size_t value_end = i;
+            if (i < html.size() && (html[i] == '"' || html[i] == '\''))
+            {
+                char quote = html[i];
+                value_start = i + 1;
+                value_end = html.find(quote, value_start);
+                if (value_end == std::string_view::npos)
+                {
+                    value_end = html.size();
+                }
+                i = std::min(value_end + 1, html.size());
+            }
+            else
+            {
+                while (i < html.size() && !isSpace(html[i]) && html[i] != '>')
+                {
+                    ++i;
+                }
+                value_end = i;
+            }
+            if (attr == "class")
+            {
+                tag.cls = html.substr(value_start, value_end - value_start);
+            }
+        }
+        return std::min(i + 1, html.size());
+    }
 
-        // Set cookie file
-        curl_easy_setopt(curl, CURLOPT_COOKIEFILE, "");
+    // Position just past the first occurrence of marker at or after pos
+    size_t skipPast(size_t pos, std::string_view marker) const
+    {
+        size_t found = html.find(marker, pos);
+        return found == std::string_view::npos ? html.size() : found + marker.size();
+    }
 
-        // Perform the request
-        CURLcode res = curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
+    // Append UTF-8 for a code point; &nbsp; becomes a space, direction marks vanish
+    void appendCodePoint(unsigned long code)
+    {
+        if (code == 0xA0)
+        {
+            appendChar(' ');
+        }
+        else if (code == 0x200E || code == 0x200F || code == 0 || code > 0x10FFFF)
+        {
+        }
+        else if (code < 0x80)
+        {
+            appendChar(static_cast<char>(code));
+        }
+        else if (code < 0x800)
+        {
+            text.push_back(static_cast<char>(0xC0 | (code >> 6)));
+            text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+        else if (code < 0x10000)
+        {
+            text.push_back(static_cast<char>(0xE0 | (code >> 12)));
+            text.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+        else
+        {
+            text.push_back(static_cast<char>(0xF0 | (code >> 18)));
+            text.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+            text.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+    }
 
-        if (res != CURLE_OK)
+    // Append one character, collapsing whitespace runs into one space
+    void appendChar(char c)
+    {
+        if (isSpace(c))
         {
-            result.error_message = "CURL request failed: " + std::string(curl_easy_strerror(res));
-            return result;
+            if (!text.empty() && text.back() != ' ')
+            {
+                text.push_back(' ');
+            }
+            return;
         }
+        text.push_back(c);
+    }
 
-        result.raw_response = response_string;
+    // Append a run of character data, decoding entities
+    void appendText(std::string_view run)
+    {
+        static const std::pair<std::string_view, char> named[] = {
+            {"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'}, {"apos", '\''}, {"nbsp", ' '}};
 
-        try
+        for (size_t i = 0; i < run.size(); ++i)
         {
-            // Parse HTML response
-            // Note: A HTML parsing library such as libxml2 or pugixml should be included here.
-            // The following is a simplified parsing logic.
-            std::istringstream stream(response_string);
-            std::string line;
-            PaperInfo current_paper;
-            bool in_result = false;
+            if (run[i] != '&')
+            {
+                appendChar(run[i]);
+                continue;
+            }
 
-            while (std::getline(stream, line))
+            size_t semicolon = run.find(';', i + 1);
+            if (semicolon == std::string_view::npos || semicolon - i > 10)
+            {
+                appendChar('&');
+                continue;
+            }
+            std::string_view entity = run.substr(i + 1, semicolon - i - 1);
+            bool decoded = false;
+            if (entity.size() > 1 && entity[0] == '#')
             {
-                // Detect start of a result
-                if (line.find("<div class=\"gs_ri\">") != std::string::npos)
+                bool hex = entity[1] == 'x' || entity[1] == 'X';
+                std::string digits(entity.substr(hex ? 2 : 1));
+                char *end = nullptr;
+                unsigned long code = std::strtoul(digits.c_str(), &end, hex ? 16 : 10);
+                if (!digits.empty() && *end == '\0')
                 {
-                    in_result = true;
-                    current_paper = PaperInfo();
-                    continue;
+                    appendCodePoint(code);
+                    decoded = true;
                 }
-
-                if (in_result)
+            }
+            else
+            {
+                for (const auto &[name, chr] : named)
                 {
-                    // Extract title
-                    if (line.find("<h3 class=\"gs_rt\">") != std::string::npos)
+                    if (entity == name)
                     {
-                        size_t start = line.find(">") + 1;
-                        size_t end = line.find("</h3>");
-                        if (start != std::string::npos && end != std::string::npos)
-                        {
-                            current_paper.title = line.substr(start, end - start);
-                        }
+                        appendChar(chr);
+                        decoded = true;
+                        break;
                     }
+                }
+            }
 
-                    // Extract authors and year
-                    if (line.find("<div class=\"gs_a\">") != std::string::npos)
-                    {
-                        size_t start = line.find(">") + 1;
-                        size_t end = line.find("</div>");
-                        if (start != std::string::npos && end != std::string::npos)
-                        {
-                            std::string author_text = line.substr(start, end - start);
-                            // Parse authors
-                            std::istringstream author_stream(author_text);
-                            std::string author;
-                            while (std::getline(author_stream, author, ','))
-                            {
-                                if (author.find("...") == std::string::npos)
-                                {
-                                    current_paper.authors.push_back(author);
-                                }
-                            }
-
-                            // Try to extract year
-                            std::regex year_pattern("\\b(19|20)\\d{2}\\b");
-                            std::smatch year_match;
-                            if (std::regex_search(author_text, year_match, year_pattern))
-                            {
-                                current_paper.year = year_match.str();
-                            }
-                        }
-                    }
+            if (decoded)
+            {
+                i = semicolon;
+            }
+            else
+            {
+                appendChar('&');
+            }
+        }
+    }
 
-                    // Detect the end of a result
-                    if (line.find("</div>") != std::string::npos)
-                    {
-                        in_result = false;
-                        if (!current_paper.title.empty())
-                        {
-                            // Generate citation key
-                            if (!current_paper.authors.empty() && !current_paper.year.empty())
-                            {
-                                size_t comma_pos = current_paper.authors[0].find(",");
-                                std::string first_author =
-                                    (comma_pos != std::string::npos)
-                                        ? current_paper.authors[0].substr(0, comma_pos)
-                                        : current_paper.authors[0];
-
-                                first_author.erase(std::remove_if(first_author.begin(),
-                                                                  first_author.end(),
-                                                                  [](unsigned char c)
-                                                                  { return !std::isalnum(c); }),
-                                                   first_author.end());
-
-                                current_paper.citation_key = first_author + current_paper.year;
-                            }
-
-                            result.papers.push_back(current_paper);
-                        }
-                    }
+    static std::string_view trim(std::string_view text)
+    {
+        while (!text.empty() && isSpace(text.front()))
+        {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && isSpace(text.back()))
+        {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+
+    // "A Smith, B Jones - Journal, 2019 - publisher"
+    void finishByline()
+    {
+        std::string_view byline = trim(text);
+
+        std::string_view names = byline.substr(0, byline.find(" - "));
+        size_t pos = 0;
+        while (pos <= names.size())
+        {
+            size_t comma = names.find(',', pos);
+            if (comma == std::string_view::npos)
+            {
+                comma = names.size();
+            }
+            std::string_view author = trim(names.substr(pos, comma - pos));
+            // Truncated author lists end in an ellipsis
+            if (!author.empty() && author.find("...") == std::string_view::npos &&
+                author.find("\xE2\x80\xA6") == std::string_view::npos)
+            {
+                paper.authors.emplace_back(author);
+            }
+            pos = comma + 1;
+        }
+
+        // First 19xx or 20xx standing on its own
+        auto isWordChar = [](char c)
+        { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+        for (size_t i = 0; i + 4 <= byline.size(); ++i)
+        {
+            if ((byline[i] == '1' && byline[i + 1] == '9') ||
+                (byline[i] == '2' && byline[i + 1] == '0'))
+            {
+                bool digits = std::isdigit(static_cast<unsigned char>(byline[i + 2])) &&
+                              std::isdigit(static_cast<unsigned char>(byline[i + 3]));
+                bool bounded = (i == 0 || !isWordChar(byline[i - 1])) &&
+                               (i + 4 == byline.size() || !isWordChar(byline[i + 4]));
+                if (digits && bounded)
+                {
+                    paper.year = std::string(byline.substr(i, 4));
+                    break;
                 }
             }
+        }
+    }
 
-            result.success = true;
+    void finishResult()
+    {
+        if (!paper.title.empty())
+        {
+            if (!paper.authors.empty() && !paper.year.empty())
+            {
+                assignCitationKey(paper, papers.size() + 1);
+            }
+            papers.push_back(std::move(paper));
         }
-        catch (const std::exception &e)
+        paper = PaperInfo();
+        in_result = false;
+        field = Field::None;
+    }
+
+    void handleTag(const Tag &tag)
+    {
+        if (tag.name == "div")
+        {
+            if (!in_result)
+            {
+                if (!tag.closing && hasClass(tag.cls, "gs_ri"))
+                {
+                    in_result = true;
+                    div_depth = 1;
+                }
+                return;
+            }
+
+            if (!tag.closing)
+            {
+                ++div_depth;
+                if (field == Field::None && hasClass(tag.cls, "gs_a"))
+                {
+                    field = Field::Byline;
+                    field_depth = div_depth;
+                    text.clear();
+                }
+                return;
+            }
+
+            if (field == Field::Byline && div_depth == field_depth)
+            {
+                finishByline();
+                field = Field::None;
+            }
+            if (--div_depth == 0)
+            {
+                finishResult();
+            }
+        }
+        else if (!in_result)
+        {
+            return;
+        }
+        else if (tag.name == "h3")
+        {
+            if (!tag.closing && field == Field::None && hasClass(tag.cls, "gs_rt"))
+            {
+                field = Field::Title;
+                text.clear();
+                skip_depth = 0;
+            }
+            else if (tag.closing && field == Field::Title)
+            {
+                paper.title = std::string(trim(text));
+                field = Field::None;
+            }
+        }
+        else if (tag.name == "span" && field == Field::Title)
+        {
+            // Drop the [BOOK], [PDF], ... markers in front of titles
+            if (tag.closing)
+            {
+                skip_depth -= skip_depth > 0 ? 1 : 0;
+            }
+            else if (skip_depth > 0 || tag.cls.substr(0, 5) == "gs_ct")
+            {
+                ++skip_depth;
+            }
+        }
+    }
+
+    void run()
+    {
+        size_t pos = 0;
+        while (pos < html.size())
+        {
+            size_t open = html.find('<', pos);
+            if (open == std::string_view::npos)
+            {
+                open = html.size();
+            }
+            if (field != Field::None && skip_depth == 0)
+            {
+                appendText(html.substr(pos, open - pos));
+            }
+            if (open == html.size())
+            {
+                break;
+            }
+
+            if (html.compare(open, 4, "<!--") == 0)
+            {
+                pos = skipPast(open + 4, "-->");
+                continue;
+            }
+
+            Tag tag;
+            pos = readTag(open, tag);
+            if (!tag.closing && (tag.name == "script" || tag.name == "style"))
+            {
+                pos = skipPast(pos, tag.name == "script" ? "</script" : "</style");
+                pos = skipPast(pos, ">");
+                continue;
+            }
+            handleTag(tag);
+        }
+
+        // A result left open at the end of the page
+        if (in_result)
+        {
+            if (field == Field::Byline)
+            {
+                finishByline();
+            }
+            finishResult();
+        }
+    }
+
+    std::string_view html;
+    std::vector<PaperInfo> papers;
+    PaperInfo paper;
+    bool in_result{false};
+    // Open divs in the current result, counting the gs_ri div itself
+    int div_depth{0};
+    Field field{Field::None};
+    int field_depth{0};
+    // Open spans being dropped from the title
+    int skip_depth{0};
+    // Text of the field being collected
+    std::string text;
+};
+
+// Google Scholar API implementation
+class GoogleScholarAPI : public CitationSource
+{
+  public:
+    explicit GoogleScholarAPI(std::string base_url = "https://scholar.google.com")
+        : base_url(std::move(base_url))
+    {
+    }
+
+    HttpRequest request(const std::string &query_string) const override
+    {
+        HttpRequest request;
+        request.url = base_url + "/scholar?q=" + urlEncode(query_string) + "&hl=en&as_sdt=0,5";
+        request.user_agent = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36";
+        request.use_cookies = true;
+        return request;
+    }
+
+    QueryResult parse(const std::string &response) const override
+    {
+        QueryResult result;
+        if (keep_raw_response)
         {
-            result.error_message = "Failed to parse response: " + std::string(e.what());
+            result.raw_response = response;
         }
 
+        result.papers = ScholarHtmlParser::parse(response);
+        result.success = true;
         return result;
     }
 
     std::string name() const override { return "Google Scholar"; }
+
+  private:
+    std::string base_url;
 };
 
 // Paper citation API class
 class PaperCitationAPI
 {
   private:
+    // Shared by every source for the lifetime of the API object
+    std::unique_ptr<CurlSession> session{std::make_unique<CurlSession>()};
     std::vector<std::unique_ptr<CitationSource>> sources;
 
   public:
-    PaperCitationAPI()
+    // A non-empty base_url replaces the service address of every source, e.g.
+    // to run against a local test server
+    explicit PaperCitationAPI(const std::string &base_url = "")
     {
         // Add supported data sources
         // sources.push_back(std::make_unique<CrossRefAPI>());
-        sources.push_back(std::make_unique<GoogleScholarAPI>());
+        sources.push_back(base_url.empty() ? std::make_unique<GoogleScholarAPI>()
+                                           : std::make_unique<GoogleScholarAPI>(base_url));
         // Additional sources can be added, such as arXiv, IEEE Xplore, Scopus, etc.
+
+        for (auto &source : sources)
+        {
+            source->useSession(session.get());
+        }
+    }
+
+    CurlSession &getSession() const { return *session; }
+
+    // Sources in query order
+    std::vector<CitationSource *> getSources() const
+    {
+        std::vector<CitationSource *> list;
+        for (const auto &source : sources)
+        {
+            list.push_back(source.get());
+        }
+        return list;
+    }
+
+    // Replace every source by wrap(source), e.g. to add caching
+    void wrapSources(
+        const std::function<std::unique_ptr<CitationSource>(std::unique_ptr<CitationSource>)> &wrap)
+    {
+        for (auto &source : sources)
+        {
+            source = wrap(std::move(source));
+            source->useSession(session.get());
+        }
     }
 
     // Search for papers with the given query string
@@ -447,7 +1243,7 @@ class PaperCitationAPI
 
         for (const auto &source : sources)
         {
-            std::cout << "Querying " << source->name() << "..." << "\n";
+            std::cerr << "Querying " << source->name() << "..." << "\n";
             auto query_result = source->query(query_string);
 
             if (query_result.success)
@@ -564,10 +1360,23 @@ class PaperCitationAPI
         return bib_entry;
     }
 
+    // The contents of a .bib file holding papers
+    std::string toBibFile(const std::vector<PaperInfo> &papers)
+    {
+        std::string bib_file;
+        for (const auto &paper : papers)
+        {
+            bib_file += toBibTeX(paper) + "\n\n";
+        }
+        return bib_file;
+    }
+
     // Generate and save a .bib file
     bool saveBibFile(const std::vector<PaperInfo> &papers,
                      const std::string &filename = "references.bib")
     {
+        TraceSpan span("saveBibFile", "citation");
+        span.arg("entries", papers.size());
         try
         {
             std::ofstream bib_file(filename);
@@ -577,13 +1386,10 @@ class PaperCitationAPI
                 return false;
             }
 
-            for (const auto &paper : papers)
-            {
-                bib_file << toBibTeX(paper) << "\n\n";
-            }
+            bib_file << toBibFile(papers);
 
             bib_file.close();
-            std::cout << "BibTeX file saved: " << std::filesystem::absolute(filename).string()
+            std::cerr << "BibTeX file saved: " << std::filesystem::absolute(filename).string()
                       << "\n";
             return true;
         }
@@ -0,0 +1,69 @@
+// thread_pool.h
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool with one task deque per worker. Tasks submitted from
+// outside the pool are spread over the workers and start in submission
+// order; tasks a worker submits itself go to its own deque and run newest
+// first, while they are hot in its cache. A worker that runs dry steals the
+// oldest task of another worker, so one long task never holds back the
+// queue behind it.
+class ThreadPool
+{
+  public:
+    // Tasks receive the index of the worker running them, in [0, size())
+    using Task = std::function<void(size_t worker)>;
+
+    // threads == 0 uses one worker per hardware thread
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(Task task);
+
+    // Block until every submitted task has finished
+    void wait();
+
+    size_t size() const;
+
+  private:
+    struct Entry
+    {
+        Task task;
+        // Submitted by the worker owning the queue
+        bool spawned;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Entry> tasks;
+    };
+
+    void workerLoop(size_t worker);
+    bool takeTask(size_t worker, Task &task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t queued{0};
+    size_t pending{0};
+    size_t nextQueue{0};
+    bool stopping{false};
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,117 @@
+// trace.h
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Timeline recorder writing Chrome trace-event JSON, which chrome://tracing
+// and ui.perfetto.dev display. Each thread appends to its own buffer, so
+// recording takes no shared lock; the buffers are merged when the trace is
+// written. While tracing is off a span costs one relaxed atomic load.
+//
+// Event names and categories must be string literals (or otherwise outlive
+// the trace); anything dynamic goes into the arguments.
+class Tracer
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    // Discard anything recorded before and start recording. The calling
+    // thread is named "main".
+    static void start();
+
+    // Stop recording and write everything recorded since start() to path. On
+    // failure returns false and sets error.
+    static bool stop(const std::string &path, std::string &error);
+
+    // Label the calling thread in the trace; may be called before start()
+    static void setThreadName(const std::string &name);
+
+    // A span on the calling thread; spans of one thread must nest
+    static void complete(const char *name, const char *category, Clock::time_point start,
+                         Clock::time_point end, std::string args = {});
+
+    // A span that may overlap others on the same thread, e.g. one of several
+    // requests in flight at once. Spans with the same category and id share a
+    // track.
+    static void async(const char *name, const char *category, std::uint64_t id,
+                      Clock::time_point start, Clock::time_point end, std::string args = {});
+
+    // Append "key":value to a list of arguments in JSON
+    static void appendArg(std::string &args, const char *key, long long value);
+    static void appendArg(std::string &args, const char *key, double value);
+    static void appendArg(std::string &args, const char *key, std::string_view value);
+
+  private:
+    inline static std::atomic<bool> active{false};
+};
+
+// Records a span from construction to destruction on the calling thread
+class TraceSpan
+{
+  public:
+    TraceSpan(const char *name, const char *category)
+        : name(name), category(category), active(Tracer::enabled())
+    {
+        if (active)
+        {
+            start = Tracer::Clock::now();
+        }
+    }
+
+    ~TraceSpan() { end(); }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    // End the span before the end of its scope
+    void end()
+    {
+        if (active)
+        {
+            Tracer::complete(name, category, start, Tracer::Clock::now(), std::move(args));
+            active = false;
+        }
+    }
+
+    // Whether this span is recorded; arguments that are costly to compute
+    // can be skipped otherwise
+    bool recording() const { return active; }
+
+    // Attach a number or string shown with the span
+    template <typename T> void arg(const char *key, const T &value)
+    {
+        if (!active)
+        {
+            return;
+        }
+        if constexpr (std::is_integral_v<T>)
+        {
+            Tracer::appendArg(args, key, static_cast<long long>(value));
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            Tracer::appendArg(args, key, static_cast<double>(value));
+        }
+        else
+        {
+            Tracer::appendArg(args, key, std::string_view(value));
+        }
+    }
+
+  private:
+    const char *name;
+    const char *category;
+    bool active;
+    Tracer::Clock::time_point start;
+    std::string args;
+};
+
+#endif // TRACE_H
@@ -1,25 +1,98 @@
-#include <curl/curl.h>
+#include <chrono>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <unistd.h>
 #include <vector>
 
+#include "batch_converter.h"
+#include "citation_ingester.h"
+#include "conversion_server.h"
+#include "file_watcher.h"
+#include "latex_template.h"
+#include "mapped_file.h"
 #include "md_converter.h"
+#include "output_sink.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Progress messages and summaries go here: stdout at the interactive prompt,
+// stderr when running a single command from the arguments, so that stdout
+// can carry the LaTeX
+std::ostream *statusStream = &std::cout;
+
+std::ostream &status() { return *statusStream; }
 
 void printUsage()
 {
     std::cout << "\n===== Markdown to LaTeX Converter =====\n";
     std::cout << "Available commands:\n";
-    std::cout << "  1. convert <input_markdown_file> [output_latex_file]\n";
-    std::cout << "     - Convert a markdown file to LaTeX\n";
+    std::cout << "  1. convert <input_markdown_file> [output_latex_file] [-o output_latex_file]\n";
+    std::cout << "             [-j threads]\n";
+    std::cout << "     - Convert a markdown file to LaTeX; - reads standard input or writes\n";
+    std::cout << "       standard output, which never prompts for citations\n";
     std::cout << "     - If output file is not specified, output will be written to "
                  "input_file_name.tex\n";
-    std::cout << "  2. help\n";
+    std::cout << "     - With -j, large files are split at block boundaries and converted\n";
+    std::cout << "       in parallel (0 = one thread per core)\n";
+    std::cout << "  2. batch <directory|file_list> [output_directory] [-j threads]\n";
+    std::cout << "     - Convert every .md file below a directory, or every file listed in\n";
+    std::cout << "       file_list, in parallel (default: one thread per core). Never prompts\n";
+    std::cout << "       for citations\n";
+    std::cout << "  3. watch <input_markdown_file> [output_latex_file]\n";
+    std::cout << "     - Convert, then convert again whenever the file is saved, redoing only\n";
+    std::cout << "       the blocks that changed; press Enter to stop. Never prompts for\n";
+    std::cout << "       citations\n";
+    std::cout << "  4. serve <socket_path> [--http port] [-j threads] [--timeout seconds]\n";
+    std::cout << "     - Convert documents sent over a Unix domain socket, and over HTTP on\n";
+    std::cout << "       127.0.0.1 with --http, until Enter is pressed; see conversion_server.h\n";
+    std::cout << "       for the protocols. Never prompts for citations\n";
+    std::cout << "  5. ingest <dump.jsonl>... -o <store_file> [-j threads]\n";
+    std::cout << "     - Index JSONL metadata dumps (one CrossRef work per line) into a\n";
+    std::cout << "       citation store for --store, in parallel (default: one thread per "
+                 "core)\n";
+    std::cout << "  Options for convert, batch, watch and serve:\n";
+    std::cout << "     --cache <file>        - Citation cache file "
+                 "(default .md2latex-citations.msgpack)\n";
+    std::cout << "     --no-cache            - Do not read or write the citation cache\n";
+    std::cout << "     --cache-ttl <seconds> - Re-query cached references older than this "
+                 "(0 = never)\n";
+    std::cout << "     --refresh-cache       - Ignore cached lookups and query again\n";
+    std::cout << "     --citation-jobs <n>   - Citation lookups kept in flight at once "
+                 "(default 8)\n";
+    std::cout << "     --citation-url <url>  - Send citation lookups to another server\n";
+    std::cout << "     --match-threshold <s> - Accept the best candidate scoring at least "
+                 "s (0-1, default 0.7)\n";
+    std::cout << "     --no-prompt           - Skip references without a confident match "
+                 "instead of asking\n";
+    std::cout << "     --bib <file>          - Match references in a BibTeX file before "
+                 "looking them up\n";
+    std::cout << "                             online (repeatable; indexed into <file>.idx)\n";
+    std::cout << "     --store <file>        - Also match references in a store built by "
+                 "ingest\n";
+    std::cout << "     --bib-out <file>      - Write the BibTeX of the references here "
+                 "(default references.bib;\n";
+    std::cout << "                             batch writes <output>.bib beside each output, "
+                 "serve\n";
+    std::cout << "                             answers it instead)\n";
+    std::cout << "     --no-bib-out          - Do not write a BibTeX file\n";
+    std::cout << "     --template <file>     - Write the document into a LaTeX template; see "
+                 "README\n";
+    std::cout << "     --minimal-preamble    - Load only the packages the document needs\n";
+    std::cout << "     --stats[=json]        - Print per-stage counters and times as text or "
+                 "JSON\n";
+    std::cout << "     --trace <file>        - Write a timeline of the run as Chrome trace-event "
+                 "JSON\n";
+    std::cout << "  6. help\n";
     std::cout << "     - Display this help message\n";
-    std::cout << "  3. exit\n";
+    std::cout << "  7. exit\n";
     std::cout << "     - Exit the program\n";
+    std::cout << "  Any command can also be given as arguments, e.g. md2LateX convert in.md\n";
+    std::cout << "  -o out.tex or md2LateX - < in.md > out.tex, to run it once and exit\n";
     std::cout << "======================================\n";
 }
 
@@ -80,99 +153,684 @@ std::string getDefaultOutputFilename(const std::string &inputFile)
     return outputPath.string();
 }
 
-bool convertMarkdownToLatex(const std::string &inputFile, std::string outputFile = "")
+enum class StatsFormat
 {
-    // Read input file
-    std::ifstream inFile(inputFile);
-    if (!inFile)
+    None,
+    Text,
+    Json,
+};
+
+// Consume a --stats option at args[i], if it is one
+bool parseStatsOption(const std::vector<std::string> &args, size_t i, StatsFormat &format)
+{
+    if (args[i] == "--stats" || args[i] == "--stats=text")
+    {
+        format = StatsFormat::Text;
+    }
+    else if (args[i] == "--stats=json")
+    {
+        format = StatsFormat::Json;
+    }
+    else
     {
-        std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
         return false;
     }
+    return true;
+}
+
+void printStats(const ConversionStats &stats, StatsFormat format)
+{
+    if (format == StatsFormat::Text)
+    {
+        stats.writeText(status());
+    }
+    else if (format == StatsFormat::Json)
+    {
+        status() << stats.toJson() << "\n";
+    }
+}
+
+// Consume a --trace option at args[i], if it is one
+bool parseTraceOption(const std::vector<std::string> &args, size_t &i, std::string &tracePath)
+{
+    if (args[i] == "--trace" && i + 1 < args.size())
+    {
+        tracePath = args[++i];
+        return true;
+    }
+    return false;
+}
 
-    std::string content((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
-    inFile.close();
+// Records a timeline while it exists, if given a file to write it to
+class TraceSession
+{
+  public:
+    explicit TraceSession(std::string file) : path(std::move(file))
+    {
+        if (!path.empty())
+        {
+            Tracer::start();
+        }
+    }
 
-    // Convert markdown to LaTeX
-    MarkdownConverter converter;
-    std::string latexContent = converter.convertToLatex(content);
+    ~TraceSession()
+    {
+        if (path.empty())
+        {
+            return;
+        }
+        std::string error;
+        if (Tracer::stop(path, error))
+        {
+            status() << "Trace written to " << path << "\n";
+        }
+        else
+        {
+            std::cerr << "Error: " << error << "\n";
+        }
+    }
+
+    TraceSession(const TraceSession &) = delete;
+    TraceSession &operator=(const TraceSession &) = delete;
+
+  private:
+    std::string path;
+};
+
+// Consume the converter option at args[i], if it is one
+bool parseConverterOption(const std::vector<std::string> &args, size_t &i,
+                          ConverterOptions &options)
+{
+    const std::string &arg = args[i];
+    bool hasValue = i + 1 < args.size();
+
+    if (arg == "--cache" && hasValue)
+    {
+        options.citationCachePath = args[++i];
+    }
+    else if (arg == "--no-cache")
+    {
+        options.citationCachePath.clear();
+    }
+    else if (arg == "--cache-ttl" && hasValue)
+    {
+        options.citationCacheTtl = std::strtoll(args[++i].c_str(), nullptr, 10);
+    }
+    else if (arg == "--refresh-cache")
+    {
+        options.refreshCitationCache = true;
+    }
+    else if (arg == "--citation-jobs" && hasValue)
+    {
+        options.citationConcurrency = std::strtoul(args[++i].c_str(), nullptr, 10);
+    }
+    else if (arg == "--citation-url" && hasValue)
+    {
+        options.citationBaseUrl = args[++i];
+    }
+    else if (arg == "--match-threshold" && hasValue)
+    {
+        options.citationMatchThreshold = std::strtod(args[++i].c_str(), nullptr);
+    }
+    else if (arg == "--no-prompt")
+    {
+        options.promptCitations = false;
+    }
+    else if (arg == "--bib" && hasValue)
+    {
+        options.bibLibraries.push_back(args[++i]);
+    }
+    else if (arg == "--store" && hasValue)
+    {
+        options.citationStores.push_back(args[++i]);
+    }
+    else if (arg == "--bib-out" && hasValue)
+    {
+        options.bibliographyPath = args[++i];
+    }
+    else if (arg == "--no-bib-out")
+    {
+        options.bibliographyPath.clear();
+    }
+    else if (arg == "--template" && hasValue)
+    {
+        // Compiled once here and shared by every conversion of the command
+        auto compiled = std::make_shared<LatexTemplate>();
+        if (compiled->load(args[++i]))
+        {
+            options.documentTemplate = std::move(compiled);
+        }
+        else
+        {
+            std::cerr << "Error: " << compiled->error() << "; keeping the built-in preamble\n";
+        }
+    }
+    else if (arg == "--minimal-preamble")
+    {
+        options.documentTemplate = LatexTemplate::minimal();
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
 
-    // If no output file specified, use default name
+// Convert inputFile to outputFile, where "-" stands for standard input or
+// output; reading standard input writes standard output unless told otherwise
+bool convertMarkdownToLatex(const std::string &inputFile, std::string outputFile = "",
+                            size_t threads = 1, ConverterOptions options = {},
+                            StatsFormat statsFormat = StatsFormat::None)
+{
+    bool fromStdin = inputFile == "-";
     if (outputFile.empty())
     {
-        outputFile = getDefaultOutputFilename(inputFile);
+        outputFile = fromStdin ? "-" : getDefaultOutputFilename(inputFile);
+    }
+    bool toStdout = outputFile == "-";
+    if (fromStdin || toStdout)
+    {
+        // The prompt would read the document or end up in the LaTeX
+        options.promptCitations = false;
+    }
+
+    // Map input file; standard input is streamed instead, unless it is to be
+    // split up for parallel conversion
+    TraceSpan readSpan("read input", "input");
+    MappedFile inFile;
+    std::string piped;
+    std::string_view markdown;
+    if (!fromStdin)
+    {
+        if (!inFile.open(inputFile))
+        {
+            std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
+            return false;
+        }
+        markdown = inFile.data();
+    }
+    else if (threads != 1)
+    {
+        piped.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        markdown = piped;
     }
+    readSpan.end();
 
-    // Output result to file
-    std::ofstream outFile(outputFile);
-    if (!outFile)
+    // Open output file
+    ChunkedOutput sink(STDOUT_FILENO);
+    if (!toStdout && !sink.open(outputFile))
     {
         std::cerr << "Error: Cannot open output file: " << outputFile << "\n";
         return false;
     }
+    std::ostream outFile(&sink);
+
+    // Convert straight from the mapped input, streaming LaTeX to the output file
+    MarkdownConverter converter(options);
+    if (fromStdin && threads == 1)
+    {
+        converter.convertToLatex(std::cin, outFile);
+    }
+    else if (threads == 1)
+    {
+        converter.convertToLatex(markdown, outFile);
+    }
+    else
+    {
+        ThreadPool pool(threads);
+        converter.convertToLatexParallel(markdown, outFile, pool);
+    }
 
-    outFile << latexContent;
-    outFile.close();
-    std::cout << "Conversion successful. LaTeX content written to " << outputFile << "\n";
+    TraceSpan writeSpan("write output", "output");
+    bool written = sink.close();
+    writeSpan.end();
+    if (!written)
+    {
+        std::cerr << "Error: Failed to write output file: " << outputFile << ": " << sink.error()
+                  << "\n";
+        return false;
+    }
+    if (!toStdout)
+    {
+        status() << "Conversion successful. LaTeX content written to " << outputFile << "\n";
+    }
+    printStats(converter.stats(), statsFormat);
 
     return true;
 }
 
-int main()
+// Read a whole file into content, reusing its buffer; the watched file may be
+// rewritten at any time, so it is not mapped
+bool readFile(const std::string &path, std::string &content)
 {
-    std::string command;
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+        return false;
+    }
+    content.resize(static_cast<size_t>(in.tellg()));
+    in.seekg(0);
+    in.read(content.data(), static_cast<std::streamsize>(content.size()));
+    content.resize(static_cast<size_t>(in.gcount()));
+    return !in.bad();
+}
 
-    // Display initial usage information
-    std::cout << "Welcome to Markdown to LaTeX Converter!\n";
-    printUsage();
+bool watchMarkdown(const std::string &inputFile, std::string outputFile, ConverterOptions options,
+                   StatsFormat statsFormat = StatsFormat::None)
+{
+    if (outputFile.empty())
+    {
+        outputFile = getDefaultOutputFilename(inputFile);
+    }
+    // Nobody is around to answer while watching
+    options.promptCitations = false;
 
-    while (true)
+    FileWatcher watcher;
+    if (!watcher.open(inputFile))
     {
-        std::cout << "\n> ";
-        std::getline(std::cin, command);
+        std::cerr << "Error: " << watcher.error() << "\n";
+        return false;
+    }
+
+    MarkdownConverter converter(options);
+    std::string markdown;
 
-        if (command.empty())
+    auto update = [&]()
+    {
+        auto start = std::chrono::steady_clock::now();
+        TraceSpan span("update", "watch");
+        TraceSpan readSpan("read input", "input");
+        if (!readFile(inputFile, markdown))
+        {
+            std::cerr << "Error: Cannot open input file: " << inputFile << "\n";
+            return;
+        }
+        readSpan.end();
+
+        IncrementalUpdate result = converter.updateIncremental(markdown);
+
+        // Rewrite the output from the first byte that changed
+        TraceSpan writeSpan("write output", "output");
+        std::error_code error;
+        bool rewriteAll = !std::filesystem::exists(outputFile, error) ||
+                          std::filesystem::file_size(outputFile, error) < result.unchangedBytes;
+        size_t from = rewriteAll ? 0 : result.unchangedBytes;
+        auto mode = rewriteAll ? std::ios::out | std::ios::trunc : std::ios::in | std::ios::out;
+        std::fstream outFile(outputFile, mode | std::ios::binary);
+        outFile.seekp(static_cast<std::streamoff>(from));
+        converter.writeIncremental(outFile, from);
+        outFile.close();
+        if (outFile)
+        {
+            std::filesystem::resize_file(outputFile, result.outputBytes, error);
+        }
+        writeSpan.end();
+        if (!outFile || error)
+        {
+            std::cerr << "Error: Failed to write output file: " << outputFile << "\n";
+            return;
+        }
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        status() << "Updated " << outputFile << ": " << result.reconverted << " of "
+                 << result.segments << " blocks converted in "
+                 << std::chrono::duration<double, std::milli>(elapsed).count() << " ms\n";
+        printStats(converter.stats(), statsFormat);
+    };
+
+    update();
+    status() << "Watching " << inputFile << " for changes, press Enter to stop\n";
+    while (watcher.waitForChange(STDIN_FILENO))
+    {
+        update();
+    }
+    if (!watcher.error().empty())
+    {
+        std::cerr << "Error: " << watcher.error() << "\n";
+    }
+
+    // Swallow the line that stopped watching
+    std::string line;
+    std::getline(std::cin, line);
+    return true;
+}
+
+bool convertBatch(const std::vector<std::string> &args)
+{
+    std::string source;
+    std::string outputDir;
+    size_t threads = 0;
+    ConverterOptions options;
+    StatsFormat statsFormat = StatsFormat::None;
+    std::string tracePath;
+
+    for (size_t i = 1; i < args.size(); ++i)
+    {
+        if (parseConverterOption(args, i, options) || parseStatsOption(args, i, statsFormat) ||
+            parseTraceOption(args, i, tracePath))
         {
             continue;
         }
 
-        std::vector<std::string> args = splitCommand(command);
+        if (args[i] == "-j" && i + 1 < args.size())
+        {
+            threads = std::strtoul(args[++i].c_str(), nullptr, 10);
+        }
+        else if (source.empty())
+        {
+            source = args[i];
+        }
+        else
+        {
+            outputDir = args[i];
+        }
+    }
 
-        if (args.empty())
+    TraceSession trace(tracePath);
+    std::vector<BatchJob> jobs = BatchConverter::collectJobs(source, outputDir);
+    if (jobs.empty())
+    {
+        std::cerr << "Error: No markdown files found in: " << source << "\n";
+        return false;
+    }
+
+    options.collectStats = statsFormat != StatsFormat::None;
+    // Nobody is around to answer for thousands of files
+    options.promptCitations = false;
+    BatchConverter batch(threads, options);
+    BatchSummary summary = batch.run(std::move(jobs));
+
+    double megabytes = static_cast<double>(summary.inputBytes) / (1024.0 * 1024.0);
+    status() << "Converted " << (summary.files - summary.failed) << " of " << summary.files
+             << " files (" << summary.failed << " failed) on " << summary.threads
+             << " threads\n";
+    status() << "  " << megabytes << " MB in " << summary.seconds << " s: "
+             << (summary.seconds > 0 ? megabytes / summary.seconds : 0.0) << " MB/s, "
+             << (summary.seconds > 0 ? static_cast<double>(summary.files) / summary.seconds
+                                     : 0.0)
+             << " files/s\n";
+    printStats(summary.stats, statsFormat);
+
+    return summary.failed == 0;
+}
+
+bool serveConversions(const std::vector<std::string> &args)
+{
+    ConverterOptions options;
+    ServerOptions serverOptions;
+    std::string tracePath;
+
+    for (size_t i = 1; i < args.size(); ++i)
+    {
+        if (parseConverterOption(args, i, options) || parseTraceOption(args, i, tracePath))
         {
             continue;
         }
 
-        if (args[0] == "exit" || args[0] == "quit")
+        bool hasValue = i + 1 < args.size();
+        if (args[i] == "--http" && hasValue)
         {
-            std::cout << "Exiting program. Goodbye!\n";
-            break;
+            serverOptions.httpPort = std::atoi(args[++i].c_str());
         }
+        else if (args[i] == "-j" && hasValue)
+        {
+            serverOptions.threads = std::strtoul(args[++i].c_str(), nullptr, 10);
+        }
+        else if (args[i] == "--timeout" && hasValue)
+        {
+            serverOptions.timeoutSeconds = std::strtod(args[++i].c_str(), nullptr);
+        }
+        else
+        {
+            serverOptions.socketPath = args[i];
+        }
+    }
 
-        if (args[0] == "help")
+    TraceSession trace(tracePath);
+    ConversionServer server(options, serverOptions);
+    if (!server.open())
+    {
+        std::cerr << "Error: " << server.error() << "\n";
+        return false;
+    }
+    status() << "Serving on " << serverOptions.socketPath;
+    if (serverOptions.httpPort != 0)
+    {
+        status() << " and http://127.0.0.1:" << serverOptions.httpPort;
+    }
+    status() << ", press Enter to stop\n";
+
+    bool served = server.run(STDIN_FILENO);
+    if (!served)
+    {
+        std::cerr << "Error: " << server.error() << "\n";
+    }
+    status() << "Served " << server.requests() << " requests (" << server.failures()
+             << " failed)\n";
+
+    // Swallow the line that stopped serving
+    std::string line;
+    std::getline(std::cin, line);
+    return served;
+}
+
+// Index JSONL metadata dumps into a citation store for --store
+bool ingestDumps(const std::vector<std::string> &args)
+{
+    std::vector<std::string> dumps;
+    std::string storePath;
+    size_t threads = 0;
+    std::string tracePath;
+
+    for (size_t i = 1; i < args.size(); ++i)
+    {
+        if (parseTraceOption(args, i, tracePath))
         {
-            printUsage();
+            continue;
         }
-        else if (args[0] == "convert")
+
+        bool hasValue = i + 1 < args.size();
+        if (args[i] == "-o" && hasValue)
+        {
+            storePath = args[++i];
+        }
+        else if (args[i] == "-j" && hasValue)
         {
-            if (args.size() < 2)
+            threads = std::strtoul(args[++i].c_str(), nullptr, 10);
+        }
+        else
+        {
+            dumps.push_back(args[i]);
+        }
+    }
+    if (dumps.empty() || storePath.empty())
+    {
+        status() << "Error: Missing dump or store. Usage: ingest <dump.jsonl>... "
+                    "-o <store_file> [-j threads]\n";
+        return false;
+    }
+
+    TraceSession trace(tracePath);
+    CitationIngester ingester(threads);
+    if (!ingester.run(dumps, storePath))
+    {
+        status() << "Error: " << ingester.error() << "\n";
+        return false;
+    }
+
+    const IngestSummary &summary = ingester.summary();
+    double megabytes = static_cast<double>(summary.inputBytes) / (1024.0 * 1024.0);
+    status() << "Ingested " << summary.records << " works from " << summary.files
+             << " files (" << summary.skipped << " lines skipped) on " << summary.threads
+             << " threads\n";
+    status() << "  " << megabytes << " MB in " << summary.seconds << " s ("
+             << summary.writeSeconds << " s writing the store): "
+             << (summary.seconds > 0 ? static_cast<double>(summary.records) / summary.seconds
+                                     : 0.0)
+             << " records/s, " << (summary.seconds > 0 ? megabytes / summary.seconds : 0.0)
+             << " MB/s\n";
+    status() << "  Store " << storePath << ": "
+             << static_cast<double>(summary.storeBytes) / (1024.0 * 1024.0) << " MB\n";
+    return true;
+}
+
+// Run one command, e.g. {"convert", "in.md", "-o", "out.tex"}; false if it failed
+bool runCommand(const std::vector<std::string> &args)
+{
+    if (args[0] == "help")
+    {
+        printUsage();
+        return true;
+    }
+    if (args[0] == "convert")
+    {
+        std::vector<std::string> files;
+        std::string outputFile;
+        size_t threads = 1;
+        ConverterOptions options;
+        StatsFormat statsFormat = StatsFormat::None;
+        std::string tracePath;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (parseConverterOption(args, i, options) || parseStatsOption(args, i, statsFormat) ||
+                parseTraceOption(args, i, tracePath))
             {
-                std::cout
-                    << "Error: Missing input file. Usage: convert <input_file> [output_file]\n";
                 continue;
             }
 
-            const std::string &inputFile = args[1];
-            std::string outputFile = (args.size() > 2) ? args[2] : "";
+            if (args[i] == "-j" && i + 1 < args.size())
+            {
+                threads = std::strtoul(args[++i].c_str(), nullptr, 10);
+            }
+            else if (args[i] == "-o" && i + 1 < args.size())
+            {
+                outputFile = args[++i];
+            }
+            else
+            {
+                files.push_back(args[i]);
+            }
+        }
+        if (files.empty())
+        {
+            status() << "Error: Missing input file. Usage: convert <input_file> [output_file]\n";
+            return false;
+        }
+        if (outputFile.empty() && files.size() > 1)
+        {
+            outputFile = files[1];
+        }
 
-            convertMarkdownToLatex(inputFile, outputFile);
+        options.collectStats = statsFormat != StatsFormat::None;
+        TraceSession trace(tracePath);
+        return convertMarkdownToLatex(files[0], outputFile, threads, options, statsFormat);
+    }
+    if (args[0] == "watch")
+    {
+        std::vector<std::string> files;
+        ConverterOptions options;
+        StatsFormat statsFormat = StatsFormat::None;
+        std::string tracePath;
+        for (size_t i = 1; i < args.size(); ++i)
+        {
+            if (!parseConverterOption(args, i, options) &&
+                !parseStatsOption(args, i, statsFormat) && !parseTraceOption(args, i, tracePath))
+            {
+                files.push_back(args[i]);
+            }
         }
-        else
+        if (files.empty())
+        {
+            status() << "Error: Missing input file. Usage: watch <input_file> [output_file]\n";
+            return false;
+        }
+
+        options.collectStats = statsFormat != StatsFormat::None;
+        TraceSession trace(tracePath);
+        return watchMarkdown(files[0], files.size() > 1 ? files[1] : "", options, statsFormat);
+    }
+    if (args[0] == "batch")
+    {
+        if (args.size() < 2)
+        {
+            status() << "Error: Missing input. Usage: batch <directory|file_list> "
+                        "[output_directory] [-j threads]\n";
+            return false;
+        }
+        return convertBatch(args);
+    }
+    if (args[0] == "serve")
+    {
+        if (args.size() < 2)
+        {
+            status() << "Error: Missing socket path. Usage: serve <socket_path> "
+                        "[--http port] [-j threads] [--timeout seconds]\n";
+            return false;
+        }
+        return serveConversions(args);
+    }
+    if (args[0] == "ingest")
+    {
+        return ingestDumps(args);
+    }
+
+    status() << "Unknown command: " << args[0] << "\n";
+    status() << "Type 'help' for available commands.\n";
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    // With arguments, run them as one command and exit, e.g. md2LateX convert
+    // in.md -o out.tex; -h and --help are help, and anything else but a
+    // command name is the input of convert, as in md2LateX - < in.md > out.tex
+    if (argc > 1)
+    {
+        std::ios::sync_with_stdio(false);
+        statusStream = &std::cerr;
+        std::vector<std::string> args(argv + 1, argv + argc);
+        if (args[0] == "-h" || args[0] == "--help")
         {
-            std::cout << "Unknown command: " << args[0] << "\n";
-            std::cout << "Type 'help' for available commands.\n";
+            args[0] = "help";
         }
+        const std::string &name = args[0];
+        if (name != "help" && name != "convert" && name != "watch" && name != "batch" &&
+            name != "serve" && name != "ingest")
+        {
+            args.insert(args.begin(), "convert");
+        }
+        return runCommand(args) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::string command;
+
+    // Display initial usage information
+    std::cout << "Welcome to Markdown to LaTeX Converter!\n";
+    printUsage();
+
+    while (true)
+    {
+        std::cout << "\n> ";
+        if (!std::getline(std::cin, command))
+        {
+            break;
+        }
+
+        std::vector<std::string> args = splitCommand(command);
+
+        if (args.empty())
+        {
+            continue;
+        }
+
+        if (args[0] == "exit" || args[0] == "quit")
+        {
+            std::cout << "Exiting program. Goodbye!\n";
+            break;
+        }
+
+        runCommand(args);
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,271 @@
+#include <array>
+#include <random>
+
+#include "corpus.h"
+
+namespace
+{
+
+constexpr std::array<const char *, 32> kWords = {
+    "markdown",  "latex",    "document", "section",  "theorem", "proof",   "result",
+    "analysis",  "model",    "data",     "network",  "function", "value",  "system",
+    "parameter", "method",   "approach", "converge", "bound",   "error",   "sample",
+    "estimate",  "the",      "of",       "and",      "with",    "for",     "a",
+    "is",        "between",  "under",    "given",
+};
+
+constexpr std::array<const char *, 6> kLanguages = {"cpp", "python", "bash", "latex", "json", ""};
+
+// Code lines with every character the escaper and lstlisting care about
+constexpr std::array<const char *, 8> kCodeLines = {
+    "int total = values[i] % 16 & mask; // #1",
+    "if (a_b > 0 && c_d < $limit) { return ~x ^ y; }",
+    "printf(\"%d%% done\\n\", 100 * i / n);",
+    "\\begin{align} x^2 + y_1 &= \\frac{a}{b} \\end{align}",
+    "for key, value in table.items(): print(f\"{key}_{value}\")",
+    "echo \"$HOME/#tmp\" | sed 's/_/-/g' > out_{1,2}.txt",
+    "{\"name\": \"x_y\", \"cost\": \"$5 & up\", \"tags\": [\"#a\", \"~b\"]}",
+    "    std::map<std::string, int> counts; // 50% of cases",
+};
+
+class Generator
+{
+  public:
+    explicit Generator(unsigned seed) : random(seed) {}
+
+    size_t pick(size_t count)
+    {
+        return std::uniform_int_distribution<size_t>(0, count - 1)(random);
+    }
+
+    bool chance(double probability) { return std::bernoulli_distribution(probability)(random); }
+
+    void words(std::string &out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i > 0)
+            {
+                out += ' ';
+            }
+            out += kWords[pick(kWords.size())];
+        }
+    }
+
+    // A sentence with occasional inline markup and special characters
+    void sentence(std::string &out, double markup)
+    {
+        words(out, 4 + pick(10));
+        if (chance(markup))
+        {
+            static constexpr std::array<const char *, 8> kMarkup = {
+                " **important**", " *note*",         " `x_i`",
+                " [link](https://example.org/a_b)", " 50% & more", " ***both***",
+                " $n$ items",     " see ![fig](img/plot_1.png)",
+            };
+            out += kMarkup[pick(kMarkup.size())];
+        }
+        out += ". ";
+    }
+
+    void paragraphLine(std::string &out, size_t sentences, double markup)
+    {
+        for (size_t i = 0; i < sentences; ++i)
+        {
+            sentence(out, markup);
+        }
+        out.back() = '\n';
+    }
+
+    void headers(std::string &out)
+    {
+        out.append(1 + pick(4), '#');
+        out += ' ';
+        words(out, 2 + pick(5));
+        if (chance(0.2))
+        {
+            out += " & Notes_1";
+        }
+        out += "\n\n";
+        for (size_t i = 0, lines = 1 + pick(2); i < lines; ++i)
+        {
+            paragraphLine(out, 1 + pick(3), 0.2);
+        }
+        out += '\n';
+    }
+
+    void lists(std::string &out)
+    {
+        bool numbered = chance(0.3);
+        size_t depth = 0;
+        for (size_t i = 0, items = 3 + pick(10); i < items; ++i)
+        {
+            // Step in or out by at most one level, as lists usually do
+            if (depth > 0 && chance(0.3))
+            {
+                depth--;
+            }
+            else if (depth < 3 && chance(0.3))
+            {
+                depth++;
+            }
+            out.append(depth * 2, ' ');
+            if (numbered)
+            {
+                out += std::to_string(i + 1) + ". ";
+            }
+            else
+            {
+                static constexpr std::array<char, 3> kBullets = {'-', '*', '+'};
+                out += kBullets[pick(kBullets.size())];
+                out += ' ';
+            }
+            sentence(out, 0.5);
+            out.back() = '\n';
+        }
+        out += '\n';
+    }
+
+    void codeFences(std::string &out)
+    {
+        paragraphLine(out, 1, 0.1);
+        out += '\n';
+        out += "```";
+        out += kLanguages[pick(kLanguages.size())];
+        out += '\n';
+        for (size_t i = 0, lines = 5 + pick(25); i < lines; ++i)
+        {
+            out += kCodeLines[pick(kCodeLines.size())];
+            out += '\n';
+        }
+        out += "```\n\n";
+    }
+
+    void citations(std::string &out)
+    {
+        for (size_t i = 0, sentences = 3 + pick(5); i < sentences; ++i)
+        {
+            words(out, 5 + pick(10));
+            out += " [^" + std::to_string(1 + pick(200)) + "]";
+            if (chance(0.3))
+            {
+                out += "[^" + std::to_string(1 + pick(200)) + "]";
+            }
+            out += ". ";
+        }
+        out.back() = '\n';
+        out += '\n';
+    }
+
+    // Delimiters that never close, close in the wrong order or nest deeply,
+    // which make naive emphasis matching search far ahead for a partner
+    void emphasis(std::string &out)
+    {
+        static constexpr std::array<const char *, 10> kRuns = {
+            "*",       "**",    "***",        "_",         "__",
+            "*****",   "`",     "snake_case", "a*b*c*d",   "**_*_**",
+        };
+        for (size_t i = 0, tokens = 20 + pick(40); i < tokens; ++i)
+        {
+            if (i > 0)
+            {
+                out += ' ';
+            }
+            if (chance(0.5))
+            {
+                out += kRuns[pick(kRuns.size())];
+            }
+            out += kWords[pick(kWords.size())];
+            if (chance(0.3))
+            {
+                out += kRuns[pick(kRuns.size())];
+            }
+        }
+        out += "\n\n";
+    }
+
+    void block(CorpusKind kind, std::string &out)
+    {
+        switch (kind)
+        {
+        case CorpusKind::Headers:
+            headers(out);
+            break;
+        case CorpusKind::Lists:
+            lists(out);
+            break;
+        case CorpusKind::CodeFences:
+            codeFences(out);
+            break;
+        case CorpusKind::Citations:
+            citations(out);
+            break;
+        case CorpusKind::Emphasis:
+            emphasis(out);
+            break;
+        case CorpusKind::Mixed:
+            block(allCorpusKinds()[pick(allCorpusKinds().size() - 1)], out);
+            break;
+        }
+    }
+
+  private:
+    std::mt19937 random;
+};
+
+} // namespace
+
+const std::vector<CorpusKind> &allCorpusKinds()
+{
+    static const std::vector<CorpusKind> kinds = {
+        CorpusKind::Headers,   CorpusKind::Lists,    CorpusKind::CodeFences,
+        CorpusKind::Citations, CorpusKind::Emphasis, CorpusKind::Mixed,
+    };
+    return kinds;
+}
+
+const char *corpusName(CorpusKind kind)
+{
+    switch (kind)
+    {
+    case CorpusKind::Headers:
+        return "headers";
+    case CorpusKind::Lists:
+        return "lists";
+    case CorpusKind::CodeFences:
+        return "code";
+    case CorpusKind::Citations:
+        return "citations";
+    case CorpusKind::Emphasis:
+        return "emphasis";
+    case CorpusKind::Mixed:
+        return "mixed";
+    }
+    return "unknown";
+}
+
+bool parseCorpusKind(std::string_view name, CorpusKind &kind)
+{
+    for (CorpusKind candidate : allCorpusKinds())
+    {
+        if (name == corpusName(candidate))
+        {
+            kind = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string generateCorpus(CorpusKind kind, size_t bytes, unsigned seed)
+{
+    Generator generator(seed);
+    std::string out;
+    out.reserve(bytes + 4096);
+    out += "# Benchmark document\n\n";
+    while (out.size() < bytes)
+    {
+        generator.block(kind, out);
+    }
+    return out;
+}
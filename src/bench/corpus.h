@@ -0,0 +1,33 @@
+// corpus.h
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Synthetic Markdown documents that each stress one part of the converter
+enum class CorpusKind
+{
+    Headers,    // short sections: a header and one or two paragraph lines
+    Lists,      // nested bullet and numbered lists with inline markup
+    CodeFences, // fenced code blocks full of LaTeX special characters
+    Citations,  // prose with a citation marker in every sentence
+    Emphasis,   // unbalanced and deeply nested *, _ and ` runs
+    Mixed,      // all of the above, interleaved by section
+};
+
+const std::vector<CorpusKind> &allCorpusKinds();
+
+const char *corpusName(CorpusKind kind);
+
+// Look up a kind by the name corpusName gives it
+bool parseCorpusKind(std::string_view name, CorpusKind &kind);
+
+// A document of kind of at least bytes bytes, ending after a complete block.
+// The same seed always gives the same document. Citation markers have no
+// reference section, so converting a corpus never looks anything up online.
+std::string generateCorpus(CorpusKind kind, size_t bytes, unsigned seed = 1);
+
+#endif // BENCH_CORPUS_H
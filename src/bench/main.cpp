@@ -0,0 +1,408 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "arena.h"
+#include "block_parser.h"
+#include "corpus.h"
+#include "inline_scanner.h"
+#include "latex_emitter.h"
+#include "latex_escape.h"
+#include "mapped_file.h"
+#include "md_converter.h"
+#include "thread_pool.h"
+
+// Every operator new in the process is counted, so allocations per MB cover
+// the library as well as the standard containers it uses
+namespace
+{
+std::atomic<size_t> allocationCount{0};
+} // namespace
+
+// Results of the benchmarked calls are added up here, so that the compiler
+// cannot drop calls whose results are otherwise unused
+size_t benchmarkSink = 0;
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *memory = std::malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, size_t) noexcept { std::free(memory); }
+
+namespace
+{
+
+constexpr double kMegabyte = 1024.0 * 1024.0;
+
+struct Settings
+{
+    size_t bytes{4 * 1024 * 1024};
+    std::vector<CorpusKind> corpora;
+    std::string stageFilter;
+    double minSeconds{0.5};
+    size_t minIterations{3};
+    size_t threads{0};
+    unsigned seed{1};
+    std::string corpusDir;
+};
+
+struct Result
+{
+    double megabytesPerSecond{0.0};
+    double allocationsPerMegabyte{0.0};
+    double peakRssMegabytes{0.0};
+    size_t iterations{0};
+};
+
+// Discards everything written to it
+class NullBuffer : public std::streambuf
+{
+  protected:
+    int_type overflow(int_type chr) override { return traits_type::not_eof(chr); }
+    std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+};
+
+// Start a new peak so that each benchmark reports its own. Linux resets the
+// high-water mark through clear_refs; elsewhere the peak of the whole run is
+// reported.
+void resetPeakRss()
+{
+#ifdef __linux__
+    std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+double peakRssMegabytes()
+{
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            return std::strtod(line.c_str() + 6, nullptr) / 1024.0;
+        }
+    }
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<double>(usage.ru_maxrss) / kMegabyte;
+#else
+    return static_cast<double>(usage.ru_maxrss) / 1024.0;
+#endif
+#else
+    return 0.0;
+#endif
+}
+
+// Run body once to warm up, then until it has run minIterations times and
+// for at least minSeconds. Throughput is taken from the median run; the
+// warm-up run's allocations are left out so that reused buffers show.
+Result measure(size_t bytes, const Settings &settings, const std::function<void()> &body)
+{
+    resetPeakRss();
+    body();
+
+    size_t allocationsBefore = allocationCount.load();
+    std::vector<double> times;
+    double total = 0.0;
+    while (times.size() < settings.minIterations || total < settings.minSeconds)
+    {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        times.push_back(seconds);
+        total += seconds;
+    }
+    size_t allocations = allocationCount.load() - allocationsBefore;
+
+    std::sort(times.begin(), times.end());
+    double megabytes = static_cast<double>(bytes) / kMegabyte;
+
+    Result result;
+    result.iterations = times.size();
+    result.megabytesPerSecond = megabytes / std::max(times[times.size() / 2], 1e-9);
+    result.allocationsPerMegabyte = static_cast<double>(allocations) / times.size() / megabytes;
+    result.peakRssMegabytes = peakRssMegabytes();
+    return result;
+}
+
+void printHeader()
+{
+    std::printf("%-10s %-28s %10s %12s %12s %6s\n", "corpus", "stage", "MB/s", "allocs/MB",
+                "peak RSS MB", "runs");
+}
+
+void printResult(const char *corpus, const std::string &stage, const Result &result)
+{
+    std::printf("%-10s %-28s %10.1f %12.1f %12.1f %6zu\n", corpus, stage.c_str(),
+                result.megabytesPerSecond, result.allocationsPerMegabyte,
+                result.peakRssMegabytes, result.iterations);
+    std::fflush(stdout);
+}
+
+void benchmarkCorpus(CorpusKind kind, const Settings &settings, ThreadPool &pool)
+{
+    const char *name = corpusName(kind);
+    std::string markdown = generateCorpus(kind, settings.bytes, settings.seed);
+
+    if (!settings.corpusDir.empty())
+    {
+        std::filesystem::create_directories(settings.corpusDir);
+        std::ofstream(std::filesystem::path(settings.corpusDir) / (std::string(name) + ".md"),
+                      std::ios::binary)
+            << markdown;
+    }
+
+    auto run = [&](const std::string &stage, size_t bytes, const std::function<void()> &body)
+    {
+        if (stage.find(settings.stageFilter) == std::string::npos)
+        {
+            return;
+        }
+        printResult(name, stage, measure(bytes, settings, body));
+    };
+
+    // Lines as the inline passes receive them; blank lines never reach them
+    LineIndex index(markdown);
+    std::vector<std::string> lines;
+    size_t lineBytes = 0;
+    for (size_t i = 0; i < index.size(); ++i)
+    {
+        if (!index.line(i).empty())
+        {
+            lines.emplace_back(index.line(i));
+            lineBytes += lines.back().size();
+        }
+    }
+
+    NullBuffer nullBuffer;
+    std::ostream null(&nullBuffer);
+
+    // Block stages: parsing (headers, lists, quotes, fences) and emitting
+    run("parse", markdown.size(),
+        [&]
+        {
+            Arena arena;
+            LineIndex documentLines(markdown);
+            BlockParser parser(arena);
+            for (size_t i = 0; i < documentLines.size(); ++i)
+            {
+                parser.parseLine(documentLines.line(i));
+                if (parser.blocks().count >= 256)
+                {
+                    benchmarkSink += parser.takeBlocks().count;
+                    arena.reset();
+                }
+            }
+            benchmarkSink += parser.blocks().count;
+        });
+
+    Arena parsedArena;
+    BlockParser parsed(parsedArena);
+    for (size_t i = 0; i < index.size(); ++i)
+    {
+        parsed.parseLine(index.line(i));
+    }
+    run("emit", markdown.size(),
+        [&]
+        {
+            LatexEmitter emitter;
+            emitter.emitBlocks(parsed.blocks(), null);
+            emitter.closeEnvironments(null);
+        });
+
+    // Inline passes, each run on its own over every line
+    using Pass = std::string_view (InlineScanner::*)(std::string_view);
+    const std::vector<std::pair<const char *, Pass>> passes = {
+        {"inline/convertLinks", &InlineScanner::convertLinks},
+        {"inline/convertImages", &InlineScanner::convertImages},
+        {"inline/convertEmphasis", &InlineScanner::convertEmphasis},
+        {"inline/convertCodeBlocks", &InlineScanner::convertCodeBlocks},
+        {"inline/convertCitations", &InlineScanner::convertCitations},
+        {"inline/escapeLatexChars", &InlineScanner::escapeLatexChars},
+        {"inline/convertParagraph", &InlineScanner::convertParagraph},
+    };
+    InlineScanner scanner;
+    for (const auto &[stage, pass] : passes)
+    {
+        run(stage, lineBytes,
+            [&, pass = pass]
+            {
+                for (const std::string &line : lines)
+                {
+                    benchmarkSink += (scanner.*pass)(line).size();
+                }
+            });
+    }
+
+    // Each escape kernel this CPU supports
+    EscapeKernel defaultKernel = activeEscapeKernel();
+    for (EscapeKernel kernel : {EscapeKernel::Scalar, EscapeKernel::Sse42, EscapeKernel::Avx2})
+    {
+        setEscapeKernel(kernel);
+        if (activeEscapeKernel() != kernel)
+        {
+            continue;
+        }
+        std::string escaped;
+        run(std::string("escape/") + escapeKernelName(kernel), lineBytes,
+            [&]
+            {
+                for (const std::string &line : lines)
+                {
+                    escaped.clear();
+                    benchmarkSink += escapeLatex(line, escaped) ? escaped.size() : line.size();
+                }
+            });
+    }
+    setEscapeKernel(defaultKernel);
+
+    // End to end
+    ConverterOptions options;
+    options.citationCachePath.clear();
+    options.promptCitations = false;
+    MarkdownConverter converter(options);
+
+    run("convertToLatex(string)", markdown.size(),
+        [&] { benchmarkSink += converter.convertToLatex(markdown).size(); });
+    run("convertToLatex(view)", markdown.size(),
+        [&] { converter.convertToLatex(std::string_view(markdown), null); });
+    run("convertToLatexParallel/" + std::to_string(pool.size()), markdown.size(),
+        [&] { converter.convertToLatexParallel(markdown, null, pool); });
+
+    // One character changed in the middle of the document, and changed back
+    std::string edited = markdown;
+    edited[edited.size() / 2] = edited[edited.size() / 2] == 'a' ? 'b' : 'a';
+    bool toggle = false;
+    MarkdownConverter incremental(options);
+    run("updateIncremental(1 edit)", markdown.size(),
+        [&]
+        {
+            toggle = !toggle;
+            benchmarkSink += incremental.updateIncremental(toggle ? edited : markdown).reconverted;
+        });
+}
+
+void printUsage()
+{
+    std::cout << "Usage: md2LateX_bench [options]\n";
+    std::cout << "  --size <MB>          - Size of each generated document (default 4)\n";
+    std::cout << "  --corpus <name>      - Only this corpus; may be repeated. One of headers,\n";
+    std::cout << "                         lists, code, citations, emphasis, mixed\n";
+    std::cout << "  --stage <text>       - Only stages whose name contains text\n";
+    std::cout << "  --min-time <s>       - Run each stage for at least s seconds "
+                 "(default 0.5)\n";
+    std::cout << "  --threads <n>        - Workers for the parallel stage "
+                 "(default: one per core)\n";
+    std::cout << "  --seed <n>           - Seed for the corpus generator (default 1)\n";
+    std::cout << "  --write-corpus <dir> - Also save the generated documents to dir\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Settings settings;
+    std::vector<std::string> args(argv + 1, argv + argc);
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        const std::string &arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == "--size" && hasValue)
+        {
+            settings.bytes =
+                static_cast<size_t>(std::strtod(args[++i].c_str(), nullptr) * kMegabyte);
+        }
+        else if (arg == "--corpus" && hasValue)
+        {
+            CorpusKind kind;
+            if (!parseCorpusKind(args[++i], kind))
+            {
+                std::cerr << "Unknown corpus: " << args[i] << "\n";
+                return 1;
+            }
+            settings.corpora.push_back(kind);
+        }
+        else if (arg == "--stage" && hasValue)
+        {
+            settings.stageFilter = args[++i];
+        }
+        else if (arg == "--min-time" && hasValue)
+        {
+            settings.minSeconds = std::strtod(args[++i].c_str(), nullptr);
+        }
+        else if (arg == "--threads" && hasValue)
+        {
+            settings.threads = std::strtoul(args[++i].c_str(), nullptr, 10);
+        }
+        else if (arg == "--seed" && hasValue)
+        {
+            settings.seed = static_cast<unsigned>(std::strtoul(args[++i].c_str(), nullptr, 10));
+        }
+        else if (arg == "--write-corpus" && hasValue)
+        {
+            settings.corpusDir = args[++i];
+        }
+        else
+        {
+            printUsage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+    if (settings.corpora.empty())
+    {
+        settings.corpora = allCorpusKinds();
+    }
+
+    ThreadPool pool(settings.threads);
+    std::printf("document size %.1f MB, escape kernel %s, %zu worker threads\n\n",
+                static_cast<double>(settings.bytes) / kMegabyte,
+                escapeKernelName(activeEscapeKernel()), pool.size());
+    printHeader();
+    for (CorpusKind kind : settings.corpora)
+    {
+        benchmarkCorpus(kind, settings, pool);
+    }
+    return 0;
+}
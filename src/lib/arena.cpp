@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "arena.h"
+
+Arena::Arena(size_t chunkSize) : chunkSize(chunkSize) {}
+
+void *Arena::allocate(size_t size, size_t align)
+{
+    while (current < chunks.size())
+    {
+        Chunk &chunk = chunks[current];
+        auto base = reinterpret_cast<std::uintptr_t>(chunk.data.get());
+        size_t aligned = ((base + offset + align - 1) & ~(align - 1)) - base;
+        if (aligned + size <= chunk.size)
+        {
+            offset = aligned + size;
+            used += size;
+            return chunk.data.get() + aligned;
+        }
+
+        // Move on to the next retained chunk, or fall through to grow
+        if (current + 1 == chunks.size())
+        {
+            break;
+        }
+        current++;
+        offset = 0;
+    }
+
+    size_t newSize = std::max(chunkSize, size + align);
+    chunks.push_back({std::make_unique<char[]>(newSize), newSize});
+    current = chunks.size() - 1;
+    offset = 0;
+    return allocate(size, align);
+}
+
+std::string_view Arena::copy(std::string_view text)
+{
+    if (text.empty())
+    {
+        return {};
+    }
+    auto *data = static_cast<char *>(allocate(text.size(), 1));
+    std::memcpy(data, text.data(), text.size());
+    return {data, text.size()};
+}
+
+void Arena::reset()
+{
+    current = 0;
+    offset = 0;
+    used = 0;
+}
+
+size_t Arena::bytesUsed() const { return used; }
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+
+#include "batch_converter.h"
+#include "mapped_file.h"
+#include "md_converter.h"
+#include "output_sink.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+// The part of a listed path kept below the output directory: the path
+// without its root and leading "..", so that a/x.md and b/x.md stay apart
+fs::path listedRelative(const fs::path &path)
+{
+    fs::path relative;
+    for (const fs::path &part : path.lexically_normal().relative_path())
+    {
+        if (relative.empty() && part == "..")
+        {
+            continue;
+        }
+        relative /= part;
+    }
+    return relative;
+}
+
+} // namespace
+
+BatchConverter::BatchConverter(size_t threads, ConverterOptions options)
+    : threads(threads), options(std::move(options))
+{
+}
+
+std::vector<BatchJob> BatchConverter::collectJobs(const std::string &source,
+                                                  const std::string &outputDir)
+{
+    std::vector<BatchJob> jobs;
+    std::error_code error;
+
+    auto addJob = [&](const fs::path &input, const fs::path &relative)
+    {
+        BatchJob job;
+        job.input = input.string();
+        fs::path output = outputDir.empty() ? input : fs::path(outputDir) / relative;
+        job.output = output.replace_extension(".tex").string();
+        job.size = fs::file_size(input, error);
+        if (error)
+        {
+            job.size = 0;
+        }
+        jobs.push_back(std::move(job));
+    };
+
+    if (fs::is_directory(source, error))
+    {
+        for (const auto &entry : fs::recursive_directory_iterator(source, error))
+        {
+            if (entry.is_regular_file(error) && entry.path().extension() == ".md")
+            {
+                addJob(entry.path(), fs::relative(entry.path(), source, error));
+            }
+        }
+    }
+    else
+    {
+        std::ifstream list(source);
+        std::string line;
+        while (std::getline(list, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (!line.empty())
+            {
+                addJob(line, listedRelative(line));
+            }
+        }
+    }
+
+    return jobs;
+}
+
+BatchSummary BatchConverter::run(std::vector<BatchJob> jobs)
+{
+    // Start the largest files first so that a huge file does not end up last
+    std::sort(jobs.begin(), jobs.end(),
+              [](const BatchJob &a, const BatchJob &b) { return a.size > b.size; });
+
+    ThreadPool pool(threads);
+    // One converter serves every worker; each worker reuses its own context
+    const MarkdownConverter converter(options);
+    std::vector<ConversionContext> contexts(pool.size());
+    // Each worker adds up the statistics of its own files
+    std::vector<ConversionStats> workerStats(pool.size());
+
+    std::atomic<size_t> failed{0};
+    std::atomic<std::uintmax_t> inputBytes{0};
+    std::atomic<std::uintmax_t> outputBytes{0};
+    std::mutex errorMutex;
+    // Outputs already claimed; workers must never write one file twice
+    std::set<fs::path> outputs;
+
+    auto reportError = [&](const std::string &message)
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        std::cerr << "Error: " << message << "\n";
+        failed++;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (const BatchJob &job : jobs)
+    {
+        if (!outputs.insert(fs::path(job.output).lexically_normal()).second)
+        {
+            reportError("Skipped " + job.input + ": another input is written to " + job.output);
+            continue;
+        }
+        pool.submit(
+            [&, job](size_t worker)
+            {
+                // A job that throws, e.g. on a directory in the file list,
+                // fails alone instead of taking down the worker
+                try
+                {
+                    TraceSpan span("convert file", "batch");
+                    span.arg("input", job.input);
+
+                    TraceSpan readSpan("read input", "input");
+                    MappedFile input;
+                    if (!input.open(job.input))
+                    {
+                        reportError("Cannot open input file: " + job.input);
+                        return;
+                    }
+                    readSpan.end();
+
+                    std::error_code error;
+                    fs::path parent = fs::path(job.output).parent_path();
+                    if (!parent.empty())
+                    {
+                        fs::create_directories(parent, error);
+                    }
+                    ChunkedOutput sink;
+                    if (!sink.open(job.output))
+                    {
+                        reportError("Cannot open output file: " + job.output);
+                        return;
+                    }
+                    std::ostream output(&sink);
+
+                    // Each document's BibTeX goes next to its LaTeX, since
+                    // their citation keys clash
+                    if (!options.bibliographyPath.empty())
+                    {
+                        fs::path bibliography = job.output;
+                        contexts[worker].setBibliographyPath(
+                            bibliography.replace_extension(".bib").string());
+                    }
+                    converter.convertToLatex(input.data(), output, contexts[worker]);
+                    outputBytes += sink.size();
+
+                    TraceSpan writeSpan("write output", "output");
+                    bool written = sink.close();
+                    writeSpan.end();
+                    if (!written)
+                    {
+                        reportError("Failed to write output file: " + job.output + ": " +
+                                    sink.error());
+                        return;
+                    }
+                    inputBytes += input.data().size();
+                    if (options.collectStats)
+                    {
+                        workerStats[worker].add(contexts[worker].stats());
+                    }
+                }
+                catch (const std::exception &exception)
+                {
+                    reportError("Failed to convert " + job.input + ": " + exception.what());
+                }
+            });
+    }
+    pool.wait();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    BatchSummary summary;
+    summary.files = jobs.size();
+    summary.failed = failed;
+    summary.inputBytes = inputBytes;
+    summary.outputBytes = outputBytes;
+    summary.seconds = std::chrono::duration<double>(elapsed).count();
+    summary.threads = pool.size();
+    for (const ConversionStats &stats : workerStats)
+    {
+        summary.stats.add(stats);
+    }
+    return summary;
+}
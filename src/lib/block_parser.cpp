@@ -0,0 +1,283 @@
+#include <cctype>
+
+#include "block_parser.h"
+
+namespace
+{
+
+// Whitespace as matched by \s in the classic locale
+bool isSpace(char chr)
+{
+    return chr == ' ' || chr == '\t' || chr == '\n' || chr == '\v' || chr == '\f' || chr == '\r';
+}
+
+std::string_view trimLeading(std::string_view text)
+{
+    size_t start = text.find_first_not_of(" \t");
+    return start == std::string_view::npos ? std::string_view() : text.substr(start);
+}
+
+// Matches "<ws>*[*-+]<ws>+text" or "<ws>*<digits>.<ws>+text" and extracts text, which
+// may not contain a line terminator.
+bool matchListItem(std::string_view line, std::string_view &itemText)
+{
+    size_t pos = 0;
+    while (pos < line.size() && isSpace(line[pos]))
+    {
+        pos++;
+    }
+
+    if (pos < line.size() && (line[pos] == '*' || line[pos] == '-' || line[pos] == '+'))
+    {
+        pos++;
+    }
+    else
+    {
+        size_t digitsStart = pos;
+        while (pos < line.size() && line[pos] >= '0' && line[pos] <= '9')
+        {
+            pos++;
+        }
+        if (pos == digitsStart || pos >= line.size() || line[pos] != '.')
+        {
+            return false;
+        }
+        pos++;
+    }
+
+    size_t spaceStart = pos;
+    while (pos < line.size() && isSpace(line[pos]))
+    {
+        pos++;
+    }
+    if (pos == spaceStart || line.find_first_of("\r\n", pos) != std::string_view::npos)
+    {
+        return false;
+    }
+
+    itemText = line.substr(pos);
+    return true;
+}
+
+std::string_view extractListItemText(std::string_view line)
+{
+    std::string_view itemText;
+    if (matchListItem(line, itemText))
+    {
+        return itemText;
+    }
+
+    // Fallback if the item does not have the canonical shape
+    size_t textStart = line.find_first_of("-*+1234567890");
+    if (textStart != std::string_view::npos)
+    {
+        textStart = line.find_first_not_of("-*+1234567890. ", textStart);
+        if (textStart != std::string_view::npos)
+        {
+            return line.substr(textStart);
+        }
+    }
+    return {};
+}
+
+// Nesting depth of a list item from its indentation (2 spaces per level, tab = 4 spaces)
+int listItemDepth(std::string_view line)
+{
+    int indent = 0;
+    size_t i = 0;
+    while (i < line.size() && (line[i] == ' ' || line[i] == '\t'))
+    {
+        indent += (line[i] == ' ') ? 1 : 4;
+        i++;
+    }
+    return (indent / 2) + 1;
+}
+
+bool isListMarker(std::string_view line)
+{
+    return line[0] == '-' || line[0] == '*' || line[0] == '+' ||
+           (line.size() >= 2 && std::isdigit(static_cast<unsigned char>(line[0])) &&
+            line[1] == '.');
+}
+
+bool isCitationReferenceLine(std::string_view line)
+{
+    return line.substr(0, 2) == "[^" && line.find("]:") != std::string_view::npos;
+}
+
+bool isCodeFence(std::string_view line) { return line.substr(0, 3) == "```"; }
+
+// Block type of a line outside code blocks and the citation section
+BlockType classifyLine(std::string_view line)
+{
+    if (line.empty())
+    {
+        return BlockType::Blank;
+    }
+    if (line[0] == '#')
+    {
+        return BlockType::Heading;
+    }
+    if (isListMarker(line))
+    {
+        return BlockType::ListItem;
+    }
+    if (line[0] == '>')
+    {
+        return BlockType::Quote;
+    }
+    return BlockType::Paragraph;
+}
+
+} // namespace
+
+bool SplitScanner::feed(std::string_view line)
+{
+    if (inCitationSection || isCitationReferenceLine(line))
+    {
+        inCitationSection = true;
+        return false;
+    }
+    if (isCodeFence(line))
+    {
+        inCodeBlock = !inCodeBlock;
+        return false;
+    }
+    if (inCodeBlock)
+    {
+        return false;
+    }
+
+    bool split = false;
+    switch (classifyLine(line))
+    {
+    case BlockType::Blank:
+    case BlockType::Heading:
+        split = !inList && !inQuote;
+        // Headers close both environments; blank lines leave them open
+        if (!line.empty())
+        {
+            inList = false;
+            inQuote = false;
+        }
+        break;
+    case BlockType::ListItem:
+        inList = true;
+        break;
+    case BlockType::Quote:
+        inQuote = true;
+        break;
+    default:
+        inList = false;
+        inQuote = false;
+        break;
+    }
+    return split;
+}
+
+bool SplitScanner::done() const { return inCitationSection; }
+
+std::vector<size_t> findSafeSplitPoints(const LineIndex &lines)
+{
+    std::vector<size_t> splits;
+    SplitScanner scanner;
+    for (size_t i = 0; i < lines.size() && !scanner.done(); ++i)
+    {
+        if (scanner.feed(lines.line(i)))
+        {
+            splits.push_back(i);
+        }
+    }
+    return splits;
+}
+
+BlockParser::BlockParser(Arena &arena) : arena(arena) {}
+
+void BlockParser::parseLine(std::string_view line)
+{
+    // Skip lines that are citation references, and everything after the first one
+    if (isCitationReferenceLine(line))
+    {
+        inCitationSection = true;
+        return;
+    }
+    if (inCitationSection)
+    {
+        return;
+    }
+
+    // Check for code blocks (```...)
+    if (isCodeFence(line))
+    {
+        if (!inCodeBlock)
+        {
+            inCodeBlock = true;
+            codeBlockLanguage = line.substr(3);
+        }
+        else
+        {
+            inCodeBlock = false;
+            appendBlock(BlockType::CodeBlock, 0, codeBlockContent, codeBlockLanguage);
+            codeBlockContent.clear();
+            codeBlockLanguage.clear();
+        }
+        return;
+    }
+
+    if (inCodeBlock)
+    {
+        codeBlockContent.append(line);
+        codeBlockContent.push_back('\n');
+        return;
+    }
+
+    switch (classifyLine(line))
+    {
+    case BlockType::Blank:
+        appendBlock(BlockType::Blank, 0, {});
+        break;
+    case BlockType::Heading:
+    {
+        int level = 0;
+        while (static_cast<size_t>(level) < line.size() && line[level] == '#')
+        {
+            level++;
+        }
+        appendBlock(BlockType::Heading, level, trimLeading(line.substr(level)));
+        break;
+    }
+    case BlockType::ListItem:
+        appendBlock(BlockType::ListItem, listItemDepth(line), extractListItemText(line));
+        break;
+    case BlockType::Quote:
+        appendBlock(BlockType::Quote, 0, trimLeading(line.substr(1)));
+        break;
+    default:
+        appendBlock(BlockType::Paragraph, 0, line);
+        break;
+    }
+}
+
+const BlockList &BlockParser::blocks() const { return list; }
+
+BlockList BlockParser::takeBlocks()
+{
+    BlockList taken = list;
+    list = BlockList();
+    return taken;
+}
+
+void BlockParser::reset()
+{
+    list = BlockList();
+    inCodeBlock = false;
+    inCitationSection = false;
+    codeBlockContent.clear();
+    codeBlockLanguage.clear();
+}
+
+void BlockParser::appendBlock(BlockType type, int level, std::string_view text,
+                              std::string_view info)
+{
+    list.append(arena.make<BlockNode>(type, level, arena.copy(text), arena.copy(info), nullptr));
+}
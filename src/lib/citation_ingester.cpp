@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+#include "citation_ingester.h"
+#include "citation_library.h"
+#include "conversion_stats.h"
+#include "mapped_file.h"
+#include "paper_cition_api.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace
+{
+
+struct Chunk
+{
+    explicit Chunk(std::string_view text) : text(text) {}
+
+    std::string_view text;
+    citation::LibraryIndex::Batch batch;
+    size_t skipped{0};
+};
+
+// Index the works of a chunk, one per line
+void ingestChunk(Chunk &chunk)
+{
+    TraceSpan span("ingest chunk", "citation");
+    span.arg("bytes", chunk.text.size());
+
+    std::vector<citation::PaperInfo> papers;
+    chunk.batch.reserve(chunk.text.size());
+    std::string_view text = chunk.text;
+    while (!text.empty())
+    {
+        size_t end = text.find('\n');
+        std::string_view line = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        if (line.find_first_not_of(" \t\r") == std::string_view::npos)
+        {
+            continue;
+        }
+
+        papers.clear();
+        citation::CrossRefSaxHandler handler(papers, true);
+        if (!nlohmann::json::sax_parse(line.begin(), line.end(), &handler) || papers.empty() ||
+            (papers.front().title.empty() && papers.front().authors.empty()))
+        {
+            ++chunk.skipped;
+            continue;
+        }
+        chunk.batch.add(papers.front());
+    }
+    chunk.batch.finish();
+    span.arg("records", chunk.batch.size());
+}
+
+} // namespace
+
+CitationIngester::CitationIngester(size_t threads, size_t chunkBytes)
+    : threads(threads), chunkBytes(std::max<size_t>(chunkBytes, 1))
+{
+}
+
+bool CitationIngester::run(const std::vector<std::string> &dumps, const std::string &storePath)
+{
+    auto start = std::chrono::steady_clock::now();
+    TraceSpan span("ingest", "citation");
+    result = IngestSummary();
+    errorMessage.clear();
+
+    // The dumps stay mapped until the store is written; chunks point into them
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::vector<Chunk> chunks;
+    for (const auto &path : dumps)
+    {
+        auto file = std::make_unique<MappedFile>();
+        if (!file->open(path))
+        {
+            errorMessage = file->error();
+            return false;
+        }
+        std::string_view data = file->data();
+        size_t begin = 0;
+        while (begin < data.size())
+        {
+            size_t end = begin + chunkBytes < data.size() ? data.find('\n', begin + chunkBytes)
+                                                         : std::string_view::npos;
+            end = end == std::string_view::npos ? data.size() : end + 1;
+            chunks.emplace_back(data.substr(begin, end - begin));
+            begin = end;
+        }
+        result.inputBytes += data.size();
+        ++result.files;
+        files.push_back(std::move(file));
+    }
+
+    {
+        ThreadPool pool(threads);
+        result.threads = pool.size();
+        for (Chunk &chunk : chunks)
+        {
+            pool.submit([&chunk](size_t) { ingestChunk(chunk); });
+        }
+        pool.wait();
+    }
+
+    std::vector<citation::LibraryIndex::Batch> batches;
+    batches.reserve(chunks.size());
+    for (Chunk &chunk : chunks)
+    {
+        result.records += chunk.batch.size();
+        result.skipped += chunk.skipped;
+        batches.push_back(std::move(chunk.batch));
+    }
+    if (result.records > UINT32_MAX)
+    {
+        errorMessage = "Too many works for one citation store; split the dumps";
+        return false;
+    }
+
+    auto writeStart = std::chrono::steady_clock::now();
+    TraceSpan writeSpan("write citation store", "citation");
+    if (!citation::LibraryIndex::save(batches, {}, storePath))
+    {
+        errorMessage = "Cannot write citation store " + storePath;
+        return false;
+    }
+    writeSpan.end();
+    result.writeSeconds = secondsSince(writeStart);
+
+    std::error_code error;
+    result.storeBytes = std::filesystem::file_size(storePath, error);
+    if (error)
+    {
+        result.storeBytes = 0;
+    }
+    result.seconds = secondsSince(start);
+    return true;
+}
+
+const IngestSummary &CitationIngester::summary() const { return result; }
+
+const std::string &CitationIngester::error() const { return errorMessage; }
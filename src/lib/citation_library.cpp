@@ -0,0 +1,1172 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "citation_library.h"
+#include "trace.h"
+
+namespace citation
+{
+
+BibParser::BibParser(std::string_view text) : text(text)
+{
+    static const char *const months[] = {"jan", "feb", "mar", "apr", "may", "jun",
+                                         "jul", "aug", "sep", "oct", "nov", "dec"};
+    for (int i = 0; i < 12; ++i)
+    {
+        macros[months[i]] = std::to_string(i + 1);
+    }
+}
+
+std::vector<PaperInfo> BibParser::parse()
+{
+    std::vector<PaperInfo> papers;
+    while ((pos = text.find('@', pos)) != std::string_view::npos)
+    {
+        ++pos;
+        std::string type = lower(readName());
+        skipSpace();
+        if (pos >= text.size() || (text[pos] != '{' && text[pos] != '('))
+        {
+            continue;
+        }
+        char close = text[pos++] == '{' ? '}' : ')';
+
+        // Parse up to the next entry, so that an entry left open by a
+        // missing delimiter does not swallow the ones after it
+        std::string_view whole = text;
+        text = whole.substr(0, nextEntry(pos));
+        if (type == "comment" || type == "preamble")
+        {
+            skipPast(close);
+        }
+        else if (type == "string")
+        {
+            for (auto &[name, value] : readFields(close))
+            {
+                macros[name] = std::move(value);
+            }
+        }
+        else
+        {
+            parseEntry(type, close, papers);
+        }
+        text = whole;
+    }
+    return papers;
+}
+
+bool BibParser::isNameChar(char c)
+{
+    return !std::isspace(static_cast<unsigned char>(c)) &&
+           std::strchr("\"#%'(),={}@", c) == nullptr;
+}
+
+std::string BibParser::lower(std::string_view name)
+{
+    std::string result(name);
+    for (char &c : result)
+    {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return result;
+}
+
+std::string BibParser::collapse(std::string_view value)
+{
+    std::string result;
+    result.reserve(value.size());
+    bool pendingSpace = false;
+    for (char c : value)
+    {
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            pendingSpace = true;
+            continue;
+        }
+        if (pendingSpace && !result.empty())
+        {
+            result.push_back(' ');
+        }
+        pendingSpace = false;
+        result.push_back(c);
+    }
+    return result;
+}
+
+std::vector<std::string> BibParser::splitAuthors(std::string_view value)
+{
+    std::vector<std::string> authors;
+    int depth = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        if (value[i] == '{')
+        {
+            ++depth;
+        }
+        else if (value[i] == '}')
+        {
+            depth = std::max(depth - 1, 0);
+        }
+        else if (depth == 0 && i > 0 && i + 3 < value.size() &&
+                 std::isspace(static_cast<unsigned char>(value[i - 1])) &&
+                 lower(value.substr(i, 3)) == "and" &&
+                 std::isspace(static_cast<unsigned char>(value[i + 3])))
+        {
+            std::string author = collapse(value.substr(start, i - start));
+            if (!author.empty())
+            {
+                authors.push_back(std::move(author));
+            }
+            start = i + 3;
+        }
+    }
+    std::string author = collapse(value.substr(start));
+    if (!author.empty())
+    {
+        authors.push_back(std::move(author));
+    }
+    return authors;
+}
+
+PaperInfo BibParser::toPaper(const std::string &type, std::string key, const Fields &fields)
+{
+    PaperInfo paper;
+    paper.citation_key = std::move(key);
+    paper.type = type == "book" ? "book" : "article";
+    for (const auto &[name, value] : fields)
+    {
+        if (name == "author" || (name == "editor" && paper.authors.empty()))
+        {
+            paper.authors = splitAuthors(value);
+            continue;
+        }
+
+        std::string PaperInfo::*field = nullptr;
+        if (name == "title")
+        {
+            field = &PaperInfo::title;
+        }
+        else if (name == "journal")
+        {
+            field = &PaperInfo::journal;
+        }
+        else if (name == "booktitle")
+        {
+            field = &PaperInfo::book_title;
+        }
+        else if (name == "volume")
+        {
+            field = &PaperInfo::volume;
+        }
+        else if (name == "number")
+        {
+            field = &PaperInfo::issue;
+        }
+        else if (name == "pages")
+        {
+            field = &PaperInfo::pages;
+        }
+        else if (name == "year")
+        {
+            field = &PaperInfo::year;
+        }
+        else if (name == "doi")
+        {
+            field = &PaperInfo::doi;
+        }
+        else if (name == "url")
+        {
+            field = &PaperInfo::url;
+        }
+        else if (name == "publisher")
+        {
+            field = &PaperInfo::publisher;
+        }
+        else if (name == "edition")
+        {
+            field = &PaperInfo::edition;
+        }
+        else if (name == "isbn")
+        {
+            field = &PaperInfo::isbn;
+        }
+        if (field)
+        {
+            paper.*field = collapse(value);
+        }
+    }
+    // Proceedings papers are written out as articles in their proceedings
+    if (paper.journal.empty() && paper.type != "book")
+    {
+        paper.journal = paper.book_title;
+    }
+    return paper;
+}
+
+size_t BibParser::nextEntry(size_t from) const
+{
+    size_t at = from;
+    while ((at = text.find('\n', at)) != std::string_view::npos)
+    {
+        ++at;
+        while (at < text.size() && (text[at] == ' ' || text[at] == '\t' || text[at] == '\r'))
+        {
+            ++at;
+        }
+        if (at < text.size() && text[at] == '@')
+        {
+            return at;
+        }
+    }
+    return text.size();
+}
+
+void BibParser::parseEntry(const std::string &type, char close, std::vector<PaperInfo> &papers)
+{
+    skipSpace();
+    size_t keyStart = pos;
+    while (pos < text.size() && text[pos] != ',' && text[pos] != close &&
+           !std::isspace(static_cast<unsigned char>(text[pos])))
+    {
+        ++pos;
+    }
+    std::string key(text.substr(keyStart, pos - keyStart));
+    PaperInfo paper = toPaper(type, std::move(key), readFields(close));
+    if (!paper.title.empty() || !paper.authors.empty())
+    {
+        papers.push_back(std::move(paper));
+    }
+}
+
+void BibParser::skipSpace()
+{
+    while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+    {
+        ++pos;
+    }
+}
+
+std::string_view BibParser::readName()
+{
+    size_t start = pos;
+    while (pos < text.size() && isNameChar(text[pos]))
+    {
+        ++pos;
+    }
+    return text.substr(start, pos - start);
+}
+
+void BibParser::skipPast(char stop)
+{
+    int depth = 0;
+    for (; pos < text.size(); ++pos)
+    {
+        char c = text[pos];
+        if (c == '{')
+        {
+            ++depth;
+        }
+        else if (c == '}' && depth > 0)
+        {
+            --depth;
+        }
+        else if (c == stop && depth == 0)
+        {
+            ++pos;
+            return;
+        }
+    }
+}
+
+void BibParser::recover(char close)
+{
+    int depth = 0;
+    for (; pos < text.size(); ++pos)
+    {
+        char c = text[pos];
+        if (depth == 0 && (c == ',' || c == close))
+        {
+            return;
+        }
+        if (c == '{')
+        {
+            ++depth;
+        }
+        else if (c == '}' && depth > 0)
+        {
+            --depth;
+        }
+    }
+}
+
+BibParser::Fields BibParser::readFields(char close)
+{
+    Fields fields;
+    while (true)
+    {
+        skipSpace();
+        if (pos >= text.size())
+        {
+            break;
+        }
+        if (text[pos] == close)
+        {
+            ++pos;
+            break;
+        }
+        if (text[pos] == ',')
+        {
+            ++pos;
+            continue;
+        }
+
+        size_t fieldStart = pos;
+        std::string name = lower(readName());
+        skipSpace();
+        if (name.empty() || pos >= text.size() || text[pos] != '=')
+        {
+            recover(close);
+            if (pos == fieldStart)
+            {
+                ++pos;
+            }
+            continue;
+        }
+        ++pos;
+        fields.emplace_back(std::move(name), readValue());
+    }
+    return fields;
+}
+
+std::string BibParser::readValue()
+{
+    std::string value;
+    while (true)
+    {
+        skipSpace();
+        if (pos >= text.size())
+        {
+            break;
+        }
+        char c = text[pos];
+        if (c == '{')
+        {
+            size_t start = ++pos;
+            skipPast('}');
+            value.append(text.substr(start, pos - 1 - start));
+        }
+        else if (c == '"')
+        {
+            size_t start = ++pos;
+            int depth = 0;
+            while (pos < text.size() && (text[pos] != '"' || depth > 0))
+            {
+                if (text[pos] == '{')
+                {
+                    ++depth;
+                }
+                else if (text[pos] == '}' && depth > 0)
+                {
+                    --depth;
+                }
+                ++pos;
+            }
+            value.append(text.substr(start, pos - start));
+            pos = std::min(pos + 1, text.size());
+        }
+        else
+        {
+            std::string name = lower(readName());
+            if (name.empty())
+            {
+                break;
+            }
+            auto it = macros.find(name);
+            value += it != macros.end() ? it->second : name;
+        }
+
+        skipSpace();
+        if (pos < text.size() && text[pos] == '#')
+        {
+            ++pos;
+            continue;
+        }
+        break;
+    }
+    return value;
+}
+
+template <typename Visit> void LibraryIndex::forEachToken(std::string_view text, Visit visit)
+{
+    std::string current;
+    auto flush = [&]()
+    {
+        if (current.size() >= 2 && !isStopword(current))
+        {
+            visit(current);
+        }
+        current.clear();
+    };
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (std::isalnum(c) || c >= 0x80)
+        {
+            current.push_back(static_cast<char>(std::tolower(c)));
+            continue;
+        }
+        flush();
+        if (c == '\\')
+        {
+            while (i + 1 < text.size() && std::isalpha(static_cast<unsigned char>(text[i + 1])))
+            {
+                ++i;
+            }
+        }
+    }
+    flush();
+}
+
+template <typename Visit>
+void LibraryIndex::forEachWord(const std::vector<Batch> &batches, Visit visit)
+{
+    // Position of each batch in its word table, smallest word on top
+    using Cursor = std::pair<size_t, size_t>;
+    auto text = [&batches](const Cursor &cursor)
+    {
+        const Batch &batch = batches[cursor.first];
+        return batch.word(batch.table[cursor.second]);
+    };
+    auto later = [&text](const Cursor &a, const Cursor &b)
+    {
+        int order = text(a).compare(text(b));
+        return order != 0 ? order > 0 : a.first > b.first;
+    };
+    std::vector<Cursor> heap;
+    for (size_t i = 0; i < batches.size(); ++i)
+    {
+        if (!batches[i].table.empty())
+        {
+            heap.push_back({i, 0});
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    std::vector<Part> parts;
+    while (!heap.empty())
+    {
+        std::string_view current = text(heap.front());
+        parts.clear();
+        while (!heap.empty() && text(heap.front()) == current)
+        {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            Cursor &cursor = heap.back();
+            const Batch &batch = batches[cursor.first];
+            parts.push_back({cursor.first, &batch.table[cursor.second]});
+            if (++cursor.second < batch.table.size())
+            {
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+            else
+            {
+                heap.pop_back();
+            }
+        }
+        visit(current, parts);
+    }
+}
+
+std::vector<std::string> LibraryIndex::tokenize(std::string_view text)
+{
+    std::vector<std::string> tokens;
+    forEachToken(text, [&tokens](const std::string &token) { tokens.push_back(token); });
+    return tokens;
+}
+
+void LibraryIndex::write(const std::vector<Batch> &batches, IndexStamp stamp, std::ostream &out)
+{
+    std::uint64_t entries = 0;
+    std::uint64_t recordBytes = 0;
+    std::vector<std::uint32_t> bases;
+    for (const auto &batch : batches)
+    {
+        bases.push_back(static_cast<std::uint32_t>(entries));
+        entries += batch.size();
+        recordBytes += batch.records.size();
+    }
+    std::uint64_t tokens = 0;
+    std::uint64_t postingTotal = 0;
+    std::uint64_t wordBytes = 0;
+    forEachWord(batches,
+                [&](std::string_view text, const std::vector<Part> &parts)
+                {
+                    ++tokens;
+                    wordBytes += text.size();
+                    for (const Part &part : parts)
+                    {
+                        postingTotal += part.word->count;
+                    }
+                });
+
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(header.magic));
+    header.version = kFormatVersion;
+    header.byteOrder = kByteOrder;
+    header.sourceSize = stamp.size;
+    header.sourceModified = stamp.modified;
+    header.entries = entries;
+    header.tokens = tokens;
+    header.entryTable = sizeof(Header);
+    header.tokenTable = header.entryTable + entries * sizeof(EntryRecord);
+    header.postingTable = header.tokenTable + tokens * sizeof(TokenRecord);
+    header.stringTable = header.postingTable + postingTotal * sizeof(std::uint32_t);
+    header.fileSize = header.stringTable + wordBytes + recordBytes;
+    writeRaw(out, &header, sizeof(header));
+
+    // The string area holds the words, then the records
+    std::uint64_t recordOffset = wordBytes;
+    for (const auto &batch : batches)
+    {
+        std::uint64_t start = 0;
+        for (std::uint64_t end : batch.recordEnds)
+        {
+            EntryRecord record{recordOffset + start, end - start};
+            writeRaw(out, &record, sizeof(record));
+            start = end;
+        }
+        recordOffset += batch.records.size();
+    }
+
+    std::uint64_t textOffset = 0;
+    std::uint64_t postingOffset = 0;
+    forEachWord(batches,
+                [&](std::string_view text, const std::vector<Part> &parts)
+                {
+                    std::uint32_t count = 0;
+                    for (const Part &part : parts)
+                    {
+                        count += part.word->count;
+                    }
+                    TokenRecord record{textOffset, static_cast<std::uint32_t>(text.size()), count,
+                                       postingOffset};
+                    writeRaw(out, &record, sizeof(record));
+                    textOffset += text.size();
+                    postingOffset += count;
+                });
+
+    std::vector<std::uint32_t> renumbered;
+    forEachWord(batches,
+                [&](std::string_view, const std::vector<Part> &parts)
+                {
+                    for (const Part &part : parts)
+                    {
+                        const std::uint32_t *first =
+                            batches[part.batch].postings.data() + part.word->postings;
+                        renumbered.assign(first, first + part.word->count);
+                        for (std::uint32_t &entry : renumbered)
+                        {
+                            entry += bases[part.batch];
+                        }
+                        writeRaw(out, renumbered.data(), renumbered.size() * sizeof(std::uint32_t));
+                    }
+                });
+
+    forEachWord(batches, [&](std::string_view text, const std::vector<Part> &)
+                { out.write(text.data(), static_cast<std::streamsize>(text.size())); });
+    for (const auto &batch : batches)
+    {
+        out.write(batch.records.data(), static_cast<std::streamsize>(batch.records.size()));
+    }
+}
+
+std::string LibraryIndex::build(const std::vector<Batch> &batches, IndexStamp stamp)
+{
+    std::ostringstream out;
+    write(batches, stamp, out);
+    return out.str();
+}
+
+bool LibraryIndex::save(const std::string &bytes, const std::string &path)
+{
+    return saveWith(path, [&bytes](std::ostream &out)
+                    { out.write(bytes.data(), static_cast<std::streamsize>(bytes.size())); });
+}
+
+bool LibraryIndex::save(const std::vector<Batch> &batches, IndexStamp stamp,
+                        const std::string &path)
+{
+    return saveWith(path, [&](std::ostream &out) { write(batches, stamp, out); });
+}
+
+bool LibraryIndex::open(const std::string &path)
+{
+    owned.clear();
+    if (!mapped.open(path))
+    {
+        errorMessage = mapped.error();
+        return false;
+    }
+    return validate();
+}
+
+bool LibraryIndex::load(std::string bytes)
+{
+    mapped = MappedFile();
+    owned = std::move(bytes);
+    return validate();
+}
+
+std::vector<LibraryIndex::Match> LibraryIndex::search(const std::vector<std::string> &tokens,
+                                                       size_t limit) const
+{
+    std::vector<TokenRecord> words;
+    for (const auto &token : tokens)
+    {
+        TokenRecord record;
+        if (find(token, record) && record.count > 0 &&
+            record.postings <= postingCount() &&
+            record.count <= postingCount() - record.postings)
+        {
+            words.push_back(record);
+        }
+    }
+    std::sort(words.begin(), words.end(), [](const TokenRecord &a, const TokenRecord &b)
+              { return a.count < b.count; });
+    std::vector<double> weights(words.size());
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        weights[i] = std::log(1.0 + static_cast<double>(header.entries) / words[i].count);
+    }
+    double remaining = 0.0;
+    for (double weight : weights)
+    {
+        remaining += weight;
+    }
+
+    std::vector<Match> matches;
+    std::vector<Match> merged;
+    std::vector<double> scores;
+    for (size_t i = 0; i < words.size() && limit > 0; ++i)
+    {
+        const char *postings = bytes().data() + header.postingTable +
+                               words[i].postings * sizeof(std::uint32_t);
+        auto posting = [postings](std::uint32_t j)
+        {
+            std::uint32_t entry;
+            std::memcpy(&entry, postings + j * sizeof(entry), sizeof(entry));
+            return entry;
+        };
+        std::uint32_t count = words[i].count;
+        double weight = weights[i];
+
+        // Score an entry must beat to be among the best limit
+        double cutoff = -1.0;
+        if (matches.size() >= limit)
+        {
+            scores.clear();
+            for (const Match &match : matches)
+            {
+                scores.push_back(match.score);
+            }
+            std::nth_element(scores.begin(), scores.begin() + (limit - 1), scores.end(),
+                             std::greater<double>());
+            cutoff = scores[limit - 1];
+        }
+
+        merged.clear();
+        std::uint32_t j = 0;
+        if (i >= kCandidateWords || cutoff >= remaining)
+        {
+            for (Match match : matches)
+            {
+                if (match.score + remaining < cutoff)
+                {
+                    continue;
+                }
+                // Gallop to the entry, since matches are few by now
+                std::uint32_t step = 1;
+                while (j + step < count && posting(j + step) <= match.entry)
+                {
+                    j += step;
+                    step *= 2;
+                }
+                std::uint32_t high = std::min<std::uint32_t>(j + step, count);
+                while (j < high && posting(j) < match.entry)
+                {
+                    std::uint32_t middle = j + (high - j) / 2;
+                    if (posting(middle) < match.entry)
+                    {
+                        j = middle + 1;
+                    }
+                    else
+                    {
+                        high = middle;
+                    }
+                }
+                if (j < count && posting(j) == match.entry)
+                {
+                    match.score += weight;
+                }
+                merged.push_back(match);
+            }
+        }
+        else
+        {
+            size_t m = 0;
+            while (m < matches.size() || j < count)
+            {
+                if (j == count || (m < matches.size() && matches[m].entry < posting(j)))
+                {
+                    merged.push_back(matches[m++]);
+                }
+                else if (m == matches.size() || posting(j) < matches[m].entry)
+                {
+                    merged.push_back({posting(j++), weight});
+                }
+                else
+                {
+                    merged.push_back({matches[m].entry, matches[m].score + weight});
+                    ++m;
+                    ++j;
+                }
+            }
+        }
+        matches.swap(merged);
+        remaining -= weight;
+    }
+
+    size_t count = std::min(limit, matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + count, matches.end(),
+                      [](const Match &a, const Match &b)
+                      { return a.score != b.score ? a.score > b.score : a.entry < b.entry; });
+    matches.resize(count);
+    return matches;
+}
+
+PaperInfo LibraryIndex::entry(std::uint32_t i) const
+{
+    PaperInfo paper;
+    if (i >= header.entries)
+    {
+        return paper;
+    }
+    EntryRecord record = read<EntryRecord>(header.entryTable + i * sizeof(EntryRecord));
+    std::string_view strings = bytes().substr(header.stringTable);
+    if (record.offset > strings.size() || record.size > strings.size() - record.offset)
+    {
+        return paper;
+    }
+    readRecord(strings.substr(record.offset, record.size), paper);
+    return paper;
+}
+
+bool LibraryIndex::isStopword(const std::string &word)
+{
+    static const char *const stopwords[] = {"the", "of", "and", "an", "in", "on",
+                                            "for", "to", "with", "by", "from", "at",
+                                            "is",  "are", "as", "et", "al"};
+    for (const char *stopword : stopwords)
+    {
+        if (word == stopword)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LibraryIndex::saveWith(const std::string &path,
+                            const std::function<void(std::ostream &)> &write)
+{
+    try
+    {
+        std::filesystem::path target(path);
+        if (target.has_parent_path())
+        {
+            std::filesystem::create_directories(target.parent_path());
+        }
+
+        // Write a temporary file and rename it so readers never see a partial index
+        std::filesystem::path temp = target;
+        temp += ".tmp";
+        {
+            std::vector<char> buffer(1 << 20);
+            std::ofstream file;
+            file.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            file.open(temp, std::ios::binary | std::ios::trunc);
+            write(file);
+            file.flush();
+            if (!file)
+            {
+                std::cerr << "Failed to write library index: " << temp.string() << "\n";
+                return false;
+            }
+        }
+        std::filesystem::rename(temp, target);
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error saving library index: " << e.what() << "\n";
+        return false;
+    }
+}
+
+void LibraryIndex::writeRaw(std::ostream &out, const void *data, size_t size)
+{
+    out.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+}
+
+void LibraryIndex::appendRaw(std::string &bytes, const void *data, size_t size)
+{
+    bytes.append(static_cast<const char *>(data), size);
+}
+
+void LibraryIndex::appendString(std::string &bytes, std::string_view text)
+{
+    auto length = static_cast<std::uint32_t>(text.size());
+    appendRaw(bytes, &length, sizeof(length));
+    bytes += text;
+}
+
+void LibraryIndex::appendRecord(std::string &bytes, const PaperInfo &paper)
+{
+    appendString(bytes, paper.title);
+    std::string authors;
+    for (size_t i = 0; i < paper.authors.size(); ++i)
+    {
+        if (i > 0)
+        {
+            authors.push_back('\x1f');
+        }
+        authors += paper.authors[i];
+    }
+    appendString(bytes, authors);
+    for (auto field : kRecordFields)
+    {
+        appendString(bytes, paper.*field);
+    }
+}
+
+bool LibraryIndex::readString(std::string_view &record, std::string &text)
+{
+    std::uint32_t length;
+    if (record.size() < sizeof(length))
+    {
+        return false;
+    }
+    std::memcpy(&length, record.data(), sizeof(length));
+    record.remove_prefix(sizeof(length));
+    if (record.size() < length)
+    {
+        return false;
+    }
+    text.assign(record.data(), length);
+    record.remove_prefix(length);
+    return true;
+}
+
+void LibraryIndex::readRecord(std::string_view record, PaperInfo &paper)
+{
+    std::string authors;
+    if (!readString(record, paper.title) || !readString(record, authors))
+    {
+        return;
+    }
+    size_t start = 0;
+    while (!authors.empty())
+    {
+        size_t end = authors.find('\x1f', start);
+        paper.authors.push_back(authors.substr(start, end - start));
+        if (end == std::string::npos)
+        {
+            break;
+        }
+        start = end + 1;
+    }
+    for (auto field : kRecordFields)
+    {
+        if (!readString(record, paper.*field))
+        {
+            return;
+        }
+    }
+}
+
+bool LibraryIndex::find(std::string_view token, TokenRecord &record) const
+{
+    std::string_view strings = bytes().substr(header.stringTable);
+    std::uint64_t low = 0;
+    std::uint64_t high = header.tokens;
+    while (low < high)
+    {
+        std::uint64_t middle = low + (high - low) / 2;
+        record = read<TokenRecord>(header.tokenTable + middle * sizeof(TokenRecord));
+        if (record.text > strings.size() || record.length > strings.size() - record.text)
+        {
+            return false;
+        }
+        int order = strings.substr(record.text, record.length).compare(token);
+        if (order == 0)
+        {
+            return true;
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+bool LibraryIndex::validate()
+{
+    header = Header{};
+    std::string_view data = bytes();
+    Header stored{};
+    if (data.size() < sizeof(Header))
+    {
+        errorMessage = "Library index is truncated";
+        return false;
+    }
+    std::memcpy(&stored, data.data(), sizeof(Header));
+    if (std::memcmp(stored.magic, kMagic, sizeof(kMagic)) != 0 ||
+        stored.version != kFormatVersion || stored.byteOrder != kByteOrder)
+    {
+        errorMessage = "Not a library index of this version";
+        return false;
+    }
+    std::uint64_t size = data.size();
+    std::uint64_t entriesEnd = stored.entryTable + stored.entries * sizeof(EntryRecord);
+    std::uint64_t tokensEnd = stored.tokenTable + stored.tokens * sizeof(TokenRecord);
+    bool fits = stored.fileSize == size && stored.entries <= UINT32_MAX &&
+                stored.entryTable >= sizeof(Header) && stored.entryTable <= size &&
+                stored.entries <= (size - stored.entryTable) / sizeof(EntryRecord) &&
+                stored.tokenTable >= entriesEnd && stored.tokenTable <= size &&
+                stored.tokens <= (size - stored.tokenTable) / sizeof(TokenRecord) &&
+                stored.postingTable >= tokensEnd && stored.stringTable >= stored.postingTable &&
+                stored.stringTable <= size;
+    if (!fits)
+    {
+        errorMessage = "Library index is damaged";
+        return false;
+    }
+    header = stored;
+    errorMessage.clear();
+    return true;
+}
+
+void LibraryIndex::Batch::add(const PaperInfo &paper)
+{
+    auto entry = static_cast<std::uint32_t>(recordEnds.size());
+    appendRecord(records, paper);
+    recordEnds.push_back(records.size());
+
+    auto addWord = [&](const std::string &token)
+    {
+        auto id = static_cast<std::uint32_t>(lastEntry.size());
+        auto [it, added] = ids.try_emplace(token, id);
+        if (added)
+        {
+            lastEntry.push_back(entry);
+        }
+        else if (lastEntry[it->second] == entry)
+        {
+            return;
+        }
+        lastEntry[it->second] = entry;
+        occurrences.push_back({it->second, entry});
+    };
+    forEachToken(paper.title, addWord);
+    for (const auto &author : paper.authors)
+    {
+        forEachToken(author, addWord);
+    }
+    forEachToken(paper.year, addWord);
+}
+
+void LibraryIndex::Batch::finish()
+{
+    std::vector<std::pair<std::string_view, std::uint32_t>> sorted;
+    sorted.reserve(ids.size());
+    for (const auto &[word, id] : ids)
+    {
+        sorted.emplace_back(word, id);
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    std::vector<std::uint32_t> counts(ids.size());
+    for (const Occurrence &occurrence : occurrences)
+    {
+        ++counts[occurrence.word];
+    }
+    // Lay the posting lists out in word order. Occurrences are in entry
+    // order, so each list comes out ascending; next[id] is where the next
+    // entry of word id goes
+    std::vector<std::uint64_t> next(ids.size());
+    table.reserve(sorted.size());
+    std::uint64_t offset = 0;
+    for (const auto &[word, id] : sorted)
+    {
+        table.push_back({words.size(), static_cast<std::uint32_t>(word.size()), counts[id],
+                         offset});
+        words += word;
+        next[id] = offset;
+        offset += counts[id];
+    }
+    postings.resize(offset);
+    for (const Occurrence &occurrence : occurrences)
+    {
+        postings[next[occurrence.word]++] = occurrence.entry;
+    }
+
+    decltype(ids)().swap(ids);
+    decltype(lastEntry)().swap(lastEntry);
+    decltype(occurrences)().swap(occurrences);
+}
+
+QueryResult LibrarySource::parse(const std::string & /*response*/) const
+{
+    QueryResult result;
+    result.error_message = "The local library makes no requests";
+    return result;
+}
+
+bool LibrarySource::cached(const std::string &query_string, QueryResult &result)
+{
+    result = search(query_string);
+    return true;
+}
+
+QueryResult LibrarySource::search(const std::string &query_string, size_t max_results) const
+{
+    std::call_once(loaded, [this]() { load(); });
+
+    std::vector<std::string> tokens = LibraryIndex::tokenize(query_string);
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+    struct Candidate
+    {
+        LibraryIndex::Match match;
+        size_t index;
+    };
+    std::vector<Candidate> candidates;
+    for (size_t i = 0; i < indexes.size(); ++i)
+    {
+        for (const auto &match : indexes[i].search(tokens, max_results))
+        {
+            candidates.push_back({match, i});
+        }
+    }
+    size_t count = std::min(max_results, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                      [](const Candidate &a, const Candidate &b)
+                      {
+                          if (a.match.score != b.match.score)
+                          {
+                              return a.match.score > b.match.score;
+                          }
+                          return a.index < b.index;
+                      });
+
+    QueryResult result;
+    result.success = true;
+    for (size_t i = 0; i < count; ++i)
+    {
+        result.papers.push_back(indexes[candidates[i].index].entry(candidates[i].match.entry));
+    }
+    return result;
+}
+
+void LibrarySource::load() const
+{
+    TraceSpan span("load citation library", "citation");
+    for (const auto &path : bibFiles)
+    {
+        LibraryIndex index;
+        if (openBib(path, index))
+        {
+            indexes.push_back(std::move(index));
+        }
+    }
+    for (const auto &path : stores)
+    {
+        LibraryIndex index;
+        if (index.open(path))
+        {
+            indexes.push_back(std::move(index));
+        }
+        else
+        {
+            std::cerr << "Error: Cannot open citation store " << path << ": " << index.error()
+                      << "\n";
+        }
+    }
+}
+
+bool LibrarySource::openBib(const std::string &path, LibraryIndex &index)
+{
+    std::error_code error;
+    auto size = std::filesystem::file_size(path, error);
+    std::filesystem::file_time_type modified;
+    if (!error)
+    {
+        modified = std::filesystem::last_write_time(path, error);
+    }
+    if (error)
+    {
+        std::cerr << "Error: Cannot read citation library " << path << ": "
+                  << error.message() << "\n";
+        return false;
+    }
+    IndexStamp stamp{static_cast<std::int64_t>(size),
+                     static_cast<std::int64_t>(modified.time_since_epoch().count())};
+
+    std::string indexPath = path + ".idx";
+    if (index.open(indexPath) && index.stamp() == stamp)
+    {
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(path))
+    {
+        std::cerr << "Error: " << file.error() << "\n";
+        return false;
+    }
+    std::vector<PaperInfo> papers = BibParser(file.data()).parse();
+    std::vector<LibraryIndex::Batch> batches(1);
+    for (const auto &paper : papers)
+    {
+        batches[0].add(paper);
+    }
+    batches[0].finish();
+    std::string bytes = LibraryIndex::build(batches, stamp);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cerr << "Indexed " << papers.size() << " entries of " << path << " in "
+              << elapsed.count() << " ms" << "\n";
+
+    // Without a saved index, this run still searches it from memory
+    if (LibraryIndex::save(bytes, indexPath) && index.open(indexPath))
+    {
+        return true;
+    }
+    return index.load(std::move(bytes));
+}
+
+} // namespace citation
@@ -0,0 +1,1048 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <nlohmann/json.hpp>
+#include <string_view>
+#include <utility>
+
+#include "conversion_server.h"
+#include "latex_template.h"
+#include "output_sink.h"
+#include "trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define MD2LATEX_HAVE_SOCKETS 1
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct ConversionServer::Connection
+{
+    std::uint64_t id{0};
+    int fd{-1};
+    std::string input;
+    // Response being written: a header and the body
+    std::string header;
+    std::string body;
+    size_t written{0};
+    // The request in flight; only one per connection at a time, so that
+    // responses go out in the order of the requests
+    std::shared_ptr<Request> request;
+    // Speaking HTTP rather than the framed protocol
+    bool http{false};
+    // Close once the response has been written
+    bool closing{false};
+    // "100 Continue" has been sent for the request being received
+    bool continued{false};
+    // The peer has shut down its side; close when its requests are answered
+    bool inputDone{false};
+};
+
+struct ConversionServer::Request
+{
+    std::uint64_t connection{0};
+    std::shared_ptr<const MarkdownConverter> converter;
+    std::string markdown;
+    Clock::time_point deadline;
+    std::atomic<bool> cancelled{false};
+    // Close the connection after the response (HTTP "Connection: close")
+    bool closeAfter{false};
+    // Answer the BibTeX instead of the LaTeX (HTTP "output=bibliography")
+    bool bibliographyOnly{false};
+};
+
+namespace
+{
+
+// Longest header line or HTTP header block accepted
+constexpr size_t kMaxHeaderBytes = 16 * 1024;
+constexpr size_t kReadSize = 64 * 1024;
+constexpr const char *kLatexType = "application/x-tex";
+constexpr const char *kTextType = "text/plain";
+constexpr const char *kBibTeXType = "application/x-bibtex";
+
+const char *reasonPhrase(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 411:
+        return "Length Required";
+    case 413:
+        return "Payload Too Large";
+    case 431:
+        return "Request Header Fields Too Large";
+    case 500:
+        return "Internal Server Error";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Error";
+    }
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(),
+                      [](char x, char y) { return std::tolower(static_cast<unsigned char>(x)) ==
+                                                  std::tolower(static_cast<unsigned char>(y)); });
+}
+
+std::string_view trim(std::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+    {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+    {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// Parse a decimal number; false unless text is all digits
+bool parseSize(std::string_view text, size_t &value)
+{
+    if (text.empty() || text.size() > 18)
+    {
+        return false;
+    }
+    value = 0;
+    for (char chr : text)
+    {
+        if (chr < '0' || chr > '9')
+        {
+            return false;
+        }
+        value = value * 10 + static_cast<size_t>(chr - '0');
+    }
+    return true;
+}
+
+// Deadline for a request arriving now that may take seconds
+Clock::time_point deadlineAfter(double seconds)
+{
+    // Beyond this a deadline is as good as none, and converting it overflows
+    constexpr double kForever = 1e9;
+    if (seconds >= kForever)
+    {
+        return Clock::time_point::max();
+    }
+    return Clock::now() +
+           std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+#ifdef MD2LATEX_HAVE_SOCKETS
+bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 &&
+           fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+#endif
+
+} // namespace
+
+ConversionServer::ConversionServer(ConverterOptions converter, ServerOptions server)
+    : converterOptions(std::move(converter)), options(std::move(server)), pool(options.threads)
+{
+    // Nobody is there to answer a prompt, and the BibTeX goes into the response
+    converterOptions.promptCitations = false;
+    converterOptions.bibliographyPath.clear();
+    ConverterOptions minimalOptions = converterOptions;
+    minimalOptions.documentTemplate = LatexTemplate::minimal();
+    defaultConverter = std::make_shared<const MarkdownConverter>(converterOptions);
+    minimalConverter = std::make_shared<const MarkdownConverter>(minimalOptions);
+
+    contexts.reserve(pool.size());
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+        contexts.push_back(std::make_unique<ConversionContext>());
+    }
+}
+
+ConversionServer::~ConversionServer() { close(); }
+
+size_t ConversionServer::requests() const { return answered; }
+
+size_t ConversionServer::failures() const { return failed; }
+
+const std::string &ConversionServer::error() const { return errorMessage; }
+
+std::shared_ptr<const MarkdownConverter>
+ConversionServer::converterFor(const std::string &name) const
+{
+    if (name.empty() || name == "default")
+    {
+        return defaultConverter;
+    }
+    if (name == "minimal")
+    {
+        return minimalConverter;
+    }
+    return nullptr;
+}
+
+void ConversionServer::convert(const std::shared_ptr<Request> &request, size_t worker)
+{
+    TraceSpan span("serve request", "serve");
+    Completion done{request->connection, 200, {}, {}, kLatexType};
+    try
+    {
+        if (request->cancelled.load())
+        {
+            done.status = 503;
+            done.message = "cancelled";
+        }
+        else if (Clock::now() >= request->deadline)
+        {
+            done.status = 503;
+            done.message = "deadline exceeded";
+        }
+        else
+        {
+            ConversionContext &context = *contexts[worker];
+            context.setLimits(request->deadline, &request->cancelled);
+            {
+                StringOutput sink(done.body);
+                std::ostream out(&sink);
+                request->converter->convertToLatex(std::string_view(request->markdown), out,
+                                                   context);
+            }
+            bool interrupted = context.interrupted();
+            context.setLimits(Clock::time_point::max());
+            if (interrupted)
+            {
+                done.status = 503;
+                done.message = request->cancelled.load() ? "cancelled" : "deadline exceeded";
+                done.body.clear();
+            }
+            else if (request->bibliographyOnly)
+            {
+                done.body = context.bibliography();
+                done.contentType = kBibTeXType;
+            }
+            else
+            {
+                done.bibliography = context.bibliography();
+            }
+        }
+    }
+    catch (const std::exception &exception)
+    {
+        done.status = 500;
+        done.message = exception.what();
+        done.body.clear();
+    }
+    finish(std::move(done));
+}
+
+#ifdef MD2LATEX_HAVE_SOCKETS
+
+bool ConversionServer::open()
+{
+    close();
+
+    auto fail = [&](const std::string &what)
+    {
+        errorMessage = what + ": " + std::strerror(errno);
+        close();
+        return false;
+    };
+
+    if (pipe(wakeFds) != 0)
+    {
+        return fail("pipe failed");
+    }
+    if (!setNonBlocking(wakeFds[0]) || !setNonBlocking(wakeFds[1]))
+    {
+        return fail("fcntl failed");
+    }
+
+    const std::string &path = options.socketPath;
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+    {
+        errorMessage = "Socket path is empty or too long: " + path;
+        close();
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    auto *socketAddress = reinterpret_cast<sockaddr *>(&address);
+
+    // Replace the socket file of a server that is gone, but neither a running
+    // server's nor anything that is not a socket
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0)
+    {
+        if (!S_ISSOCK(info.st_mode))
+        {
+            errorMessage = "Not a socket: " + path;
+            close();
+            return false;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = probe >= 0 && connect(probe, socketAddress, sizeof(address)) == 0;
+        if (probe >= 0)
+        {
+            ::close(probe);
+        }
+        if (live)
+        {
+            errorMessage = "Another server is listening on " + path;
+            close();
+            return false;
+        }
+        unlink(path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return fail("socket failed");
+    }
+    if (bind(fd, socketAddress, sizeof(address)) != 0)
+    {
+        int bindError = errno;
+        ::close(fd);
+        errno = bindError;
+        return fail("Cannot bind " + path);
+    }
+    // From here on close() removes the socket file
+    socketFd = fd;
+    if (listen(socketFd, SOMAXCONN) != 0 || !setNonBlocking(socketFd))
+    {
+        return fail("Cannot listen on " + path);
+    }
+
+    if (options.httpPort != 0)
+    {
+        httpFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (httpFd < 0)
+        {
+            return fail("socket failed");
+        }
+        int one = 1;
+        setsockopt(httpFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_port = htons(static_cast<std::uint16_t>(options.httpPort));
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::string where = "127.0.0.1:" + std::to_string(options.httpPort);
+        if (bind(httpFd, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0)
+        {
+            return fail("Cannot bind " + where);
+        }
+        if (listen(httpFd, SOMAXCONN) != 0 || !setNonBlocking(httpFd))
+        {
+            return fail("Cannot listen on " + where);
+        }
+    }
+    errorMessage.clear();
+    return true;
+}
+
+void ConversionServer::close()
+{
+    // Workers still converting refer to the connections' requests
+    for (auto &entry : connections)
+    {
+        if (entry.second->request)
+        {
+            entry.second->request->cancelled = true;
+        }
+    }
+    pool.wait();
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        completions.clear();
+    }
+    for (auto &entry : connections)
+    {
+        if (entry.second->fd >= 0)
+        {
+            ::close(entry.second->fd);
+        }
+    }
+    connections.clear();
+
+    if (socketFd >= 0)
+    {
+        ::close(socketFd);
+        unlink(options.socketPath.c_str());
+        socketFd = -1;
+    }
+    if (httpFd >= 0)
+    {
+        ::close(httpFd);
+        httpFd = -1;
+    }
+    for (int &fd : wakeFds)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+}
+
+bool ConversionServer::run(int stopFd)
+{
+    if (socketFd < 0)
+    {
+        errorMessage = "The server is not open";
+        return false;
+    }
+
+    // poll() skips negative descriptors, so the optional ones keep their slot
+    enum : size_t
+    {
+        kWake,
+        kSocket,
+        kHttp,
+        kStop,
+        kFixed
+    };
+    std::vector<pollfd> fds;
+    std::vector<std::uint64_t> ids;
+    bool served = true;
+    while (true)
+    {
+        fds.assign({{wakeFds[0], POLLIN, 0},
+                    {socketFd, POLLIN, 0},
+                    {httpFd, POLLIN, 0},
+                    {stopFd, POLLIN, 0}});
+        ids.clear();
+        for (auto &entry : connections)
+        {
+            Connection &connection = *entry.second;
+            if (connection.fd < 0)
+            {
+                continue;
+            }
+            short events = 0;
+            // Stop reading from a client that sends faster than it is served
+            if (!connection.inputDone &&
+                connection.input.size() < options.maxRequestBytes + kMaxHeaderBytes)
+            {
+                events |= POLLIN;
+            }
+            if (connection.written < connection.header.size() + connection.body.size())
+            {
+                events |= POLLOUT;
+            }
+            fds.push_back({connection.fd, events, 0});
+            ids.push_back(entry.first);
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            errorMessage = std::string("poll failed: ") + std::strerror(errno);
+            served = false;
+            break;
+        }
+        if (fds[kStop].revents != 0)
+        {
+            break;
+        }
+        if (fds[kWake].revents != 0)
+        {
+            collectCompletions();
+        }
+        if (fds[kSocket].revents != 0)
+        {
+            accept(socketFd);
+        }
+        if (fds[kHttp].revents != 0)
+        {
+            accept(httpFd);
+        }
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            short revents = fds[kFixed + i].revents;
+            auto found = connections.find(ids[i]);
+            if (revents == 0 || found == connections.end() || found->second->fd < 0)
+            {
+                continue;
+            }
+            Connection &connection = *found->second;
+            if (revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                readFrom(connection, (revents & (POLLHUP | POLLERR)) != 0);
+            }
+            else
+            {
+                service(connection);
+            }
+        }
+
+        // A closed connection with a request in flight waits for its completion
+        for (auto entry = connections.begin(); entry != connections.end();)
+        {
+            if (entry->second->fd < 0 && !entry->second->request)
+            {
+                entry = connections.erase(entry);
+            }
+            else
+            {
+                ++entry;
+            }
+        }
+    }
+    close();
+    return served;
+}
+
+void ConversionServer::accept(int listener)
+{
+    while (true)
+    {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        if (!setNonBlocking(fd))
+        {
+            ::close(fd);
+            continue;
+        }
+        int one = 1;
+#ifdef SO_NOSIGPIPE
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        if (listener == httpFd)
+        {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        auto connection = std::make_unique<Connection>();
+        connection->id = nextConnection++;
+        connection->fd = fd;
+        connections.emplace(connection->id, std::move(connection));
+    }
+}
+
+void ConversionServer::readFrom(Connection &connection, bool hangup)
+{
+    char buffer[kReadSize];
+    while (!connection.inputDone)
+    {
+        ssize_t count = read(connection.fd, buffer, sizeof(buffer));
+        if (count > 0)
+        {
+            connection.input.append(buffer, static_cast<size_t>(count));
+            continue;
+        }
+        if (count == 0)
+        {
+            connection.inputDone = true;
+        }
+        else if (errno == EINTR)
+        {
+            continue;
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            hangup = true;
+        }
+        break;
+    }
+
+    // A client that has shut down only its sending side still gets its
+    // answers; one that is gone, or an HTTP client closing, has its request
+    // cancelled
+    if (hangup || (connection.inputDone && connection.http))
+    {
+        closeConnection(connection);
+        return;
+    }
+    service(connection);
+}
+
+void ConversionServer::service(Connection &connection)
+{
+    while (connection.fd >= 0)
+    {
+        if (connection.written < connection.header.size() + connection.body.size())
+        {
+            if (!flushOutput(connection))
+            {
+                return;
+            }
+            continue;
+        }
+        if (connection.closing)
+        {
+            closeConnection(connection);
+            return;
+        }
+        if (connection.request)
+        {
+            return;
+        }
+
+        // Tolerate line breaks between framed requests, e.g. typed by hand
+        std::string &input = connection.input;
+        size_t start = input.find_first_not_of("\r\n");
+        input.erase(0, start == std::string::npos ? input.size() : start);
+        if (input.empty())
+        {
+            if (connection.inputDone)
+            {
+                closeConnection(connection);
+            }
+            return;
+        }
+
+        auto request = std::make_shared<Request>();
+        request->connection = connection.id;
+        connection.http = input[0] != '{';
+        Parsed parsed =
+            connection.http ? parseHttp(connection, *request) : parseFramed(connection, *request);
+        if (parsed == Parsed::Request)
+        {
+            connection.request = request;
+            pool.submit([this, request](size_t worker) { convert(request, worker); });
+            return;
+        }
+        if (parsed == Parsed::Incomplete && connection.header.empty())
+        {
+            if (connection.inputDone)
+            {
+                closeConnection(connection);
+            }
+            return;
+        }
+    }
+}
+
+bool ConversionServer::flushOutput(Connection &connection)
+{
+    const std::string &header = connection.header;
+    const std::string &body = connection.body;
+    while (connection.written < header.size() + body.size())
+    {
+        iovec parts[2];
+        msghdr message{};
+        message.msg_iov = parts;
+        if (connection.written < header.size())
+        {
+            parts[0] = {const_cast<char *>(header.data()) + connection.written,
+                        header.size() - connection.written};
+            parts[1] = {const_cast<char *>(body.data()), body.size()};
+            message.msg_iovlen = body.empty() ? 1 : 2;
+        }
+        else
+        {
+            size_t offset = connection.written - header.size();
+            parts[0] = {const_cast<char *>(body.data()) + offset, body.size() - offset};
+            message.msg_iovlen = 1;
+        }
+
+        ssize_t count = sendmsg(connection.fd, &message, MSG_NOSIGNAL);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                closeConnection(connection);
+            }
+            return false;
+        }
+        connection.written += static_cast<size_t>(count);
+    }
+    connection.header.clear();
+    // Do not hold on to the memory of a large document between requests
+    connection.body = std::string();
+    connection.written = 0;
+    return true;
+}
+
+void ConversionServer::closeConnection(Connection &connection)
+{
+    if (connection.request)
+    {
+        connection.request->cancelled = true;
+    }
+    if (connection.fd >= 0)
+    {
+        ::close(connection.fd);
+        connection.fd = -1;
+    }
+    connection.input = std::string();
+    connection.header.clear();
+    connection.body = std::string();
+    connection.written = 0;
+}
+
+ConversionServer::Parsed ConversionServer::parseFramed(Connection &connection, Request &request)
+{
+    std::string &input = connection.input;
+    auto reject = [&](int status, const std::string &message, bool close)
+    {
+        if (close)
+        {
+            input.clear();
+        }
+        respond(connection, {connection.id, status, message, {}, kTextType}, close);
+        return Parsed::Answered;
+    };
+
+    size_t lineEnd = input.find('\n');
+    if (lineEnd == std::string::npos)
+    {
+        return input.size() > kMaxHeaderBytes ? reject(431, "header line too long", true)
+                                              : Parsed::Incomplete;
+    }
+    if (lineEnd > kMaxHeaderBytes)
+    {
+        return reject(431, "header line too long", true);
+    }
+
+    nlohmann::json header =
+        nlohmann::json::parse(input.begin(), input.begin() + lineEnd, nullptr, false);
+    if (header.is_discarded() || !header.is_object())
+    {
+        return reject(400, "invalid request header", true);
+    }
+    auto length = header.find("length");
+    if (length == header.end() || !length->is_number_unsigned())
+    {
+        return reject(400, "request header without length", true);
+    }
+    size_t size = length->get<size_t>();
+    if (size > options.maxRequestBytes)
+    {
+        return reject(413, "document too large", true);
+    }
+    if (input.size() - lineEnd - 1 < size)
+    {
+        return Parsed::Incomplete;
+    }
+
+    std::string templateName;
+    auto field = header.find("template");
+    if (field != header.end() && field->is_string())
+    {
+        templateName = field->get<std::string>();
+    }
+    double timeout = options.timeoutSeconds;
+    field = header.find("timeout_ms");
+    if (field != header.end() && field->is_number())
+    {
+        timeout = field->get<double>() / 1000.0;
+    }
+
+    request.markdown.assign(input, lineEnd + 1, size);
+    input.erase(0, lineEnd + 1 + size);
+    request.converter = converterFor(templateName);
+    if (!request.converter)
+    {
+        return reject(400, "unknown template: " + templateName, false);
+    }
+    request.deadline = deadlineAfter(timeout);
+    return Parsed::Request;
+}
+
+ConversionServer::Parsed ConversionServer::parseHttp(Connection &connection, Request &request)
+{
+    std::string &input = connection.input;
+    auto reject = [&](int status, const std::string &message, bool close)
+    {
+        if (close)
+        {
+            input.clear();
+        }
+        respond(connection, {connection.id, status, message, {}, kTextType}, close);
+        return Parsed::Answered;
+    };
+
+    size_t headEnd = input.find("\r\n\r\n");
+    if (headEnd == std::string::npos)
+    {
+        return input.size() > kMaxHeaderBytes ? reject(431, "header too long", true)
+                                              : Parsed::Incomplete;
+    }
+    std::string_view head(input.data(), headEnd);
+    size_t lineEnd = std::min(head.find("\r\n"), head.size());
+    std::string_view requestLine = head.substr(0, lineEnd);
+    size_t methodEnd = requestLine.find(' ');
+    size_t targetEnd = requestLine.rfind(' ');
+    if (methodEnd == std::string_view::npos || targetEnd <= methodEnd + 1)
+    {
+        return reject(400, "invalid request line", true);
+    }
+    std::string_view method = requestLine.substr(0, methodEnd);
+    std::string_view target = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+    bool keepAlive = requestLine.substr(targetEnd + 1) == "HTTP/1.1";
+
+    size_t contentLength = 0;
+    bool expectContinue = false;
+    while (lineEnd < head.size())
+    {
+        size_t next = std::min(head.find("\r\n", lineEnd + 2), head.size());
+        std::string_view line = head.substr(lineEnd + 2, next - lineEnd - 2);
+        lineEnd = next;
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+        {
+            continue;
+        }
+        std::string_view name = trim(line.substr(0, colon));
+        std::string_view value = trim(line.substr(colon + 1));
+        if (equalsIgnoreCase(name, "Content-Length"))
+        {
+            if (!parseSize(value, contentLength))
+            {
+                return reject(400, "invalid Content-Length", true);
+            }
+        }
+        else if (equalsIgnoreCase(name, "Transfer-Encoding") &&
+                 !equalsIgnoreCase(value, "identity"))
+        {
+            return reject(411, "Content-Length required", true);
+        }
+        else if (equalsIgnoreCase(name, "Connection"))
+        {
+            keepAlive = equalsIgnoreCase(value, "keep-alive") ||
+                        (keepAlive && !equalsIgnoreCase(value, "close"));
+        }
+        else if (equalsIgnoreCase(name, "Expect"))
+        {
+            expectContinue = equalsIgnoreCase(value, "100-continue");
+        }
+    }
+    if (contentLength > options.maxRequestBytes)
+    {
+        return reject(413, "document too large", true);
+    }
+    size_t bodyStart = headEnd + 4;
+    if (input.size() - bodyStart < contentLength)
+    {
+        if (expectContinue && !connection.continued)
+        {
+            connection.continued = true;
+            connection.header = "HTTP/1.1 100 Continue\r\n\r\n";
+        }
+        return Parsed::Incomplete;
+    }
+    connection.continued = false;
+
+    size_t queryStart = std::min(target.find('?'), target.size());
+    std::string path(target.substr(0, queryStart));
+    std::string query(target.substr(std::min(queryStart + 1, target.size())));
+    bool isPost = method == "POST";
+    bool isGet = method == "GET";
+    request.markdown.assign(input, bodyStart, contentLength);
+    input.erase(0, bodyStart + contentLength);
+
+    if (path == "/health")
+    {
+        if (!isGet)
+        {
+            return reject(405, "use GET", !keepAlive);
+        }
+        respond(connection, {connection.id, 200, {}, "ok\n", kTextType}, !keepAlive);
+        return Parsed::Answered;
+    }
+    if (path != "/convert")
+    {
+        return reject(404, "no such resource: " + path, !keepAlive);
+    }
+    if (!isPost)
+    {
+        return reject(405, "use POST", !keepAlive);
+    }
+
+    std::string templateName;
+    double timeout = options.timeoutSeconds;
+    std::string_view parameters = query;
+    while (!parameters.empty())
+    {
+        size_t end = std::min(parameters.find('&'), parameters.size());
+        std::string_view parameter = parameters.substr(0, end);
+        parameters.remove_prefix(std::min(end + 1, parameters.size()));
+        size_t equals = std::min(parameter.find('='), parameter.size());
+        std::string_view name = parameter.substr(0, equals);
+        std::string_view value = parameter.substr(std::min(equals + 1, parameter.size()));
+        size_t milliseconds = 0;
+        if (name == "template")
+        {
+            templateName = value;
+        }
+        else if (name == "timeout_ms" && parseSize(value, milliseconds))
+        {
+            timeout = static_cast<double>(milliseconds) / 1000.0;
+        }
+        else if (name == "output")
+        {
+            if (value != "latex" && value != "bibliography")
+            {
+                return reject(400, "unknown output: " + std::string(value), !keepAlive);
+            }
+            request.bibliographyOnly = value == "bibliography";
+        }
+    }
+
+    request.converter = converterFor(templateName);
+    if (!request.converter)
+    {
+        return reject(400, "unknown template: " + templateName, !keepAlive);
+    }
+    request.deadline = deadlineAfter(timeout);
+    request.closeAfter = !keepAlive;
+    return Parsed::Request;
+}
+
+void ConversionServer::respond(Connection &connection, Completion completion, bool close)
+{
+    ++answered;
+    bool ok = completion.status == 200;
+    if (!ok)
+    {
+        ++failed;
+    }
+
+    if (connection.http)
+    {
+        if (!ok)
+        {
+            completion.body = completion.message + "\n";
+            completion.contentType = kTextType;
+        }
+        connection.header = "HTTP/1.1 " + std::to_string(completion.status) + " " +
+                            reasonPhrase(completion.status) +
+                            "\r\nContent-Type: " + completion.contentType +
+                            "\r\nContent-Length: " + std::to_string(completion.body.size()) +
+                            "\r\nConnection: " + (close ? "close" : "keep-alive") + "\r\n\r\n";
+    }
+    else if (ok)
+    {
+        connection.header =
+            "{\"status\":\"ok\",\"length\":" + std::to_string(completion.body.size());
+        if (!completion.bibliography.empty())
+        {
+            // Library entries are copied as written and need not be UTF-8
+            connection.header +=
+                ",\"bibliography\":" +
+                nlohmann::json(completion.bibliography)
+                    .dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        }
+        connection.header += "}\n";
+    }
+    else
+    {
+        completion.body.clear();
+        // Messages may quote bytes of the request, which need not be UTF-8
+        std::string message = nlohmann::json(completion.message)
+                                  .dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        connection.header =
+            "{\"status\":\"error\",\"error\":" + message + ",\"length\":0}\n";
+    }
+    connection.body = std::move(completion.body);
+    connection.written = 0;
+    connection.closing = close;
+}
+
+void ConversionServer::finish(Completion completion)
+{
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        completions.push_back(std::move(completion));
+    }
+    // A full pipe already has the polling thread on its way
+    char wake = 1;
+    ssize_t ignored = write(wakeFds[1], &wake, 1);
+    static_cast<void>(ignored);
+}
+
+void ConversionServer::collectCompletions()
+{
+    char buffer[256];
+    while (read(wakeFds[0], buffer, sizeof(buffer)) > 0)
+    {
+    }
+    std::deque<Completion> done;
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        done.swap(completions);
+    }
+
+    for (Completion &completion : done)
+    {
+        auto found = connections.find(completion.connection);
+        if (found == connections.end())
+        {
+            continue;
+        }
+        Connection &connection = *found->second;
+        bool close = connection.request && connection.request->closeAfter;
+        connection.request.reset();
+        if (connection.fd < 0)
+        {
+            connections.erase(found);
+            continue;
+        }
+        respond(connection, std::move(completion), close);
+        service(connection);
+    }
+}
+
+#else
+
+bool ConversionServer::open()
+{
+    errorMessage = "serve needs Unix domain sockets, which this platform lacks";
+    return false;
+}
+
+void ConversionServer::close() {}
+
+bool ConversionServer::run(int)
+{
+    errorMessage = "serve needs Unix domain sockets, which this platform lacks";
+    return false;
+}
+
+void ConversionServer::finish(Completion) {}
+
+#endif
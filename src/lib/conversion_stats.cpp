@@ -0,0 +1,191 @@
+#include <cstdio>
+#include <nlohmann/json.hpp>
+
+#include "conversion_stats.h"
+
+namespace
+{
+
+nlohmann::json stageToJson(const StageStats &stage, bool withChanged)
+{
+    nlohmann::json json = {
+        {"count", stage.count}, {"bytes", stage.bytes}, {"seconds", stage.seconds}};
+    if (withChanged)
+    {
+        json["changed"] = stage.changed;
+    }
+    return json;
+}
+
+// One row of the text table
+void writeRow(std::ostream &out, const char *name, const StageStats &stage, bool withChanged)
+{
+    char row[128];
+    if (withChanged)
+    {
+        std::snprintf(row, sizeof(row), "    %-12s %12zu %10zu %14zu %10.3f\n", name, stage.count,
+                      stage.changed, stage.bytes, stage.seconds);
+    }
+    else
+    {
+        std::snprintf(row, sizeof(row), "    %-12s %12zu %10s %14zu %10.3f\n", name, stage.count,
+                      "", stage.bytes, stage.seconds);
+    }
+    out << row;
+}
+
+} // namespace
+
+void StageStats::add(const StageStats &other)
+{
+    count += other.count;
+    changed += other.changed;
+    bytes += other.bytes;
+    seconds += other.seconds;
+}
+
+double ConversionStats::conversionSeconds() const
+{
+    double seconds = parseSeconds;
+    for (const StageStats &stage : blocks)
+    {
+        seconds += stage.seconds;
+    }
+    return seconds;
+}
+
+void ConversionStats::add(const ConversionStats &other)
+{
+    documents += other.documents;
+    lines += other.lines;
+    inputBytes += other.inputBytes;
+    parseSeconds += other.parseSeconds;
+    for (size_t i = 0; i < kBlockTypeCount; ++i)
+    {
+        blocks[i].add(other.blocks[i]);
+    }
+    for (size_t i = 0; i < kInlinePassCount; ++i)
+    {
+        inlinePasses[i].add(other.inlinePasses[i]);
+    }
+    citationReferences += other.citationReferences;
+    citationLibraryMatches += other.citationLibraryMatches;
+    citationLookups += other.citationLookups;
+    citationsResolved += other.citationsResolved;
+    citationsUnmatched += other.citationsUnmatched;
+    citationLookupsFailed += other.citationLookupsFailed;
+    citationNetworkSeconds += other.citationNetworkSeconds;
+    citationSeconds += other.citationSeconds;
+}
+
+void ConversionStats::writeText(std::ostream &out) const
+{
+    char line[160];
+    out << "Conversion statistics (" << documents << (documents == 1 ? " document" : " documents")
+        << ")\n";
+    std::snprintf(line, sizeof(line), "  %zu lines, %zu bytes\n", lines, inputBytes);
+    out << line;
+
+    std::snprintf(line, sizeof(line), "  %-16s %12s %10s %14s %10s\n", "blocks", "count", "",
+                  "bytes", "seconds");
+    out << line;
+    for (size_t i = 0; i < kBlockTypeCount; ++i)
+    {
+        writeRow(out, blockTypeName(static_cast<BlockType>(i)), blocks[i], false);
+    }
+
+    std::snprintf(line, sizeof(line), "  %-16s %12s %10s %14s %10s\n", "inline passes", "lines",
+                  "changed", "bytes", "seconds");
+    out << line;
+    for (size_t i = 0; i < kInlinePassCount; ++i)
+    {
+        writeRow(out, inlinePassName(static_cast<InlinePass>(i)), inlinePasses[i], true);
+    }
+
+    std::snprintf(line, sizeof(line),
+                  "  citations: %zu references, %zu from the library, %zu looked up, "
+                  "%zu resolved, %zu without a confident match, %zu failed lookups\n",
+                  citationReferences, citationLibraryMatches, citationLookups,
+                  citationsResolved, citationsUnmatched, citationLookupsFailed);
+    out << line;
+    std::snprintf(line, sizeof(line),
+                  "  time: parse %.3f s, emit %.3f s, citation network %.3f s of %.3f s "
+                  "citation phase\n",
+                  parseSeconds, conversionSeconds() - parseSeconds, citationNetworkSeconds,
+                  citationSeconds);
+    out << line;
+}
+
+std::string ConversionStats::toJson() const
+{
+    nlohmann::json blockJson = nlohmann::json::object();
+    for (size_t i = 0; i < kBlockTypeCount; ++i)
+    {
+        blockJson[blockTypeName(static_cast<BlockType>(i))] = stageToJson(blocks[i], false);
+    }
+    nlohmann::json passJson = nlohmann::json::object();
+    for (size_t i = 0; i < kInlinePassCount; ++i)
+    {
+        passJson[inlinePassName(static_cast<InlinePass>(i))] = stageToJson(inlinePasses[i], true);
+    }
+
+    nlohmann::json json = {
+        {"documents", documents},
+        {"lines", lines},
+        {"input_bytes", inputBytes},
+        {"parse_seconds", parseSeconds},
+        {"conversion_seconds", conversionSeconds()},
+        {"blocks", blockJson},
+        {"inline_passes", passJson},
+        {"citations",
+         {{"references", citationReferences},
+          {"library_matches", citationLibraryMatches},
+          {"lookups", citationLookups},
+          {"resolved", citationsResolved},
+          {"unmatched", citationsUnmatched},
+          {"failed_lookups", citationLookupsFailed},
+          {"network_seconds", citationNetworkSeconds},
+          {"seconds", citationSeconds}}},
+    };
+    return json.dump();
+}
+
+const char *blockTypeName(BlockType type)
+{
+    switch (type)
+    {
+    case BlockType::Heading:
+        return "headers";
+    case BlockType::ListItem:
+        return "list_items";
+    case BlockType::Quote:
+        return "quote_lines";
+    case BlockType::Paragraph:
+        return "paragraphs";
+    case BlockType::CodeBlock:
+        return "code_blocks";
+    case BlockType::Blank:
+        return "blank_lines";
+    }
+    return "unknown";
+}
+
+const char *inlinePassName(InlinePass which)
+{
+    switch (which)
+    {
+    case InlinePass::Links:
+        return "links";
+    case InlinePass::Images:
+        return "images";
+    case InlinePass::Emphasis:
+        return "emphasis";
+    case InlinePass::Code:
+        return "code";
+    case InlinePass::Citations:
+        return "citations";
+    case InlinePass::Escape:
+        return "escape";
+    }
+    return "unknown";
+}
@@ -0,0 +1,260 @@
+// Definitions of the libcurl functions the citation code calls, forwarding to
+// libcurl loaded with dlopen() on the first call. Built instead of linking
+// libcurl when MD2LATEX_LAZY_CURL is on, so that converting documents without
+// citations never loads libcurl and the TLS, Kerberos and LDAP libraries it
+// pulls in, which otherwise dominate the startup time of the program.
+//
+// Only the functions used by the citation headers are defined; calling any
+// other curl function fails to link, which is the reminder to add it here.
+
+// The type-checking macros of curl.h would hide the definitions below
+#define CURL_DISABLE_TYPECHECK
+
+#include <cstdarg>
+#include <curl/curl.h>
+#include <dlfcn.h>
+#include <initializer_list>
+#include <iostream>
+#include <type_traits>
+
+namespace
+{
+
+// Entry points of the loaded library; all null when it could not be loaded
+struct CurlLibrary
+{
+    CURLcode (*globalInit)(long);
+    CURL *(*easyInit)();
+    CURLcode (*easySetopt)(CURL *, CURLoption, ...);
+    CURLcode (*easyPerform)(CURL *);
+    CURLcode (*easyGetinfo)(CURL *, CURLINFO, ...);
+    void (*easyReset)(CURL *);
+    void (*easyCleanup)(CURL *);
+    const char *(*easyStrerror)(CURLcode);
+    CURLSH *(*shareInit)();
+    CURLSHcode (*shareSetopt)(CURLSH *, CURLSHoption, ...);
+    CURLSHcode (*shareCleanup)(CURLSH *);
+    CURLM *(*multiInit)();
+    CURLMcode (*multiAddHandle)(CURLM *, CURL *);
+    CURLMcode (*multiRemoveHandle)(CURLM *, CURL *);
+    CURLMcode (*multiPerform)(CURLM *, int *);
+    CURLMcode (*multiPoll)(CURLM *, curl_waitfd[], unsigned int, int, int *);
+    CURLMsg *(*multiInfoRead)(CURLM *, int *);
+    CURLMcode (*multiCleanup)(CURLM *);
+    const char *(*multiStrerror)(CURLMcode);
+};
+
+bool load(CurlLibrary &library)
+{
+    void *handle = nullptr;
+    for (const char *name : {MD2LATEX_CURL_SONAME, MD2LATEX_CURL_PATH})
+    {
+        handle = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+        if (handle)
+        {
+            break;
+        }
+    }
+    if (!handle)
+    {
+        std::cerr << "Error: Cannot load libcurl, citations are not looked up: " << dlerror()
+                  << "\n";
+        return false;
+    }
+
+    bool complete = true;
+    auto resolve = [&](auto &function, const char *name)
+    {
+        function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(
+            dlsym(handle, name));
+        complete = complete && function != nullptr;
+    };
+    resolve(library.globalInit, "curl_global_init");
+    resolve(library.easyInit, "curl_easy_init");
+    resolve(library.easySetopt, "curl_easy_setopt");
+    resolve(library.easyPerform, "curl_easy_perform");
+    resolve(library.easyGetinfo, "curl_easy_getinfo");
+    resolve(library.easyReset, "curl_easy_reset");
+    resolve(library.easyCleanup, "curl_easy_cleanup");
+    resolve(library.easyStrerror, "curl_easy_strerror");
+    resolve(library.shareInit, "curl_share_init");
+    resolve(library.shareSetopt, "curl_share_setopt");
+    resolve(library.shareCleanup, "curl_share_cleanup");
+    resolve(library.multiInit, "curl_multi_init");
+    resolve(library.multiAddHandle, "curl_multi_add_handle");
+    resolve(library.multiRemoveHandle, "curl_multi_remove_handle");
+    resolve(library.multiPerform, "curl_multi_perform");
+    resolve(library.multiPoll, "curl_multi_poll");
+    resolve(library.multiInfoRead, "curl_multi_info_read");
+    resolve(library.multiCleanup, "curl_multi_cleanup");
+    resolve(library.multiStrerror, "curl_multi_strerror");
+    if (!complete)
+    {
+        std::cerr << "Error: The libcurl found lacks functions citations need, e.g. "
+                     "curl_multi_poll (7.66)\n";
+        return false;
+    }
+
+    // Done once here rather than implicitly by the first handle, which is not
+    // safe while other threads create handles
+    if (library.globalInit(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+    {
+        std::cerr << "Error: curl_global_init failed, citations are not looked up\n";
+        return false;
+    }
+    return true;
+}
+
+// The library, loaded by the first caller; null entry points if that failed
+const CurlLibrary &curl()
+{
+    static const CurlLibrary library = []
+    {
+        CurlLibrary loaded{};
+        if (!load(loaded))
+        {
+            loaded = CurlLibrary{};
+        }
+        return loaded;
+    }();
+    return library;
+}
+
+constexpr const char *kNotLoaded = "libcurl could not be loaded";
+
+} // namespace
+
+// Loading the library initializes it, see load()
+CURLcode curl_global_init(long /*flags*/)
+{
+    return curl().globalInit ? CURLE_OK : CURLE_FAILED_INIT;
+}
+
+// Creating a handle loads the library; every other call needs a handle
+
+CURL *curl_easy_init()
+{
+    return curl().easyInit ? curl().easyInit() : nullptr;
+}
+
+CURLcode curl_easy_setopt(CURL *handle, CURLoption option, ...)
+{
+    // The type of the argument follows from the range of the option, as in
+    // libcurl itself
+    using Callback = void (*)();
+    va_list args;
+    va_start(args, option);
+    CURLcode result;
+    if (option < CURLOPTTYPE_OBJECTPOINT)
+    {
+        result = curl().easySetopt(handle, option, va_arg(args, long));
+    }
+    else if (option < CURLOPTTYPE_FUNCTIONPOINT)
+    {
+        result = curl().easySetopt(handle, option, va_arg(args, void *));
+    }
+    else if (option < CURLOPTTYPE_OFF_T)
+    {
+        result = curl().easySetopt(handle, option, va_arg(args, Callback));
+    }
+    else if (option < CURLOPTTYPE_BLOB)
+    {
+        result = curl().easySetopt(handle, option, va_arg(args, curl_off_t));
+    }
+    else
+    {
+        result = curl().easySetopt(handle, option, va_arg(args, void *));
+    }
+    va_end(args);
+    return result;
+}
+
+CURLcode curl_easy_perform(CURL *handle) { return curl().easyPerform(handle); }
+
+CURLcode curl_easy_getinfo(CURL *handle, CURLINFO info, ...)
+{
+    // Every kind of information is returned through a pointer
+    va_list args;
+    va_start(args, info);
+    CURLcode result = curl().easyGetinfo(handle, info, va_arg(args, void *));
+    va_end(args);
+    return result;
+}
+
+void curl_easy_reset(CURL *handle) { curl().easyReset(handle); }
+
+void curl_easy_cleanup(CURL *handle) { curl().easyCleanup(handle); }
+
+const char *curl_easy_strerror(CURLcode code)
+{
+    return curl().easyStrerror ? curl().easyStrerror(code) : kNotLoaded;
+}
+
+CURLSH *curl_share_init()
+{
+    return curl().shareInit ? curl().shareInit() : nullptr;
+}
+
+CURLSHcode curl_share_setopt(CURLSH *share, CURLSHoption option, ...)
+{
+    using Callback = void (*)();
+    va_list args;
+    va_start(args, option);
+    CURLSHcode result;
+    switch (option)
+    {
+    case CURLSHOPT_SHARE:
+    case CURLSHOPT_UNSHARE:
+        result = curl().shareSetopt(share, option, va_arg(args, int));
+        break;
+    case CURLSHOPT_LOCKFUNC:
+    case CURLSHOPT_UNLOCKFUNC:
+        result = curl().shareSetopt(share, option, va_arg(args, Callback));
+        break;
+    default:
+        result = curl().shareSetopt(share, option, va_arg(args, void *));
+        break;
+    }
+    va_end(args);
+    return result;
+}
+
+CURLSHcode curl_share_cleanup(CURLSH *share) { return curl().shareCleanup(share); }
+
+CURLM *curl_multi_init()
+{
+    return curl().multiInit ? curl().multiInit() : nullptr;
+}
+
+CURLMcode curl_multi_add_handle(CURLM *multi, CURL *handle)
+{
+    return curl().multiAddHandle(multi, handle);
+}
+
+CURLMcode curl_multi_remove_handle(CURLM *multi, CURL *handle)
+{
+    return curl().multiRemoveHandle(multi, handle);
+}
+
+CURLMcode curl_multi_perform(CURLM *multi, int *running)
+{
+    return curl().multiPerform(multi, running);
+}
+
+CURLMcode curl_multi_poll(CURLM *multi, curl_waitfd extraFds[], unsigned int extraCount,
+                          int timeoutMs, int *ready)
+{
+    return curl().multiPoll(multi, extraFds, extraCount, timeoutMs, ready);
+}
+
+CURLMsg *curl_multi_info_read(CURLM *multi, int *queued)
+{
+    return curl().multiInfoRead(multi, queued);
+}
+
+CURLMcode curl_multi_cleanup(CURLM *multi) { return curl().multiCleanup(multi); }
+
+const char *curl_multi_strerror(CURLMcode code)
+{
+    return curl().multiStrerror ? curl().multiStrerror(code) : kNotLoaded;
+}
@@ -0,0 +1,146 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#include "file_watcher.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <unistd.h>
+#define MD2LATEX_HAVE_POLL 1
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define MD2LATEX_HAVE_INOTIFY 1
+#endif
+
+namespace fs = std::filesystem;
+
+FileWatcher::~FileWatcher() { close(); }
+
+void FileWatcher::close()
+{
+#ifdef MD2LATEX_HAVE_INOTIFY
+    if (notifyFd >= 0)
+    {
+        ::close(notifyFd);
+        notifyFd = -1;
+    }
+#endif
+}
+
+bool FileWatcher::open(const std::string &watchPath)
+{
+    close();
+    path = watchPath;
+    fileName = fs::path(watchPath).filename().string();
+
+    std::error_code error;
+    if (!fs::is_regular_file(watchPath, error))
+    {
+        errorMessage = "Not a regular file: " + watchPath;
+        return false;
+    }
+
+#ifdef MD2LATEX_HAVE_INOTIFY
+    notifyFd = inotify_init1(IN_CLOEXEC);
+    if (notifyFd < 0)
+    {
+        errorMessage = std::string("inotify_init1 failed: ") + std::strerror(errno);
+        return false;
+    }
+
+    fs::path directory = fs::path(watchPath).parent_path();
+    if (directory.empty())
+    {
+        directory = ".";
+    }
+    // Saves either finish writing the file or rename a new one onto it
+    if (inotify_add_watch(notifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        errorMessage = "Cannot watch " + directory.string() + ": " + std::strerror(errno);
+        close();
+        return false;
+    }
+#endif
+    return true;
+}
+
+bool FileWatcher::waitForChange(int stopFd)
+{
+#ifdef MD2LATEX_HAVE_INOTIFY
+    alignas(inotify_event) char buffer[16 * 1024];
+    while (true)
+    {
+        pollfd fds[2] = {{notifyFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+        if (::poll(fds, stopFd >= 0 ? 2 : 1, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            errorMessage = std::string("poll failed: ") + std::strerror(errno);
+            return false;
+        }
+        if (stopFd >= 0 && fds[1].revents != 0)
+        {
+            return false;
+        }
+
+        ssize_t length = ::read(notifyFd, buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            if (length < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            errorMessage = std::string("inotify read failed: ") + std::strerror(errno);
+            return false;
+        }
+
+        // Only events for the watched file count; one read may hold several
+        bool changed = false;
+        for (char *pos = buffer; pos < buffer + length;)
+        {
+            auto *event = reinterpret_cast<inotify_event *>(pos);
+            if (event->len > 0 && fileName == event->name)
+            {
+                changed = true;
+            }
+            pos += sizeof(inotify_event) + event->len;
+        }
+        if (changed)
+        {
+            return true;
+        }
+    }
+#else
+    std::error_code error;
+    auto lastWrite = fs::last_write_time(path, error);
+    while (true)
+    {
+#ifdef MD2LATEX_HAVE_POLL
+        pollfd stop = {stopFd, POLLIN, 0};
+        if (stopFd >= 0 && ::poll(&stop, 1, 100) > 0)
+        {
+            return false;
+        }
+        if (stopFd < 0)
+#endif
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        auto writeTime = fs::last_write_time(path, error);
+        if (!error && writeTime != lastWrite)
+        {
+            return true;
+        }
+    }
+#endif
+}
+
+const std::string &FileWatcher::error() const { return errorMessage; }
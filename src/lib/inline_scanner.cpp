@@ -0,0 +1,366 @@
+#include <utility>
+
+#include "inline_scanner.h"
+#include "latex_escape.h"
+
+namespace
+{
+
+// Generated command prefixes. The doubled backslash matches what the former
+// regex_replace format strings produced; escapeLatexChars relies on it.
+constexpr std::string_view kHref = "\\\\href{";
+constexpr std::string_view kTextbf = "\\\\textbf{";
+constexpr std::string_view kTextit = "\\\\textit{";
+constexpr std::string_view kTexttt = "\\\\texttt{";
+constexpr std::string_view kFigureBegin = "\\\\begin{figure}\n\\\\centering\n\\\\includegraphics{";
+constexpr std::string_view kFigureCaption = "}\n\\\\caption{";
+constexpr std::string_view kFigureEnd = "}\n\\\\end{figure}";
+
+enum Trigger : unsigned
+{
+    kBracket = 1U << 0,
+    kBang = 1U << 1,
+    kStar = 1U << 2,
+    kUnderscore = 1U << 3,
+    kBacktick = 1U << 4,
+    kCaret = 1U << 5,
+};
+
+unsigned classify(std::string_view text)
+{
+    unsigned mask = 0;
+    for (char chr : text)
+    {
+        switch (chr)
+        {
+        case '[':
+            mask |= kBracket;
+            break;
+        case '!':
+            mask |= kBang;
+            break;
+        case '*':
+            mask |= kStar;
+            break;
+        case '_':
+            mask |= kUnderscore;
+            break;
+        case '`':
+            mask |= kBacktick;
+            break;
+        case '^':
+            mask |= kCaret;
+            break;
+        default:
+            break;
+        }
+    }
+    return mask;
+}
+
+// End of the line segment containing pos. '.' in the former patterns did not
+// match '\n' or '\r', so no match may span a segment boundary.
+size_t segmentEnd(std::string_view text, size_t pos)
+{
+    size_t end = text.find_first_of("\r\n", pos);
+    return end == std::string_view::npos ? text.size() : end;
+}
+
+// Replaces every non-greedy <delim>(.*?)<delim> with <command>body}.
+bool delimitedPass(std::string_view in, std::string_view delim, std::string_view command,
+                   std::string &out)
+{
+    bool matched = false;
+    size_t copied = 0;
+    size_t pos = 0;
+    size_t segEnd = 0;
+
+    while (pos < in.size())
+    {
+        size_t open = in.find(delim, pos);
+        if (open == std::string_view::npos)
+        {
+            break;
+        }
+        if (open >= segEnd)
+        {
+            segEnd = segmentEnd(in, open);
+        }
+
+        // If this opener has no closer in its segment, no later opener there has one either
+        size_t bodyStart = open + delim.size();
+        size_t close = in.substr(0, segEnd).find(delim, bodyStart);
+        if (close == std::string_view::npos)
+        {
+            pos = segEnd;
+            continue;
+        }
+
+        if (!matched)
+        {
+            out.clear();
+            matched = true;
+        }
+        out.append(in.substr(copied, open - copied));
+        out.append(command);
+        out.append(in.substr(bodyStart, close - bodyStart));
+        out.push_back('}');
+        pos = copied = close + delim.size();
+    }
+
+    if (matched)
+    {
+        out.append(in.substr(copied));
+    }
+    return matched;
+}
+
+// Handles both [text](url) and ![alt](url), which share the same shape.
+bool bracketPass(std::string_view in, bool image, std::string &out)
+{
+    std::string_view opener = image ? "![" : "[";
+    bool matched = false;
+    size_t copied = 0;
+    size_t pos = 0;
+    size_t segEnd = 0;
+
+    while (pos < in.size())
+    {
+        size_t open = in.find(opener, pos);
+        if (open == std::string_view::npos)
+        {
+            break;
+        }
+        if (open >= segEnd)
+        {
+            segEnd = segmentEnd(in, open);
+        }
+
+        std::string_view segment = in.substr(0, segEnd);
+        size_t textStart = open + opener.size();
+        size_t middle = segment.find("](", textStart);
+        size_t close =
+            (middle == std::string_view::npos) ? middle : segment.find(')', middle + 2);
+        if (close == std::string_view::npos)
+        {
+            pos = segEnd;
+            continue;
+        }
+
+        if (!matched)
+        {
+            out.clear();
+            matched = true;
+        }
+        std::string_view text = in.substr(textStart, middle - textStart);
+        std::string_view url = in.substr(middle + 2, close - middle - 2);
+        out.append(in.substr(copied, open - copied));
+        if (image)
+        {
+            out.append(kFigureBegin);
+            out.append(url);
+            out.append(kFigureCaption);
+            out.append(text);
+            out.append(kFigureEnd);
+        }
+        else
+        {
+            out.append(kHref);
+            out.append(url);
+            out.append("}{");
+            out.append(text);
+            out.push_back('}');
+        }
+        pos = copied = close + 1;
+    }
+
+    if (matched)
+    {
+        out.append(in.substr(copied));
+    }
+    return matched;
+}
+
+bool isDigit(char chr) { return chr >= '0' && chr <= '9'; }
+
+// [^12] -> \cite{ref12}
+bool citationPass(std::string_view in, std::string &out)
+{
+    bool matched = false;
+    size_t copied = 0;
+    size_t pos = 0;
+
+    while ((pos = in.find("[^", pos)) != std::string_view::npos)
+    {
+        size_t digitsEnd = pos + 2;
+        while (digitsEnd < in.size() && isDigit(in[digitsEnd]))
+        {
+            digitsEnd++;
+        }
+        if (digitsEnd == pos + 2 || digitsEnd >= in.size() || in[digitsEnd] != ']')
+        {
+            pos++;
+            continue;
+        }
+
+        if (!matched)
+        {
+            out.clear();
+            matched = true;
+        }
+        out.append(in.substr(copied, pos - copied));
+        out.append("\\cite{ref");
+        out.append(in.substr(pos + 2, digitsEnd - pos - 2));
+        out.push_back('}');
+        pos = copied = digitsEnd + 1;
+    }
+
+    if (matched)
+    {
+        out.append(in.substr(copied));
+    }
+    return matched;
+}
+
+} // namespace
+
+std::string_view InlineScanner::run(std::string_view text, bool withImages)
+{
+    unsigned mask = classify(text);
+    std::string_view current = text;
+
+    auto apply = [&](bool matched)
+    {
+        if (matched)
+        {
+            std::swap(front, back);
+            current = front;
+        }
+        return matched;
+    };
+
+    // Run the passes of one kind, counting and timing them if asked to
+    auto stage = [&](InlinePass which, auto &&passes)
+    {
+        if (stats == nullptr)
+        {
+            return passes();
+        }
+        StageStats &counters = stats->pass(which);
+        counters.count++;
+        counters.bytes += current.size();
+        auto start = std::chrono::steady_clock::now();
+        bool matched = passes();
+        if (matched)
+        {
+            counters.changed++;
+        }
+        counters.seconds += secondsSince(start);
+        return matched;
+    };
+
+    if (mask & kBracket)
+    {
+        if (stage(InlinePass::Links, [&] { return apply(bracketPass(current, false, back)); }))
+        {
+            usedFeatures |= kFeatureLinks;
+        }
+        if (withImages && (mask & kBang) &&
+            stage(InlinePass::Images, [&] { return apply(bracketPass(current, true, back)); }))
+        {
+            usedFeatures |= kFeatureImages;
+        }
+    }
+    if (mask & (kStar | kUnderscore))
+    {
+        stage(InlinePass::Emphasis,
+              [&]
+              {
+                  bool matched = false;
+                  if (mask & kStar)
+                  {
+                      matched = apply(delimitedPass(current, "**", kTextbf, back)) || matched;
+                  }
+                  if (mask & kUnderscore)
+                  {
+                      matched = apply(delimitedPass(current, "__", kTextbf, back)) || matched;
+                  }
+                  if (mask & kStar)
+                  {
+                      matched = apply(delimitedPass(current, "*", kTextit, back)) || matched;
+                  }
+                  if (mask & kUnderscore)
+                  {
+                      matched = apply(delimitedPass(current, "_", kTextit, back)) || matched;
+                  }
+                  return matched;
+              });
+    }
+    if (mask & kBacktick)
+    {
+        stage(InlinePass::Code, [&] { return apply(delimitedPass(current, "`", kTexttt, back)); });
+    }
+    if ((mask & kBracket) && (mask & kCaret) &&
+        stage(InlinePass::Citations, [&] { return apply(citationPass(current, back)); }))
+    {
+        usedFeatures |= kFeatureCitations;
+    }
+    stage(InlinePass::Escape, [&] { return apply(escapeLatex(current, back)); });
+
+    return current;
+}
+
+std::string_view InlineScanner::convertParagraph(std::string_view line)
+{
+    return run(line, true);
+}
+
+std::string_view InlineScanner::convertInline(std::string_view text) { return run(text, false); }
+
+std::string_view InlineScanner::convertLinks(std::string_view line)
+{
+    return bracketPass(line, false, front) ? front : line;
+}
+
+std::string_view InlineScanner::convertImages(std::string_view line)
+{
+    return bracketPass(line, true, front) ? front : line;
+}
+
+std::string_view InlineScanner::convertEmphasis(std::string_view line)
+{
+    std::string_view current = line;
+    for (auto [delim, command] : {std::pair{std::string_view("**"), kTextbf},
+                                  std::pair{std::string_view("__"), kTextbf},
+                                  std::pair{std::string_view("*"), kTextit},
+                                  std::pair{std::string_view("_"), kTextit}})
+    {
+        if (delimitedPass(current, delim, command, back))
+        {
+            std::swap(front, back);
+            current = front;
+        }
+    }
+    return current;
+}
+
+std::string_view InlineScanner::convertCodeBlocks(std::string_view line)
+{
+    return delimitedPass(line, "`", kTexttt, front) ? front : line;
+}
+
+std::string_view InlineScanner::convertCitations(std::string_view line)
+{
+    return citationPass(line, front) ? front : line;
+}
+
+std::string_view InlineScanner::escapeLatexChars(std::string_view text)
+{
+    return escapeLatex(text, front) ? front : text;
+}
+
+unsigned InlineScanner::features() const { return usedFeatures; }
+
+void InlineScanner::clearFeatures() { usedFeatures = 0; }
+
+void InlineScanner::setStats(ConversionStats *target) { stats = target; }
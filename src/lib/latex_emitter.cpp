@@ -0,0 +1,217 @@
+#include "latex_emitter.h"
+
+void LatexEmitter::emitPreamble(std::ostream &out)
+{
+    out << "\\documentclass{article}\n";
+    out << "\\usepackage{hyperref}\n";
+    out << "\\usepackage{graphicx}\n";
+    out << "\\usepackage{listings}\n";
+    out << "\\usepackage{xcolor}\n";
+    out << "\\usepackage{enumitem}\n";
+    out << "\\usepackage{geometry}\n";
+    out << "\\usepackage{natbib}  % For citations\n";
+    out << "\\geometry{margin=1in}\n";
+    out << "\n\\begin{document}\n\n";
+}
+
+void LatexEmitter::emitBlocks(const BlockList &blocks, std::ostream &out)
+{
+    for (const BlockNode *node = blocks.first; node != nullptr; node = node->next)
+    {
+        if (stats == nullptr)
+        {
+            emitBlock(*node, out);
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        emitBlock(*node, out);
+        StageStats &counters = stats->block(node->type);
+        counters.count++;
+        counters.bytes += node->text.size();
+        counters.seconds += secondsSince(start);
+    }
+}
+
+void LatexEmitter::emitBlock(const BlockNode &node, std::ostream &out)
+{
+    switch (node.type)
+    {
+    case BlockType::Heading:
+        emitHeading(node, out);
+        break;
+    case BlockType::ListItem:
+        emitListItem(node, out);
+        break;
+    case BlockType::Quote:
+        emitQuote(node, out);
+        break;
+    case BlockType::CodeBlock:
+        emitCodeBlock(node, out);
+        break;
+    case BlockType::Paragraph:
+        emitParagraph(node, out);
+        break;
+    case BlockType::Blank:
+        out << "\n";
+        break;
+    }
+}
+
+void LatexEmitter::closeEnvironments(std::ostream &out)
+{
+    if (inList)
+    {
+        out << "\\end{itemize}\n";
+        inList = false;
+        listDepth = 0;
+    }
+    if (inQuote)
+    {
+        out << "\\end{quotation}\n";
+        inQuote = false;
+    }
+}
+
+void LatexEmitter::emitEpilogue(bool hasCitations, const std::string &bibliography,
+                               std::ostream &out)
+{
+    // Add bibliography
+    if (hasCitations)
+    {
+        out << "\\bibliographystyle{plain}\n";
+        out << "\\bibliography{" << bibliography << "}\n";
+    }
+
+    // Close the document
+    out << "\\end{document}\n";
+}
+
+void LatexEmitter::reset()
+{
+    inlineScanner.clearFeatures();
+    hasCode = false;
+    inList = false;
+    listDepth = 0;
+    inQuote = false;
+}
+
+unsigned LatexEmitter::features() const
+{
+    return inlineScanner.features() | (hasCode ? kFeatureCode : 0U);
+}
+
+void LatexEmitter::setStats(ConversionStats *target)
+{
+    stats = target;
+    inlineScanner.setStats(target);
+}
+
+void LatexEmitter::emitHeading(const BlockNode &node, std::ostream &out)
+{
+    closeForParagraph(out);
+
+    // Map the header level to LaTeX section commands
+    const char *latexCommand = nullptr;
+    switch (node.level)
+    {
+    case 1:
+        latexCommand = "\\section{";
+        break;
+    case 2:
+        latexCommand = "\\subsection{";
+        break;
+    case 3:
+        latexCommand = "\\subsubsection{";
+        break;
+    case 4:
+        latexCommand = "\\paragraph{";
+        break;
+    case 5:
+    case 6:
+        latexCommand = "\\subparagraph{";
+        break;
+    default:
+        latexCommand = "\\section{";
+    }
+
+    out << latexCommand << node.text << "}\n\n";
+}
+
+void LatexEmitter::emitListItem(const BlockNode &node, std::ostream &out)
+{
+    // If not already in a list, start one
+    if (!inList)
+    {
+        out << "\\begin{itemize}\n";
+        inList = true;
+        listDepth = 1;
+    }
+
+    // Adjust list depth if needed
+    while (node.level > listDepth)
+    {
+        out << "\\begin{itemize}\n";
+        listDepth++;
+    }
+    while (node.level < listDepth)
+    {
+        out << "\\end{itemize}\n";
+        listDepth--;
+    }
+
+    // Process the item text for other markdown elements
+    out << "\\item " << inlineScanner.convertInline(node.text) << "\n\n";
+}
+
+void LatexEmitter::emitQuote(const BlockNode &node, std::ostream &out)
+{
+    // Process the quote text for other markdown elements
+    std::string_view quoteText = inlineScanner.convertInline(node.text);
+
+    if (!inQuote)
+    {
+        out << "\\begin{quotation}\n";
+        inQuote = true;
+    }
+
+    out << quoteText << "\n\n";
+}
+
+void LatexEmitter::emitCodeBlock(const BlockNode &node, std::ostream &out)
+{
+    hasCode = true;
+    out << "\\begin{lstlisting}[language=";
+    if (node.info.empty())
+    {
+        out << "text";
+    }
+    else
+    {
+        out << node.info;
+    }
+    out << "]\n" << node.text << "\\end{lstlisting}\n\n";
+}
+
+void LatexEmitter::emitParagraph(const BlockNode &node, std::ostream &out)
+{
+    closeForParagraph(out);
+
+    // Process links, images, emphasis, inline code, and citations
+    out << inlineScanner.convertParagraph(node.text) << "\n\n";
+}
+
+void LatexEmitter::closeForParagraph(std::ostream &out)
+{
+    if (inList)
+    {
+        out << "\\end{itemize}\n\n";
+        inList = false;
+        listDepth = 0;
+    }
+    if (inQuote)
+    {
+        out << "\\end{quotation}\n\n";
+        inQuote = false;
+    }
+}
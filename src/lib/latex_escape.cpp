@@ -0,0 +1,225 @@
+#include <array>
+#include <atomic>
+
+#include "latex_escape.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define MD2LATEX_X86_SIMD 1
+#endif
+
+namespace
+{
+
+// Commands whose backslash is not doubled
+constexpr std::array<std::string_view, 14> kProtectedCommands = {
+    "textbf",  "textit",        "texttt",    "href",      "includegraphics",
+    "begin",   "end",           "item",      "section",   "subsection",
+    "subsubsection", "paragraph", "subparagraph", "cite"};
+
+using FindSpecial = const char *(*)(const char *begin, const char *end);
+
+constexpr std::array<bool, 256> makeSpecialTable()
+{
+    std::array<bool, 256> table{};
+    for (unsigned char chr : std::string_view("#$%&_~^\\"))
+    {
+        table[chr] = true;
+    }
+    return table;
+}
+
+constexpr std::array<bool, 256> kSpecial = makeSpecialTable();
+
+const char *findSpecialScalar(const char *begin, const char *end)
+{
+    while (begin != end && !kSpecial[static_cast<unsigned char>(*begin)])
+    {
+        ++begin;
+    }
+    return begin;
+}
+
+#ifdef MD2LATEX_X86_SIMD
+
+__attribute__((target("sse4.2"))) const char *findSpecialSse42(const char *begin,
+                                                                const char *end)
+{
+    const __m128i needles = _mm_setr_epi8('#', '$', '%', '&', '_', '~', '^', '\\', 0, 0, 0, 0,
+                                          0, 0, 0, 0);
+    constexpr int mode = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT;
+
+    while (end - begin >= 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+        int index = _mm_cmpestri(needles, 8, block, 16, mode);
+        if (index < 16)
+        {
+            return begin + index;
+        }
+        begin += 16;
+    }
+    return findSpecialScalar(begin, end);
+}
+
+__attribute__((target("avx2"))) const char *findSpecialAvx2(const char *begin, const char *end)
+{
+    const __m256i hash = _mm256_set1_epi8('#');
+    const __m256i dollar = _mm256_set1_epi8('$');
+    const __m256i percent = _mm256_set1_epi8('%');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i underscore = _mm256_set1_epi8('_');
+    const __m256i tilde = _mm256_set1_epi8('~');
+    const __m256i caret = _mm256_set1_epi8('^');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+
+    while (end - begin >= 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+        __m256i hits = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(block, hash), _mm256_cmpeq_epi8(block, dollar)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(block, percent), _mm256_cmpeq_epi8(block, amp))),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(block, underscore),
+                                _mm256_cmpeq_epi8(block, tilde)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(block, caret),
+                                _mm256_cmpeq_epi8(block, backslash))));
+        auto mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask != 0)
+        {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 32;
+    }
+    return findSpecialScalar(begin, end);
+}
+
+#endif // MD2LATEX_X86_SIMD
+
+bool kernelSupported(EscapeKernel kernel)
+{
+    switch (kernel)
+    {
+    case EscapeKernel::Scalar:
+        return true;
+#ifdef MD2LATEX_X86_SIMD
+    case EscapeKernel::Sse42:
+        return __builtin_cpu_supports("sse4.2");
+    case EscapeKernel::Avx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+EscapeKernel detectKernel()
+{
+    if (kernelSupported(EscapeKernel::Avx2))
+    {
+        return EscapeKernel::Avx2;
+    }
+    if (kernelSupported(EscapeKernel::Sse42))
+    {
+        return EscapeKernel::Sse42;
+    }
+    return EscapeKernel::Scalar;
+}
+
+FindSpecial kernelFunction(EscapeKernel kernel)
+{
+    switch (kernel)
+    {
+#ifdef MD2LATEX_X86_SIMD
+    case EscapeKernel::Avx2:
+        return findSpecialAvx2;
+    case EscapeKernel::Sse42:
+        return findSpecialSse42;
+#endif
+    default:
+        return findSpecialScalar;
+    }
+}
+
+struct Dispatch
+{
+    std::atomic<EscapeKernel> kernel{detectKernel()};
+    std::atomic<FindSpecial> findSpecial{kernelFunction(kernel.load())};
+};
+
+Dispatch &dispatch()
+{
+    static Dispatch instance;
+    return instance;
+}
+
+bool isProtectedCommand(const char *pos, const char *end)
+{
+    std::string_view rest(pos, static_cast<size_t>(end - pos));
+    for (std::string_view command : kProtectedCommands)
+    {
+        if (rest.substr(0, command.size()) == command)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+bool escapeLatex(std::string_view in, std::string &out)
+{
+    FindSpecial findSpecial = dispatch().findSpecial.load(std::memory_order_relaxed);
+    const char *begin = in.data();
+    const char *end = begin + in.size();
+
+    const char *special = findSpecial(begin, end);
+    if (special == end)
+    {
+        return false;
+    }
+
+    out.clear();
+    out.reserve(in.size() + (in.size() / 8));
+    const char *copied = begin;
+    while (special != end)
+    {
+        out.append(copied, special);
+        if (*special != '\\' || !isProtectedCommand(special + 1, end))
+        {
+            out.push_back('\\');
+        }
+        out.push_back(*special);
+        copied = special + 1;
+        special = findSpecial(copied, end);
+    }
+    out.append(copied, end);
+    return true;
+}
+
+EscapeKernel activeEscapeKernel() { return dispatch().kernel.load(); }
+
+void setEscapeKernel(EscapeKernel kernel)
+{
+    if (!kernelSupported(kernel))
+    {
+        kernel = detectKernel();
+    }
+    dispatch().kernel.store(kernel);
+    dispatch().findSpecial.store(kernelFunction(kernel));
+}
+
+const char *escapeKernelName(EscapeKernel kernel)
+{
+    switch (kernel)
+    {
+    case EscapeKernel::Avx2:
+        return "avx2";
+    case EscapeKernel::Sse42:
+        return "sse4.2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <utility>
+
+#include "latex_template.h"
+#include "mapped_file.h"
+
+namespace
+{
+
+constexpr std::string_view kMinimalTemplate = "\\documentclass{article}\n"
+                                              "{{packages}}\n"
+                                              "\n"
+                                              "\\begin{document}\n"
+                                              "\n"
+                                              "{{body}}\n"
+                                              "{{#bibliography}}\n"
+                                              "\\bibliographystyle{plain}\n"
+                                              "\\bibliography{references}\n"
+                                              "{{/bibliography}}\n"
+                                              "\\end{document}\n";
+
+// Feature bit of a section name, 0 if there is no such feature
+unsigned featureNamed(std::string_view name)
+{
+    if (name == "links")
+    {
+        return kFeatureLinks;
+    }
+    if (name == "images")
+    {
+        return kFeatureImages;
+    }
+    if (name == "code")
+    {
+        return kFeatureCode;
+    }
+    if (name == "citations")
+    {
+        return kFeatureCitations;
+    }
+    if (name == "bibliography")
+    {
+        return kFeatureBibliography;
+    }
+    return 0;
+}
+
+bool isBlank(std::string_view text)
+{
+    return std::all_of(text.begin(), text.end(),
+                       [](char chr) { return chr == ' ' || chr == '\t' || chr == '\r'; });
+}
+
+} // namespace
+
+bool LatexTemplate::compile(std::string_view text)
+{
+    head.clear();
+    tail.clear();
+    errorMessage.clear();
+
+    struct Section
+    {
+        std::string_view name;
+        unsigned feature;
+        bool inverted;
+    };
+    std::vector<Section> sections;
+    std::vector<Segment> *target = &head;
+    bool hasBody = false;
+
+    auto fail = [&](size_t pos, const std::string &message)
+    {
+        size_t line = std::count(text.begin(), text.begin() + pos, '\n') + 1;
+        errorMessage = "line " + std::to_string(line) + ": " + message;
+        head.clear();
+        tail.clear();
+        return false;
+    };
+
+    auto append = [&](bool packages, std::string_view piece)
+    {
+        unsigned required = 0;
+        unsigned excluded = 0;
+        for (const Section &section : sections)
+        {
+            (section.inverted ? excluded : required) |= section.feature;
+        }
+        if (!packages && piece.empty())
+        {
+            return;
+        }
+        if (!packages && !target->empty() && !target->back().packages &&
+            target->back().required == required && target->back().excluded == excluded)
+        {
+            target->back().text.append(piece);
+            return;
+        }
+        target->push_back({packages, std::string(packages ? std::string_view() : piece),
+                           required, excluded});
+    };
+
+    size_t copied = 0;
+    size_t pos = 0;
+    while ((pos = text.find("{{", pos)) != std::string_view::npos)
+    {
+        size_t close = text.find("}}", pos + 2);
+        if (close == std::string_view::npos)
+        {
+            break;
+        }
+        std::string_view tag = text.substr(pos + 2, close - pos - 2);
+        unsigned feature = tag.empty() ? 0 : featureNamed(tag.substr(1));
+        bool isSection = feature != 0 && (tag[0] == '#' || tag[0] == '^' || tag[0] == '/');
+        if (tag != "body" && tag != "packages" && !isSection)
+        {
+            // Not a tag but LaTeX, e.g. \def\x{{\bfseries y}} or {{#1}}
+            ++pos;
+            continue;
+        }
+        size_t tagEnd = close + 2;
+
+        // A tag alone on its line takes the line with it
+        size_t lineStart = text.rfind('\n', pos);
+        lineStart = lineStart == std::string_view::npos ? 0 : lineStart + 1;
+        size_t lineEnd = text.find('\n', tagEnd);
+        lineEnd = lineEnd == std::string_view::npos ? text.size() : lineEnd;
+        size_t textEnd = pos;
+        size_t next = tagEnd;
+        if (lineStart >= copied && isBlank(text.substr(lineStart, pos - lineStart)) &&
+            isBlank(text.substr(tagEnd, lineEnd - tagEnd)))
+        {
+            textEnd = lineStart;
+            next = std::min(lineEnd + 1, text.size());
+        }
+        append(false, text.substr(copied, textEnd - copied));
+
+        if (tag == "body")
+        {
+            if (hasBody)
+            {
+                return fail(pos, "more than one {{body}}");
+            }
+            if (!sections.empty())
+            {
+                return fail(pos, "{{body}} inside {{#" + std::string(sections.back().name) + "}}");
+            }
+            hasBody = true;
+            target = &tail;
+        }
+        else if (tag == "packages")
+        {
+            append(true, {});
+        }
+        else if (tag[0] == '/')
+        {
+            if (sections.empty() || sections.back().name != tag.substr(1))
+            {
+                return fail(pos, "{{" + std::string(tag) + "}} does not close a section");
+            }
+            sections.pop_back();
+        }
+        else
+        {
+            sections.push_back({tag.substr(1), feature, tag[0] == '^'});
+        }
+        pos = copied = next;
+    }
+    append(false, text.substr(copied));
+
+    if (!sections.empty())
+    {
+        return fail(text.size(), "{{#" + std::string(sections.back().name) + "}} is not closed");
+    }
+    if (!hasBody)
+    {
+        return fail(text.size(), "no {{body}}");
+    }
+    return true;
+}
+
+bool LatexTemplate::load(const std::string &path)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        errorMessage = file.error();
+        return false;
+    }
+    if (!compile(file.data()))
+    {
+        errorMessage = path + ": " + errorMessage;
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const LatexTemplate> LatexTemplate::minimal()
+{
+    static const std::shared_ptr<const LatexTemplate> instance = []
+    {
+        auto compiled = std::make_shared<LatexTemplate>();
+        compiled->compile(kMinimalTemplate);
+        return compiled;
+    }();
+    return instance;
+}
+
+void LatexTemplate::writeHead(unsigned features, std::ostream &out) const
+{
+    write(head, features, out);
+}
+
+void LatexTemplate::writeTail(unsigned features, std::ostream &out) const
+{
+    write(tail, features, out);
+}
+
+const std::string &LatexTemplate::error() const { return errorMessage; }
+
+void LatexTemplate::write(const std::vector<Segment> &segments, unsigned features,
+                          std::ostream &out)
+{
+    for (const Segment &segment : segments)
+    {
+        if ((features & segment.required) != segment.required ||
+            (features & segment.excluded) != 0)
+        {
+            continue;
+        }
+        if (!segment.packages)
+        {
+            out << segment.text;
+            continue;
+        }
+
+        // hyperref goes last, as it redefines commands of the others
+        if (features & kFeatureImages)
+        {
+            out << "\\usepackage{graphicx}\n";
+        }
+        if (features & kFeatureCode)
+        {
+            out << "\\usepackage{listings}\n";
+        }
+        if (features & (kFeatureCitations | kFeatureBibliography))
+        {
+            out << "\\usepackage{natbib}\n";
+        }
+        if (features & kFeatureLinks)
+        {
+            out << "\\usepackage{hyperref}\n";
+        }
+    }
+}
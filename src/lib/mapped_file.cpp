@@ -0,0 +1,132 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include "mapped_file.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MD2LATEX_HAVE_MMAP 1
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+MappedFile::MappedFile(MappedFile &&other) noexcept { *this = std::move(other); }
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        mapping = std::exchange(other.mapping, nullptr);
+        mappedSize = std::exchange(other.mappedSize, 0);
+        bool ownsFallback = other.view.data() == other.fallback.data();
+        fallback = std::move(other.fallback);
+        view = ownsFallback ? std::string_view(fallback) : other.view;
+        other.view = {};
+        errorMessage = std::move(other.errorMessage);
+    }
+    return *this;
+}
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+
+#ifdef MD2LATEX_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        errorMessage = "Cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    struct stat info
+    {
+    };
+    if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        if (info.st_size == 0)
+        {
+            ::close(fd);
+            return true;
+        }
+
+        void *addr = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE,
+                            fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            ::madvise(addr, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+            ::close(fd);
+            mapping = addr;
+            mappedSize = static_cast<size_t>(info.st_size);
+            view = std::string_view(static_cast<const char *>(addr), mappedSize);
+            return true;
+        }
+    }
+    ::close(fd);
+#endif
+
+    // Not mappable: read it instead
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        errorMessage = "Cannot open " + path;
+        return false;
+    }
+    fallback.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    view = fallback;
+    return true;
+}
+
+std::string_view MappedFile::data() const { return view; }
+
+const std::string &MappedFile::error() const { return errorMessage; }
+
+void MappedFile::close()
+{
+#ifdef MD2LATEX_HAVE_MMAP
+    if (mapping)
+    {
+        ::munmap(mapping, mappedSize);
+    }
+#endif
+    mapping = nullptr;
+    mappedSize = 0;
+    fallback.clear();
+    view = {};
+    errorMessage.clear();
+}
+
+LineIndex::LineIndex(std::string_view text) : text(text)
+{
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        starts.push_back(pos);
+        const void *newline = std::memchr(text.data() + pos, '\n', text.size() - pos);
+        if (!newline)
+        {
+            break;
+        }
+        pos = static_cast<size_t>(static_cast<const char *>(newline) - text.data()) + 1;
+    }
+}
+
+size_t LineIndex::size() const { return starts.size(); }
+
+std::string_view LineIndex::line(size_t i) const
+{
+    size_t start = starts[i];
+    size_t end = (i + 1 < starts.size()) ? starts[i + 1] - 1 : text.size();
+    if (end > start && end == text.size() && text[end - 1] == '\n')
+    {
+        end--;
+    }
+    return text.substr(start, end - start);
+}
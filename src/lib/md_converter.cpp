@@ -1,431 +1,792 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <optional>
 #include <sstream>
 
+#include "block_parser.h"
+#include "citation_cache.h"
+#include "citation_library.h"
+#include "citation_matcher.h"
+#include "citation_resolver.h"
+#include "latex_emitter.h"
+#include "latex_template.h"
+#include "mapped_file.h"
 #include "md_converter.h"
+#include "output_sink.h"
 #include "paper_cition_api.h"
+#include "thread_pool.h"
+#include "trace.h"
 
-MarkdownConverter::MarkdownConverter()
+// Lookups are answered from cache and made through api, whose sources hold a
+// reference to cache and whose connections are reused across documents
+struct MarkdownConverter::CitationServices
 {
-    // Constructor can be used for any initialization if needed
+    // Load the cache and set up the sources
+    void open(const ConverterOptions &options)
+    {
+        citation::CacheOptions cacheOptions;
+        cacheOptions.path = options.citationCachePath;
+        cacheOptions.ttl = std::chrono::seconds(options.citationCacheTtl);
+        cacheOptions.refresh = options.refreshCitationCache;
+        TraceSpan cacheSpan("load citation cache", "citation");
+        cache = citation::CitationCache::shared(cacheOptions);
+        cacheSpan.end();
+
+        api = std::make_unique<citation::PaperCitationAPI>(options.citationBaseUrl);
+        if (cache->enabled())
+        {
+            citation::CitationCache &shared = *cache;
+            api->wrapSources(
+                [&shared](std::unique_ptr<citation::CitationSource> source)
+                { return std::make_unique<citation::CachedSource>(std::move(source), shared); });
+        }
+    }
+
+    std::once_flag opened;
+    std::shared_ptr<citation::CitationCache> cache;
+    std::unique_ptr<citation::PaperCitationAPI> api;
+};
+
+MarkdownConverter::MarkdownConverter(ConverterOptions converterOptions)
+    : options(std::move(converterOptions)), citationServices(std::make_shared<CitationServices>())
+{
+    if (!options.bibLibraries.empty() || !options.citationStores.empty())
+    {
+        // Indexes are opened by the first document with citations
+        library = std::make_shared<const citation::LibrarySource>(options.bibLibraries,
+                                                                  options.citationStores);
+    }
 }
 
-std::string MarkdownConverter::convertToLatex(const std::string &markdown)
+namespace
 {
-    // First, process all citation references
-    processCitationReferences(markdown);
-
-    std::stringstream result;
-    std::istringstream stream(markdown);
-    std::string line;
-    bool inList = false;
-    int listDepth = 0;
-    bool inQuote = false;
-    bool inCodeBlock = false;
-    bool inCitationSection = false;
-    std::string codeBlockContent;
-    std::string codeBlockLanguage;
-
-    // Add LaTeX document preamble
-    result << "\\documentclass{article}\n";
-    result << "\\usepackage{hyperref}\n";
-    result << "\\usepackage{graphicx}\n";
-    result << "\\usepackage{listings}\n";
-    result << "\\usepackage{xcolor}\n";
-    result << "\\usepackage{enumitem}\n";
-    result << "\\usepackage{geometry}\n";
-    result << "\\usepackage{natbib}  % For citations\n";
-    result << "\\geometry{margin=1in}\n";
-    result << "\n\\begin{document}\n\n";
-
-    while (std::getline(stream, line))
-    {
-        // Skip lines that are citation references
-        if (line.find("[^") == 0 && line.find("]:") != std::string::npos)
-        {
-            inCitationSection = true;
-            continue;
-        }
 
-        // If we've entered the citation section, we should skip all remaining lines
-        if (inCitationSection)
-        {
-            continue;
-        }
+// Parsed blocks are handed to the emitter in batches of this size, which bounds
+// the arena to roughly one batch plus the largest single block
+constexpr size_t kBlocksPerFlush = 256;
 
-        // Check for code blocks (```...)
-        if (line.find("```") == 0)
-        {
-            if (!inCodeBlock)
-            {
-                inCodeBlock = true;
-                codeBlockLanguage = line.substr(3);
-                continue;
-            }
-            else
-            {
-                inCodeBlock = false;
-                result << "\\begin{lstlisting}[language="
-                       << (codeBlockLanguage.empty() ? "text" : codeBlockLanguage) << "]\n";
-                result << codeBlockContent;
-                result << "\\end{lstlisting}\n\n";
-                codeBlockContent.clear();
-                codeBlockLanguage.clear();
-                continue;
-            }
-        }
+bool isSpace(char chr)
+{
+    return chr == ' ' || chr == '\t' || chr == '\n' || chr == '\v' || chr == '\f' || chr == '\r';
+}
+
+// Convert lines [begin, end), which must start and end at safe split points,
+// without preamble or epilogue. Adds to stats unless it is nullptr. Returns
+// the DocumentFeature bits of the LaTeX.
+unsigned emitLines(const LineIndex &lines, size_t begin, size_t end, Arena &arena,
+                   LatexEmitter &emitter, std::ostream &out, ConversionStats *stats)
+{
+    TraceSpan span("convert blocks", "convert");
+    span.arg("lines", end - begin);
+    auto parseStart = std::chrono::steady_clock::now();
+    BlockParser parser(arena);
+    for (size_t i = begin; i < end; ++i)
+    {
+        parser.parseLine(lines.line(i));
+    }
 
-        if (inCodeBlock)
+    emitter.reset();
+    emitter.setStats(stats);
+    if (stats != nullptr)
+    {
+        stats->parseSeconds += secondsSince(parseStart);
+        stats->lines += end - begin;
+        for (size_t i = begin; i < end; ++i)
         {
-            codeBlockContent += line + "\n";
-            continue;
+            stats->inputBytes += lines.line(i).size() + 1;
         }
+    }
+    emitter.emitBlocks(parser.blocks(), out);
+    // A no-op except at the end of the document
+    emitter.closeEnvironments(out);
+    arena.reset();
+    return emitter.features();
+}
 
-        // Process regular markdown
-        if (!line.empty())
-        {
-            // First check for headers
-            if (line[0] == '#')
-            {
-                if (inList)
-                {
-                    result << "\\end{itemize}\n\n";
-                    inList = false;
-                    listDepth = 0;
-                }
-                if (inQuote)
-                {
-                    result << "\\end{quotation}\n\n";
-                    inQuote = false;
-                }
-                result << convertHeaders(line) << "\n\n";
-            }
-            // Check for lists
-            else if (line[0] == '-' || line[0] == '*' || line[0] == '+' ||
-                     (line.size() >= 2 && std::isdigit(line[0]) && line[1] == '.'))
-            {
-                result << convertLists(line, inList, listDepth) << "\n";
-            }
-            // Check for blockquotes
-            else if (line[0] == '>')
-            {
-                result << convertBlockquotes(line, inQuote) << "\n";
-            }
-            // Regular text
-            else
-            {
-                if (inList)
-                {
-                    result << "\\end{itemize}\n\n";
-                    inList = false;
-                    listDepth = 0;
-                }
-                if (inQuote)
-                {
-                    result << "\\end{quotation}\n\n";
-                    inQuote = false;
-                }
+} // namespace
 
-                // Process links, images, emphasis, inline code, and citations
-                std::string processedLine = line;
-                processedLine = convertLinks(processedLine);
-                processedLine = convertImages(processedLine);
-                processedLine = convertEmphasis(processedLine);
-                processedLine = convertCodeBlocks(processedLine);
-                processedLine = convertCitations(processedLine);
-                processedLine = escapeLatexChars(processedLine);
+template <typename LineSource>
+void MarkdownConverter::convertLines(LineSource &nextLine, std::ostream &out,
+                                     ConversionContext &context) const
+{
+    // References belong to one document; a context may be reused for the next
+    context.citationRefs.clear();
+    context.bibtex.clear();
+    context.stopped = false;
+    ConversionStats *stats = startStats(context);
+
+    BlockParser parser(context.arena);
+    LatexEmitter &emitter = context.emitter;
+    emitter.reset();
+    emitter.setStats(stats);
+
+    // A template's head depends on what the document turns out to use, so the
+    // blocks are collected first
+    context.body.clear();
+    StringOutput bodySink(context.body);
+    std::ostream bodyOut(&bodySink);
+    std::ostream &blocksOut = options.documentTemplate ? bodyOut : out;
+    if (!options.documentTemplate)
+    {
+        writeHead(0, out);
+    }
 
-                result << processedLine << "\n\n";
-            }
+    // Parsing is timed between flushes, which keeps clock reads off the
+    // per-line path
+    auto parseStart = std::chrono::steady_clock::now();
+    auto flush = [&]
+    {
+        if (stats != nullptr)
+        {
+            stats->parseSeconds += secondsSince(parseStart);
         }
-        else
+        emitter.emitBlocks(parser.takeBlocks(), blocksOut);
+        context.arena.reset();
+        parseStart = std::chrono::steady_clock::now();
+    };
+
+    std::string_view line;
+    size_t lineCount = 0;
+    size_t byteCount = 0;
+    {
+        TraceSpan span("convert blocks", "convert");
+        while (!context.stopped && nextLine(line))
         {
-            result << "\n";
+            lineCount++;
+            byteCount += line.size() + 1;
+            processCitationReference(line, context);
+            parser.parseLine(line);
+
+            if (parser.blocks().count >= kBlocksPerFlush)
+            {
+                flush();
+                context.checkLimits();
+            }
         }
+        flush();
+        span.arg("lines", lineCount);
+        span.arg("bytes", byteCount);
     }
 
-    // Close any open environments
-    if (inList)
+    if (stats != nullptr)
     {
-        result << "\\end{itemize}\n";
+        stats->lines = lineCount;
+        stats->inputBytes = byteCount;
     }
-    if (inQuote)
+
+    emitter.closeEnvironments(blocksOut);
+    unsigned features =
+        emitter.features() | (context.citationRefs.empty() ? 0U : kFeatureBibliography);
+    if (options.documentTemplate)
     {
-        result << "\\end{quotation}\n";
+        bodySink.finish();
+        writeHead(features, out);
+        out << context.body;
     }
+    writeTail(features, context, out);
 
-    // Add bibliography
-    if (!citationRefs.empty())
+    if (!context.citationRefs.empty() && !context.checkLimits())
     {
-        result << "\\bibliographystyle{plain}\n";
-        result << "\\bibliography{references}\n";
-
-        //// Generate BibTeX file
-        // std::ofstream bibFile("references.bib");
-        // if (bibFile)
-        //{
-        //     bibFile << generateBibTeX();
-        //     bibFile.close();
-        // }
-        generateBibTeX();
+        generateBibTeX(context);
     }
-
-    // Close the document
-    result << "\\end{document}\n";
-
-    return result.str();
 }
 
-std::string MarkdownConverter::convertHeaders(const std::string &line)
+std::string MarkdownConverter::convertToLatex(const std::string &markdown)
 {
-    // Count the number of # symbols
-    size_t level = 0;
-    while (level < line.size() && line[level] == '#')
-    {
-        level++;
-    }
-
-    // Extract the header text
-    std::string headerText = line.substr(level);
-    // Trim leading spaces
-    headerText.erase(0, headerText.find_first_not_of(" \t"));
-
-    // Map the header level to LaTeX section commands
-    std::string latexCommand;
-    switch (level)
-    {
-    case 1:
-        latexCommand = "\\section{";
-        break;
-    case 2:
-        latexCommand = "\\subsection{";
-        break;
-    case 3:
-        latexCommand = "\\subsubsection{";
-        break;
-    case 4:
-        latexCommand = "\\paragraph{";
-        break;
-    case 5:
-    case 6:
-        latexCommand = "\\subparagraph{";
-        break;
-    default:
-        latexCommand = "\\section{";
-    }
-
-    return latexCommand + headerText + "}";
+    std::string latex;
+    StringOutput sink(latex);
+    std::ostream out(&sink);
+    convertToLatex(std::string_view(markdown), out);
+    sink.finish();
+    return latex;
 }
 
-std::string MarkdownConverter::convertEmphasis(const std::string &line)
+void MarkdownConverter::convertToLatex(std::string_view markdown, std::ostream &out)
 {
-    std::string result = line;
-
-    // Bold: **text** or __text__ -> \textbf{text}
-    std::regex boldPattern1("\\*\\*(.*?)\\*\\*");
-    result = std::regex_replace(result, boldPattern1, "\\\\textbf{$1}");
-
-    std::regex boldPattern2("__(.*?)__");
-    result = std::regex_replace(result, boldPattern2, "\\\\textbf{$1}");
-
-    // Italic: *text* or _text_ -> \textit{text}
-    std::regex italicPattern1("\\*(.*?)\\*");
-    result = std::regex_replace(result, italicPattern1, "\\\\textit{$1}");
-
-    std::regex italicPattern2("_(.*?)_");
-    result = std::regex_replace(result, italicPattern2, "\\\\textit{$1}");
+    convertToLatex(markdown, out, ownContext);
+}
 
-    return result;
+void MarkdownConverter::convertToLatex(std::string_view markdown, std::ostream &out,
+                                       ConversionContext &context) const
+{
+    LineIndex lines(markdown);
+    size_t next = 0;
+    auto nextLine = [&](std::string_view &line)
+    {
+        if (next == lines.size())
+        {
+            return false;
+        }
+        line = lines.line(next++);
+        return true;
+    };
+    convertLines(nextLine, out, context);
 }
 
-std::string MarkdownConverter::convertCodeBlocks(const std::string &line)
+void MarkdownConverter::convertToLatex(std::istream &in, std::ostream &out)
 {
-    std::string result = line;
+    convertToLatex(in, out, ownContext);
+}
 
-    // Inline code: `code` -> \texttt{code}
-    std::regex inlineCodePattern("`(.*?)`");
-    result = std::regex_replace(result, inlineCodePattern, "\\\\texttt{$1}");
+void MarkdownConverter::convertToLatex(std::istream &in, std::ostream &out,
+                                       ConversionContext &context) const
+{
+    std::string buffer;
+    auto nextLine = [&](std::string_view &line)
+    {
+        if (!std::getline(in, buffer))
+        {
+            return false;
+        }
+        line = buffer;
+        return true;
+    };
+    convertLines(nextLine, out, context);
+}
 
-    return result;
+void MarkdownConverter::convertToLatexParallel(std::string_view markdown, std::ostream &out,
+                                               ThreadPool &pool)
+{
+    convertToLatexParallel(markdown, out, pool, ownContext);
 }
 
-std::string MarkdownConverter::convertLists(const std::string &line, bool &inList, int &listDepth)
+void MarkdownConverter::convertToLatexParallel(std::string_view markdown, std::ostream &out,
+                                               ThreadPool &pool, ConversionContext &context) const
 {
-    // If not already in a list, start one
-    std::string result;
-    if (!inList)
+    TraceSpan splitSpan("split document", "convert");
+    LineIndex lines(markdown);
+    std::vector<size_t> splits = findSafeSplitPoints(lines);
+
+    // Aim for a few chunks per worker so that uneven chunks still balance
+    size_t targetChunks = pool.size() * 4;
+    size_t targetBytes = std::max<size_t>(markdown.size() / targetChunks, 64 * 1024);
+
+    std::vector<size_t> chunkStarts{0};
+    size_t lastStartOffset = 0;
+    for (size_t split : splits)
     {
-        result = "\\begin{itemize}\n";
-        inList = true;
-        listDepth = 1;
+        size_t offset = lines.line(split).data() - markdown.data();
+        if (split > chunkStarts.back() && offset - lastStartOffset >= targetBytes)
+        {
+            chunkStarts.push_back(split);
+            lastStartOffset = offset;
+        }
     }
+    chunkStarts.push_back(lines.size());
 
-    // Calculate indentation level
-    int currentDepth = 0;
-    size_t i = 0;
-    while (i < line.size() && (line[i] == ' ' || line[i] == '\t'))
+    size_t chunkCount = chunkStarts.size() - 1;
+    splitSpan.arg("chunks", chunkCount);
+    splitSpan.end();
+    if (chunkCount < 2)
     {
-        currentDepth += (line[i] == ' ') ? 1 : 4; // Count spaces and tabs
-        i++;
+        convertToLatex(markdown, out, context);
+        return;
     }
-    currentDepth = (currentDepth / 2) + 1; // Normalize depth
 
-    // Adjust list depth if needed
-    while (currentDepth > listDepth)
+    // References only appear in the citation section, which the last chunk holds
+    context.citationRefs.clear();
+    context.bibtex.clear();
+    context.stopped = false;
+    ConversionStats *stats = startStats(context);
     {
-        result += "\\begin{itemize}\n";
-        listDepth++;
+        TraceSpan span("processCitationReferences", "convert");
+        for (size_t i = chunkStarts[chunkCount - 1]; i < lines.size(); ++i)
+        {
+            processCitationReference(lines.line(i), context);
+        }
     }
-    while (currentDepth < listDepth)
+
+    while (context.workers.size() < pool.size())
     {
-        result += "\\end{itemize}\n";
-        listDepth--;
+        context.workers.push_back(std::make_unique<ConversionContext::Worker>());
     }
 
-    // Extract list item text (skip the bullet/number and space)
-    std::string itemText;
-    std::regex listPattern("^\\s*[\\*\\-\\+]\\s+(.*)$");     // For bullet lists
-    std::regex numberedListPattern("^\\s*\\d+\\.\\s+(.*)$"); // For numbered lists
+    std::vector<std::string> chunkOutputs(chunkCount);
+    std::vector<unsigned> chunkFeatures(chunkCount);
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    size_t remaining = chunkCount;
+    // Set once a chunk finds a limit reached; the chunks after it are skipped
+    std::atomic<bool> abandoned{false};
 
-    std::smatch matches;
-    if (std::regex_match(line, matches, listPattern) ||
-        std::regex_match(line, matches, numberedListPattern))
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk)
     {
-        itemText = matches[1].str();
+        pool.submit(
+            [&, chunk](size_t worker)
+            {
+                ConversionStats chunkStats;
+                if (abandoned.load(std::memory_order_relaxed) || context.limitReached())
+                {
+                    abandoned.store(true, std::memory_order_relaxed);
+                }
+                else
+                {
+                    ConversionContext::Worker &scratch = *context.workers[worker];
+                    StringOutput chunkSink(chunkOutputs[chunk]);
+                    std::ostream chunkOut(&chunkSink);
+                    chunkFeatures[chunk] =
+                        emitLines(lines, chunkStarts[chunk], chunkStarts[chunk + 1], scratch.arena,
+                                  scratch.emitter, chunkOut,
+                                  stats != nullptr ? &chunkStats : nullptr);
+                    chunkSink.finish();
+                }
+
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (stats != nullptr)
+                {
+                    stats->add(chunkStats);
+                }
+                if (--remaining == 0)
+                {
+                    doneCondition.notify_one();
+                }
+            });
     }
-    else
+
+    {
+        TraceSpan span("wait for chunks", "convert");
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCondition.wait(lock, [&] { return remaining == 0; });
+    }
+    context.stopped = abandoned.load();
+
     {
-        // Fallback if regex doesn't match
-        size_t textStart = line.find_first_of("-*+1234567890");
-        if (textStart != std::string::npos)
+        TraceSpan span("write chunks", "output");
+        unsigned features = context.citationRefs.empty() ? 0U : kFeatureBibliography;
+        for (unsigned chunkUsed : chunkFeatures)
         {
-            textStart = line.find_first_not_of("-*+1234567890. ", textStart);
-            if (textStart != std::string::npos)
-            {
-                itemText = line.substr(textStart);
-            }
-            else
-            {
-                itemText = "";
-            }
+            features |= chunkUsed;
         }
+        writeHead(features, out);
+        for (const std::string &chunkOutput : chunkOutputs)
+        {
+            out << chunkOutput;
+        }
+        writeTail(features, context, out);
     }
 
-    // Process the item text for other markdown elements
-    itemText = convertLinks(itemText);
-    itemText = convertEmphasis(itemText);
-    itemText = convertCodeBlocks(itemText);
-    itemText = convertCitations(itemText);
-    itemText = escapeLatexChars(itemText);
-
-    result += "\\item " + itemText + "\n";
-
-    return result;
+    if (!context.citationRefs.empty() && !context.checkLimits())
+    {
+        generateBibTeX(context);
+    }
 }
 
-std::string MarkdownConverter::convertLinks(const std::string &line)
+IncrementalUpdate MarkdownConverter::convertToLatexIncremental(std::string_view markdown,
+                                                               std::ostream &out)
 {
-    std::string result = line;
-
-    // [text](url) -> \href{url}{text}
-    std::regex linkPattern("\\[(.*?)\\]\\((.*?)\\)");
-    result = std::regex_replace(result, linkPattern, "\\\\href{$2}{$1}");
+    IncrementalUpdate update = updateIncremental(markdown);
+    writeIncremental(out);
+    return update;
+}
 
-    return result;
+IncrementalUpdate MarkdownConverter::updateIncremental(std::string_view markdown)
+{
+    return updateIncremental(markdown, ownContext);
 }
 
-std::string MarkdownConverter::convertImages(const std::string &line)
+IncrementalUpdate MarkdownConverter::updateIncremental(std::string_view markdown,
+                                                       ConversionContext &context) const
 {
-    std::string result = line;
+    using Segment = ConversionContext::Segment;
+    std::vector<Segment> &segments = context.segments;
+    std::string &latexHead = context.latexHead;
+    std::string &latexTail = context.latexTail;
+
+    bool incremental = context.hasPrevious;
+    std::string_view previous = context.previousMarkdown;
+    size_t firstChanged = 0;
+    size_t unchangedFrom = markdown.size();
+
+    TraceSpan diffSpan("diff", "convert");
+    if (incremental)
+    {
+        // The texts agree on [0, prefix) and on their last suffix bytes. Compare
+        // a block at a time from either end, then narrow down bytewise.
+        constexpr size_t kBlock = 4096;
+        size_t limit = std::min(previous.size(), markdown.size());
+        size_t prefix = 0;
+        while (limit - prefix >= kBlock &&
+               std::memcmp(markdown.data() + prefix, previous.data() + prefix, kBlock) == 0)
+        {
+            prefix += kBlock;
+        }
+        while (prefix < limit && markdown[prefix] == previous[prefix])
+        {
+            prefix++;
+        }
+        size_t suffix = 0;
+        while (limit - prefix - suffix >= kBlock &&
+               std::memcmp(markdown.data() + markdown.size() - suffix - kBlock,
+                           previous.data() + previous.size() - suffix - kBlock, kBlock) == 0)
+        {
+            suffix += kBlock;
+        }
+        while (suffix < limit - prefix &&
+               markdown[markdown.size() - 1 - suffix] == previous[previous.size() - 1 - suffix])
+        {
+            suffix++;
+        }
+        unchangedFrom = markdown.size() - suffix;
+
+        // Redo from the segment holding the first line that differs
+        size_t lineStart = markdown.substr(0, prefix).rfind('\n');
+        lineStart = lineStart == std::string_view::npos ? 0 : lineStart + 1;
+        auto holder = std::upper_bound(segments.begin(), segments.end(), lineStart,
+                                       [](size_t offset, const Segment &segment)
+                                       { return offset < segment.begin; });
+        firstChanged = holder == segments.begin() ? 0 : holder - segments.begin() - 1;
+
+        // A changed first line may no longer be a split point, in which case
+        // the segment merges into the one before
+        if (firstChanged > 0 && segments[firstChanged].begin == lineStart)
+        {
+            firstChanged--;
+        }
+    }
+    diffSpan.end();
 
-    // ![alt](url) -> \includegraphics{url}
-    std::regex imagePattern("!\\[(.*?)\\]\\((.*?)\\)");
-    result = std::regex_replace(
-        result, imagePattern,
-        "\\\\begin{figure}\n\\\\centering\n\\\\includegraphics{$2}\n\\\\caption{$"
-        "1}\n\\\\end{figure}");
+    IncrementalUpdate update;
+    context.stopped = false;
+    ConversionStats *stats = startStats(context);
+    std::vector<Segment> next;
+    next.reserve(segments.size() + 1);
+    std::move(segments.begin(), segments.begin() + firstChanged, std::back_inserter(next));
 
-    return result;
-}
+    auto convertSegment = [&](size_t begin, size_t end)
+    {
+        LineIndex lines(markdown.substr(begin, end - begin));
+        next.push_back({begin, {}, 0});
+        StringOutput sink(next.back().latex);
+        std::ostream latex(&sink);
+        next.back().features =
+            emitLines(lines, 0, lines.size(), context.arena, context.emitter, latex, stats);
+        update.reconverted++;
+    };
+
+    // Scan forward from the first changed segment. At a split point inside the
+    // unchanged tail where the previous version also had one, the rest of the
+    // document splits as before, so its segments are reused.
+    size_t segmentStart = firstChanged < segments.size() ? segments[firstChanged].begin : 0;
+    std::ptrdiff_t shift = static_cast<std::ptrdiff_t>(markdown.size()) -
+                           static_cast<std::ptrdiff_t>(previous.size());
+    bool resynced = false;
+    SplitScanner scanner;
+    for (size_t pos = segmentStart; pos < markdown.size() && !scanner.done();)
+    {
+        size_t end = markdown.find('\n', pos);
+        end = end == std::string_view::npos ? markdown.size() : end;
 
-std::string MarkdownConverter::convertBlockquotes(const std::string &line, bool &inQuote)
-{
-    // Extract the quote text
-    std::string quoteText = line.substr(1);
-    // Trim leading spaces
-    quoteText.erase(0, quoteText.find_first_not_of(" \t"));
+        if (scanner.feed(markdown.substr(pos, end - pos)) && pos > segmentStart)
+        {
+            convertSegment(segmentStart, pos);
+            segmentStart = pos;
+
+            if (incremental && pos >= unchangedFrom)
+            {
+                size_t oldOffset = pos - shift;
+                auto match = std::lower_bound(segments.begin() + firstChanged, segments.end(),
+                                              oldOffset,
+                                              [](const Segment &segment, size_t offset)
+                                              { return segment.begin < offset; });
+                if (match != segments.end() && match->begin == oldOffset)
+                {
+                    for (; match != segments.end(); ++match)
+                    {
+                        next.push_back(
+                            {match->begin + shift, std::move(match->latex), match->features});
+                    }
+                    resynced = true;
+                    break;
+                }
+            }
+        }
+        pos = end + 1;
+    }
+    if (!resynced && segmentStart < markdown.size())
+    {
+        convertSegment(segmentStart, markdown.size());
+    }
 
-    // Process the quote text for other markdown elements
-    quoteText = convertLinks(quoteText);
-    quoteText = convertEmphasis(quoteText);
-    quoteText = convertCodeBlocks(quoteText);
-    quoteText = convertCitations(quoteText);
-    quoteText = escapeLatexChars(quoteText);
+    segments = std::move(next);
+    context.previousMarkdown.assign(markdown);
+    context.hasPrevious = true;
 
-    std::string result;
-    if (!inQuote)
+    // References only appear in the last segment
+    context.citationRefs.clear();
+    if (!segments.empty())
     {
-        result = "\\begin{quotation}\n";
-        inQuote = true;
+        TraceSpan span("processCitationReferences", "convert");
+        LineIndex lines(std::string_view(context.previousMarkdown).substr(segments.back().begin));
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            processCitationReference(lines.line(i), context);
+        }
+    }
+
+    // With a template the head depends on the features, so it may differ
+    // from the previous one
+    unsigned features = context.citationRefs.empty() ? 0U : kFeatureBibliography;
+    for (const Segment &segment : segments)
+    {
+        features |= segment.features;
+    }
+    std::string previousHead = std::move(latexHead);
+    latexHead.clear();
+    latexTail.clear();
+    {
+        StringOutput headSink(latexHead);
+        std::ostream preamble(&headSink);
+        writeHead(features, preamble);
+        StringOutput tailSink(latexTail);
+        std::ostream epilogue(&tailSink);
+        writeTail(features, context, epilogue);
     }
 
-    result += quoteText + "\n";
+    // Output up to the first segment converted again is the same as last time
+    update.segments = segments.size();
+    update.outputBytes = latexHead.size() + latexTail.size();
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        if (incremental && i == firstChanged)
+        {
+            update.unchangedBytes = update.outputBytes - latexTail.size();
+        }
+        update.outputBytes += segments[i].latex.size();
+    }
+    if (incremental && firstChanged >= segments.size())
+    {
+        update.unchangedBytes = update.outputBytes - latexTail.size();
+    }
+    if (incremental && latexHead != previousHead)
+    {
+        auto differs = std::mismatch(latexHead.begin(), latexHead.end(), previousHead.begin(),
+                                     previousHead.end());
+        update.unchangedBytes = std::min<size_t>(update.unchangedBytes,
+                                                 differs.first - latexHead.begin());
+    }
 
-    return result;
+    if (context.citationRefs.empty())
+    {
+        context.bibtex.clear();
+    }
+    else if (context.citationRefs != context.previousCitationRefs)
+    {
+        generateBibTeX(context);
+    }
+    // References not resolved because of the limits are tried again next time
+    if (!context.stopped)
+    {
+        context.previousCitationRefs = context.citationRefs;
+    }
+    return update;
 }
 
-std::string MarkdownConverter::convertCitations(const std::string &line)
+void MarkdownConverter::writeIncremental(std::ostream &out, size_t from) const
 {
-    std::string result = line;
+    writeIncremental(out, ownContext, from);
+}
 
-    // Replace [^1] with \cite{ref1}
-    std::regex citationPattern("\\[\\^(\\d+)\\]");
-    std::smatch matches;
-    std::string::const_iterator searchStart(result.cbegin());
+void MarkdownConverter::writeIncremental(std::ostream &out, const ConversionContext &context,
+                                         size_t from) const
+{
+    auto write = [&](const std::string &piece)
+    {
+        if (from >= piece.size())
+        {
+            from -= piece.size();
+            return;
+        }
+        out.write(piece.data() + from, static_cast<std::streamsize>(piece.size() - from));
+        from = 0;
+    };
 
-    while (std::regex_search(searchStart, result.cend(), matches, citationPattern))
+    write(context.latexHead);
+    for (const ConversionContext::Segment &segment : context.segments)
     {
-        std::string refNum = matches[1].str();
-        std::string citation = "\\cite{ref" + refNum + "}";
+        write(segment.latex);
+    }
+    write(context.latexTail);
+}
 
-        // Replace this occurrence
-        result.replace(matches.position() + (searchStart - result.cbegin()), matches.length(),
-                       citation);
+void MarkdownConverter::writeHead(unsigned features, std::ostream &out) const
+{
+    if (options.documentTemplate)
+    {
+        options.documentTemplate->writeHead(features, out);
+        return;
+    }
+    LatexEmitter emitter;
+    emitter.emitPreamble(out);
+}
 
-        // Move to the next position
-        searchStart = result.cbegin() + matches.position() + citation.length();
+void MarkdownConverter::writeTail(unsigned features, const ConversionContext &context,
+                                  std::ostream &out) const
+{
+    if (options.documentTemplate)
+    {
+        options.documentTemplate->writeTail(features, out);
+        return;
     }
+    const std::string &path = bibliographyPath(context);
+    std::string bibliography =
+        path.empty() ? std::string("references") : std::filesystem::path(path).stem().string();
+    LatexEmitter emitter;
+    emitter.emitEpilogue((features & kFeatureBibliography) != 0, bibliography, out);
+}
 
-    return result;
+const std::string &MarkdownConverter::bibliographyPath(const ConversionContext &context) const
+{
+    return context.bibliographyFile ? *context.bibliographyFile : options.bibliographyPath;
 }
 
-void MarkdownConverter::processCitationReferences(const std::string &markdown)
+const ConversionStats &MarkdownConverter::stats() const { return ownContext.stats(); }
+
+ConversionStats *MarkdownConverter::startStats(ConversionContext &context) const
 {
-    std::istringstream stream(markdown);
-    std::string line;
+    if (!options.collectStats)
+    {
+        return nullptr;
+    }
+    context.conversionStats = ConversionStats();
+    context.conversionStats.documents = 1;
+    return &context.conversionStats;
+}
 
-    // Regular expression to match citation references like [^1]: reference text
-    std::regex refPattern("\\[\\^(\\d+)\\]:\\s*(.+)");
+void MarkdownConverter::processCitationReference(std::string_view line,
+                                                 ConversionContext &context)
+{
+    // Matches [^<digits>]:<ws>*<text> where text is non-empty and has no '\r';
+    // when only whitespace follows the colon its last character is the text
+    if (line.compare(0, 2, "[^") != 0)
+    {
+        return;
+    }
+    size_t digitsEnd = 2;
+    while (digitsEnd < line.size() && std::isdigit(static_cast<unsigned char>(line[digitsEnd])))
+    {
+        digitsEnd++;
+    }
+    if (digitsEnd == 2 || line.compare(digitsEnd, 2, "]:") != 0)
+    {
+        return;
+    }
 
-    while (std::getline(stream, line))
+    size_t textStart = digitsEnd + 2;
+    while (textStart < line.size() && isSpace(line[textStart]))
     {
-        std::smatch matches;
-        if (std::regex_match(line, matches, refPattern))
+        textStart++;
+    }
+    if (textStart == line.size())
+    {
+        if (textStart == digitsEnd + 2 || line.back() == '\r' || line.back() == '\n')
         {
-            std::string refNum = matches[1].str();
-            std::string refText = matches[2].str();
-
-            // Store the reference
-            citationRefs["ref" + refNum] = refText;
+            return;
         }
+        textStart--;
+    }
+    if (line.find_first_of("\r\n", textStart) != std::string_view::npos)
+    {
+        return;
     }
+
+    // Store the reference
+    context.citationRefs["ref" + std::string(line.substr(2, digitsEnd - 2))] =
+        line.substr(textStart);
 }
 
-std::string MarkdownConverter::generateBibTeX()
+void MarkdownConverter::generateBibTeX(ConversionContext &context) const
 {
-    std::stringstream bibtex;
+    auto citationStart = std::chrono::steady_clock::now();
+    TraceSpan span("generateBibTeX", "citation");
+    span.arg("references", context.citationRefs.size());
+
+    // Selection prompts on stdin and the bibliography files are shared by
+    // every converter, so only they are done one document at a time
+    static std::mutex bibliographyMutex;
+
+    CitationServices &services = *citationServices;
+    std::call_once(services.opened, [&]() { services.open(options); });
+    citation::CitationCache &cache = *services.cache;
+    citation::PaperCitationAPI &api = *services.api;
+
+    // Candidates for every reference without a stored selection, in reference
+    // order: first from the local library, and when none of those is a
+    // confident match, from the citation services, all looked up at once so
+    // that the selection prompts below then follow reference order. The
+    // selections are looked up once, since other conversions may add to them.
+    citation::CitationMatcher matcher(options.citationMatchThreshold);
+    std::vector<std::optional<citation::PaperInfo>> remembered;
+    std::vector<std::vector<citation::PaperInfo>> found;
+    std::vector<std::string> queries;
+    std::vector<size_t> queried;
+    size_t libraryMatches = 0;
+    size_t failedLookups = 0;
+    for (const auto &ref : context.citationRefs)
+    {
+        if (context.checkLimits())
+        {
+            return;
+        }
+        citation::PaperInfo selected;
+        if (cache.lookupSelection(ref.second, selected))
+        {
+            remembered.emplace_back(std::move(selected));
+            continue;
+        }
+        remembered.emplace_back();
+        found.emplace_back();
+        if (library)
+        {
+            found.back() = library->search(ref.second).papers;
+            auto ranked = matcher.rank(ref.second, found.back());
+            if (!ranked.empty() && ranked.front().score >= matcher.getThreshold())
+            {
+                ++libraryMatches;
+                continue;
+            }
+        }
+        queried.push_back(found.size() - 1);
+        queries.push_back(ref.second);
+    }
+    if (!queries.empty())
+    {
+        citation::ConcurrentResolver resolver(options.citationConcurrency);
+        resolver.setLimits(context.deadline, context.cancelFlag);
+        auto networkStart = std::chrono::steady_clock::now();
+        auto results = resolver.search(api, queries, &failedLookups);
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            auto &papers = found[queried[i]];
+            papers.insert(papers.end(), results[i].begin(), results[i].end());
+        }
+        if (options.collectStats)
+        {
+            context.conversionStats.citationNetworkSeconds += secondsSince(networkStart);
+        }
+    }
+    // Lookups given up on leave the bibliography incomplete
+    if (context.checkLimits())
+    {
+        cache.save();
+        return;
+    }
 
     std::vector<citation::PaperInfo> res;
-    for (const auto &ref : citationRefs)
+    // References with candidates, none of them confident or picked
+    size_t unmatched = 0;
+    size_t nextReference = 0;
+    size_t nextResult = 0;
+    TraceSpan selectSpan("select citations", "citation");
+    for (const auto &ref : context.citationRefs)
     {
         // Parse the reference text to extract author, title, year, etc.
         // This is a simplified approach; in reality, you might want to parse the
@@ -433,18 +794,38 @@ std::string MarkdownConverter::generateBibTeX()
 
         std::string refText = ref.second;
 
-        citation::PaperCitationAPI api;
-
-        auto papers = api.search(refText);
+        // Reuse the paper picked for this reference on an earlier run
+        const auto &selected = remembered[nextReference++];
+        if (selected)
+        {
+            res.emplace_back(*selected);
+            res.back().citation_key = ref.first;
+            continue;
+        }
 
-        // std::cout << "Found " << papers.size() << " papers." << "\n";
+        const auto &papers = found[nextResult++];
+        if (papers.empty())
+        {
+            continue;
+        }
 
-        if (!papers.empty())
+        // Take the best candidate when it is a confident match; otherwise fall
+        // back to asking, if allowed
+        auto ranked = matcher.rank(refText, papers);
+        const citation::PaperInfo *choice = nullptr;
+        if (ranked.front().score >= matcher.getThreshold())
+        {
+            choice = &papers[ranked.front().index];
+        }
+        else if (options.promptCitations)
         {
-            for (size_t i = 0; i < papers.size(); ++i)
+            std::lock_guard<std::mutex> lock(bibliographyMutex);
+            std::cout << "No confident match for " << ref.first << ": " << refText << "\n";
+            for (size_t i = 0; i < ranked.size(); ++i)
             {
-                const auto &paper = papers[i];
-                std::cout << i + 1 << ". " << paper.title << " (" << paper.year << ")" << "\n";
+                const auto &paper = papers[ranked[i].index];
+                std::cout << i + 1 << ". " << paper.title << " (" << paper.year << ") [score "
+                          << ranked[i].score << "]" << "\n";
                 for (auto author : paper.authors)
                 {
                     std::cout << author << ", ";
@@ -452,22 +833,27 @@ std::string MarkdownConverter::generateBibTeX()
                 std::cout << "\n";
             }
 
-            std::cout << "Please select a paper, input the number" << "\n";
+            std::cout << "Please select a paper, input the number (empty to skip)" << "\n";
 
             std::string ref_str;
             std::getline(std::cin, ref_str);
-            int ref_num = std::stoi(ref_str);
-
-            if (ref_num > 0 && ref_num <= papers.size())
+            long ref_num = std::strtol(ref_str.c_str(), nullptr, 10);
+            if (ref_num > 0 && static_cast<size_t>(ref_num) <= ranked.size())
             {
-                res.emplace_back(papers[ref_num - 1]);
-                res.back().citation_key = ref.first;
+                choice = &papers[ranked[ref_num - 1].index];
             }
-
-            // std::cout << "Saving all results to references.bib" << "\n";
         }
 
-        api.saveBibFile(res, "references.bib");
+        if (choice)
+        {
+            cache.storeSelection(refText, *choice);
+            res.emplace_back(*choice);
+            res.back().citation_key = ref.first;
+        }
+        else
+        {
+            unmatched++;
+        }
         //// Simple BibTeX entry format
         // bibtex << "@misc{" << ref.first << ",\n";
         // bibtex << "  author = {Author},\n";
@@ -476,27 +862,64 @@ std::string MarkdownConverter::generateBibTeX()
         // bibtex << "}\n\n";
     }
 
-    return bibtex.str();
+    selectSpan.end();
+
+    cache.save();
+    context.bibtex = api.toBibFile(res);
+    const std::string &path = bibliographyPath(context);
+    if (!path.empty())
+    {
+        std::lock_guard<std::mutex> lock(bibliographyMutex);
+        api.saveBibFile(res, path);
+    }
+
+    if (options.collectStats)
+    {
+        context.conversionStats.citationReferences += context.citationRefs.size();
+        context.conversionStats.citationLibraryMatches += libraryMatches;
+        context.conversionStats.citationLookups += queries.size();
+        context.conversionStats.citationsResolved += res.size();
+        context.conversionStats.citationsUnmatched += unmatched;
+        context.conversionStats.citationLookupsFailed += failedLookups;
+        context.conversionStats.citationSeconds += secondsSince(citationStart);
+    }
+}
+
+const std::map<std::string, std::string> &ConversionContext::citationReferences() const
+{
+    return citationRefs;
 }
 
-std::string MarkdownConverter::escapeLatexChars(const std::string &text)
+const std::string &ConversionContext::bibliography() const { return bibtex; }
+
+void ConversionContext::setBibliographyPath(std::string path)
 {
-    std::string result = text;
+    bibliographyFile = std::move(path);
+}
 
-    // LaTeX special characters that need to be escaped: #, $, %, &, _, {, }, ~, ^, \
-    // But we need to be careful not to escape characters that are already part of a LaTeX command
+const ConversionStats &ConversionContext::stats() const { return conversionStats; }
 
-    // This is a simplified approach - in a real implementation, this would need
-    // to be more sophisticated
-    std::regex escapePattern("([\\#\\$\\%\\&\\_\\~\\^\\\\])");
-    result = std::regex_replace(result, escapePattern, "\\$1");
+void ConversionContext::setLimits(std::chrono::steady_clock::time_point limit,
+                                  const std::atomic<bool> *cancelled)
+{
+    deadline = limit;
+    cancelFlag = cancelled;
+}
 
-    // Fix double escaping that might have occurred from other conversions
-    result = std::regex_replace(
-        result,
-        std::regex("\\\\\\\\(textbf|textit|texttt|href|includegraphics|begin|end|item|"
-                   "section|subsection|subsubsection|paragraph|subparagraph|cite)"),
-        "\\$1");
+bool ConversionContext::interrupted() const { return stopped; }
 
-    return result;
-}
\ No newline at end of file
+bool ConversionContext::checkLimits()
+{
+    if (!stopped)
+    {
+        stopped = limitReached();
+    }
+    return stopped;
+}
+
+bool ConversionContext::limitReached() const
+{
+    return (cancelFlag != nullptr && cancelFlag->load(std::memory_order_relaxed)) ||
+           (deadline != std::chrono::steady_clock::time_point::max() &&
+            std::chrono::steady_clock::now() >= deadline);
+}
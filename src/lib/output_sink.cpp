@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include "output_sink.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define MD2LATEX_HAVE_WRITEV 1
+#else
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+
+struct Piece
+{
+    const char *data;
+    size_t size;
+};
+
+// Write every piece, retrying after partial writes and interruptions.
+// Returns the number of bytes written, which is short only on error.
+size_t writePieces(int fd, std::vector<Piece> &pieces)
+{
+    size_t written = 0;
+#ifdef MD2LATEX_HAVE_WRITEV
+    std::vector<iovec> vectors;
+    vectors.reserve(pieces.size());
+    for (const Piece &piece : pieces)
+    {
+        vectors.push_back({const_cast<char *>(piece.data), piece.size});
+    }
+
+    size_t index = 0;
+    while (index < vectors.size())
+    {
+        int count = static_cast<int>(std::min<size_t>(vectors.size() - index, IOV_MAX));
+        ssize_t result = ::writev(fd, vectors.data() + index, count);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        size_t done = static_cast<size_t>(result);
+        written += done;
+        while (index < vectors.size() && done >= vectors[index].iov_len)
+        {
+            done -= vectors[index].iov_len;
+            index++;
+        }
+        if (index < vectors.size())
+        {
+            vectors[index].iov_base = static_cast<char *>(vectors[index].iov_base) + done;
+            vectors[index].iov_len -= done;
+        }
+    }
+#else
+    for (const Piece &piece : pieces)
+    {
+        size_t done = 0;
+        while (done < piece.size)
+        {
+            auto count = static_cast<unsigned int>(std::min<size_t>(piece.size - done, INT_MAX));
+            int result = ::_write(fd, piece.data + done, count);
+            if (result < 0)
+            {
+                return written;
+            }
+            done += static_cast<size_t>(result);
+            written += static_cast<size_t>(result);
+        }
+    }
+#endif
+    return written;
+}
+
+} // namespace
+
+ChunkedOutput::ChunkedOutput(int fd) : fd(fd) {}
+
+ChunkedOutput::~ChunkedOutput()
+{
+    if (fd >= 0)
+    {
+        close();
+    }
+}
+
+bool ChunkedOutput::open(const std::string &path)
+{
+    close();
+    failed = false;
+    flushedBytes = 0;
+    errorMessage.clear();
+
+#ifdef MD2LATEX_HAVE_WRITEV
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#else
+    fd = ::_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                 _S_IREAD | _S_IWRITE);
+#endif
+    if (fd < 0)
+    {
+        errorMessage = "Cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    ownsFd = true;
+    return true;
+}
+
+bool ChunkedOutput::flush()
+{
+    if (pbase() == nullptr)
+    {
+        return !failed;
+    }
+    return writeChunks(static_cast<size_t>(pptr() - pbase()));
+}
+
+bool ChunkedOutput::close()
+{
+    bool ok = flush();
+    if (ownsFd && fd >= 0)
+    {
+#ifdef MD2LATEX_HAVE_WRITEV
+        int result = ::close(fd);
+#else
+        int result = ::_close(fd);
+#endif
+        if (result != 0 && !failed)
+        {
+            failed = true;
+            errorMessage = std::strerror(errno);
+            ok = false;
+        }
+    }
+    fd = -1;
+    ownsFd = false;
+    return ok && !failed;
+}
+
+size_t ChunkedOutput::size() const
+{
+    size_t held = pbase() == nullptr ? 0 : static_cast<size_t>(pptr() - pbase());
+    return flushedBytes + filled * kChunkSize + held;
+}
+
+const std::string &ChunkedOutput::error() const { return errorMessage; }
+
+ChunkedOutput::int_type ChunkedOutput::overflow(int_type chr)
+{
+    if (traits_type::eq_int_type(chr, traits_type::eof()))
+    {
+        return traits_type::not_eof(chr);
+    }
+    if (!nextChunk())
+    {
+        return traits_type::eof();
+    }
+    *pptr() = traits_type::to_char_type(chr);
+    pbump(1);
+    return chr;
+}
+
+std::streamsize ChunkedOutput::xsputn(const char *data, std::streamsize count)
+{
+    if (failed)
+    {
+        return 0;
+    }
+
+    // Pieces of a chunk or more go to the kernel as they are, behind what is
+    // held already, instead of being copied into chunks first
+    auto size = static_cast<size_t>(count);
+    if (size >= kChunkSize)
+    {
+        size_t held = pbase() == nullptr ? 0 : static_cast<size_t>(pptr() - pbase());
+        return writeChunks(held, data, size) ? count : 0;
+    }
+
+    size_t copied = 0;
+    while (copied < size)
+    {
+        if (pptr() == epptr() && !nextChunk())
+        {
+            break;
+        }
+        size_t room = std::min(static_cast<size_t>(epptr() - pptr()), size - copied);
+        std::memcpy(pptr(), data + copied, room);
+        pbump(static_cast<int>(room));
+        copied += room;
+    }
+    return static_cast<std::streamsize>(copied);
+}
+
+int ChunkedOutput::sync() { return flush() ? 0 : -1; }
+
+bool ChunkedOutput::nextChunk()
+{
+    if (failed)
+    {
+        return false;
+    }
+    if (pbase() != nullptr)
+    {
+        filled++;
+        if (filled >= kChunksPerWrite)
+        {
+            return writeChunks(0);
+        }
+    }
+    if (chunks.size() <= filled)
+    {
+        chunks.push_back(std::make_unique<char[]>(kChunkSize));
+    }
+    setp(chunks[filled].get(), chunks[filled].get() + kChunkSize);
+    return true;
+}
+
+bool ChunkedOutput::writeChunks(size_t lastBytes, const char *extra, size_t extraBytes)
+{
+    std::vector<Piece> pieces;
+    for (size_t i = 0; i < filled; ++i)
+    {
+        pieces.push_back({chunks[i].get(), kChunkSize});
+    }
+    if (lastBytes > 0)
+    {
+        pieces.push_back({chunks[filled].get(), lastBytes});
+    }
+    if (extraBytes > 0)
+    {
+        pieces.push_back({extra, extraBytes});
+    }
+
+    size_t expected = filled * kChunkSize + lastBytes + extraBytes;
+    if (!failed && expected > 0)
+    {
+        if (fd < 0)
+        {
+            failed = true;
+            errorMessage = "Output is not open";
+        }
+        else
+        {
+            size_t written = writePieces(fd, pieces);
+            flushedBytes += written;
+            if (written != expected)
+            {
+                failed = true;
+                errorMessage = std::strerror(errno);
+            }
+        }
+    }
+
+    // Start over in the first chunk; after a failure the output is dropped
+    filled = 0;
+    if (chunks.empty())
+    {
+        chunks.push_back(std::make_unique<char[]>(kChunkSize));
+    }
+    setp(chunks[0].get(), chunks[0].get() + kChunkSize);
+    return !failed;
+}
+
+StringOutput::StringOutput(std::string &target) : target(target) {}
+
+StringOutput::~StringOutput() { finish(); }
+
+void StringOutput::finish()
+{
+    if (pbase() != nullptr)
+    {
+        target.resize(static_cast<size_t>(pptr() - target.data()));
+        setp(nullptr, nullptr);
+    }
+}
+
+StringOutput::int_type StringOutput::overflow(int_type chr)
+{
+    if (traits_type::eq_int_type(chr, traits_type::eof()))
+    {
+        return traits_type::not_eof(chr);
+    }
+    reserve(1);
+    *pptr() = traits_type::to_char_type(chr);
+    pbump(1);
+    return chr;
+}
+
+std::streamsize StringOutput::xsputn(const char *data, std::streamsize count)
+{
+    auto size = static_cast<size_t>(count);
+    if (static_cast<size_t>(epptr() - pptr()) < size)
+    {
+        reserve(size);
+    }
+    std::memcpy(pptr(), data, size);
+    // pbump takes an int; only pptr() matters here, so move the put area
+    setp(pptr() + size, epptr());
+    return count;
+}
+
+void StringOutput::reserve(size_t count)
+{
+    size_t length =
+        pbase() == nullptr ? target.size() : static_cast<size_t>(pptr() - target.data());
+    target.resize(std::max({length + count, target.size() * 2, size_t{256}}));
+    setp(target.data() + length, target.data() + target.size());
+}
@@ -0,0 +1,149 @@
+#include <algorithm>
+
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace
+{
+
+// Pool and worker index of the current thread when it is a pool worker
+thread_local const ThreadPool *currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t threads)
+{
+    if (threads == 0)
+    {
+        threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([this, i] { workerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(Task task)
+{
+    // Tasks spawned by a worker go to its own queue, others are spread round-robin
+    bool spawned = currentPool == this;
+    size_t target = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        target = spawned ? currentWorker : nextQueue++ % queues.size();
+        pending++;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back({std::move(task), spawned});
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+size_t ThreadPool::size() const { return workers.size(); }
+
+void ThreadPool::workerLoop(size_t worker)
+{
+    currentPool = this;
+    currentWorker = worker;
+    Tracer::setThreadName("worker " + std::to_string(worker));
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (queued == 0)
+            {
+                return;
+            }
+            // Reserve one of the queued tasks; it is found below
+            queued--;
+        }
+
+        Task task;
+        while (!takeTask(worker, task))
+        {
+            std::this_thread::yield();
+        }
+        task(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending--;
+            if (pending == 0)
+            {
+                idle.notify_all();
+            }
+        }
+    }
+}
+
+bool ThreadPool::takeTask(size_t worker, Task &task)
+{
+    // Own queue first: the newest task this worker spawned, else the oldest
+    // one submitted from outside
+    {
+        Queue &own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            if (own.tasks.back().spawned)
+            {
+                task = std::move(own.tasks.back().task);
+                own.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(own.tasks.front().task);
+                own.tasks.pop_front();
+            }
+            return true;
+        }
+    }
+
+    // Otherwise steal the oldest task of another worker
+    for (size_t offset = 1; offset < queues.size(); ++offset)
+    {
+        Queue &victim = *queues[(worker + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front().task);
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
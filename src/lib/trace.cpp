@@ -0,0 +1,222 @@
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <vector>
+
+#include "trace.h"
+
+namespace
+{
+
+struct Event
+{
+    char phase;
+    const char *name;
+    const char *category;
+    Tracer::Clock::time_point start;
+    Tracer::Clock::time_point end;
+    std::uint64_t id;
+    std::string args;
+};
+
+// Events of one thread. Only the owning thread appends, so its mutex is only
+// contended while the trace is being written.
+struct ThreadBuffer
+{
+    std::mutex mutex;
+    int tid;
+    std::string name;
+    std::vector<Event> events;
+};
+
+// Buffers live until the process exits, since threads keep a pointer to
+// theirs for good; a new trace only empties them
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    Tracer::Clock::time_point origin;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+// The calling thread's buffer, created on its first event, and its name
+thread_local ThreadBuffer *currentBuffer = nullptr;
+thread_local std::string currentName;
+
+ThreadBuffer &localBuffer()
+{
+    if (currentBuffer == nullptr)
+    {
+        Registry &shared = registry();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        shared.buffers.push_back(std::make_unique<ThreadBuffer>());
+        currentBuffer = shared.buffers.back().get();
+        currentBuffer->tid = static_cast<int>(shared.buffers.size());
+        currentBuffer->name = currentName;
+    }
+    return *currentBuffer;
+}
+
+void record(Event event)
+{
+    ThreadBuffer &buffer = localBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(std::move(event));
+}
+
+// JSON string for text. File names, references and the like need not be
+// UTF-8; invalid bytes become U+FFFD rather than making dump() throw, since
+// tracing must never abort the run it records.
+std::string quoted(std::string_view text)
+{
+    return nlohmann::json(text).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+void startArg(std::string &args, const char *key)
+{
+    if (!args.empty())
+    {
+        args += ',';
+    }
+    args += quoted(key);
+    args += ':';
+}
+
+// Microseconds since the trace started, the unit of trace-event timestamps
+double micros(Tracer::Clock::time_point time, Tracer::Clock::time_point origin)
+{
+    return std::chrono::duration<double, std::micro>(time - origin).count();
+}
+
+// Event objects, each preceded by a comma; async spans become a begin and an
+// end event
+void writeEvent(std::ostream &out, const Event &event, int tid, Tracer::Clock::time_point origin)
+{
+    auto open = [&](char phase, double timestamp)
+    {
+        out << ",\n{\"name\":" << quoted(event.name)
+            << ",\"cat\":" << quoted(event.category) << ",\"ph\":\"" << phase
+            << "\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << timestamp;
+    };
+
+    if (event.phase == 'X')
+    {
+        open('X', micros(event.start, origin));
+        out << ",\"dur\":" << micros(event.end, event.start) << ",\"args\":{" << event.args
+            << "}}";
+        return;
+    }
+
+    open('b', micros(event.start, origin));
+    out << ",\"id\":" << event.id << ",\"args\":{" << event.args << "}}";
+    open('e', micros(event.end, origin));
+    out << ",\"id\":" << event.id << "}";
+}
+
+} // namespace
+
+void Tracer::start()
+{
+    Registry &shared = registry();
+    {
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        for (auto &buffer : shared.buffers)
+        {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            buffer->events.clear();
+        }
+        shared.origin = Clock::now();
+    }
+    active.store(true, std::memory_order_relaxed);
+    setThreadName("main");
+}
+
+bool Tracer::stop(const std::string &path, std::string &error)
+{
+    active.store(false, std::memory_order_relaxed);
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        error = "Cannot open trace file: " + path;
+        return false;
+    }
+
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    out << "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+           "\"args\":{\"name\":\"md2LateX\"}}";
+    for (auto &buffer : shared.buffers)
+    {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        // Threads of earlier traces keep their buffers; leave the idle ones out
+        if (!buffer->name.empty() && !buffer->events.empty())
+        {
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"args\":{\"name\":" << quoted(buffer->name) << "}}";
+        }
+        for (const Event &event : buffer->events)
+        {
+            writeEvent(out, event, buffer->tid, shared.origin);
+        }
+        buffer->events.clear();
+    }
+    out << "\n]}\n";
+
+    out.close();
+    if (!out)
+    {
+        error = "Failed to write trace file: " + path;
+        return false;
+    }
+    return true;
+}
+
+void Tracer::setThreadName(const std::string &name)
+{
+    currentName = name;
+    if (currentBuffer != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(currentBuffer->mutex);
+        currentBuffer->name = name;
+    }
+}
+
+void Tracer::complete(const char *name, const char *category, Clock::time_point start,
+                      Clock::time_point end, std::string args)
+{
+    record({'X', name, category, start, end, 0, std::move(args)});
+}
+
+void Tracer::async(const char *name, const char *category, std::uint64_t id,
+                   Clock::time_point start, Clock::time_point end, std::string args)
+{
+    record({'b', name, category, start, end, id, std::move(args)});
+}
+
+void Tracer::appendArg(std::string &args, const char *key, long long value)
+{
+    startArg(args, key);
+    args += std::to_string(value);
+}
+
+void Tracer::appendArg(std::string &args, const char *key, double value)
+{
+    startArg(args, key);
+    args += nlohmann::json(value).dump();
+}
+
+void Tracer::appendArg(std::string &args, const char *key, std::string_view value)
+{
+    startArg(args, key);
+    args += quoted(value);
+}
@@ -0,0 +1,112 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include "batch_converter.h"
+#include "test_check.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+std::string readFile(const fs::path &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+ConverterOptions batchOptions()
+{
+    ConverterOptions options;
+    options.citationCachePath.clear();
+    options.citationBaseUrl = "http://127.0.0.1:1";
+    options.bibliographyPath.clear();
+    options.promptCitations = false;
+    return options;
+}
+
+void testBadInputsFailAlone(const fs::path &root)
+{
+    // A directory named like a document, a missing file and an unreadable
+    // one each fail on their own; the good documents are still converted
+    fs::create_directories(root / "in" / "sub.md");
+    std::ofstream(root / "in" / "a.md") << "# First\n\nSome *text*.\n";
+    std::ofstream(root / "in" / "b.md") << "# Second\n";
+    fs::path unreadable = root / "in" / "locked.md";
+    std::ofstream(unreadable) << "# Locked\n";
+    fs::permissions(unreadable, fs::perms::none);
+    // Permissions do not stop root
+    bool locked = !std::ifstream(unreadable).is_open();
+
+    fs::path list = root / "list.txt";
+    std::ofstream(list) << (root / "in" / "a.md").string() << "\n"
+                        << (root / "in" / "sub.md").string() << "\n"
+                        << (root / "in" / "missing.md").string() << "\n"
+                        << unreadable.string() << "\n"
+                        << (root / "in" / "b.md").string() << "\n";
+
+    fs::path out = root / "out";
+    std::vector<BatchJob> jobs = BatchConverter::collectJobs(list.string(), out.string());
+    CHECK_EQ(jobs.size(), size_t{5});
+
+    BatchConverter batch(2, batchOptions());
+    BatchSummary summary = batch.run(std::move(jobs));
+    CHECK_EQ(summary.files, size_t{5});
+    CHECK_EQ(summary.failed, locked ? size_t{3} : size_t{2});
+
+    fs::path converted = out / fs::path(root.relative_path()) / "in";
+    std::string first = readFile(converted / "a.tex");
+    CHECK(first.find("\\section{First}") != std::string::npos);
+    CHECK(first.find("\\textit{text}") != std::string::npos);
+    CHECK(readFile(converted / "b.tex").find("\\section{Second}") != std::string::npos);
+    CHECK(!fs::exists(converted / "missing.tex"));
+
+    fs::permissions(unreadable, fs::perms::owner_all);
+}
+
+void testDirectorySource(const fs::path &root)
+{
+    // Only .md files below a directory become jobs, written next to them
+    fs::create_directories(root / "tree" / "nested");
+    std::ofstream(root / "tree" / "top.md") << "Top\n";
+    std::ofstream(root / "tree" / "nested" / "deep.md") << "Deep\n";
+    std::ofstream(root / "tree" / "notes.txt") << "Not Markdown\n";
+
+    std::vector<BatchJob> jobs = BatchConverter::collectJobs((root / "tree").string());
+    CHECK_EQ(jobs.size(), size_t{2});
+
+    BatchConverter batch(2, batchOptions());
+    BatchSummary summary = batch.run(std::move(jobs));
+    CHECK_EQ(summary.failed, size_t{0});
+    CHECK(fs::exists(root / "tree" / "top.tex"));
+    CHECK(fs::exists(root / "tree" / "nested" / "deep.tex"));
+    CHECK(!fs::exists(root / "tree" / "notes.tex"));
+}
+
+} // namespace
+
+int main()
+{
+    std::string name = "md2latex-batch-test";
+#if defined(__unix__) || defined(__APPLE__)
+    name += "-" + std::to_string(getpid());
+#endif
+    fs::path root = fs::temp_directory_path() / name;
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    testBadInputsFailAlone(root);
+    testDirectorySource(root);
+
+    fs::remove_all(root);
+    return test::result();
+}
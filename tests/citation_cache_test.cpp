@@ -0,0 +1,275 @@
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "test_check.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include "citation_cache.h"
+#include "loopback_http.h"
+#include "md_converter.h"
+
+// CitationCache on its own, and a converter re-run against a loopback
+// stand-in for Google Scholar that must not be asked again
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+using citation::CacheOptions;
+using citation::CitationCache;
+using citation::PaperInfo;
+
+PaperInfo samplePaper()
+{
+    PaperInfo paper;
+    paper.title = "Attention Is All You Need";
+    paper.authors = {"Vaswani, Ashish", "Shazeer, Noam"};
+    paper.journal = "NeurIPS";
+    paper.volume = "30";
+    paper.issue = "1";
+    paper.pages = "5998--6008";
+    paper.year = "2017";
+    paper.doi = "10.5555/3295222";
+    paper.url = "https://example.org/attention";
+    paper.publisher = "Curran";
+    paper.abstract = "Transformers.";
+    paper.citation_key = "Vaswani2017";
+    paper.book_title = "Advances";
+    paper.edition = "First";
+    paper.isbn = "978-0";
+    paper.type = "book";
+    return paper;
+}
+
+bool samePaper(const PaperInfo &a, const PaperInfo &b)
+{
+    return paperToJson(a) == paperToJson(b);
+}
+
+CacheOptions cacheAt(const fs::path &path, std::chrono::seconds ttl = std::chrono::hours(1))
+{
+    CacheOptions options;
+    options.path = path.string();
+    options.ttl = ttl;
+    return options;
+}
+
+void testRoundTrip(const fs::path &root)
+{
+    fs::path path = root / "nested" / "dir" / "cache.msgpack";
+    {
+        CitationCache cache(cacheAt(path));
+        CHECK_EQ(cache.size(), size_t{0});
+        cache.store("CrossRef", "Attention is all you need", {samplePaper(), PaperInfo()});
+        cache.storeSelection("[1] Vaswani et al. Attention!", samplePaper());
+        CHECK(cache.save());
+    }
+    // Written through a temporary file, which is gone
+    CHECK(fs::exists(path));
+    CHECK(!fs::exists(path.string() + ".tmp"));
+
+    std::ifstream file(path, std::ios::binary);
+    std::vector<std::uint8_t> bytes((std::istreambuf_iterator<char>(file)),
+                                    std::istreambuf_iterator<char>());
+    nlohmann::json json = nlohmann::json::from_msgpack(bytes);
+    CHECK_EQ(json.value("version", 0), 1);
+
+    CitationCache cache(cacheAt(path));
+    CHECK_EQ(cache.size(), size_t{2});
+    // Queries match after normalization, per source
+    std::vector<PaperInfo> papers;
+    CHECK(cache.lookup("CrossRef", "  ATTENTION is all... you need ", papers));
+    CHECK_EQ(papers.size(), size_t{2});
+    CHECK(papers.size() == 2 && samePaper(papers[0], samplePaper()));
+    CHECK(!cache.lookup("Google Scholar", "Attention is all you need", papers));
+
+    PaperInfo selected;
+    CHECK(cache.lookupSelection("[1] vaswani et al attention", selected));
+    CHECK(samePaper(selected, samplePaper()));
+    CHECK(!cache.lookupSelection("[2] another reference", selected));
+}
+
+// A cache file holding one result and one selection fetched age ago
+void writeAged(const fs::path &path, std::chrono::seconds age)
+{
+    std::int64_t fetched = std::chrono::duration_cast<std::chrono::seconds>(
+                               std::chrono::system_clock::now().time_since_epoch() - age)
+                               .count();
+    nlohmann::json entry = {{"fetched", fetched},
+                            {"papers", nlohmann::json::array({paperToJson(samplePaper())})}};
+    nlohmann::json json = {{"version", 1},
+                           {"results", {{std::string("CrossRef\x1f") + "old query", entry}}},
+                           {"selections", {{"old reference", entry}}}};
+    std::vector<std::uint8_t> bytes = nlohmann::json::to_msgpack(json);
+    std::ofstream(path, std::ios::binary)
+        .write(reinterpret_cast<const char *>(bytes.data()),
+               static_cast<std::streamsize>(bytes.size()));
+}
+
+void testTtlAndRefresh(const fs::path &root)
+{
+    fs::path path = root / "aged.msgpack";
+    writeAged(path, std::chrono::seconds(100));
+    std::vector<PaperInfo> papers;
+    PaperInfo selected;
+
+    {
+        CitationCache stale(cacheAt(path, std::chrono::seconds(10)));
+        CHECK_EQ(stale.size(), size_t{2});
+        CHECK(!stale.lookup("CrossRef", "old query", papers));
+        CHECK(!stale.lookupSelection("old reference", selected));
+    }
+    {
+        CitationCache fresh(cacheAt(path, std::chrono::seconds(1000)));
+        CHECK(fresh.lookup("CrossRef", "old query", papers));
+        CHECK(fresh.lookupSelection("old reference", selected));
+    }
+    {
+        // A TTL of zero keeps entries forever
+        CitationCache forever(cacheAt(path, std::chrono::seconds(0)));
+        CHECK(forever.lookup("CrossRef", "old query", papers));
+    }
+
+    // --refresh-cache ignores what is stored, but still records fresh results
+    {
+        CacheOptions options = cacheAt(path);
+        options.refresh = true;
+        CitationCache refresh(options);
+        CHECK(!refresh.lookup("CrossRef", "old query", papers));
+        refresh.store("CrossRef", "new query", {samplePaper()});
+        CHECK(!refresh.lookup("CrossRef", "new query", papers));
+    }
+    CitationCache after(cacheAt(path));
+    CHECK(after.lookup("CrossRef", "new query", papers));
+}
+
+void testDamagedAndDisabled(const fs::path &root)
+{
+    // A damaged file is ignored, and replaced on the next save
+    fs::path path = root / "damaged.msgpack";
+    std::ofstream(path, std::ios::binary) << "\xc1 not msgpack";
+    {
+        CitationCache cache(cacheAt(path));
+        CHECK_EQ(cache.size(), size_t{0});
+        cache.store("CrossRef", "query", {samplePaper()});
+    }
+    std::vector<PaperInfo> papers;
+    CHECK(CitationCache(cacheAt(path)).lookup("CrossRef", "query", papers));
+
+    // A path that is a directory is not read, and the save that cannot
+    // replace it reports it
+    fs::path blocked = root / "blocked.msgpack";
+    fs::create_directories(blocked / "child");
+    {
+        CitationCache cache(cacheAt(blocked));
+        cache.store("CrossRef", "query", {samplePaper()});
+        CHECK(!cache.save());
+        // Saved again on destruction, once it can be
+        fs::remove_all(blocked);
+    }
+    CHECK(CitationCache(cacheAt(blocked)).lookup("CrossRef", "query", papers));
+
+    // Without a path nothing is stored or written
+    CitationCache disabled(CacheOptions{""});
+    CHECK(!disabled.enabled());
+    disabled.store("CrossRef", "query", {samplePaper()});
+    CHECK(!disabled.lookup("CrossRef", "query", papers));
+    CHECK(disabled.save());
+}
+
+const char *const kDocument = "As shown in [^1] and [^2].\n\n"
+                              "[^1]: Vaswani, Shazeer. Attention is all you need. 2017.\n"
+                              "[^2]: LeCun, Bengio, Hinton. Deep learning. Nature 2015.\n";
+
+// A Scholar results page with the paper the query names
+test::HttpReply scholarPage(const std::string &target)
+{
+    std::string query = test::queryParameter(target, "q");
+    bool attention = query.find("Attention") != std::string::npos;
+    test::HttpReply reply;
+    reply.body = std::string(R"(<div class="gs_ri"><h3 class="gs_rt"><a href="x">)") +
+                 (attention ? "Attention is all you need" : "Deep learning") +
+                 R"(</a></h3><div class="gs_a">)" +
+                 (attention ? "A Vaswani, N Shazeer - Advances in neural information, 2017"
+                            : "Y LeCun, Y Bengio, G Hinton - Nature, 2015") +
+                 " - example.org</div></div>";
+    return reply;
+}
+
+std::string readFile(const fs::path &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+void testUnchangedRerun(const fs::path &root)
+{
+    test::LoopbackHttpServer server(scholarPage);
+    CHECK(server.start());
+
+    ConverterOptions options;
+    options.citationBaseUrl = server.baseUrl();
+    options.citationCachePath = (root / "rerun.msgpack").string();
+    options.bibliographyPath = (root / "rerun.bib").string();
+    options.promptCitations = false;
+
+    auto convert = [&options](bool refresh)
+    {
+        ConverterOptions runOptions = options;
+        runOptions.refreshCitationCache = refresh;
+        MarkdownConverter converter(runOptions);
+        return converter.convertToLatex(kDocument);
+    };
+
+    std::string latex = convert(false);
+    CHECK_EQ(server.requests(), size_t{2});
+    std::string bibliography = readFile(options.bibliographyPath);
+    CHECK(bibliography.find("Attention is all you need") != std::string::npos);
+    CHECK(bibliography.find("Deep learning") != std::string::npos);
+
+    // The same document again: everything comes from the cache
+    server.resetCounts();
+    fs::remove(options.bibliographyPath);
+    CHECK_EQ(convert(false), latex);
+    CHECK_EQ(server.requests(), size_t{0});
+    CHECK_EQ(readFile(options.bibliographyPath), bibliography);
+
+    // Refreshing asks again
+    server.resetCounts();
+    CHECK_EQ(convert(true), latex);
+    CHECK_EQ(server.requests(), size_t{2});
+    CHECK_EQ(readFile(options.bibliographyPath), bibliography);
+}
+
+} // namespace
+
+int main()
+{
+    fs::path root = fs::temp_directory_path() / ("md2latex-cache-test-" + std::to_string(getpid()));
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    testRoundTrip(root);
+    testTtlAndRefresh(root);
+    testDamagedAndDisabled(root);
+    testUnchangedRerun(root);
+
+    fs::remove_all(root);
+    return test::result();
+}
+
+#else
+
+int main() { return 0; }
+
+#endif
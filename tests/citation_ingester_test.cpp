@@ -0,0 +1,131 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include "citation_ingester.h"
+#include "citation_library.h"
+#include "test_check.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+constexpr size_t kWorks = 40;
+
+std::string work(size_t i)
+{
+    return R"({"title": ["Ingested work number )" + std::to_string(i) +
+           R"( on topic q)" + std::to_string(i * 7919) +
+           R"("], "author": [{"given": "Ada", "family": "Writer)" + std::to_string(i) +
+           R"("}], "published": {"date-parts": [[)" + std::to_string(1990 + i % 30) +
+           R"(]]}, "reference": [{"title": ["Not this one"]}]})";
+}
+
+// kWorks works, with lines that are skipped mixed in: malformed JSON, a work
+// with neither title nor authors, and a blank line, which is not counted
+void writeDump(const fs::path &path, size_t first, size_t count, bool finalNewline)
+{
+    std::ofstream dump(path, std::ios::binary);
+    for (size_t i = first; i < first + count; ++i)
+    {
+        dump << work(i) << "\n";
+        if (i % 10 == 3)
+        {
+            dump << R"({"title": ["Cut off)" << "\n";
+        }
+        if (i % 10 == 6)
+        {
+            dump << R"({"DOI": "10.1/none", "published": {"date-parts": [[2000]]}})" << "\r\n";
+        }
+        if (i % 10 == 8)
+        {
+            dump << " \t\r\n";
+        }
+    }
+    if (finalNewline)
+    {
+        dump << "\n";
+    }
+}
+
+std::string firstTitle(const citation::LibrarySource &source, const std::string &query)
+{
+    auto result = source.search(query);
+    return result.papers.empty() ? std::string() : result.papers.front().title;
+}
+
+void testChunkBoundaries(const fs::path &root)
+{
+    std::vector<std::string> dumps = {(root / "first.jsonl").string(),
+                                      (root / "second.jsonl").string()};
+    writeDump(dumps[0], 0, kWorks / 2, true);
+    // The last line of a dump may lack its line end
+    writeDump(dumps[1], kWorks / 2, kWorks / 2, false);
+
+    // Chunks far smaller than a line, so that every chunk boundary falls
+    // inside a work, and the default of one chunk per dump
+    for (size_t chunkBytes : {size_t{1}, size_t{61}, size_t{200}, CitationIngester::kChunkBytes})
+    {
+        std::string store = (root / ("works-" + std::to_string(chunkBytes) + ".idx")).string();
+        CitationIngester ingester(3, chunkBytes);
+        CHECK(ingester.run(dumps, store));
+        CHECK(ingester.error().empty());
+
+        const IngestSummary &summary = ingester.summary();
+        CHECK_EQ(summary.files, size_t{2});
+        CHECK_EQ(summary.records, kWorks);
+        CHECK_EQ(summary.skipped, size_t{8});
+        CHECK_EQ(summary.inputBytes, fs::file_size(dumps[0]) + fs::file_size(dumps[1]));
+        CHECK_EQ(summary.storeBytes, fs::file_size(store));
+
+        // Every work is whole and can be found
+        citation::LibrarySource source({}, {store});
+        for (size_t i : {size_t{0}, size_t{13}, size_t{20}, kWorks - 1})
+        {
+            std::string title = "Ingested work number " + std::to_string(i) + " on topic q" +
+                                std::to_string(i * 7919);
+            CHECK_EQ(firstTitle(source, "Writer" + std::to_string(i) + ". " + title), title);
+        }
+        auto result = source.search("Writer13 ingested work topic q102947");
+        CHECK(!result.papers.empty());
+        if (!result.papers.empty())
+        {
+            CHECK(result.papers.front().authors == std::vector<std::string>{"Writer13, Ada"});
+            CHECK_EQ(result.papers.front().year, std::string("2003"));
+        }
+    }
+}
+
+void testMissingDump(const fs::path &root)
+{
+    CitationIngester ingester(1);
+    std::string store = (root / "never.idx").string();
+    CHECK(!ingester.run({(root / "missing.jsonl").string()}, store));
+    CHECK(!ingester.error().empty());
+    CHECK(!fs::exists(store));
+}
+
+} // namespace
+
+int main()
+{
+    std::string name = "md2latex-ingester-test";
+#if defined(__unix__) || defined(__APPLE__)
+    name += "-" + std::to_string(getpid());
+#endif
+    fs::path root = fs::temp_directory_path() / name;
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    testChunkBoundaries(root);
+    testMissingDump(root);
+
+    fs::remove_all(root);
+    return test::result();
+}
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include "citation_library.h"
+#include "test_check.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+using citation::BibParser;
+using citation::IndexStamp;
+using citation::LibraryIndex;
+using citation::LibrarySource;
+using citation::PaperInfo;
+
+const char *const kLibrary = R"(@string{nips = "Advances in Neural " #
+                "Information Processing Systems"}
+@STRING(pub = {Curran})
+@comment{Not an entry: @article{fake, title = {Fake}}}
+
+@inproceedings{vaswani2017,
+  title = {Attention Is {All} You
+           Need},
+  author = "Vaswani, Ashish and Shazeer, Noam",
+  booktitle = nips,
+  publisher = pub # " Associates",
+  month = may,
+  number = dec,
+  year = 2017,
+}
+
+@Book(barnes,
+  title = "Selling {"}Books{"}",
+  author = {{Barnes and Noble} and Smith, John AND Doe, Jane},
+  year = {1999}, edition = {Second}
+)
+
+@article{broken, title = {Kept Title}, = {no name}, junk, year = 2001}
+@article{open, title = {Left Open
+@article{next, title = {After the Open One}, pages = 1 # "--" # 9}
+)";
+
+PaperInfo findKey(const std::vector<PaperInfo> &papers, const std::string &key)
+{
+    for (const PaperInfo &paper : papers)
+    {
+        if (paper.citation_key == key)
+        {
+            return paper;
+        }
+    }
+    return {};
+}
+
+void testBibParser()
+{
+    std::vector<PaperInfo> papers = BibParser(kLibrary).parse();
+    CHECK_EQ(papers.size(), size_t{5});
+
+    // @string macros, '#' concatenation and month names are expanded
+    PaperInfo vaswani = findKey(papers, "vaswani2017");
+    CHECK_EQ(vaswani.title, std::string("Attention Is {All} You Need"));
+    CHECK(vaswani.authors == (std::vector<std::string>{"Vaswani, Ashish", "Shazeer, Noam"}));
+    CHECK_EQ(vaswani.journal, std::string("Advances in Neural Information Processing Systems"));
+    CHECK_EQ(vaswani.book_title, vaswani.journal);
+    CHECK_EQ(vaswani.publisher, std::string("Curran Associates"));
+    CHECK_EQ(vaswani.issue, std::string("12"));
+    CHECK_EQ(vaswani.year, std::string("2017"));
+    CHECK_EQ(vaswani.type, std::string("article"));
+
+    // "and" inside braces does not split a name; "AND" does
+    PaperInfo barnes = findKey(papers, "barnes");
+    CHECK_EQ(barnes.type, std::string("book"));
+    CHECK_EQ(barnes.title, std::string("Selling {\"}Books{\"}"));
+    CHECK(barnes.authors ==
+          (std::vector<std::string>{"{Barnes and Noble}", "Smith, John", "Doe, Jane"}));
+    CHECK_EQ(barnes.edition, std::string("Second"));
+    CHECK(barnes.journal.empty());
+
+    // Malformed fields are skipped; an entry left open ends at the next one
+    PaperInfo broken = findKey(papers, "broken");
+    CHECK_EQ(broken.title, std::string("Kept Title"));
+    CHECK_EQ(broken.year, std::string("2001"));
+    CHECK_EQ(findKey(papers, "open").title, std::string("Left Open"));
+    PaperInfo next = findKey(papers, "next");
+    CHECK_EQ(next.title, std::string("After the Open One"));
+    CHECK_EQ(next.pages, std::string("1--9"));
+    CHECK(findKey(papers, "fake").title.empty());
+}
+
+std::string buildIndex(const std::vector<PaperInfo> &papers, IndexStamp stamp = {})
+{
+    std::vector<LibraryIndex::Batch> batches(1);
+    for (const PaperInfo &paper : papers)
+    {
+        batches[0].add(paper);
+    }
+    batches[0].finish();
+    return LibraryIndex::build(batches, stamp);
+}
+
+void testIndexSearch()
+{
+    std::vector<PaperInfo> papers = BibParser(kLibrary).parse();
+    LibraryIndex index;
+    CHECK(index.load(buildIndex(papers, {42, 7})));
+    CHECK_EQ(index.size(), papers.size());
+    CHECK(index.stamp() == (IndexStamp{42, 7}));
+
+    auto matches = index.search(LibraryIndex::tokenize("Vaswani: attention is all you need"), 3);
+    CHECK(!matches.empty());
+    if (!matches.empty())
+    {
+        PaperInfo found = index.entry(matches.front().entry);
+        CHECK_EQ(found.citation_key, std::string("vaswani2017"));
+        CHECK(found.authors == papers[0].authors);
+        CHECK_EQ(found.publisher, std::string("Curran Associates"));
+    }
+    CHECK(index.search(LibraryIndex::tokenize("unrelated words entirely"), 3).empty());
+    CHECK(index.entry(1000).title.empty());
+}
+
+// Offsets of header fields; see LibraryIndex::Header
+constexpr size_t kVersionOffset = 8;
+constexpr size_t kByteOrderOffset = 12;
+constexpr size_t kEntryTableOffset = 48;
+
+void testValidate()
+{
+    const std::string bytes = buildIndex(BibParser(kLibrary).parse());
+    LibraryIndex index;
+    CHECK(index.load(bytes));
+
+    CHECK(!index.load(bytes.substr(0, 20)));
+    CHECK_EQ(index.error(), std::string("Library index is truncated"));
+    CHECK_EQ(index.size(), size_t{0});
+
+    std::string foreign = bytes;
+    CHECK(!index.load("NOTANIDX" + foreign.substr(8)));
+    CHECK_EQ(index.error(), std::string("Not a library index of this version"));
+
+    // Built on a machine of the other byte order: every number is swapped
+    for (size_t offset : {kVersionOffset, kByteOrderOffset})
+    {
+        std::reverse(foreign.begin() + offset, foreign.begin() + offset + 4);
+    }
+    CHECK(!index.load(foreign));
+    CHECK_EQ(index.error(), std::string("Not a library index of this version"));
+
+    std::string damaged = bytes;
+    damaged.resize(bytes.size() - 1);
+    CHECK(!index.load(damaged));
+    CHECK_EQ(index.error(), std::string("Library index is damaged"));
+
+    damaged = bytes;
+    std::uint64_t offset = bytes.size() + 1;
+    std::memcpy(&damaged[kEntryTableOffset], &offset, sizeof(offset));
+    CHECK(!index.load(damaged));
+    CHECK_EQ(index.error(), std::string("Library index is damaged"));
+
+    CHECK(index.load(bytes));
+    CHECK(index.error().empty());
+}
+
+IndexStamp stampOf(const fs::path &path)
+{
+    return {static_cast<std::int64_t>(fs::file_size(path)),
+            static_cast<std::int64_t>(fs::last_write_time(path).time_since_epoch().count())};
+}
+
+std::string firstTitle(const LibrarySource &source, const std::string &query)
+{
+    auto result = source.search(query);
+    return result.papers.empty() ? std::string() : result.papers.front().title;
+}
+
+void testIndexFile(const fs::path &root)
+{
+    fs::path bib = root / "library.bib";
+    fs::path idx = root / "library.bib.idx";
+    std::ofstream(bib) << "@article{a, title = {Alpha Particles}, author = {Rutherford, E}}\n";
+
+    // Indexed on first use into <file>.idx, stamped with the file
+    CHECK_EQ(firstTitle(LibrarySource({bib.string()}), "Rutherford alpha particles"),
+             std::string("Alpha Particles"));
+    LibraryIndex index;
+    CHECK(index.open(idx.string()));
+    CHECK(index.stamp() == stampOf(bib));
+
+    // An index whose stamp matches is used as it is, not rebuilt
+    PaperInfo planted;
+    planted.title = "Planted Alpha";
+    planted.authors = {"Rutherford, E"};
+    CHECK(LibraryIndex::save(buildIndex({planted}, stampOf(bib)), idx.string()));
+    CHECK_EQ(firstTitle(LibrarySource({bib.string()}), "Rutherford alpha particles"),
+             std::string("Planted Alpha"));
+
+    // Same size, later modification time: stale, so rebuilt
+    std::ofstream(bib) << "@article{a, title = {Alpha Particlez}, author = {Rutherford, E}}\n";
+    fs::last_write_time(bib, fs::last_write_time(bib) + std::chrono::seconds(10));
+    CHECK_EQ(firstTitle(LibrarySource({bib.string()}), "Rutherford alpha particlez"),
+             std::string("Alpha Particlez"));
+    CHECK(index.open(idx.string()));
+    CHECK(index.stamp() == stampOf(bib));
+
+    // A damaged index is rebuilt too
+    std::ofstream(idx, std::ios::binary | std::ios::trunc) << "MD2LBIBX garbage";
+    CHECK_EQ(firstTitle(LibrarySource({bib.string()}), "Rutherford alpha particlez"),
+             std::string("Alpha Particlez"));
+    CHECK(index.open(idx.string()));
+    CHECK_EQ(index.size(), size_t{1});
+
+    // A missing library is reported and searched as empty
+    CHECK(LibrarySource({(root / "missing.bib").string()}).search("alpha").papers.empty());
+}
+
+} // namespace
+
+int main()
+{
+    std::string name = "md2latex-library-test";
+#if defined(__unix__) || defined(__APPLE__)
+    name += "-" + std::to_string(getpid());
+#endif
+    fs::path root = fs::temp_directory_path() / name;
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    testBibParser();
+    testIndexSearch();
+    testValidate();
+    testIndexFile(root);
+
+    fs::remove_all(root);
+    return test::result();
+}
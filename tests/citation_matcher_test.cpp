@@ -0,0 +1,111 @@
+#include <string>
+#include <vector>
+
+#include "citation_matcher.h"
+#include "test_check.h"
+
+namespace
+{
+
+using citation::CitationMatcher;
+using citation::PaperInfo;
+
+const char *const kAttention = "Vaswani et al. Attention is all you need. NeurIPS 2017.";
+const char *const kDeepLearning = "LeCun, Bengio, Hinton. Deep learning. Nature 2015.";
+
+PaperInfo paper(std::string title, std::vector<std::string> authors = {}, std::string year = {},
+                std::string journal = {})
+{
+    PaperInfo info;
+    info.title = std::move(title);
+    info.authors = std::move(authors);
+    info.year = std::move(year);
+    info.journal = std::move(journal);
+    return info;
+}
+
+const PaperInfo kTransformer =
+    paper("Attention is all you need", {"Vaswani, Ashish", "Shazeer, Noam"}, "2017",
+          "Advances in Neural Information Processing Systems");
+const PaperInfo kNature =
+    paper("Deep learning", {"LeCun, Yann", "Bengio, Yoshua", "Hinton, Geoffrey"}, "2015",
+          "Nature");
+
+void testCorrectCandidatesAreAccepted()
+{
+    CitationMatcher matcher;
+    CHECK(matcher.score(kAttention, kTransformer) >= matcher.getThreshold());
+    CHECK(matcher.score(kDeepLearning, kNature) >= matcher.getThreshold());
+    CHECK(matcher.score("Vaswani et al. Attention is all you need. 2017.", kTransformer) > 0.99);
+
+    // Titles copied from BibTeX keep their case braces
+    PaperInfo braced = kNature;
+    braced.title = "Deep {L}earning";
+    CHECK(matcher.score(kDeepLearning, braced) > 0.99);
+
+    // Spelling differences are tolerated through trigrams
+    CHECK(matcher.score("Vaswani et al. Atention is all you need. 2017", kTransformer) >=
+          matcher.getThreshold());
+}
+
+void testShortTitlesAreNotAccepted()
+{
+    // A title found inside the reference is not enough when it is a small
+    // part of it, and missing authors and year earn nothing
+    CitationMatcher matcher;
+    CHECK(matcher.score(kAttention, paper("Attention")) < matcher.getThreshold());
+    CHECK(matcher.score(kDeepLearning, paper("Learning")) < matcher.getThreshold());
+    CHECK(matcher.score(kDeepLearning, paper("Deep")) < matcher.getThreshold());
+    CHECK(matcher.score(kAttention, paper("Attention", {}, "2017")) < matcher.getThreshold());
+}
+
+void testMissingFieldsEarnNothing()
+{
+    // The full title alone stays below the threshold
+    CitationMatcher matcher;
+    PaperInfo titleOnly = paper("Attention is all you need");
+    CHECK(matcher.score("Attention is all you need", titleOnly) < matcher.getThreshold());
+    CHECK(matcher.score("Attention is all you need", titleOnly) >
+          matcher.score("Attention is all you need", paper("Attention")));
+
+    // A different year, or authors not named, count against a candidate
+    PaperInfo wrongYear = kTransformer;
+    wrongYear.year = "2019";
+    CHECK(matcher.score(kAttention, wrongYear) < matcher.score(kAttention, kTransformer));
+    PaperInfo otherAuthors = kTransformer;
+    otherAuthors.authors = {"Smith, John"};
+    CHECK(matcher.score(kAttention, otherAuthors) < matcher.score(kAttention, kTransformer));
+
+    CHECK_EQ(matcher.score(kAttention, paper("")), 0.0);
+}
+
+void testRanking()
+{
+    CitationMatcher matcher;
+    std::vector<PaperInfo> candidates = {paper("Attention"), paper("Learning"), kTransformer,
+                                         paper("Attention is all you need", {}, "2017")};
+    std::vector<citation::RankedCandidate> ranked = matcher.rank(kAttention, candidates);
+    CHECK_EQ(ranked.size(), candidates.size());
+    CHECK_EQ(ranked[0].index, size_t{2});
+    CHECK_EQ(ranked[1].index, size_t{3});
+    for (size_t i = 1; i < ranked.size(); ++i)
+    {
+        CHECK(ranked[i - 1].score >= ranked[i].score);
+    }
+    CHECK_EQ(ranked.back().index, size_t{1});
+
+    // Equal scores keep their original order
+    ranked = matcher.rank(kAttention, {paper("Other"), paper("Other")});
+    CHECK_EQ(ranked[0].index, size_t{0});
+}
+
+} // namespace
+
+int main()
+{
+    testCorrectCandidatesAreAccepted();
+    testShortTitlesAreNotAccepted();
+    testMissingFieldsEarnNothing();
+    testRanking();
+    return test::result();
+}
@@ -0,0 +1,240 @@
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "citation_cache.h"
+#include "paper_cition_api.h"
+#include "test_check.h"
+
+namespace
+{
+
+using citation::CrossRefAPI;
+using citation::CrossRefSaxHandler;
+using citation::PaperInfo;
+using citation::QueryResult;
+using citation::ScholarHtmlParser;
+
+// A /works response whose items carry the subtrees the handler must skip:
+// reference lists and licenses with titles, authors, URLs and dates of their
+// own, and dates other than the publication date
+const char *const kWorks = R"({
+  "status": "ok",
+  "message-type": "work-list",
+  "message": {
+    "facets": {"title": ["Facet"]},
+    "total-results": 2,
+    "items": [
+      {
+        "reference": [
+          {"key": "r1", "title": ["Cited Work"], "DOI": "10.1/cited",
+           "author": [{"family": "Cited"}], "published": {"date-parts": [[1990]]}}
+        ],
+        "license": [{"URL": "https://license.example", "start": {"date-parts": [[2000, 1, 1]]}}],
+        "issued": {"date-parts": [[1999]]},
+        "title": ["Attention Is All You Need", "A Subtitle"],
+        "author": [
+          {"given": "Ashish", "family": "Vaswani", "affiliation": [{"name": "Google"}]},
+          {"family": "Shazeer"},
+          {"name": "Some Consortium"}
+        ],
+        "container-title": ["Advances in Neural Information Processing Systems"],
+        "published": {"date-parts": [[2017, 12, 4], [2018]]},
+        "volume": "30",
+        "page": "5998-6008",
+        "DOI": "10.5555/3295222",
+        "URL": "https://doi.org/10.5555/3295222",
+        "publisher": "Curran Associates",
+        "score": 12.5,
+        "is-referenced-by-count": 100000
+      },
+      {
+        "title": ["Untitled Date"],
+        "DOI": "10.1000/xyz123",
+        "reference-count": 0
+      }
+    ]
+  }
+})";
+
+std::vector<PaperInfo> parseWorks(const std::string &json, bool single_work = false)
+{
+    std::vector<PaperInfo> papers;
+    CrossRefSaxHandler handler(papers, single_work);
+    CHECK(nlohmann::json::sax_parse(json, &handler));
+    CHECK(handler.getError().empty());
+    return papers;
+}
+
+void testSkippedSubtrees()
+{
+    std::vector<PaperInfo> papers = parseWorks(kWorks);
+    CHECK_EQ(papers.size(), size_t{2});
+    if (papers.size() != 2)
+    {
+        return;
+    }
+
+    const PaperInfo &paper = papers[0];
+    CHECK_EQ(paper.title, std::string("Attention Is All You Need"));
+    CHECK(paper.authors == (std::vector<std::string>{"Vaswani, Ashish", "Shazeer"}));
+    CHECK_EQ(paper.journal, std::string("Advances in Neural Information Processing Systems"));
+    CHECK_EQ(paper.volume, std::string("30"));
+    CHECK_EQ(paper.pages, std::string("5998-6008"));
+    CHECK_EQ(paper.doi, std::string("10.5555/3295222"));
+    CHECK_EQ(paper.url, std::string("https://doi.org/10.5555/3295222"));
+    CHECK_EQ(paper.publisher, std::string("Curran Associates"));
+    CHECK_EQ(paper.citation_key, std::string("Vaswani2017"));
+
+    // Without authors or a year the key falls back to the DOI
+    CHECK_EQ(papers[1].title, std::string("Untitled Date"));
+    CHECK(papers[1].year.empty());
+    CHECK(papers[1].authors.empty());
+    CHECK_EQ(papers[1].citation_key, std::string("doixyz123"));
+}
+
+void testPublishedYear()
+{
+    // The year is the first part of the first published date only
+    std::vector<PaperInfo> papers = parseWorks(kWorks);
+    CHECK(!papers.empty() && papers[0].year == "2017");
+
+    papers = parseWorks(R"({"message": {"items": [
+        {"title": ["Late"], "published": {"date-parts": [[2021]], "note": [[1900]]}},
+        {"title": ["Text year"], "published": {"date-parts": [["2020"]]}}
+    ]}})");
+    CHECK_EQ(papers.size(), size_t{2});
+    CHECK(papers.size() == 2 && papers[0].year == "2021");
+    CHECK(papers.size() == 2 && papers[1].year.empty());
+
+    // One work on its own, as in a line of a metadata dump
+    papers = parseWorks(R"({"title": ["Alone"], "published": {"date-parts": [[2001, 5]]}})", true);
+    CHECK_EQ(papers.size(), size_t{1});
+    CHECK(papers.size() == 1 && papers[0].title == "Alone" && papers[0].year == "2001");
+}
+
+void testMalformedInput()
+{
+    CrossRefAPI api;
+    for (const char *body : {R"({"message": {"items": [{"title": ["Cut off)", "not json",
+                             "", R"({"message": {"items": [{"title": ["A"]}]}} trailing)"})
+    {
+        QueryResult result = api.parse(body);
+        CHECK(!result.success);
+        CHECK(result.papers.empty());
+        CHECK(result.error_message.compare(0, 25, "Failed to parse response:") == 0);
+    }
+
+    // Valid JSON without items is a successful lookup that found nothing
+    QueryResult result = api.parse(R"({"status": "ok", "message": {"total-results": 0}})");
+    CHECK(result.success);
+    CHECK(result.papers.empty());
+}
+
+// Shows what was set on a source through a CachedSource wrapping it
+class ProbeSource : public CrossRefAPI
+{
+  public:
+    citation::CurlSession *usedSession() const { return session; }
+};
+
+void testCachedSourceForwards()
+{
+    citation::CacheOptions options;
+    options.path.clear();
+    citation::CitationCache cache(options);
+    auto probe = std::make_unique<ProbeSource>();
+    ProbeSource *inner = probe.get();
+    citation::CachedSource source(std::move(probe), cache);
+
+    const std::string body = R"({"message": {"items": [{"title": ["Kept"]}]}})";
+    CHECK(source.parse(body).raw_response.empty());
+    source.keepRawResponse(true);
+    QueryResult result = source.parse(body);
+    CHECK(result.success);
+    CHECK_EQ(result.raw_response, body);
+
+    citation::CurlSession session;
+    source.useSession(&session);
+    CHECK(inner->usedSession() == &session);
+}
+
+// Results whose tags, attributes and text break across lines in different
+// places, with entities, nested divs, and a script and a comment holding
+// markup that must not be taken for results
+const char *const kScholarPage = R"(<html><head><style>.gs_ri { x: "<div>" }</style>
+<script>var s = '<div class="gs_ri"><h3 class="gs_rt">Fake</h3></div>';</script></head>
+<body><!-- <div class="gs_ri"><h3 class="gs_rt">Commented</h3></div> -->
+<div class="gs_r gs_or gs_scl"><div
+  class="gs_ri"><h3 class="gs_rt"><span class="gs_ctc"><span class="gs_ct1">[PDF]</span></span> <a
+  href="https://example.org/a?x=1&amp;y=2>"
+  id="abc">Attention is
+  all you &nbsp;need</a></h3>
+<div class="gs_a"><a href="/citations?user=1">A
+ Vaswani</a>, N Shazeer,
+ N Parmar&#8230; - Advances in neural information processing systems, 2017 - neurips.cc</div>
+<div class="gs_rs">A snippet from 1999</div><div class="gs_fl"><a>Cited by 100</a></div></div></div>
+<div class='gs_r'><div class=gs_ri>
+<h3
+ class="gs_rt"
+ ><a href="x">Pride &amp; prejudice: &quot;a&quot; study&#x27;s</a
+ ></h3><div
+ class="gs_a">J Austen -
+ Oxford, 1998 - books.example.com</div></div></div>
+<div class="gs_ri"><h3 class="gs_rt"><a href="y">Deep
+learning</a></h3><div class="gs_a">Y LeCun, Y Bengio, G Hinton - nature, 2015 - nature.c)";
+
+void testScholarLayouts()
+{
+    std::vector<PaperInfo> papers = ScholarHtmlParser::parse(kScholarPage);
+    CHECK_EQ(papers.size(), size_t{3});
+    if (papers.size() != 3)
+    {
+        return;
+    }
+
+    CHECK_EQ(papers[0].title, std::string("Attention is all you need"));
+    CHECK(papers[0].authors == (std::vector<std::string>{"A Vaswani", "N Shazeer"}));
+    CHECK_EQ(papers[0].year, std::string("2017"));
+
+    CHECK_EQ(papers[1].title, std::string("Pride & prejudice: \"a\" study's"));
+    CHECK(papers[1].authors == (std::vector<std::string>{"J Austen"}));
+    CHECK_EQ(papers[1].year, std::string("1998"));
+
+    // The page ends inside the byline of the last result
+    CHECK_EQ(papers[2].title, std::string("Deep learning"));
+    CHECK(papers[2].authors ==
+          (std::vector<std::string>{"Y LeCun", "Y Bengio", "G Hinton"}));
+    CHECK_EQ(papers[2].year, std::string("2015"));
+}
+
+void testScholarTruncated()
+{
+    // A result cut off in its title, or in a tag, has no title and is dropped
+    std::string first = R"(<div class="gs_ri"><h3 class="gs_rt">Kept</h3>)"
+                        R"(<div class="gs_a">B Writer - 2003</div></div>)";
+    for (const char *tail : {R"(<div class="gs_ri"><h3 class="gs_rt">Cut &am)",
+                             R"(<div class="gs_ri"><h3 class="gs)", "<div class=\"gs_ri",
+                             "<!-- <div class=\"gs_ri\">"})
+    {
+        std::vector<PaperInfo> papers = ScholarHtmlParser::parse(first + tail);
+        CHECK_EQ(papers.size(), size_t{1});
+        CHECK(!papers.empty() && papers[0].title == "Kept" && papers[0].year == "2003");
+    }
+    CHECK(ScholarHtmlParser::parse("").empty());
+    CHECK(ScholarHtmlParser::parse("<").empty());
+}
+
+} // namespace
+
+int main()
+{
+    testSkippedSubtrees();
+    testPublishedYear();
+    testMalformedInput();
+    testCachedSourceForwards();
+    testScholarLayouts();
+    testScholarTruncated();
+    return test::result();
+}
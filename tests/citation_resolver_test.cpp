@@ -0,0 +1,222 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_check.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include "citation_resolver.h"
+#include "loopback_http.h"
+
+// Runs ConcurrentResolver against a loopback stand-in for CrossRef and
+// Google Scholar that holds its answers back and reorders them
+
+namespace
+{
+
+using citation::ConcurrentResolver;
+using citation::CrossRefAPI;
+using citation::GoogleScholarAPI;
+using citation::QueryResult;
+using namespace std::chrono_literals;
+
+constexpr size_t kQueries = 9;
+
+std::vector<std::string> makeQueries(size_t count)
+{
+    std::vector<std::string> queries;
+    for (size_t i = 0; i < count; ++i)
+    {
+        queries.push_back("paper number " + std::to_string(i));
+    }
+    return queries;
+}
+
+// A paper titled after the query, in the format of the service asked; later
+// queries are answered sooner, so responses arrive out of order
+test::HttpReply answerWithTitle(const std::string &target)
+{
+    test::HttpReply reply;
+    std::string query;
+    if (target.compare(0, 7, "/works?") == 0)
+    {
+        query = test::queryParameter(target, "query");
+        reply.body = R"({"message":{"items":[{"title":[")" + query + R"("]}]}})";
+    }
+    else
+    {
+        query = test::queryParameter(target, "q");
+        reply.body = R"(<div class="gs_ri"><h3 class="gs_rt">)" + query +
+                     R"(</h3><div class="gs_a">A Author - Journal, 2020</div></div>)";
+    }
+    size_t number = std::stoul(query.substr(query.rfind(' ') + 1));
+    reply.delay = std::chrono::milliseconds(20 * (kQueries - number));
+    return reply;
+}
+
+std::string firstTitle(const QueryResult &result)
+{
+    return result.papers.empty() ? std::string() : result.papers.front().title;
+}
+
+void testOrderAndCap()
+{
+    test::LoopbackHttpServer server(answerWithTitle);
+    CHECK(server.start());
+    CrossRefAPI crossref(server.baseUrl());
+    GoogleScholarAPI scholar(server.baseUrl());
+    std::vector<std::string> queries = makeQueries(kQueries);
+
+    // Without and with a session, whose handles are reused across queries
+    citation::CurlSession session;
+    for (citation::CurlSession *shared : {static_cast<citation::CurlSession *>(nullptr), &session})
+    {
+        server.resetCounts();
+        ConcurrentResolver resolver(3);
+        auto results = resolver.resolve({&crossref, &scholar}, queries, shared);
+
+        CHECK_EQ(server.requests(), 2 * kQueries);
+        CHECK(server.peakInFlight() <= 3);
+        // The requests did overlap
+        CHECK(server.peakInFlight() > 1);
+        CHECK_EQ(results.size(), kQueries);
+        for (size_t q = 0; q < results.size(); ++q)
+        {
+            CHECK_EQ(results[q].size(), size_t{2});
+            for (const QueryResult &result : results[q])
+            {
+                CHECK(result.success);
+                CHECK_EQ(firstTitle(result), queries[q]);
+            }
+        }
+        CHECK_EQ(results[4][1].papers.front().year, std::string("2020"));
+    }
+}
+
+void testFailedResponses()
+{
+    // Error statuses and unparsable bodies fail their own lookup only
+    test::LoopbackHttpServer server(
+        [](const std::string &target)
+        {
+            test::HttpReply reply = answerWithTitle(target);
+            std::string query = test::queryParameter(target, "query") +
+                                test::queryParameter(target, "q");
+            if (query == "paper number 1")
+            {
+                reply.status = 503;
+            }
+            else if (query == "paper number 2")
+            {
+                reply.body = "{\"message\":";
+            }
+            return reply;
+        });
+    CHECK(server.start());
+    CrossRefAPI crossref(server.baseUrl());
+    std::vector<std::string> queries = makeQueries(3);
+
+    auto results = ConcurrentResolver(2).resolve({&crossref}, queries);
+    CHECK(results[0][0].success);
+    CHECK_EQ(firstTitle(results[0][0]), queries[0]);
+    CHECK(!results[1][0].success);
+    CHECK(results[1][0].error_message.find("503") != std::string::npos);
+    CHECK(!results[2][0].success);
+    CHECK(results[2][0].error_message.find("Failed to parse") != std::string::npos);
+
+    // search() counts the failures instead of printing them
+    citation::PaperCitationAPI api(server.baseUrl());
+    size_t failed = 0;
+    auto papers = ConcurrentResolver(2).search(api, queries, &failed);
+    CHECK_EQ(papers.size(), size_t{3});
+    CHECK_EQ(failed, size_t{1});
+    CHECK(papers.size() == 3 && !papers[0].empty() && papers[1].empty());
+}
+
+void testDeadline()
+{
+    // Open lookups and those not started yet all fail once the deadline passes
+    test::LoopbackHttpServer server(
+        [](const std::string &)
+        {
+            test::HttpReply reply;
+            reply.delay = 10s;
+            return reply;
+        });
+    CHECK(server.start());
+    CrossRefAPI crossref(server.baseUrl());
+    std::vector<std::string> queries = makeQueries(3);
+
+    ConcurrentResolver resolver(1);
+    auto start = std::chrono::steady_clock::now();
+    resolver.setLimits(start + 200ms);
+    auto results = resolver.resolve({&crossref}, queries);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    CHECK(elapsed < 5s);
+    CHECK_EQ(server.requests(), size_t{1});
+    for (const auto &row : results)
+    {
+        CHECK(!row[0].success);
+        CHECK_EQ(row[0].error_message, std::string("deadline exceeded"));
+    }
+}
+
+void testCancel()
+{
+    test::LoopbackHttpServer server(
+        [](const std::string &)
+        {
+            test::HttpReply reply;
+            reply.delay = 10s;
+            return reply;
+        });
+    CHECK(server.start());
+    CrossRefAPI crossref(server.baseUrl());
+    GoogleScholarAPI scholar(server.baseUrl());
+    std::vector<std::string> queries = makeQueries(4);
+
+    ConcurrentResolver resolver(2);
+    std::atomic<bool> cancelled{false};
+    resolver.setLimits(std::chrono::steady_clock::time_point::max(), &cancelled);
+    std::thread canceller(
+        [&cancelled]
+        {
+            std::this_thread::sleep_for(150ms);
+            cancelled = true;
+        });
+    auto start = std::chrono::steady_clock::now();
+    auto results = resolver.resolve({&crossref, &scholar}, queries);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    canceller.join();
+
+    CHECK(elapsed < 5s);
+    CHECK(server.peakInFlight() <= 2);
+    for (const auto &row : results)
+    {
+        for (const QueryResult &result : row)
+        {
+            CHECK(!result.success);
+            CHECK_EQ(result.error_message, std::string("cancelled"));
+        }
+    }
+}
+
+} // namespace
+
+int main()
+{
+    testOrderAndCap();
+    testFailedResponses();
+    testDeadline();
+    testCancel();
+    return test::result();
+}
+
+#else
+
+int main() { return 0; }
+
+#endif
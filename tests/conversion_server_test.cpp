@@ -0,0 +1,380 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+
+#include "conversion_server.h"
+#include "latex_template.h"
+#include "test_check.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Talks both protocols to a ConversionServer over its Unix domain socket
+
+namespace
+{
+
+const char *const kMarkdown = "# Title\n\nSome *text* with 100% & more.\n";
+const char *const kCiting = "As shown in [^1].\n\n"
+                            "[^1]: Vaswani, Shazeer. Attention is all you need. 2017.\n";
+
+// BibTeX library the server matches references against
+std::string libraryPath;
+
+ConverterOptions serverOptions()
+{
+    ConverterOptions options;
+    options.citationCachePath.clear();
+    options.citationBaseUrl = "http://127.0.0.1:1";
+    options.bibLibraries = {libraryPath};
+    return options;
+}
+
+std::string expectedLatex(bool minimal)
+{
+    ConverterOptions options = serverOptions();
+    options.promptCitations = false;
+    if (minimal)
+    {
+        options.documentTemplate = LatexTemplate::minimal();
+    }
+    MarkdownConverter converter(options);
+    return converter.convertToLatex(kMarkdown);
+}
+
+class Client
+{
+  public:
+    explicit Client(const std::string &path)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ~Client()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+
+    bool connected() const { return fd >= 0; }
+
+    void send(const std::string &data)
+    {
+        size_t sent = 0;
+        while (fd >= 0 && sent < data.size())
+        {
+            ssize_t count = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (count <= 0)
+            {
+                return;
+            }
+            sent += static_cast<size_t>(count);
+        }
+    }
+
+    // Text up to and including delimiter; empty if the connection ends first
+    std::string readUntil(const std::string &delimiter)
+    {
+        size_t end;
+        while ((end = input.find(delimiter)) == std::string::npos)
+        {
+            if (!fill())
+            {
+                return {};
+            }
+        }
+        return take(end + delimiter.size());
+    }
+
+    std::string readBytes(size_t count)
+    {
+        while (input.size() < count)
+        {
+            if (!fill())
+            {
+                return {};
+            }
+        }
+        return take(count);
+    }
+
+    // Whether the server closes the connection with nothing more to read
+    bool closedByServer()
+    {
+        return input.empty() && !fill();
+    }
+
+    // A framed response: the parsed header and the body after it
+    nlohmann::json readFramed(std::string &body)
+    {
+        std::string line = readUntil("\n");
+        nlohmann::json header = nlohmann::json::parse(line, nullptr, false);
+        if (header.is_object() && header.contains("length"))
+        {
+            body = readBytes(header["length"].get<size_t>());
+        }
+        return header;
+    }
+
+    // An HTTP response: the status code and the body; -1 if there is none
+    int readHttp(std::string &body, std::string *head = nullptr)
+    {
+        std::string text = readUntil("\r\n\r\n");
+        if (text.compare(0, 9, "HTTP/1.1 ") != 0)
+        {
+            return -1;
+        }
+        size_t length = 0;
+        size_t field = text.find("Content-Length: ");
+        if (field != std::string::npos)
+        {
+            length = std::stoul(text.substr(field + 16));
+        }
+        body = readBytes(length);
+        if (head != nullptr)
+        {
+            *head = text;
+        }
+        return std::stoi(text.substr(9, 3));
+    }
+
+  private:
+    bool fill()
+    {
+        // Wait at most a few seconds, so a broken server fails the test
+        // instead of hanging it
+        pollfd waiting{fd, POLLIN, 0};
+        if (fd < 0 || poll(&waiting, 1, 5000) <= 0)
+        {
+            return false;
+        }
+        char buffer[4096];
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        if (count <= 0)
+        {
+            return false;
+        }
+        input.append(buffer, static_cast<size_t>(count));
+        return true;
+    }
+
+    std::string take(size_t count)
+    {
+        std::string taken = input.substr(0, count);
+        input.erase(0, count);
+        return taken;
+    }
+
+    int fd{-1};
+    std::string input;
+};
+
+std::string framed(const std::string &header, const std::string &markdown)
+{
+    return header + "\n" + markdown;
+}
+
+std::string lengthHeader(const std::string &markdown, const std::string &extra = {})
+{
+    return "{\"length\":" + std::to_string(markdown.size()) + extra + "}";
+}
+
+void testFramed(const std::string &socketPath)
+{
+    std::string body;
+    {
+        Client client(socketPath);
+        CHECK(client.connected());
+        // Two pipelined requests are answered in order on one connection
+        client.send(framed(lengthHeader(kMarkdown), kMarkdown) +
+                    framed(lengthHeader(kMarkdown, ",\"template\":\"minimal\""), kMarkdown));
+        nlohmann::json header = client.readFramed(body);
+        CHECK_EQ(header.value("status", ""), std::string("ok"));
+        CHECK(body == expectedLatex(false));
+        header = client.readFramed(body);
+        CHECK_EQ(header.value("status", ""), std::string("ok"));
+        CHECK(body == expectedLatex(true));
+    }
+    {
+        // An unknown template is an error for that request only
+        Client client(socketPath);
+        client.send(framed(lengthHeader("abc", ",\"template\":\"fancy\""), "abc"));
+        nlohmann::json header = client.readFramed(body);
+        CHECK_EQ(header.value("status", ""), std::string("error"));
+        CHECK_EQ(header.value("error", ""), std::string("unknown template: fancy"));
+        CHECK_EQ(header.value("length", -1), 0);
+        client.send(framed(lengthHeader(kMarkdown), kMarkdown));
+        header = client.readFramed(body);
+        CHECK_EQ(header.value("status", ""), std::string("ok"));
+    }
+    {
+        // A request whose deadline has passed is not converted
+        Client client(socketPath);
+        client.send(framed(lengthHeader(kMarkdown, ",\"timeout_ms\":0"), kMarkdown));
+        nlohmann::json header = client.readFramed(body);
+        CHECK_EQ(header.value("error", ""), std::string("deadline exceeded"));
+    }
+    const std::pair<std::string, std::string> malformed[] = {
+        {"{not json}\n", "invalid request header"},
+        {"{\"template\":\"minimal\"}\n", "request header without length"},
+        {"{\"length\":-5}\n", "request header without length"},
+        {"{\"length\":999999999999}\n", "document too large"},
+        {"{\"length\":1" + std::string(20000, ' '), "header line too long"}};
+    for (const auto &[request, error] : malformed)
+    {
+        // The stream cannot be resynchronised, so the connection is closed
+        Client client(socketPath);
+        client.send(request);
+        nlohmann::json header = client.readFramed(body);
+        CHECK_EQ(header.value("error", ""), error);
+        CHECK(client.closedByServer());
+    }
+}
+
+void testBibliography(const std::string &socketPath)
+{
+    // The BibTeX comes back with the response instead of going to a file
+    std::string body;
+    Client client(socketPath);
+    client.send(framed(lengthHeader(kCiting), kCiting));
+    nlohmann::json header = client.readFramed(body);
+    CHECK_EQ(header.value("status", ""), std::string("ok"));
+    CHECK(body.find("\\bibliography{references}") != std::string::npos);
+    std::string bibliography = header.value("bibliography", "");
+    CHECK(bibliography.find("Attention Is All You Need") != std::string::npos);
+
+    // A document without references has none
+    client.send(framed(lengthHeader(kMarkdown), kMarkdown));
+    header = client.readFramed(body);
+    CHECK(!header.contains("bibliography"));
+
+    std::string head;
+    client.send("POST /convert?output=bibliography HTTP/1.1\r\nContent-Length: " +
+                std::to_string(std::string(kCiting).size()) + "\r\n\r\n" + kCiting);
+    CHECK_EQ(client.readHttp(body, &head), 200);
+    CHECK(head.find("Content-Type: application/x-bibtex\r\n") != std::string::npos);
+    CHECK_EQ(body, bibliography);
+}
+
+void testHttp(const std::string &socketPath)
+{
+    std::string body;
+    std::string head;
+    {
+        Client client(socketPath);
+        client.send("GET /health HTTP/1.1\r\nHost: x\r\n\r\n");
+        CHECK_EQ(client.readHttp(body), 200);
+        CHECK_EQ(body, std::string("ok\n"));
+
+        // Kept alive: query parameters select the template
+        client.send("POST /convert?template=minimal&timeout_ms=60000 HTTP/1.1\r\n"
+                    "content-length: " +
+                    std::to_string(std::string(kMarkdown).size()) + "\r\n\r\n" + kMarkdown);
+        CHECK_EQ(client.readHttp(body, &head), 200);
+        CHECK(head.find("Content-Type: application/x-tex\r\n") != std::string::npos);
+        CHECK(body == expectedLatex(true));
+    }
+    {
+        // Expect: 100-continue gets an interim response before the body
+        Client client(socketPath);
+        client.send("POST /convert HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: " +
+                    std::to_string(std::string(kMarkdown).size()) + "\r\n\r\n");
+        CHECK_EQ(client.readUntil("\r\n\r\n"), std::string("HTTP/1.1 100 Continue\r\n\r\n"));
+        client.send(kMarkdown);
+        CHECK_EQ(client.readHttp(body), 200);
+        CHECK(body == expectedLatex(false));
+    }
+    {
+        // HTTP/1.0 and Connection: close end the connection after the answer
+        Client client(socketPath);
+        client.send("GET /health HTTP/1.0\r\n\r\n");
+        CHECK_EQ(client.readHttp(body, &head), 200);
+        CHECK(head.find("Connection: close\r\n") != std::string::npos);
+        CHECK(client.closedByServer());
+    }
+    const std::pair<std::string, int> rejected[] = {
+        {"POST /nowhere HTTP/1.1\r\nContent-Length: 0\r\n\r\n", 404},
+        {"GET /convert HTTP/1.1\r\n\r\n", 405},
+        {"POST /health HTTP/1.1\r\nContent-Length: 0\r\n\r\n", 405},
+        {"POST /convert?template=fancy HTTP/1.1\r\nContent-Length: 0\r\n\r\n", 400},
+        {"POST /convert?output=pdf HTTP/1.1\r\nContent-Length: 0\r\n\r\n", 400},
+        {"POST /convert HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", 411},
+        {"POST /convert HTTP/1.1\r\nContent-Length: 12x\r\n\r\n", 400},
+        {"POST /convert HTTP/1.1\r\nContent-Length: 999999999999\r\n\r\n", 413},
+        {"GARBAGE\r\n\r\n", 400},
+        {"GET /" + std::string(20000, 'a'), 431}};
+    for (const auto &[request, status] : rejected)
+    {
+        Client client(socketPath);
+        client.send(request);
+        CHECK_EQ(client.readHttp(body), status);
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::filesystem::path temp = std::filesystem::temp_directory_path();
+    std::string prefix = "md2latex-server-test-" + std::to_string(getpid());
+    std::string socketPath = (temp / (prefix + ".sock")).string();
+    libraryPath = (temp / (prefix + ".bib")).string();
+    std::ofstream(libraryPath) << "@article{vaswani2017,\n"
+                                  "  title = {Attention Is All You Need},\n"
+                                  "  author = {Vaswani, Ashish and Shazeer, Noam},\n"
+                                  "  year = {2017}\n"
+                                  "}\n";
+    ServerOptions options;
+    options.socketPath = socketPath;
+    options.threads = 2;
+    options.maxRequestBytes = 1024 * 1024;
+    ConversionServer server(serverOptions(), options);
+    if (!server.open())
+    {
+        std::cerr << "Cannot open the server: " << server.error() << "\n";
+        return 1;
+    }
+
+    int stopPipe[2];
+    if (pipe(stopPipe) != 0)
+    {
+        return 1;
+    }
+    std::thread serving([&]() { server.run(stopPipe[0]); });
+
+    testFramed(socketPath);
+    testBibliography(socketPath);
+    testHttp(socketPath);
+
+    char stop = 1;
+    CHECK(write(stopPipe[1], &stop, 1) == 1);
+    serving.join();
+    ::close(stopPipe[0]);
+    ::close(stopPipe[1]);
+    std::remove(socketPath.c_str());
+    std::remove(libraryPath.c_str());
+    std::remove((libraryPath + ".idx").c_str());
+    return test::result();
+}
+
+#else
+
+int main() { return 0; }
+
+#endif
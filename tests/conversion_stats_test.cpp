@@ -0,0 +1,170 @@
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <string>
+
+#include "conversion_stats.h"
+#include "md_converter.h"
+#include "test_check.h"
+#include "thread_pool.h"
+
+// The counters behind --stats for a small document with known contents, and
+// the same counters from sequential and parallel conversion of a large one
+
+namespace
+{
+
+using nlohmann::json;
+
+const char *const kBody = "# Title\n"
+                          "## Section\n"
+                          "\n"
+                          "- one\n"
+                          "- two\n"
+                          "- three\n"
+                          "\n"
+                          "```cpp\n"
+                          "int x;\n"
+                          "return x;\n"
+                          "```\n"
+                          "\n"
+                          "> quoted one\n"
+                          "> quoted two\n"
+                          "\n"
+                          "See [^1] and [^2], with `code` and **bold**.\n"
+                          "\n";
+
+const char *const kReferences = "[^1]: Vaswani. Attention is all you need. 2017.\n"
+                                "[^2]: LeCun. Deep learning. 2015.\n";
+
+ConverterOptions statsOptions()
+{
+    // References are looked up at an address where nothing listens, so every
+    // lookup fails and nothing is resolved
+    ConverterOptions options;
+    options.citationCachePath.clear();
+    options.bibliographyPath.clear();
+    options.citationBaseUrl = "http://127.0.0.1:1";
+    options.promptCitations = false;
+    options.collectStats = true;
+    return options;
+}
+
+// The JSON of stats without its times, which differ from run to run
+json counters(const ConversionStats &stats)
+{
+    json value = json::parse(stats.toJson());
+    value.erase("parse_seconds");
+    value.erase("conversion_seconds");
+    for (const char *group : {"blocks", "inline_passes"})
+    {
+        for (auto &stage : value[group])
+        {
+            stage.erase("seconds");
+        }
+    }
+    value["citations"].erase("seconds");
+    value["citations"].erase("network_seconds");
+    return value;
+}
+
+void testKnownCounts()
+{
+    MarkdownConverter converter(statsOptions());
+    converter.convertToLatex(std::string(kBody) + kReferences);
+    json stats = counters(converter.stats());
+
+    CHECK_EQ(stats["documents"], json(1));
+    CHECK_EQ(stats["lines"], json(19));
+    CHECK_EQ(stats["input_bytes"],
+             json(std::string(kBody).size() + std::string(kReferences).size()));
+
+    const json &blocks = stats["blocks"];
+    CHECK_EQ(blocks["headers"]["count"], json(2));
+    CHECK_EQ(blocks["headers"]["bytes"], json(12));
+    CHECK_EQ(blocks["list_items"]["count"], json(3));
+    CHECK_EQ(blocks["list_items"]["bytes"], json(11));
+    CHECK_EQ(blocks["quote_lines"]["count"], json(2));
+    CHECK_EQ(blocks["quote_lines"]["bytes"], json(20));
+    CHECK_EQ(blocks["code_blocks"]["count"], json(1));
+    CHECK_EQ(blocks["code_blocks"]["bytes"], json(std::string("int x;\nreturn x;\n").size()));
+    CHECK_EQ(blocks["paragraphs"]["count"], json(1));
+
+    // One line each has citations, inline code and emphasis to rewrite
+    const json &passes = stats["inline_passes"];
+    CHECK_EQ(passes["citations"]["changed"], json(1));
+    CHECK_EQ(passes["code"]["changed"], json(1));
+    CHECK_EQ(passes["emphasis"]["changed"], json(1));
+    CHECK_EQ(passes["images"]["count"], json(0));
+
+    const json &citations = stats["citations"];
+    CHECK_EQ(citations["references"], json(2));
+    CHECK_EQ(citations["library_matches"], json(0));
+    CHECK_EQ(citations["lookups"], json(2));
+    CHECK_EQ(citations["resolved"], json(0));
+    CHECK_EQ(citations["unmatched"], json(0));
+    CHECK_EQ(citations["failed_lookups"], json(2));
+
+    // Without collectStats nothing is counted
+    ConverterOptions options = statsOptions();
+    options.collectStats = false;
+    MarkdownConverter quiet(options);
+    quiet.convertToLatex(std::string(kBody));
+    CHECK_EQ(quiet.stats().documents, size_t{0});
+    CHECK_EQ(quiet.stats().block(BlockType::Heading).count, size_t{0});
+}
+
+void testParallelSums()
+{
+    // Large enough for several chunks, with the references in the last one
+    std::string large;
+    size_t copies = 0;
+    while (large.size() < 512 * 1024)
+    {
+        large += kBody;
+        ++copies;
+    }
+    large += kReferences;
+
+    MarkdownConverter sequential(statsOptions());
+    std::string expected = sequential.convertToLatex(large);
+    json sequentialStats = counters(sequential.stats());
+    CHECK_EQ(sequentialStats["blocks"]["headers"]["count"], json(2 * copies));
+    CHECK_EQ(sequentialStats["blocks"]["code_blocks"]["count"], json(copies));
+
+    ThreadPool pool(4);
+    MarkdownConverter parallel(statsOptions());
+    std::ostringstream out;
+    parallel.convertToLatexParallel(large, out, pool);
+    CHECK(out.str() == expected);
+    json parallelStats = counters(parallel.stats());
+    if (parallelStats != sequentialStats)
+    {
+        test::fail(__FILE__, __LINE__,
+                   "parallel counters differ:\n  " + parallelStats.dump() + "\n  " +
+                       sequentialStats.dump());
+    }
+}
+
+void testAdd()
+{
+    MarkdownConverter converter(statsOptions());
+    converter.convertToLatex(std::string(kBody));
+    ConversionStats total;
+    total.add(converter.stats());
+    total.add(converter.stats());
+    CHECK_EQ(total.documents, size_t{2});
+    CHECK_EQ(total.lines, 2 * converter.stats().lines);
+    CHECK_EQ(total.block(BlockType::ListItem).count, size_t{6});
+    CHECK_EQ(total.pass(InlinePass::Code).changed, size_t{2});
+    CHECK(total.parseSeconds >= converter.stats().parseSeconds);
+}
+
+} // namespace
+
+int main()
+{
+    testKnownCounts();
+    testParallelSums();
+    testAdd();
+    return test::result();
+}
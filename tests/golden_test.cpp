@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "md_converter.h"
+#include "test_check.h"
+#include "thread_pool.h"
+
+// Converts every <name>.md of the golden directory and compares the LaTeX,
+// byte for byte, with <name>.tex. Each document goes through every way of
+// converting it: whole string, stream, string view, incremental updates, and
+// (repeated until it is split into chunks) parallel conversion against
+// sequential conversion of the same text.
+//
+//   golden_test <dir>            check
+//   golden_test <dir> --update   rewrite the .tex files from the current output
+
+namespace
+{
+
+std::string readFile(const std::filesystem::path &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+ConverterOptions goldenOptions()
+{
+    // References are never resolved: nothing is cached, prompted, found or
+    // written
+    ConverterOptions options;
+    options.citationCachePath.clear();
+    options.bibliographyPath.clear();
+    options.citationBaseUrl = "http://127.0.0.1:1";
+    options.promptCitations = false;
+    return options;
+}
+
+std::string convertString(const std::string &markdown)
+{
+    MarkdownConverter converter(goldenOptions());
+    return converter.convertToLatex(markdown);
+}
+
+std::string convertStream(const std::string &markdown)
+{
+    MarkdownConverter converter(goldenOptions());
+    std::istringstream in(markdown);
+    std::ostringstream out;
+    converter.convertToLatex(in, out);
+    return out.str();
+}
+
+std::string convertView(const std::string &markdown)
+{
+    MarkdownConverter converter(goldenOptions());
+    ConversionContext context;
+    std::ostringstream out;
+    converter.convertToLatex(std::string_view(markdown), out, context);
+    return out.str();
+}
+
+// Convert an edited version first, then the document itself
+std::string convertIncremental(const std::string &markdown)
+{
+    MarkdownConverter converter(goldenOptions());
+    std::string edited = markdown;
+    edited.insert(edited.size() / 2, "\nAn inserted paragraph.\n\n");
+    std::ostringstream discarded;
+    converter.convertToLatexIncremental(edited, discarded);
+    std::ostringstream out;
+    converter.convertToLatexIncremental(markdown, out);
+    return out.str();
+}
+
+void checkParallel(const std::string &name, const std::string &markdown)
+{
+    // Large enough for several chunks of the parallel splitter
+    std::string large;
+    while (large.size() < 512 * 1024)
+    {
+        large += markdown;
+        large += "\n\n";
+    }
+    ThreadPool pool(4);
+    MarkdownConverter converter(goldenOptions());
+    std::ostringstream parallel;
+    converter.convertToLatexParallel(large, parallel, pool);
+    if (parallel.str() != convertString(large))
+    {
+        test::fail(__FILE__, __LINE__, name + ": parallel conversion differs");
+    }
+
+    // A cancelled conversion stops, and the next one with the same context
+    // runs to the end
+    std::atomic<bool> cancelled{true};
+    ConversionContext context;
+    context.setLimits(std::chrono::steady_clock::time_point::max(), &cancelled);
+    std::ostringstream stopped;
+    converter.convertToLatexParallel(large, stopped, pool, context);
+    CHECK(context.interrupted());
+    cancelled = false;
+    std::ostringstream resumed;
+    converter.convertToLatexParallel(large, resumed, pool, context);
+    CHECK(!context.interrupted());
+    CHECK(resumed.str() == parallel.str());
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: golden_test <dir> [--update]\n";
+        return 2;
+    }
+    std::filesystem::path directory = argv[1];
+    bool update = argc > 2 && std::string(argv[2]) == "--update";
+
+    std::vector<std::filesystem::path> documents;
+    for (const auto &entry : std::filesystem::directory_iterator(directory))
+    {
+        if (entry.path().extension() == ".md")
+        {
+            documents.push_back(entry.path());
+        }
+    }
+    std::sort(documents.begin(), documents.end());
+    CHECK(!documents.empty());
+
+    for (const auto &path : documents)
+    {
+        std::string name = path.filename().string();
+        std::string markdown = readFile(path);
+        std::filesystem::path expectedPath = path;
+        expectedPath.replace_extension(".tex");
+        if (update)
+        {
+            std::ofstream(expectedPath, std::ios::binary) << convertString(markdown);
+            continue;
+        }
+
+        std::string expected = readFile(expectedPath);
+        CHECK(!expected.empty());
+        const std::pair<const char *, std::string (*)(const std::string &)> ways[] = {
+            {"string", convertString},
+            {"stream", convertStream},
+            {"string view", convertView},
+            {"incremental", convertIncremental}};
+        for (const auto &[way, convert] : ways)
+        {
+            if (convert(markdown) != expected)
+            {
+                test::fail(__FILE__, __LINE__,
+                           name + ": " + way + " conversion differs from " +
+                               expectedPath.filename().string());
+            }
+        }
+        checkParallel(name, markdown);
+    }
+    return test::result();
+}
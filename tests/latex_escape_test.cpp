@@ -0,0 +1,165 @@
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "latex_escape.h"
+#include "test_check.h"
+
+namespace
+{
+
+constexpr std::string_view kSpecials = "#$%&_~^\\";
+
+// The escaped text, or the input when escapeLatex leaves it alone
+std::string escaped(const std::string &in)
+{
+    std::string out = "untouched";
+    if (!escapeLatex(in, out))
+    {
+        CHECK_EQ(out, std::string("untouched"));
+        return in;
+    }
+    return out;
+}
+
+std::string escapedWith(EscapeKernel kernel, const std::string &in)
+{
+    EscapeKernel previous = activeEscapeKernel();
+    setEscapeKernel(kernel);
+    std::string out = escaped(in);
+    setEscapeKernel(previous);
+    return out;
+}
+
+// Inputs that put specials and generated commands on either side of the 16
+// and 32 byte blocks the vector kernels load
+std::vector<std::string> edgeCases()
+{
+    std::vector<std::string> inputs;
+    for (size_t length = 0; length <= 70; ++length)
+    {
+        std::string plain(length, 'a');
+        inputs.push_back(plain);
+        for (size_t at = 0; at < length; ++at)
+        {
+            for (char special : kSpecials)
+            {
+                std::string one = plain;
+                one[at] = special;
+                inputs.push_back(one);
+            }
+        }
+        if (length > 0)
+        {
+            inputs.push_back(std::string(length, '_'));
+            inputs.push_back(std::string(length, '\\'));
+        }
+    }
+
+    // A protected command starting at every offset, so that its backslash or
+    // its name crosses a block edge, and cut short at the end of the input
+    for (std::string_view command : {"\\textbf{x}", "\\href{a_b}{c}", "\\cite{k}"})
+    {
+        for (size_t at = 0; at <= 70; ++at)
+        {
+            std::string text = std::string(at, 'b') + std::string(command) + "_#";
+            inputs.push_back(text);
+            for (size_t cut = 1; cut < command.size(); ++cut)
+            {
+                inputs.push_back(std::string(at, 'b') + std::string(command.substr(0, cut)));
+            }
+        }
+    }
+    return inputs;
+}
+
+// Mostly plain text, with specials, generated commands and bytes above 0x7f
+std::vector<std::string> randomCorpus(size_t count)
+{
+    const std::vector<std::string> pieces = {
+        "a", "text ", "\xc3\xa9", "\xff", "#", "$", "%", "&", "_", "~", "^", "\\", "\\\\",
+        "\\textbf{", "\\textit", "\\href{", "\\item ", "\\end{x}", "\\tex", "}", "\n"};
+    std::mt19937 random(20240611);
+    std::uniform_int_distribution<size_t> length(0, 120);
+    std::uniform_int_distribution<size_t> pick(0, pieces.size() - 1);
+    std::bernoulli_distribution plain(0.7);
+
+    std::vector<std::string> inputs;
+    inputs.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::string text;
+        size_t target = length(random);
+        while (text.size() < target)
+        {
+            text += plain(random) ? pieces[0] : pieces[pick(random)];
+        }
+        inputs.push_back(text);
+    }
+    return inputs;
+}
+
+void testScalarOutput()
+{
+    CHECK_EQ(escapedWith(EscapeKernel::Scalar, ""), std::string(""));
+    CHECK_EQ(escapedWith(EscapeKernel::Scalar, "plain text"), std::string("plain text"));
+    CHECK_EQ(escapedWith(EscapeKernel::Scalar, "50% of a_b & #1 ~ x^2 $5"),
+             std::string("50\\% of a\\_b \\& \\#1 \\~ x\\^2 \\$5"));
+    CHECK_EQ(escapedWith(EscapeKernel::Scalar, "\\textbf{a_b} \\href{u}{t} \\foo"),
+             std::string("\\textbf{a\\_b} \\href{u}{t} \\\\foo"));
+    CHECK_EQ(escapedWith(EscapeKernel::Scalar, "end \\textb"), std::string("end \\\\textb"));
+    CHECK_EQ(escapedWith(EscapeKernel::Scalar, "\\"), std::string("\\\\"));
+}
+
+void testKernelsAgree()
+{
+    std::vector<std::string> inputs = edgeCases();
+    std::vector<std::string> corpus = randomCorpus(20000);
+    inputs.insert(inputs.end(), corpus.begin(), corpus.end());
+
+    setEscapeKernel(EscapeKernel::Scalar);
+    CHECK(activeEscapeKernel() == EscapeKernel::Scalar);
+    std::vector<std::string> expected;
+    expected.reserve(inputs.size());
+    for (const std::string &input : inputs)
+    {
+        expected.push_back(escaped(input));
+    }
+
+    for (EscapeKernel kernel : {EscapeKernel::Sse42, EscapeKernel::Avx2})
+    {
+        setEscapeKernel(kernel);
+        if (activeEscapeKernel() != kernel)
+        {
+            std::cerr << escapeKernelName(kernel) << " is not supported here, skipped\n";
+            continue;
+        }
+        size_t mismatches = 0;
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            if (escaped(inputs[i]) != expected[i] && ++mismatches <= 5)
+            {
+                test::fail(__FILE__, __LINE__,
+                           std::string(escapeKernelName(kernel)) + " differs from scalar on \"" +
+                               inputs[i] + "\"");
+            }
+        }
+        CHECK_EQ(mismatches, size_t{0});
+    }
+}
+
+} // namespace
+
+int main()
+{
+    const EscapeKernel initial = activeEscapeKernel();
+
+    testScalarOutput();
+    testKernelsAgree();
+
+    // Restore the kernel picked for this CPU
+    setEscapeKernel(initial);
+    CHECK(activeEscapeKernel() == initial);
+    return test::result();
+}
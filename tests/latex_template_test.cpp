@@ -0,0 +1,115 @@
+#include <sstream>
+#include <string>
+
+#include "document_features.h"
+#include "latex_template.h"
+#include "test_check.h"
+
+namespace
+{
+
+// Head and tail of a compiled template for a document with features
+std::string render(const LatexTemplate &compiled, unsigned features)
+{
+    std::ostringstream out;
+    compiled.writeHead(features, out);
+    out << "BODY\n";
+    compiled.writeTail(features, out);
+    return out.str();
+}
+
+// The error of compiling text; empty if it compiles
+std::string compileError(const std::string &text)
+{
+    LatexTemplate compiled;
+    bool ok = compiled.compile(text);
+    CHECK_EQ(ok, compiled.error().empty());
+    return compiled.error();
+}
+
+void testErrors()
+{
+    CHECK_EQ(compileError("\\begin{document}\n\\end{document}\n"),
+             std::string("line 3: no {{body}}"));
+    CHECK_EQ(compileError("{{body}}\n{{body}}\n"), std::string("line 2: more than one {{body}}"));
+    CHECK_EQ(compileError("{{#links}}\n{{body}}\n{{/links}}\n"),
+             std::string("line 2: {{body}} inside {{#links}}"));
+    CHECK_EQ(compileError("{{body}}\n{{#code}}\nx\n"),
+             std::string("line 4: {{#code}} is not closed"));
+    CHECK_EQ(compileError("{{body}}\n{{#code}}\n{{/images}}\n"),
+             std::string("line 3: {{/images}} does not close a section"));
+    CHECK_EQ(compileError("{{body}}\n{{/links}}\n"),
+             std::string("line 2: {{/links}} does not close a section"));
+
+    // A failed compile leaves nothing behind
+    LatexTemplate compiled;
+    CHECK(compiled.compile("head\n{{body}}\ntail\n"));
+    CHECK(!compiled.compile("{{#links}}"));
+    CHECK_EQ(render(compiled, 0), std::string("BODY\n"));
+
+    CHECK(!compiled.load("/nonexistent/md2latex-template.tex"));
+    CHECK(!compiled.error().empty());
+}
+
+void testLatexBracesAreText()
+{
+    // {{...}} that is not a tag is LaTeX and copied unchanged
+    const std::string text = "\\def\\x{{\\bfseries y}}\n"
+                             "\\newcommand\\twice[1]{{#1}{#1}}\n"
+                             "\\textbf{{a}} {{/x}} {{}} {{{body}}}\n"
+                             "{{ unclosed\n";
+    LatexTemplate compiled;
+    CHECK(compiled.compile(text));
+    CHECK_EQ(render(compiled, 0), std::string("\\def\\x{{\\bfseries y}}\n"
+                                              "\\newcommand\\twice[1]{{#1}{#1}}\n"
+                                              "\\textbf{{a}} {{/x}} {{}} {BODY\n"
+                                              "}\n"
+                                              "{{ unclosed\n"));
+}
+
+void testSectionsAndPackages()
+{
+    LatexTemplate compiled;
+    CHECK(compiled.compile("\\documentclass{article}\n"
+                           "{{packages}}\n"
+                           "{{#links}}\n"
+                           "\\hypersetup{colorlinks}\n"
+                           "{{/links}}\n"
+                           "{{^code}}% no code{{/code}}\n"
+                           "{{body}}\n"
+                           "{{#bibliography}}\\bibliography{references}{{/bibliography}}\n"));
+    CHECK_EQ(render(compiled, 0), std::string("\\documentclass{article}\n"
+                                              "% no code\n"
+                                              "BODY\n"
+                                              "\n"));
+    CHECK_EQ(render(compiled, kFeatureLinks | kFeatureCode | kFeatureBibliography),
+             std::string("\\documentclass{article}\n"
+                         "\\usepackage{listings}\n"
+                         "\\usepackage{natbib}\n"
+                         "\\usepackage{hyperref}\n"
+                         "\\hypersetup{colorlinks}\n"
+                         "\n"
+                         "BODY\n"
+                         "\\bibliography{references}\n"));
+}
+
+void testMinimal()
+{
+    std::string latex = render(*LatexTemplate::minimal(), kFeatureImages);
+    CHECK(latex.find("\\usepackage{graphicx}\n") != std::string::npos);
+    CHECK(latex.find("hyperref") == std::string::npos);
+    CHECK(latex.find("\\bibliography") == std::string::npos);
+    CHECK(render(*LatexTemplate::minimal(), kFeatureBibliography).find("\\bibliography{") !=
+          std::string::npos);
+}
+
+} // namespace
+
+int main()
+{
+    testErrors();
+    testLatexBracesAreText();
+    testSectionsAndPackages();
+    testMinimal();
+    return test::result();
+}
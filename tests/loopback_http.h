@@ -0,0 +1,258 @@
+// loopback_http.h
+#ifndef LOOPBACK_HTTP_H
+#define LOOPBACK_HTTP_H
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Stand-in for the citation services: an HTTP/1.1 server on 127.0.0.1 that
+// answers every request from a handler, after a delay the handler picks, on a
+// connection of its own. It counts the requests and how many were being
+// answered at once.
+namespace test
+{
+
+struct HttpReply
+{
+    int status{200};
+    std::string body;
+    // Held back this long before answering, e.g. to reorder responses
+    std::chrono::milliseconds delay{0};
+};
+
+// Value of a query parameter of a request target, URL-decoded
+inline std::string queryParameter(const std::string &target, const std::string &name)
+{
+    size_t start = target.find('?');
+    while (start != std::string::npos)
+    {
+        ++start;
+        size_t end = std::min(target.find('&', start), target.size());
+        if (target.compare(start, name.size() + 1, name + "=") == 0)
+        {
+            std::string value;
+            for (size_t i = start + name.size() + 1; i < end; ++i)
+            {
+                if (target[i] == '+')
+                {
+                    value.push_back(' ');
+                }
+                else if (target[i] == '%' && i + 2 < end &&
+                         std::isxdigit(static_cast<unsigned char>(target[i + 1])) &&
+                         std::isxdigit(static_cast<unsigned char>(target[i + 2])))
+                {
+                    value.push_back(static_cast<char>(
+                        std::strtol(target.substr(i + 1, 2).c_str(), nullptr, 16)));
+                    i += 2;
+                }
+                else
+                {
+                    value.push_back(target[i]);
+                }
+            }
+            return value;
+        }
+        start = end < target.size() ? end : std::string::npos;
+    }
+    return {};
+}
+
+class LoopbackHttpServer
+{
+  public:
+    // Called with the target of each request, e.g. "/works?query=..."
+    using Handler = std::function<HttpReply(const std::string &target)>;
+
+    explicit LoopbackHttpServer(Handler handler) : handler(std::move(handler)) {}
+
+    ~LoopbackHttpServer() { stop(); }
+
+    LoopbackHttpServer(const LoopbackHttpServer &) = delete;
+    LoopbackHttpServer &operator=(const LoopbackHttpServer &) = delete;
+
+    // Listen on a free port; false when the socket cannot be set up
+    bool start()
+    {
+        // A client that gave up closes its end before the delayed reply
+        ::signal(SIGPIPE, SIG_IGN);
+        listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listener < 0)
+        {
+            return false;
+        }
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        socklen_t length = sizeof(address);
+        if (::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+            ::listen(listener, 64) != 0 ||
+            ::getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+        {
+            ::close(listener);
+            listener = -1;
+            return false;
+        }
+        port = ntohs(address.sin_port);
+        acceptor = std::thread([this] { acceptLoop(); });
+        return true;
+    }
+
+    // Wake delayed replies, close every connection and wait for them
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (acceptor.joinable())
+        {
+            acceptor.join();
+        }
+        std::vector<std::thread> finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.swap(connections);
+        }
+        for (std::thread &connection : finished)
+        {
+            connection.join();
+        }
+        if (listener >= 0)
+        {
+            ::close(listener);
+            listener = -1;
+        }
+    }
+
+    // "http://127.0.0.1:<port>", to pass as the base URL of a source
+    std::string baseUrl() const { return "http://127.0.0.1:" + std::to_string(port); }
+
+    size_t requests() const { return requestCount.load(); }
+
+    // Most requests being answered at the same time
+    size_t peakInFlight() const { return peak.load(); }
+
+    void resetCounts()
+    {
+        requestCount = 0;
+        peak = 0;
+    }
+
+  private:
+    void acceptLoop()
+    {
+        while (!stopped())
+        {
+            pollfd entry{listener, POLLIN, 0};
+            if (::poll(&entry, 1, 20) <= 0)
+            {
+                continue;
+            }
+            int fd = ::accept(listener, nullptr, nullptr);
+            if (fd < 0)
+            {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            connections.emplace_back([this, fd] { serve(fd); });
+        }
+    }
+
+    bool stopped()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stopping;
+    }
+
+    // One request per connection; the reply closes it
+    void serve(int fd)
+    {
+        std::string head;
+        char buffer[4096];
+        while (head.find("\r\n\r\n") == std::string::npos && !stopped())
+        {
+            pollfd entry{fd, POLLIN, 0};
+            if (::poll(&entry, 1, 20) <= 0)
+            {
+                continue;
+            }
+            ssize_t got = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (got <= 0)
+            {
+                ::close(fd);
+                return;
+            }
+            head.append(buffer, static_cast<size_t>(got));
+        }
+        size_t targetStart = head.find(' ');
+        size_t targetEnd = head.find(' ', targetStart + 1);
+        if (targetStart == std::string::npos || targetEnd == std::string::npos)
+        {
+            ::close(fd);
+            return;
+        }
+
+        ++requestCount;
+        size_t now = ++inFlight;
+        size_t seen = peak.load();
+        while (now > seen && !peak.compare_exchange_weak(seen, now))
+        {
+        }
+
+        HttpReply reply = handler(head.substr(targetStart + 1, targetEnd - targetStart - 1));
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, reply.delay, [this] { return stopping; });
+        }
+
+        // Counted out before the client can see the reply and start another
+        --inFlight;
+        std::string response = "HTTP/1.1 " + std::to_string(reply.status) +
+                               " Stand-in\r\nContent-Length: " + std::to_string(reply.body.size()) +
+                               "\r\nConnection: close\r\n\r\n" + reply.body;
+        size_t sent = 0;
+        while (sent < response.size())
+        {
+            ssize_t wrote = ::send(fd, response.data() + sent, response.size() - sent, 0);
+            if (wrote <= 0)
+            {
+                break;
+            }
+            sent += static_cast<size_t>(wrote);
+        }
+        ::close(fd);
+    }
+
+    Handler handler;
+    int listener{-1};
+    unsigned short port{0};
+    std::thread acceptor;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping{false};
+    std::vector<std::thread> connections;
+    std::atomic<size_t> requestCount{0};
+    std::atomic<size_t> inFlight{0};
+    std::atomic<size_t> peak{0};
+};
+
+} // namespace test
+
+#endif // LOOPBACK_HTTP_H
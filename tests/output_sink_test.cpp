@@ -0,0 +1,194 @@
+#include <csignal>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "output_sink.h"
+#include "test_check.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+constexpr size_t kChunk = ChunkedOutput::kChunkSize;
+constexpr size_t kPerWrite = ChunkedOutput::kChunksPerWrite;
+
+// Bytes that differ from one offset to the next, so that misplaced pieces show
+std::string pattern(size_t size, size_t seed = 0)
+{
+    std::string text(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+    {
+        text[i] = static_cast<char>('a' + (i + seed) % 23);
+    }
+    return text;
+}
+
+std::string readFile(const fs::path &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+void testWriteBoundary(const fs::path &root)
+{
+    // Full chunks are held until kChunksPerWrite of them are, and then go out
+    // together when the next byte needs room
+    fs::path path = root / "boundary.out";
+    ChunkedOutput sink;
+    CHECK(sink.open(path.string()));
+    std::ostream out(&sink);
+    std::string expected = pattern(kChunk * kPerWrite + 1);
+    const size_t piece = 4096;
+    for (size_t at = 0; at < kChunk * kPerWrite; at += piece)
+    {
+        out.write(expected.data() + at, piece);
+    }
+    CHECK_EQ(sink.size(), kChunk * kPerWrite);
+    CHECK_EQ(fs::file_size(path), std::uintmax_t{0});
+
+    out.put(expected.back());
+    CHECK_EQ(sink.size(), expected.size());
+    CHECK_EQ(fs::file_size(path), std::uintmax_t{kChunk * kPerWrite});
+
+    CHECK(sink.close());
+    CHECK(out.good());
+    CHECK(readFile(path) == expected);
+}
+
+void testDirectWrite(const fs::path &root)
+{
+    // A piece of a chunk or more is written at once, after what is held
+    fs::path path = root / "direct.out";
+    ChunkedOutput sink;
+    CHECK(sink.open(path.string()));
+    std::ostream out(&sink);
+    std::string head = pattern(100);
+    std::string large = pattern(kChunk * 3 + 5, 7);
+    std::string tail = pattern(kChunk - 1, 3);
+
+    out << head;
+    CHECK_EQ(fs::file_size(path), std::uintmax_t{0});
+    out.write(large.data(), static_cast<std::streamsize>(large.size()));
+    CHECK_EQ(fs::file_size(path), std::uintmax_t{head.size() + large.size()});
+    CHECK_EQ(sink.size(), head.size() + large.size());
+
+    // Just under a chunk is copied and held
+    out.write(tail.data(), static_cast<std::streamsize>(tail.size()));
+    CHECK_EQ(fs::file_size(path), std::uintmax_t{head.size() + large.size()});
+    CHECK_EQ(sink.size(), head.size() + large.size() + tail.size());
+
+    // A large piece with nothing held
+    CHECK(sink.flush());
+    out.write(large.data(), static_cast<std::streamsize>(large.size()));
+    CHECK_EQ(sink.size(), head.size() + 2 * large.size() + tail.size());
+    CHECK(sink.close());
+    CHECK(readFile(path) == head + large + tail + large);
+
+    // Opening again truncates and restarts the count
+    CHECK(sink.open(path.string()));
+    CHECK_EQ(sink.size(), size_t{0});
+    out << "again";
+    CHECK(sink.close());
+    CHECK_EQ(readFile(path), std::string("again"));
+}
+
+void testWriteErrors(const fs::path &root)
+{
+    // Writing to a pipe nobody reads fails; close() reports it and the
+    // output after the failure is discarded
+    std::signal(SIGPIPE, SIG_IGN);
+    int ends[2];
+    CHECK(::pipe(ends) == 0);
+    ::close(ends[0]);
+    {
+        ChunkedOutput sink(ends[1]);
+        std::ostream out(&sink);
+        out << "lost";
+        CHECK(sink.size() == 4);
+        CHECK(!sink.flush());
+        out.write(pattern(kChunk).data(), static_cast<std::streamsize>(kChunk));
+        CHECK(out.bad());
+        CHECK(!sink.close());
+        CHECK(!sink.error().empty());
+    }
+    // The descriptor belongs to the caller
+    CHECK(::close(ends[1]) == 0);
+
+    ChunkedOutput missing;
+    CHECK(!missing.open((root / "no" / "such" / "dir" / "file").string()));
+    CHECK(missing.error().compare(0, 12, "Cannot open ") == 0);
+
+    ChunkedOutput unopened;
+    std::ostream out(&unopened);
+    out << "nowhere";
+    CHECK(!unopened.close());
+    CHECK_EQ(unopened.error(), std::string("Output is not open"));
+}
+
+void testStringOutput()
+{
+    std::string target = "kept:";
+    std::string expected = target;
+    {
+        StringOutput sink(target);
+        std::ostream out(&sink);
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            out << i << ',';
+            expected += std::to_string(i) + ",";
+        }
+        std::string large = pattern(kChunk * 2);
+        out.write(large.data(), static_cast<std::streamsize>(large.size()));
+        expected += large;
+
+        // The string grows ahead of the output until finish() trims it
+        sink.finish();
+        CHECK(target == expected);
+
+        // Writing after finish() appends again
+        out << "more";
+        out.put('!');
+        expected += "more!";
+    }
+    // The destructor finishes too
+    CHECK(target == expected);
+
+    std::string empty;
+    {
+        StringOutput sink(empty);
+    }
+    CHECK(empty.empty());
+}
+
+} // namespace
+
+int main()
+{
+    fs::path root = fs::temp_directory_path() / ("md2latex-sink-test-" + std::to_string(getpid()));
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    testWriteBoundary(root);
+    testDirectWrite(root);
+    testWriteErrors(root);
+    testStringOutput();
+
+    fs::remove_all(root);
+    return test::result();
+}
+
+#else
+
+int main() { return 0; }
+
+#endif
@@ -0,0 +1,63 @@
+// test_check.h
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Minimal assertions for the test programs: a failed check is reported with
+// its location and the program carries on, exiting non-zero at the end, so
+// one run shows every failure.
+namespace test
+{
+
+inline int &failures()
+{
+    static int count = 0;
+    return count;
+}
+
+inline void fail(const char *file, int line, const std::string &message)
+{
+    std::cerr << file << ":" << line << ": " << message << "\n";
+    ++failures();
+}
+
+// Exit status for main
+inline int result()
+{
+    if (failures() != 0)
+    {
+        std::cerr << failures() << " check(s) failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace test
+
+#define CHECK(condition)                                                                           \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(condition))                                                                          \
+        {                                                                                          \
+            test::fail(__FILE__, __LINE__, "CHECK(" #condition ") failed");                        \
+        }                                                                                          \
+    } while (false)
+
+#define CHECK_EQ(actual, expected)                                                                 \
+    do                                                                                             \
+    {                                                                                              \
+        const auto &actualValue = (actual);                                                        \
+        const auto &expectedValue = (expected);                                                    \
+        if (!(actualValue == expectedValue))                                                       \
+        {                                                                                          \
+            std::ostringstream message;                                                            \
+            message << "CHECK_EQ(" #actual ", " #expected ") failed: " << actualValue              \
+                    << " != " << expectedValue;                                                    \
+            test::fail(__FILE__, __LINE__, message.str());                                         \
+        }                                                                                          \
+    } while (false)
+
+#endif // TEST_CHECK_H
@@ -0,0 +1,127 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "test_check.h"
+#include "thread_pool.h"
+
+namespace
+{
+
+// Task ids in the order the tasks started
+class StartOrder
+{
+  public:
+    void record(int id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ids.push_back(id);
+    }
+
+    std::vector<int> ids;
+
+  private:
+    std::mutex mutex;
+};
+
+void testSubmissionOrder()
+{
+    // Tasks from outside the pool start oldest first, e.g. the largest files
+    // of a batch, which it submits first
+    ThreadPool pool(1);
+    StartOrder order;
+    // Hold the worker until every task is queued
+    std::atomic<bool> queued{false};
+    pool.submit(
+        [&queued](size_t)
+        {
+            while (!queued.load())
+            {
+                std::this_thread::yield();
+            }
+        });
+    for (int id = 0; id < 40; ++id)
+    {
+        pool.submit([&order, id](size_t) { order.record(id); });
+    }
+    queued = true;
+    pool.wait();
+    std::vector<int> expected(40);
+    std::iota(expected.begin(), expected.end(), 0);
+    CHECK(order.ids == expected);
+}
+
+void testSpawnedOrder()
+{
+    // Tasks a worker submits run newest first, ahead of the older tasks
+    // from outside
+    ThreadPool pool(1);
+    StartOrder order;
+    std::atomic<bool> queued{false};
+    pool.submit(
+        [&](size_t)
+        {
+            while (!queued.load())
+            {
+                std::this_thread::yield();
+            }
+            order.record(0);
+            for (int id = 10; id < 13; ++id)
+            {
+                pool.submit([&order, id](size_t) { order.record(id); });
+            }
+        });
+    pool.submit([&order](size_t) { order.record(1); });
+    pool.submit([&order](size_t) { order.record(2); });
+    queued = true;
+    pool.wait();
+    CHECK((order.ids == std::vector<int>{0, 12, 11, 10, 1, 2}));
+}
+
+void testManyWorkers()
+{
+    // Every task runs once, and with several workers the early tasks still
+    // start before the late ones on the whole
+    constexpr int kTasks = 400;
+    ThreadPool pool(4);
+    CHECK_EQ(pool.size(), size_t{4});
+    StartOrder order;
+    std::atomic<int> runs{0};
+    for (int id = 0; id < kTasks; ++id)
+    {
+        pool.submit(
+            [&order, &runs, id](size_t worker)
+            {
+                CHECK(worker < 4);
+                order.record(id);
+                ++runs;
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            });
+    }
+    pool.wait();
+    CHECK_EQ(runs.load(), kTasks);
+    CHECK_EQ(order.ids.size(), size_t{kTasks});
+
+    // Mean start position of the first and the last quarter of the tasks
+    std::vector<int> position(kTasks);
+    for (size_t i = 0; i < order.ids.size(); ++i)
+    {
+        position[order.ids[i]] = static_cast<int>(i);
+    }
+    double first = std::accumulate(position.begin(), position.begin() + kTasks / 4, 0.0);
+    double last = std::accumulate(position.end() - kTasks / 4, position.end(), 0.0);
+    CHECK(first < last);
+}
+
+} // namespace
+
+int main()
+{
+    testSubmissionOrder();
+    testSpawnedOrder();
+    testManyWorkers();
+    return test::result();
+}
@@ -0,0 +1,189 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include "test_check.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+using nlohmann::json;
+
+std::vector<json> eventsNamed(const json &trace, const std::string &name)
+{
+    std::vector<json> events;
+    for (const json &event : trace["traceEvents"])
+    {
+        if (event.value("name", "") == name)
+        {
+            events.push_back(event);
+        }
+    }
+    return events;
+}
+
+// Trace events of everything the converter records: nested spans on the main
+// thread, a span on a pool worker, an async span, and an argument that is not
+// valid UTF-8
+void testWrittenTrace(const fs::path &root)
+{
+    Tracer::start();
+    CHECK(Tracer::enabled());
+    {
+        TraceSpan outer("outer", "test");
+        outer.arg("count", 3);
+        {
+            TraceSpan inner("inner", "test");
+            CHECK(inner.recording());
+            inner.arg("file", std::string("bad\xff\xfe.md"));
+            inner.arg("ratio", 0.5);
+        }
+    }
+    {
+        ThreadPool pool(1);
+        pool.submit([](size_t) { TraceSpan span("on worker", "test"); });
+        pool.wait();
+    }
+    Tracer::Clock::time_point begin = Tracer::Clock::now();
+    std::string args;
+    Tracer::appendArg(args, "query", std::string_view("caf\xc3"));
+    Tracer::async("request", "http", 42, begin, begin + std::chrono::milliseconds(2), args);
+
+    fs::path path = root / "trace.json";
+    std::string error;
+    CHECK(Tracer::stop(path.string(), error));
+    CHECK(error.empty());
+    CHECK(!Tracer::enabled());
+
+    json trace;
+    std::ifstream in(path);
+    try
+    {
+        trace = json::parse(in);
+    }
+    catch (const json::exception &exception)
+    {
+        test::fail(__FILE__, __LINE__, std::string("Trace is not JSON: ") + exception.what());
+        return;
+    }
+
+    // Complete spans, the inner one within the outer one
+    std::vector<json> outer = eventsNamed(trace, "outer");
+    std::vector<json> inner = eventsNamed(trace, "inner");
+    CHECK_EQ(outer.size(), size_t{1});
+    CHECK_EQ(inner.size(), size_t{1});
+    if (outer.size() == 1 && inner.size() == 1)
+    {
+        CHECK_EQ(outer[0]["ph"], json("X"));
+        CHECK_EQ(outer[0]["cat"], json("test"));
+        CHECK_EQ(outer[0]["args"]["count"], json(3));
+        CHECK_EQ(inner[0]["tid"], outer[0]["tid"]);
+        double start = outer[0]["ts"].get<double>();
+        double end = start + outer[0]["dur"].get<double>();
+        CHECK(inner[0]["ts"].get<double>() >= start);
+        CHECK(inner[0]["ts"].get<double>() + inner[0]["dur"].get<double>() <= end + 0.001);
+        // Invalid bytes became U+FFFD
+        CHECK_EQ(inner[0]["args"]["file"], json("bad\xef\xbf\xbd\xef\xbf\xbd.md"));
+        CHECK_EQ(inner[0]["args"]["ratio"], json(0.5));
+    }
+
+    std::vector<json> worker = eventsNamed(trace, "on worker");
+    CHECK_EQ(worker.size(), size_t{1});
+
+    // An async span is a begin and an end event sharing its id
+    std::vector<json> request = eventsNamed(trace, "request");
+    CHECK_EQ(request.size(), size_t{2});
+    if (request.size() == 2)
+    {
+        CHECK_EQ(request[0]["ph"], json("b"));
+        CHECK_EQ(request[1]["ph"], json("e"));
+        CHECK_EQ(request[0]["id"], json(42));
+        CHECK_EQ(request[1]["id"], request[0]["id"]);
+        CHECK_EQ(request[0]["cat"], json("http"));
+        CHECK_EQ(request[0]["args"]["query"], json("caf\xef\xbf\xbd"));
+        CHECK(request[1]["ts"].get<double>() - request[0]["ts"].get<double>() >= 1999.0);
+    }
+
+    // The threads are named, on the tids their events use
+    std::vector<json> names = eventsNamed(trace, "thread_name");
+    auto threadNamed = [&names](const json &tid)
+    {
+        for (const json &name : names)
+        {
+            if (name["tid"] == tid)
+            {
+                return name["args"]["name"].get<std::string>();
+            }
+        }
+        return std::string();
+    };
+    CHECK_EQ(eventsNamed(trace, "process_name").size(), size_t{1});
+    if (!outer.empty() && !worker.empty())
+    {
+        CHECK_EQ(threadNamed(outer[0]["tid"]), std::string("main"));
+        CHECK_EQ(threadNamed(worker[0]["tid"]), std::string("worker 0"));
+        CHECK(worker[0]["tid"] != outer[0]["tid"]);
+    }
+}
+
+void testStopped(const fs::path &root)
+{
+    // Nothing is recorded while tracing is off
+    {
+        TraceSpan span("after stop", "test");
+        CHECK(!span.recording());
+    }
+
+    // A new trace starts empty
+    Tracer::start();
+    std::string error;
+    fs::path path = root / "empty.json";
+    CHECK(Tracer::stop(path.string(), error));
+    std::ifstream in(path);
+    json trace = json::parse(in, nullptr, false);
+    CHECK(!trace.is_discarded());
+    CHECK(trace.is_object() && trace["traceEvents"].size() == 1);
+    CHECK(eventsNamed(trace, "outer").empty());
+
+    Tracer::start();
+    CHECK(!Tracer::stop((root / "no" / "such" / "dir" / "trace.json").string(), error));
+    CHECK(error.compare(0, 24, "Cannot open trace file: ") == 0);
+}
+
+} // namespace
+
+int main()
+{
+    std::string name = "md2latex-trace-test";
+#if defined(__unix__) || defined(__APPLE__)
+    name += "-" + std::to_string(getpid());
+#endif
+    fs::path root = fs::temp_directory_path() / name;
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    try
+    {
+        testWrittenTrace(root);
+        testStopped(root);
+    }
+    catch (const std::exception &exception)
+    {
+        test::fail(__FILE__, __LINE__, std::string("Tracing threw: ") + exception.what());
+    }
+
+    fs::remove_all(root);
+    return test::result();
+}